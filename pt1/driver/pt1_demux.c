@@ -0,0 +1,164 @@
+/* -*- tab-width: 4; indent-tabs-mode: t -*- */
+/***************************************************************************/
+/* DMAデータ分解                                                           */
+/* pt1_thread/pt1_read のうちハードウェアに依存しない部分                  */
+/* ロックは呼び出し側で取ること                                            */
+/***************************************************************************/
+#ifdef	__KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#else
+#include <string.h>
+#define		div_u64(a, b)	((a) / (b))
+#endif
+
+#include	"pt1_demux.h"
+
+/***************************************************************************/
+/* マイクロパケットのヘッダを調べる                                        */
+/* dma_channel には 0～(MAX_CHANNEL-1) を返す                              */
+/***************************************************************************/
+int		pt1_micro_decode(const MICRO_PACKET *micro, int *dma_channel)
+{
+	int		ch = MICRO_CHANNEL(micro->head);
+
+	// チャネル0も不正(real_channel[-1]を参照しないように)
+	if((ch < 1) || (ch > MAX_CHANNEL)){
+		return MICRO_BAD_CHANNEL ;
+	}
+	*dma_channel = ch - 1 ;
+	if(micro->head & MICRO_ERROR){
+		return MICRO_FAULT ;
+	}
+	return MICRO_OK ;
+}
+/***************************************************************************/
+/* マイクロパケットを組み立てバッファに追加する                            */
+/* 1パケット揃ったらTRUEを返す(packet_sizeは0に戻る)                       */
+/***************************************************************************/
+int		pt1_micro_append(__u8 *packet_buf, __u32 *packet_size, const MICRO_PACKET *micro)
+{
+	__u32	pos = *packet_size ;
+
+	// 先頭で、一時バッファに残っている場合は捨てる
+	if(micro->head & MICRO_START){
+		pos = 0 ;
+	}
+	// データは逆順に並んでいる
+	packet_buf[pos]   = micro->data[2];
+	packet_buf[pos+1] = micro->data[1];
+	// 188は3で割り切れないので、最後のマイクロパケットの3byte目は捨てる
+	if((pos + 2) < PACKET_SIZE){
+		packet_buf[pos+2] = micro->data[0];
+	}
+	pos += MICRO_DATA_SIZE ;
+
+	if(pos >= PACKET_SIZE){
+		*packet_size = 0 ;
+		return TRUE ;
+	}
+	*packet_size = pos ;
+	return FALSE ;
+}
+/***************************************************************************/
+/* 1パケット(lenバイト)をリングバッファの末尾(pointer + size)に書き込む   */
+/***************************************************************************/
+void	pt1_ring_put(__u8 *buf, __u32 maxsize, __u32 pointer, __u32 size, const __u8 *packet, __u32 len)
+{
+	__u32	pos = pointer + size ;
+	__u32	tmp_size ;
+
+	if(pos >= maxsize){
+		// リングバッファの境界を越えていてリングバッファの先頭に戻っている場合
+		memcpy(&buf[pos - maxsize], packet, len);
+	}else if((pos + len) > maxsize){
+		// リングバッファの境界をまたぐように書き込まれる場合
+		tmp_size = maxsize - pos ;
+		memcpy(&buf[pos], packet, tmp_size);
+		memcpy(buf, &packet[tmp_size], len - tmp_size);
+	}else{
+		// リングバッファ内で収まる場合
+		memcpy(&buf[pos], packet, len);
+	}
+}
+/***************************************************************************/
+/* リングバッファから最大cntバイト取り出す                                 */
+/* pointer/sizeを進め、取り出したバイト数を返す                            */
+/* firstには境界までの長さを返す(first < 戻り値なら先頭からの続きがある)   */
+/***************************************************************************/
+__u32	pt1_ring_get(__u32 maxsize, __u32 *pointer, __u32 *size, size_t cnt, __u32 *first)
+{
+	__u32	len = *size ;
+
+	if(cnt < len){
+		// バッファにあるデータより小さい読み込みの場合
+		len = cnt ;
+	}
+	if((*pointer + len) >= maxsize){
+		// リングバッファの境界を越える場合
+		*first = maxsize - *pointer ;
+		*pointer = len - *first ;
+	}else{
+		*first = len ;
+		*pointer += len ;
+	}
+	*size -= len ;
+	return len ;
+}
+/***************************************************************************/
+/* PIDフィルタ判定                                                         */
+/* 組み立て済みパケットを残すならTRUEを返す                                */
+/***************************************************************************/
+int		pt1_pid_pass(const PID_FILTER *filter, const __u8 *packet)
+{
+	int		pid ;
+
+	if(!filter->flags){
+		return TRUE ;
+	}
+	pid = ((packet[1] & 0x1F) << 8) | packet[2] ;
+	if((filter->flags & PID_FILTER_DROP_NULL) && (pid == 0x1FFF)){
+		return FALSE ;
+	}
+	if((filter->flags & PID_FILTER_ENABLE) && !PID_FILTER_ISSET(filter, pid)){
+		return FALSE ;
+	}
+	return TRUE ;
+}
+/***************************************************************************/
+/* 到着時刻の割り振りを始める                                              */
+/* now_nsは今回の取得時刻、pagesはこれから取り込むページ数                 */
+/***************************************************************************/
+void	pt1_clock_pass(ARRIVAL_CLOCK *clk, __u64 now_ns, __u32 pages)
+{
+	__u64	span = 0 ;
+	__u64	start ;
+
+	if((clk->last_ns != 0) && (now_ns > clk->last_ns)){
+		span = now_ns - clk->last_ns ;
+	}
+	// 長く止まっていた後は直前の分だけに割り振る
+	if(span > ARRIVAL_MAX_SPAN){
+		span = ARRIVAL_MAX_SPAN ;
+	}
+	clk->last_ns = now_ns ;
+	// 30bitで折り返すので起点は下位だけ残す(16bit左シフトしても溢れない)
+	start = div_u64((now_ns - span) * 27, 1000) & TIMESTAMP_MASK ;
+	clk->base = start << 16 ;
+	clk->step = div_u64((div_u64(span * 27, 1000)) << 16,
+						(pages ? pages : 1) * DMA_PAGE_WORDS);
+}
+/***************************************************************************/
+/* 取り込み開始からindex番目のマイクロパケットの到着時刻を書き込む         */
+/***************************************************************************/
+void	pt1_clock_stamp(const ARRIVAL_CLOCK *clk, __u32 index, __u8 *header)
+{
+	__u32	stamp = ((clk->base + clk->step * index) >> 16) & TIMESTAMP_MASK ;
+
+	// ビッグエンディアン(上位2bitのcopy_permission_indicatorは0)
+	header[0] = (stamp >> 24) & 0xFF ;
+	header[1] = (stamp >> 16) & 0xFF ;
+	header[2] = (stamp >> 8) & 0xFF ;
+	header[3] = stamp & 0xFF ;
+}
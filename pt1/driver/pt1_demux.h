@@ -0,0 +1,64 @@
+#ifndef		__PT1_DEMUX_H__
+#define		__PT1_DEMUX_H__
+/***************************************************************************/
+/* DMAデータ分解(ハードウェア非依存部)                                     */
+/* カーネル外(pt1sim)でもビルドできるよう、レジスタ・ロック等には触らない  */
+/***************************************************************************/
+#ifdef	__KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <linux/types.h>
+#endif
+#include	"pt1_com.h"
+#include	"pt1_ioctl.h"
+
+#define		PACKET_SIZE			188		// 1パケット長
+#define		DMA_SIZE			4096	// DMAバッファサイズ
+#define		MICRO_DATA_SIZE		3		// マイクロパケット1個のデータ長
+#define		DMA_PAGE_WORDS		(DMA_SIZE / sizeof(__u32))	// 1ページのマイクロパケット数
+#define		DMA_PAGE_FLAG		(DMA_PAGE_WORDS - 2)		// データ有無の判定位置
+
+typedef	struct	_MICRO_PACKET{
+	char	data[3];
+	char	head ;
+}MICRO_PACKET;
+
+/***************************************************************************/
+/* マイクロパケットヘッダ定義                                              */
+/***************************************************************************/
+#define		MICRO_CHANNEL(head)		(((head) >> 5) & 0x07)	// DMAチャネル(1～4)
+#define		MICRO_POSITION(head)	(((head) >> 2) & 0x07)	// パケット内位置
+#define		MICRO_START				0x02					// パケット先頭
+#define		MICRO_ERROR				0x01					// エラー(MICROPACKET_ERROR)
+
+enum{
+	MICRO_OK,				// データ
+	MICRO_BAD_CHANNEL,		// チャネル番号不正
+	MICRO_FAULT				// エラービットあり(DMAリセットが必要)
+};
+
+// CH別バッファの残りが1パケット分を切ったら満杯(到着時刻付きの4byteを含む)
+#define		RING_FULL(maxsize, size)	((size) >= ((maxsize) - PACKET_SIZE - TIMESTAMP_SIZE))
+
+/***************************************************************************/
+/* 到着時刻の補間                                                          */
+/* 時刻の取得はDMAを取り込む1周につき1回で、その間に届いたページの         */
+/* マイクロパケットに前回の取得時刻から均等に割り振る                      */
+/***************************************************************************/
+#define		ARRIVAL_MAX_SPAN	(200 * 1000000ULL)	// 割り振る最大時間(ns)
+
+typedef	struct	_ARRIVAL_CLOCK{
+	__u64	last_ns ;		// 前回の取得時刻(ns)
+	__u64	base ;			// 今回の起点(27MHz、下位16bitは小数部)
+	__u64	step ;			// マイクロパケット1個分(同上)
+}ARRIVAL_CLOCK;
+
+extern	int		pt1_micro_decode(const MICRO_PACKET *, int *);
+extern	int		pt1_micro_append(__u8 *, __u32 *, const MICRO_PACKET *);
+extern	void	pt1_ring_put(__u8 *, __u32, __u32, __u32, const __u8 *, __u32);
+extern	__u32	pt1_ring_get(__u32, __u32 *, __u32 *, size_t, __u32 *);
+extern	int		pt1_pid_pass(const PID_FILTER *, const __u8 *);
+extern	void	pt1_clock_pass(ARRIVAL_CLOCK *, __u64, __u32);
+extern	void	pt1_clock_stamp(const ARRIVAL_CLOCK *, __u32, __u8 *);
+#endif
@@ -9,6 +9,7 @@
 #include <linux/interrupt.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
+#include <linux/delay.h>
 #include <linux/version.h>
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,4,0)
@@ -24,6 +25,10 @@
 #include	"pt1_tuner.h"
 
 #define		PROGRAM_ADDRESS		1024
+#define		I2C_FIFO_SETTLE		5		// FIFO起動後の待ち(usec)
+#define		I2C_FIFO_SPIN		2000	// FIFO完了待ちスピン上限(usec)
+// 1ブロックの書き込みに使うFIFO数(START/STOP込みの上限値)
+#define		I2C_BLOCK_STEPS(n)	(40 + ((n) * 27))
 static	int		state = STATE_STOP ;
 static	int		i2c_lock(void __iomem *, __u32, __u32, __u32);
 static	int		i2c_lock_one(void __iomem *, __u32, __u32);
@@ -32,6 +37,7 @@ static	void	writebits(void __iomem *, __u32 *, __u32, __u32);
 static	void	begin_i2c(void __iomem *, __u32 *, __u32 *);
 static	void	start_i2c(void __iomem *, __u32 *, __u32 *, __u32);
 static	void	stop_i2c(void __iomem *, __u32 *, __u32 *, __u32, __u32);
+static	int		fifo_wait(void __iomem *);
 
 
 // PCIに書き込むI2Cデータ生成
@@ -204,54 +210,70 @@ static	int		i2c_unlock(void __iomem *regs, int lockval)
 	}
 	return -EIO ;
 }
-void	blockwrite(void __iomem *regs, WBLOCK *wblock)
+// I2C開始前の準備(初回のみバスを一度リセットする)
+static	void	begin_block(void __iomem *regs, __u32 *address, __u32 *clock)
 {
-	int		lp ;
-	int		bitpos ;
-	__u32	bits ;
 	__u32	old_bits = 1 ;
-	__u32	address = 0;
-	__u32	clock = 0;
 
-	begin_i2c(regs, &address, &clock);
+	begin_i2c(regs, address, clock);
 	if(state == STATE_STOP){
-		start_i2c(regs, &address, &clock, old_bits);
+		start_i2c(regs, address, clock, old_bits);
 		old_bits = 0 ;
-		stop_i2c(regs, &address, &clock, old_bits, FALSE);
+		stop_i2c(regs, address, clock, old_bits, FALSE);
 		state = STATE_START ;
 	}
-	old_bits = 1 ;
-	start_i2c(regs, &address, &clock, old_bits);
+}
+
+// 1ブロック分の書き込みシーケンスを作成する(STOPは呼び出し側)
+static	__u32	put_block(void __iomem *regs, __u32 *address, __u32 *clock, __u32 addr, WBLOCK *wblock)
+{
+	int		lp ;
+	int		bitpos ;
+	__u32	bits ;
+	__u32	old_bits = 1 ;
+
+	start_i2c(regs, address, clock, old_bits);
 	old_bits = 0 ;
 
 	// まずアドレスを書く
 	for(bitpos = 0 ; bitpos < 7 ; bitpos++){
-		bits  = ((wblock->addr >> (6 - bitpos)) & 1);
-		writebits(regs, &address, old_bits, bits);
+		bits  = ((addr >> (6 - bitpos)) & 1);
+		writebits(regs, address, old_bits, bits);
 		old_bits = bits ;
 	}
 	// タイプ：WRT
-	writebits(regs, &address, old_bits, 0);
+	writebits(regs, address, old_bits, 0);
 	// ACK/NACK用(必ず1)
-	writebits(regs, &address, 0, 1);
+	writebits(regs, address, 0, 1);
 
 	old_bits = 1 ;
 	// 実際のデータを書く
 	for (lp = 0 ; lp < wblock->count ; lp++){
 		for(bitpos = 0 ; bitpos < 8 ; bitpos++){
 			bits  = ((wblock->value[lp] >> (7 - bitpos)) & 1);
-			writebits(regs, &address, old_bits, bits);
+			writebits(regs, address, old_bits, bits);
 			old_bits = bits ;
 		}
 		// ACK/NACK用(必ず1)
-		writebits(regs, &address, old_bits, 1);
+		writebits(regs, address, old_bits, 1);
 		old_bits = 1 ;
 	}
 
 	// Clock negedge
-	makei2c(regs, address, address + 1, 0, (old_bits ^ 1), 1, 1);
-	clock = TRUE ;
-	address += 1 ;
+	makei2c(regs, *address, *address + 1, 0, (old_bits ^ 1), 1, 1);
+	*clock = TRUE ;
+	*address += 1 ;
+	return old_bits ;
+}
+
+void	blockwrite(void __iomem *regs, WBLOCK *wblock)
+{
+	__u32	old_bits ;
+	__u32	address = 0;
+	__u32	clock = 0;
+
+	begin_block(regs, &address, &clock);
+	old_bits = put_block(regs, &address, &clock, wblock->addr, wblock);
 	stop_i2c(regs, &address, &clock, old_bits, TRUE);
 
 }
@@ -261,49 +283,12 @@ void	blockread(void __iomem *regs, WBLOCK *wblock, int count)
 	int		lp ;
 	int		bitpos ;
 	__u32	bits ;
-	__u32	old_bits = 1 ;
+	__u32	old_bits ;
 	__u32	address = 0;
 	__u32	clock = 0;
 
-	begin_i2c(regs, &address, &clock);
-	if(state == STATE_STOP){
-		start_i2c(regs, &address, &clock, old_bits);
-		old_bits = 0 ;
-		stop_i2c(regs, &address, &clock, old_bits, FALSE);
-		state = STATE_START ;
-	}
-	old_bits = 1 ;
-	start_i2c(regs, &address, &clock, old_bits);
-	old_bits = 0 ;
-
-	// まずアドレスを書く
-	for(bitpos = 0 ; bitpos < 7 ; bitpos++){
-		bits  = ((wblock->addr >> (6 - bitpos)) & 1);
-		writebits(regs, &address, old_bits, bits);
-		old_bits = bits ;
-	}
-	// タイプ：WRT
-	writebits(regs, &address, old_bits, 0);
-	// ACK/NACK用(必ず1)
-	writebits(regs, &address, 0, 1);
-
-	old_bits = 1 ;
-	// 実際のデータを書く
-	for (lp = 0 ; lp < wblock->count ; lp++){
-		for(bitpos = 0 ; bitpos < 8 ; bitpos++){
-			bits  = ((wblock->value[lp] >> (7 - bitpos)) & 1);
-			writebits(regs, &address, old_bits, bits);
-			old_bits = bits ;
-		}
-		// ACK/NACK用(必ず1)
-		writebits(regs, &address, old_bits, 1);
-		old_bits = 1 ;
-	}
-
-	// Clock negedge
-	makei2c(regs, address, address + 1, 0, (old_bits ^ 1), 1, 1);
-	clock = TRUE ;
-	address += 1 ;
+	begin_block(regs, &address, &clock);
+	old_bits = put_block(regs, &address, &clock, wblock->addr, wblock);
 
 	// ここから Read
 	start_i2c(regs, &address, &clock, old_bits);
@@ -427,63 +412,127 @@ static	void	stop_i2c(void __iomem *regs, __u32 *address, __u32 *clock, __u32 dat
 	}
 }
 
-void	i2c_write(void __iomem *regs, struct mutex *lock, WBLOCK *wblock)
+// FIFO実行完了待ち
+// 通常は数百usで終わるのでまずはスピンで待ち、終わらなければ1ms単位で待つ
+static	int		fifo_wait(void __iomem *regs)
 {
+	int		lp ;
 
-	int		lp;
-	__u32	val ;
+	udelay(I2C_FIFO_SETTLE);
+	for(lp = 0 ; lp < I2C_FIFO_SPIN ; lp++){
+		if(!(readl(regs + FIFO_RESULT_ADDR) & FIFO_DONE)){
+			return 0 ;
+		}
+		udelay(1);
+	}
+	for(lp = 0 ; lp < 100 ; lp++){
+		schedule_timeout_interruptible(msecs_to_jiffies(1));
+		if(!(readl(regs + FIFO_RESULT_ADDR) & FIFO_DONE)){
+			return 0 ;
+		}
+	}
+	printk(KERN_INFO "PT1:ERROR I2C FIFO timeout\n");
+	return -EIO ;
+}
+
+// FIFOが完了しなければ-EIOを返す
+int		i2c_write(void __iomem *regs, struct mutex *lock, WBLOCK *wblock)
+{
+	int		rc ;
 
 	// ロックする
 	mutex_lock(lock);
 #if 0
-	printk(KERN_INFO "Addr=%x(%d)\n", wblock->addr, wblock->count);
-	for(lp = 0 ; lp  < wblock->count ; lp++){
-		printk(KERN_INFO "%x\n", wblock->value[lp]);
+	{
+		int		lp;
+		printk(KERN_INFO "Addr=%x(%d)\n", wblock->addr, wblock->count);
+		for(lp = 0 ; lp  < wblock->count ; lp++){
+			printk(KERN_INFO "%x\n", wblock->value[lp]);
+		}
+		printk(KERN_INFO "\n");
 	}
-	printk(KERN_INFO "\n");
 #endif
 
 	blockwrite(regs, wblock);
 	writel(FIFO_GO, regs + FIFO_GO_ADDR);
 	//とりあえずロックしないように。
-	for(lp = 0 ; lp < 100 ; lp++){
-		val = readl(regs + FIFO_RESULT_ADDR);
-		if(!(val & FIFO_DONE)){
-			break ;
+	rc = fifo_wait(regs);
+	mutex_unlock(lock);
+	return rc ;
+}
+
+//
+// 複数ブロックの書き込みを一つのFIFOプログラムにまとめて実行する
+// (FIFOに入りきらない場合はそこで一度実行して続きを積む)
+// FIFOが完了しなければ-EIOを返す
+//
+int		i2c_write_blocks(void __iomem *regs, struct mutex *lock, __u32 addr, WBLOCK **wblock, int count)
+{
+	int		lp ;
+	int		rc = 0 ;
+	int		queued = 0 ;
+	__u32	old_bits = 1 ;
+	__u32	address = 0;
+	__u32	clock = 0;
+
+	mutex_lock(lock);
+	for(lp = 0 ; lp < count ; lp++){
+		if(queued &&
+		   (address + I2C_BLOCK_STEPS(wblock[lp]->count)) >= PROGRAM_ADDRESS){
+			// 入りきらないのでここまでを実行
+			stop_i2c(regs, &address, &clock, old_bits, TRUE);
+			writel(FIFO_GO, regs + FIFO_GO_ADDR);
+			rc = fifo_wait(regs);
+			if(rc < 0){
+				// 途中で失敗したら残りは積まない
+				mutex_unlock(lock);
+				return rc ;
+			}
+			queued = 0 ;
 		}
-		schedule_timeout_interruptible(msecs_to_jiffies(1));
+		if(!queued){
+			address = 0 ;
+			begin_block(regs, &address, &clock);
+		}else{
+			stop_i2c(regs, &address, &clock, old_bits, FALSE);
+		}
+		old_bits = put_block(regs, &address, &clock, addr, wblock[lp]);
+		queued += 1 ;
+	}
+	if(queued){
+		stop_i2c(regs, &address, &clock, old_bits, TRUE);
+		writel(FIFO_GO, regs + FIFO_GO_ADDR);
+		rc = fifo_wait(regs);
 	}
 	mutex_unlock(lock);
+	return rc ;
 }
 
-__u32	i2c_read(void __iomem *regs, struct mutex *lock, WBLOCK *wblock, int size)
+// 読んだ値は*valに返す。FIFOが完了しなければ-EIOを返し、*valは変えない
+int		i2c_read(void __iomem *regs, struct mutex *lock, WBLOCK *wblock, int size, __u32 *val)
 {
 
-	int		lp;
-	__u32	val ;
+	int		rc ;
 
 	// ロックする
 	mutex_lock(lock);
 #if 0
-	printk(KERN_INFO "Addr=%x:%d:%d\n", wblock->addr, wblock->count, size);
-	for(lp = 0 ; lp  < wblock->count ; lp++){
-		printk(KERN_INFO "%x\n", wblock->value[lp]);
+	{
+		int		lp;
+		printk(KERN_INFO "Addr=%x:%d:%d\n", wblock->addr, wblock->count, size);
+		for(lp = 0 ; lp  < wblock->count ; lp++){
+			printk(KERN_INFO "%x\n", wblock->value[lp]);
+		}
+		printk(KERN_INFO "\n");
 	}
-	printk(KERN_INFO "\n");
 #endif
 	blockread(regs, wblock, size);
 
 	writel(FIFO_GO, regs + FIFO_GO_ADDR);
-
-	for(lp = 0 ; lp < 100 ; lp++){
-		schedule_timeout_interruptible(msecs_to_jiffies(1));
-		val = readl(regs + FIFO_RESULT_ADDR);
-		if(!(val & FIFO_DONE)){
-			break ;
-		}
+	rc = fifo_wait(regs);
+	if(rc == 0){
+		*val = readl(regs + I2C_RESULT_ADDR);
 	}
-
-	val = readl(regs + I2C_RESULT_ADDR);
 	mutex_unlock(lock);
-	return val ;
+	return rc ;
 }
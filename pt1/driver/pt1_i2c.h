@@ -78,7 +78,8 @@ typedef	struct	_WBLOCK{
 extern	int		xc3s_init(void __iomem *, int);
 extern	void	SetStream(void __iomem *, __u32, __u32);
 extern	void	blockwrite(void __iomem *, WBLOCK *);
-extern	void	i2c_write(void __iomem *, struct mutex *, WBLOCK *);
-extern	__u32	i2c_read(void __iomem *, struct mutex *, WBLOCK *, int);
+extern	int		i2c_write(void __iomem *, struct mutex *, WBLOCK *);
+extern	int		i2c_write_blocks(void __iomem *, struct mutex *, __u32, WBLOCK **, int);
+extern	int		i2c_read(void __iomem *, struct mutex *, WBLOCK *, int, __u32 *);
 
 #endif
@@ -8,6 +8,55 @@ typedef	struct	_frequency{
 	int		slot ;					// スロット番号／加算する周波数
 }FREQUENCY;
 
+/***************************************************************************/
+/* 選局時間統計                                                            */
+/***************************************************************************/
+#define		TUNE_PHASE_PLL		0		// PLLロック
+#define		TUNE_PHASE_TMCC		1		// TMCC取得(地デジは同期確認)
+#define		TUNE_PHASE_TS_LOCK	2		// TS-IDロック(BSのみ)
+#define		TUNE_PHASE_TS_ID	3		// TS-ID一覧取得(BSのみ)
+#define		MAX_TUNE_PHASE		4
+#define		TUNE_HIST_SIZE		12		// 1ms未満, 2ms未満, 4ms未満 ... 1024ms以上
+
+typedef	struct	_tune_stat{
+	unsigned int	count[MAX_TUNE_PHASE] ;		// ロック成功回数
+	unsigned int	timeout[MAX_TUNE_PHASE] ;	// タイムアウト回数
+	unsigned int	last_us[MAX_TUNE_PHASE] ;	// 直近の所要時間(usec)
+	unsigned int	max_us[MAX_TUNE_PHASE] ;	// 最大所要時間(usec)
+	unsigned int	hist[MAX_TUNE_PHASE][TUNE_HIST_SIZE] ;	// 所要時間分布
+	int				frequencyno ;				// 直近の周波数テーブル番号
+	int				slot ;						// 直近のスロット番号
+	unsigned int	switch_us ;					// 直近のSWITCH_CHANNEL停止時間(us)
+}TUNE_STAT;
+
+/***************************************************************************/
+/* PIDフィルタ                                                             */
+/* pt1_threadがパケットを組み立てた直後に選別し、不要なPIDはバッファに     */
+/* 入れない。open時とSET_CHANNEL/SWITCH_CHANNEL時に解除される              */
+/***************************************************************************/
+#define		MAX_PID_FILTER		8192
+#define		PID_FILTER_WORDS	(MAX_PID_FILTER / 32)
+#define		PID_FILTER_ENABLE	0x01		// bitmapに無いPIDを捨てる
+#define		PID_FILTER_DROP_NULL	0x02		// NULLパケット(0x1FFF)を捨てる
+
+typedef	struct	_pid_filter{
+	unsigned int	flags ;
+	unsigned int	bitmap[PID_FILTER_WORDS] ;	// PID毎に1bit
+}PID_FILTER;
+
+#define		PID_FILTER_SET(f, pid)		((f)->bitmap[(pid) >> 5] |= 1U << ((pid) & 31))
+#define		PID_FILTER_ISSET(f, pid)	((f)->bitmap[(pid) >> 5] & (1U << ((pid) & 31)))
+
+/***************************************************************************/
+/* 到着時刻付きモード                                                      */
+/* SET_TIMESTAMPで1を指定すると、各パケットの前に4byteの到着時刻を付ける   */
+/* (M2TSのTP_extra_headerと同じ形式。上位2bitは0、下位30bitが27MHzの時刻)  */
+/* read()はTIMESTAMP_SIZE + 188byte単位で返す。open時に解除される          */
+/* (192byteより短いread()は-EINVAL)                                        */
+/***************************************************************************/
+#define		TIMESTAMP_SIZE		4
+#define		TIMESTAMP_MASK		0x3FFFFFFF
+
 /***************************************************************************/
 /* IOCTL定義                                                               */
 /***************************************************************************/
@@ -17,4 +66,8 @@ typedef	struct	_frequency{
 #define		GET_SIGNAL_STRENGTH	_IOR(0x8D, 0x04, int *)
 #define		LNB_ENABLE	_IOW(0x8D, 0x05, int)
 #define		LNB_DISABLE	_IO(0x8D, 0x06)
+#define		GET_TUNE_STAT	_IOR(0x8D, 0x07, TUNE_STAT)
+#define		SWITCH_CHANNEL	_IOW(0x8D, 0x08, FREQUENCY)
+#define		SET_PID_FILTER	_IOW(0x8D, 0x09, PID_FILTER)
+#define		SET_TIMESTAMP	_IOW(0x8D, 0x0A, int)
 #endif
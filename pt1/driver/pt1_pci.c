@@ -12,6 +12,7 @@
 #include <linux/version.h>
 #include <linux/mutex.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,4,0)
 #include <asm/system.h>
@@ -39,6 +40,8 @@ typedef struct pm_message {
 #include <linux/cdev.h>
 
 #include <linux/ioctl.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include	"pt1_com.h"
 #include	"pt1_pci.h"
@@ -46,6 +49,7 @@ typedef struct pm_message {
 #include	"pt1_i2c.h"
 #include	"pt1_tuner_data.h"
 #include	"pt1_ioctl.h"
+#include	"pt1_demux.h"
 
 #if LINUX_VERSION_CODE > KERNEL_VERSION(3,8,0)
 #define __devinit
@@ -69,11 +73,14 @@ MODULE_LICENSE("GPL");
 
 static int debug = 7;			/* 1 normal messages, 0 quiet .. 7 verbose. */
 static int lnb = 0;			/* LNB OFF:0 +11V:1 +15V:2 */
+static int signal_interval = 1000;	/* /proc 読み出し時の信号強度再取得間隔(ms) */
 
 module_param(debug, int, 0);
 module_param(lnb, int, 0);
+module_param(signal_interval, int, 0644);
 MODULE_PARM_DESC(debug, "debug level (1-2)");
 MODULE_PARM_DESC(debug, "LNB level (0:OFF 1:+11V 2:+15V)");
+MODULE_PARM_DESC(signal_interval, "min interval in ms between signal reads from /proc");
 
 #define VENDOR_EARTHSOFT 0x10ee
 #define PCI_PT1_ID 0x211a
@@ -86,16 +93,17 @@ static struct pci_device_id pt1_pci_tbl[] = {
 };
 MODULE_DEVICE_TABLE(pci, pt1_pci_tbl);
 #define		DEV_NAME	"pt1video"
+#define		PROC_NAME	"driver/pt1"
 
-#define		PACKET_SIZE			188		// 1パケット長
 #define		MAX_READ_BLOCK	4			// 1度に読み出す最大DMAバッファ数
 #define		MAX_PCI_DEVICE		128		// 最大64枚
-#define		DMA_SIZE	4096			// DMAバッファサイズ
 #define		DMA_RING_SIZE	128			// number of DMA RINGS
 #define		DMA_RING_MAX	511			// number of DMA entries in a RING(1023はNGで511まで)
 #define		CHANNEL_DMA_SIZE	(2*1024*1024)	// 地デジ用(16Mbps)
 #define		BS_CHANNEL_DMA_SIZE	(4*1024*1024)	// BS用(32Mbps)
 #define		READ_SIZE	(16*DMA_SIZE)
+#define		FLUSH_KICK_MS	10			// flush_dma()で取り込みスレッドを起こす間隔
+#define		FLUSH_KICK_MAX	20			// 〃 最大回数(計200ms)
 
 typedef	struct	_DMA_CONTROL{
 	dma_addr_t	ring_dma[DMA_RING_MAX] ;	// DMA情報
@@ -108,7 +116,8 @@ typedef	struct	_pt1_device{
 	unsigned long	mmio_start ;
 	__u32			mmio_len ;
 	void __iomem		*regs;
-	struct mutex		lock ;
+	struct mutex		lock ;			// open/close用
+	struct mutex		i2c_lock ;		// I2C(FIFO)用 1トランザクション毎
 	dma_addr_t		ring_dma[DMA_RING_SIZE] ;	// DMA情報
 	void			*dmaptr[DMA_RING_SIZE] ;
 	struct	task_struct	*kthread;
@@ -117,16 +126,14 @@ typedef	struct	_pt1_device{
 	__u32			base_minor ;
 	struct	cdev	cdev[MAX_CHANNEL];
 	wait_queue_head_t	dma_wait_q ;// for poll on reading
+	wait_queue_head_t	thread_wait_q ;	// DMA取り込み1周待ち用
+	__u32			thread_pass ;	// DMA取り込み周回数
 	DMA_CONTROL		*dmactl[DMA_RING_SIZE];
 	PT1_CHANNEL		*channel[MAX_CHANNEL];
 	int			cardtype;
+	ARRIVAL_CLOCK	clock ;			// 到着時刻の補間(pt1_threadのみ使用)
 } PT1_DEVICE;
 
-typedef	struct	_MICRO_PACKET{
-	char	data[3];
-	char	head ;
-}MICRO_PACKET;
-
 struct	_PT1_CHANNEL{
 	__u32			valid ;			// 使用中フラグ
 	__u32			address ;		// I2Cアドレス
@@ -134,7 +141,8 @@ struct	_PT1_CHANNEL{
 	int			type ;			// チャネルタイプ
 	__u32			packet_size ;	// パケットサイズ
 	__u32			drop ;			// パケットドロップ数
-	struct mutex		lock ;			// CH別mutex_lock用
+	struct mutex		lock ;			// CH別mutex_lock用(受信バッファ)
+	struct mutex		tuner_lock ;	// CH別チューナ操作用
 	__u32			size ;			// DMAされたサイズ
 	__u32			maxsize ;		// DMA用バッファサイズ
 	__u32			bufsize ;		// チャネルに割り振られたサイズ
@@ -145,9 +153,18 @@ struct	_PT1_CHANNEL{
 	__u8			*buf;			// CH別受信メモリ
 	__u32			pointer;
 	__u8			req_dma ;		// 溢れたチャネル
-	__u8			packet_buf[PACKET_SIZE] ;		// 溢れたチャネル
+	__u8			packet_buf[TIMESTAMP_SIZE + PACKET_SIZE] ;	// 組み立て中(先頭は到着時刻)
+	__u8			timestamp ;		// 到着時刻付きモード
+	PID_FILTER		filter ;		// PIDフィルタ(lockで保護)
+	__u32			filtered ;		// フィルタで捨てたパケット数
 	PT1_DEVICE		*ptr ;			// カード別情報
 	wait_queue_head_t	wait_q ;	// for poll on reading
+	TUNE_STAT		stat ;			// 選局時間統計
+	int			locked ;		// 直近の選局結果
+	int			tuned ;			// このオープン中に選局に成功した
+	FREQUENCY		tuned_freq ;	// 直近に選局に成功したチャンネル
+	__u32			signal ;		// 直近の信号強度(生値)
+	unsigned long	signal_jiffies ;	// 信号強度取得時刻
 };
 
 // I2Cアドレス(video0, 1 = ISDB-S) (video2, 3 = ISDB-T)
@@ -157,6 +174,7 @@ int		channeltype[MAX_CHANNEL] = {CHANNEL_TYPE_ISDB_S, CHANNEL_TYPE_ISDB_S,
 									CHANNEL_TYPE_ISDB_T, CHANNEL_TYPE_ISDB_T};
 
 static	PT1_DEVICE	*device[MAX_PCI_DEVICE];
+static	DEFINE_MUTEX(device_lock);		// device[]の登録・削除・参照用
 static struct class	*pt1video_class;
 
 #define		PT1MAJOR	251
@@ -175,7 +193,7 @@ static	void	reset_dma(PT1_DEVICE *dev_conf)
 	for(ring_pos = 0 ; ring_pos < DMA_RING_SIZE ; ring_pos++){
 		for(data_pos = 0 ; data_pos < DMA_RING_MAX ; data_pos++){
 			dataptr = (dev_conf->dmactl[ring_pos])->data[data_pos];
-			dataptr[(DMA_SIZE / sizeof(__u32)) - 2] = 0;
+			dataptr[DMA_PAGE_FLAG] = 0;
 		}
 	}
 	// 転送カウンタをリセット
@@ -193,6 +211,27 @@ static	void	reset_dma(PT1_DEVICE *dev_conf)
 	writel(0x0c000040, dev_conf->regs);
 
 }
+// DMAが書き終えて取り込み待ちのページ数
+static	__u32	count_ready_pages(PT1_DEVICE *dev_conf, int ring_pos, int data_pos)
+{
+	__u32	count = 0 ;
+
+	while(count < (DMA_RING_SIZE * DMA_RING_MAX)){
+		if((dev_conf->dmactl[ring_pos])->data[data_pos][DMA_PAGE_FLAG] == 0){
+			break ;
+		}
+		count += 1 ;
+		data_pos += 1 ;
+		if(data_pos >= DMA_RING_MAX){
+			data_pos = 0 ;
+			ring_pos += 1 ;
+			if(ring_pos >= DMA_RING_SIZE){
+				ring_pos = 0 ;
+			}
+		}
+	}
+	return count ;
+}
 static	int		pt1_thread(void *data)
 {
 	PT1_DEVICE	*dev_conf = data ;
@@ -202,7 +241,9 @@ static	int		pt1_thread(void *data)
 	int		lp ;
 	int		chno ;
 	int		dma_channel ;
-	int		packet_pos ;
+	int		status ;
+	__u32	pass_left = 0 ;		// 時刻を取ってから取り込むページ数
+	__u32	pass_page = 0 ;		// 時刻を取ってから取り込んだページ数
 	__u32	*dataptr ;
 	__u32	*curdataptr ;
 	__u32	val ;
@@ -223,25 +264,30 @@ static	int		pt1_thread(void *data)
 		for(;;){
 			dataptr = (dev_conf->dmactl[ring_pos])->data[data_pos];
 			// データあり？
-			if(dataptr[(DMA_SIZE / sizeof(__u32)) - 2] == 0){
+			if(dataptr[DMA_PAGE_FLAG] == 0){
 				break ;
 			}
-			micro.val = *dataptr ;
+			// 溜まっているページ数を数え、時刻はその分につき1回だけ取る
+			if(pass_left == 0){
+				pass_left = count_ready_pages(dev_conf, ring_pos, data_pos);
+				pt1_clock_pass(&dev_conf->clock, ktime_to_ns(ktime_get()), pass_left);
+				pass_page = 0 ;
+			}
 			curdataptr = dataptr ;
 			data_pos += 1 ;
-			for(lp = 0 ; lp < (DMA_SIZE / sizeof(__u32)) ; lp++, dataptr++){
+			for(lp = 0 ; lp < DMA_PAGE_WORDS ; lp++, dataptr++){
 				micro.val = *dataptr ;
-				dma_channel = ((micro.packet.head >> 5) & 0x07);
+				status = pt1_micro_decode(&micro.packet, &dma_channel);
 				//チャネル情報不正
-				if(dma_channel > MAX_CHANNEL){
-					printk(KERN_ERR "DMA Channel Number Error(%d)\n", dma_channel);
+				if(status == MICRO_BAD_CHANNEL){
+					printk(KERN_ERR "DMA Channel Number Error(%d)\n",
+							MICRO_CHANNEL(micro.packet.head));
 					continue ;
 				}
-				chno = real_channel[(((micro.packet.head >> 5) & 0x07) - 1)];
-				packet_pos = ((micro.packet.head >> 2) & 0x07);
+				chno = real_channel[dma_channel];
 				channel = dev_conf->channel[chno] ;
 				//  エラーチェック
-				if((micro.packet.head & MICROPACKET_ERROR)){
+				if(status == MICRO_FAULT){
 					val = readl(dev_conf->regs);
 					if((val & BIT_RAM_OVERFLOW)){
 						channel->overflow += 1 ;
@@ -255,6 +301,7 @@ static	int		pt1_thread(void *data)
 					// 初期化して先頭から
 					reset_dma(dev_conf);
 					ring_pos = data_pos = 0 ;
+					pass_left = 0 ;
 					break ;
 				}
 				// 未使用チャネルは捨てる
@@ -264,7 +311,7 @@ static	int		pt1_thread(void *data)
 				mutex_lock(&channel->lock);
 				// あふれたら読み出すまで待つ
 				while(1){
-					if(channel->size >= (channel->maxsize - PACKET_SIZE - 4)){
+					if(RING_FULL(channel->maxsize, channel->size)){
 						// 該当チャンネルのDMA読みだし待ちにする
 						wake_up(&channel->wait_q);
 						channel->req_dma = TRUE ;
@@ -278,40 +325,35 @@ static	int		pt1_thread(void *data)
 						break ;
 					}
 				}
-				// 先頭で、一時バッファに残っている場合
-				if((micro.packet.head & 0x02) &&  (channel->packet_size != 0)){
-					channel->packet_size = 0 ;
-				}
-				// データコピー
-				channel->packet_buf[channel->packet_size]   = micro.packet.data[2];
-				channel->packet_buf[channel->packet_size+1] = micro.packet.data[1];
-				channel->packet_buf[channel->packet_size+2] = micro.packet.data[0];
-				channel->packet_size += 3;
-
 				// パケットが出来たらコピーする
-				if(channel->packet_size >= PACKET_SIZE){
-					if (channel->pointer + channel->size >= channel->maxsize) {
-						// リングバッファの境界を越えていてリングバッファの先頭に戻っている場合
-						// channel->pointer + channel->size - channel->maxsize でリングバッファ先頭からのアドレスになる
-						memcpy(&channel->buf[channel->pointer + channel->size - channel->maxsize], channel->packet_buf, PACKET_SIZE);
-					} else if (channel->pointer + channel->size + PACKET_SIZE > channel->maxsize) {
-						// リングバッファの境界をまたぐように書き込まれる場合
-						// リングバッファの境界まで書き込み
-						__u32 tmp_size = channel->maxsize - (channel->pointer + channel->size);
-						memcpy(&channel->buf[channel->pointer + channel->size], channel->packet_buf, tmp_size);
-						// 先頭に戻って書き込み
-						memcpy(channel->buf, &channel->packet_buf[tmp_size], PACKET_SIZE - tmp_size);
-					} else {
-						// リングバッファ内で収まる場合
-						// 通常の書き込み
-						memcpy(&channel->buf[channel->pointer + channel->size], channel->packet_buf, PACKET_SIZE);
+				if(pt1_micro_append(&channel->packet_buf[TIMESTAMP_SIZE],
+									&channel->packet_size, &micro.packet)){
+					// 不要なPIDはバッファに入れない
+					if(!pt1_pid_pass(&channel->filter, &channel->packet_buf[TIMESTAMP_SIZE])){
+						channel->filtered += 1 ;
+					}else if(channel->timestamp){
+						// 最後のマイクロパケットが届いた時刻を前に付ける
+						pt1_clock_stamp(&dev_conf->clock,
+										pass_page * DMA_PAGE_WORDS + lp,
+										channel->packet_buf);
+						pt1_ring_put(channel->buf, channel->maxsize, channel->pointer,
+									 channel->size, channel->packet_buf,
+									 TIMESTAMP_SIZE + PACKET_SIZE);
+						channel->size += TIMESTAMP_SIZE + PACKET_SIZE ;
+					}else{
+						pt1_ring_put(channel->buf, channel->maxsize, channel->pointer,
+									 channel->size, &channel->packet_buf[TIMESTAMP_SIZE],
+									 PACKET_SIZE);
+						channel->size += PACKET_SIZE ;
 					}
-					channel->size += PACKET_SIZE ;
-					channel->packet_size = 0 ;
 				}
 				mutex_unlock(&channel->lock);
 			}
-			curdataptr[(DMA_SIZE / sizeof(__u32)) - 2] = 0;
+			curdataptr[DMA_PAGE_FLAG] = 0;
+			if(pass_left > 0){
+				pass_left -= 1 ;
+				pass_page += 1 ;
+			}
 
 			if(data_pos >= DMA_RING_MAX){
 				data_pos = 0;
@@ -331,10 +373,33 @@ static	int		pt1_thread(void *data)
 				}
 			}
 		}
+		dev_conf->thread_pass += 1 ;
+		wake_up(&dev_conf->thread_wait_q);
 		schedule_timeout_interruptible(msecs_to_jiffies(100));
 	}
 	return 0 ;
 }
+// 転送済みDMAデータがCH別バッファに取り込まれるのを待つ
+// 周回途中の場合があるので、2周分進むのを待つ
+// スレッドは1周ごとに100ms眠るので、周回ごとに起こし直す
+// (眠りに入る直前に起こすと取りこぼすので、短い間隔で起こし続ける)
+static	void	flush_dma(PT1_DEVICE *dev_conf)
+{
+	__u32	pass = dev_conf->thread_pass ;
+	__u32	now ;
+	int		lp ;
+
+	for(lp = 0 ; lp < FLUSH_KICK_MAX ; lp++){
+		now = dev_conf->thread_pass ;
+		if((now - pass) >= 2){
+			break ;
+		}
+		wake_up_process(dev_conf->kthread);
+		wait_event_timeout(dev_conf->thread_wait_q,
+						   (dev_conf->thread_pass != now),
+						   msecs_to_jiffies(FLUSH_KICK_MS));
+	}
+}
 static int pt1_open(struct inode *inode, struct file *file)
 {
 	int		major = imajor(inode);
@@ -343,55 +408,78 @@ static int pt1_open(struct inode *inode, struct file *file)
 	int		lp2 ;
 	PT1_CHANNEL	*channel ;
 
+	// 削除中のカードを掴まないよう、確保までdevice_lockを持つ
+	mutex_lock(&device_lock);
 	for(lp = 0 ; lp < MAX_PCI_DEVICE ; lp++){
 		if(device[lp] == NULL){
-			return -EIO ;
+			continue ;
 		}
 
 		if(MAJOR(device[lp]->dev) == major &&
 		   device[lp]->base_minor <= minor &&
 		   device[lp]->base_minor + MAX_CHANNEL > minor) {
 
-			mutex_lock(&device[lp]->lock);
 			for(lp2 = 0 ; lp2 < MAX_CHANNEL ; lp2++){
 				channel = device[lp]->channel[lp2] ;
 				if(channel->minor == minor){
+					// 使用中チェックと確保だけをカード単位で行う
+					mutex_lock(&device[lp]->lock);
 					if(channel->valid == TRUE){
 						mutex_unlock(&device[lp]->lock);
+						mutex_unlock(&device_lock);
 						return -EIO ;
 					}
-
-					/* wake tuner up */
-					set_sleepmode(channel->ptr->regs, &channel->lock,
-								  channel->address, channel->type,
-								  TYPE_WAKEUP);
-					schedule_timeout_interruptible(msecs_to_jiffies(100));
-
 					channel->drop  = 0 ;
-					channel->valid = TRUE ;
 					channel->overflow = 0 ;
 					channel->counetererr = 0 ;
 					channel->transerr = 0 ;
 					channel->packet_size = 0 ;
-					file->private_data = channel;
+					channel->locked = FALSE ;
+					channel->tuned = FALSE ;
+					channel->signal = 0 ;
 					mutex_lock(&channel->lock);
 					// データ初期化
 					channel->size = 0 ;
+					channel->filter.flags = 0 ;
+					channel->filtered = 0 ;
+					channel->timestamp = FALSE ;
 					mutex_unlock(&channel->lock);
+					channel->valid = TRUE ;
 					mutex_unlock(&device[lp]->lock);
+					mutex_unlock(&device_lock);
+
+					/* wake tuner up */
+					mutex_lock(&channel->tuner_lock);
+					set_sleepmode(channel->ptr->regs, &channel->ptr->i2c_lock,
+								  channel->address, channel->type,
+								  TYPE_WAKEUP);
+					wait_wakeup(channel->ptr->regs, &channel->ptr->i2c_lock,
+								channel->address, channel->type);
+					mutex_unlock(&channel->tuner_lock);
+
+					file->private_data = channel;
 					return 0 ;
 				}
 			}
 		}
 	}
+	mutex_unlock(&device_lock);
 	return -EIO;
 }
 static int pt1_release(struct inode *inode, struct file *file)
 {
 	PT1_CHANNEL	*channel = file->private_data;
 
-	mutex_lock(&channel->ptr->lock);
 	SetStream(channel->ptr->regs, channel->channel, FALSE);
+
+	/* send tuner to sleep */
+	// 使用中のままスリープさせるので、完了前に再オープンされることはない
+	mutex_lock(&channel->tuner_lock);
+	set_sleepmode(channel->ptr->regs, &channel->ptr->i2c_lock,
+				  channel->address, channel->type, TYPE_SLEEP);
+	mutex_unlock(&channel->tuner_lock);
+
+	mutex_lock(&channel->ptr->lock);
 	channel->valid = FALSE ;
 	printk(KERN_INFO "(%d:%d)Drop=%08d:%08d:%08d:%08d\n", imajor(inode), iminor(inode), channel->drop,
 						channel->overflow, channel->counetererr, channel->transerr);
@@ -404,54 +492,64 @@ static int pt1_release(struct inode *inode, struct file *file)
 		channel->req_dma = FALSE ;
 		wake_up(&channel->ptr->dma_wait_q);
 	}
-	/* send tuner to sleep */
-	set_sleepmode(channel->ptr->regs, &channel->lock,
-				  channel->address, channel->type, TYPE_SLEEP);
-	schedule_timeout_interruptible(msecs_to_jiffies(100));
-  
-  //PT2ドライババグの注意喚起に従い修正
+	//PT2ドライババグの注意喚起に従い修正
 	//https://gist.github.com/akimasa/a2fc1fc098dee1e27ab88fab3ff27d23
-  mutex_unlock(&channel->ptr->lock);
+	mutex_unlock(&channel->ptr->lock);
 	return 0;
 }
 
-static ssize_t pt1_read(struct file *file, char __user *buf, size_t cnt, loff_t * ppos)
+// ユーザ空間へのコピー(destはユーザ空間のバッファを指すポインタ)
+// どちらのコピーもコピーした分だけdestを進め、コピーできたバイト数を返す
+static	size_t	pt1_copy_user(void *dest, const __u8 *src, size_t len)
 {
-	PT1_CHANNEL	*channel = file->private_data;
-	__u32	size ;
-	unsigned long dummy;
+	char __user	**buf = dest ;
+	size_t	done ;
+
+	done = len - copy_to_user(*buf, src, len);
+	*buf += done ;
+	return done ;
+}
+// リングバッファから最大cntバイト取り出す(read/read_iter共通)
+// リングはコピーできた分だけ進める(残りは次の読み出しで返す)
+static ssize_t pt1_read_ring(PT1_CHANNEL *channel, size_t cnt,
+				size_t (*copy)(void *, const __u8 *, size_t), void *dest)
+{
+	__u32	unit = channel->timestamp ? (TIMESTAMP_SIZE + PACKET_SIZE) : 1 ;
+	ssize_t	size = 0 ;
 
+	// 到着時刻付きは1パケット分より短い読み出しを受け付けない
+	// (切り捨てて0を返すとEOFに見える)
+	if(cnt < unit){
+		return cnt ? -EINVAL : 0 ;
+	}
 	// READ_SIZE単位で起こされるのを待つ(CPU負荷対策)
 	if(channel->size < READ_SIZE){
 		wait_event_timeout(channel->wait_q, (channel->size >= READ_SIZE),
 							msecs_to_jiffies(500));
 	}
 	mutex_lock(&channel->lock);
-	if(!channel->size){
-		size = 0 ;
-	}else{
-		__u32 tmp_size = 0;
-		if (cnt < channel->size) {
-			// バッファにあるデータより小さい読み込みの場合
-			size = cnt;
-		} else {
-			// バッファにあるデータ以上の読み込みの場合
-			size = channel->size;
-		}
-		if (channel->maxsize <= size + channel->pointer) {
-			// リングバッファの境界を越える場合
-			tmp_size = channel->maxsize - channel->pointer;
-			// 境界までコピー
-			dummy = copy_to_user(buf, &channel->buf[channel->pointer], tmp_size);
-			// 残りをコピー
-			dummy = copy_to_user(&buf[tmp_size], channel->buf, size - tmp_size);
-			channel->pointer = size - tmp_size;
-		} else {
-			// 普通にコピー
-			dummy = copy_to_user(buf, &channel->buf[channel->pointer], size);
-			channel->pointer += size;
+	if(channel->size){
+		__u32	pos = channel->pointer ;
+		__u32	pointer = pos ;
+		__u32	left = channel->size ;
+		__u32	first ;
+		__u32	len ;
+		size_t	done ;
+
+		// 到着時刻付きはパケット単位で返す
+		cnt -= cnt % unit ;
+		// 取り出せる範囲を調べるだけで、まだリングは進めない
+		len = pt1_ring_get(channel->maxsize, &pointer, &left, cnt, &first);
+		// 境界までコピー
+		done = copy(dest, &channel->buf[pos], first);
+		if((done == first) && (first < len)){
+			// リングバッファの境界を越える場合は残りをコピー
+			done += copy(dest, channel->buf, len - first);
 		}
-		channel->size -= size;
+		done -= done % unit ;
+		pt1_ring_get(channel->maxsize, &channel->pointer, &channel->size,
+					 done, &first);
+		size = done ? (ssize_t)done : -EFAULT ;
 	}
 	// 読み終わったかつ使用しているのがが4K以下
 	if(channel->req_dma == TRUE){
@@ -461,18 +559,52 @@ static ssize_t pt1_read(struct file *file, char __user *buf, size_t cnt, loff_t
 	mutex_unlock(&channel->lock);
 	return size ;
 }
+static ssize_t pt1_read(struct file *file, char __user *buf, size_t cnt, loff_t * ppos)
+{
+	char __user	*cursor = buf ;
+
+	return pt1_read_ring(file->private_data, cnt, pt1_copy_user, &cursor);
+}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+// pipeのページへのコピー(destはiov_iter、コピーした位置はiov_iterが持つ)
+static	size_t	pt1_copy_iter(void *dest, const __u8 *src, size_t len)
+{
+	return copy_to_iter(src, len, (struct iov_iter *)dest);
+}
+// splice()用。5.10からは既定のsplice_readが無くなったので、read_iter経由で
+// リングバッファからpipeのページへ直接コピーする(ユーザ空間を通らない)
+static ssize_t pt1_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	return pt1_read_ring(iocb->ki_filp->private_data, iov_iter_count(to),
+						 pt1_copy_iter, to);
+}
+#endif
+// PIDフィルタを解除する(別のTSではPIDの意味が変わる)
+static	void	clear_pid_filter(PT1_CHANNEL *channel)
+{
+	mutex_lock(&channel->lock);
+	channel->filter.flags = 0 ;
+	mutex_unlock(&channel->lock);
+}
 static	int		SetFreq(PT1_CHANNEL *channel, FREQUENCY *freq)
 {
+	ktime_t	start = ktime_get();
+	int		locked = TRUE ;
 
+	clear_pid_filter(channel);
+
+	channel->stat.frequencyno = freq->frequencyno ;
+	channel->stat.slot = freq->slot ;
+	channel->locked = FALSE ;
 	switch(channel->type){
 		case CHANNEL_TYPE_ISDB_S:
 			{
 				ISDB_S_TMCC		tmcc ;
 				if(bs_tune(channel->ptr->regs,
-						&channel->ptr->lock,
+						&channel->ptr->i2c_lock,
 						channel->address,
 						freq->frequencyno,
-						&tmcc) < 0){
+						&tmcc, &channel->stat) < 0){
 					return -EIO ;
 				}
 
@@ -494,24 +626,58 @@ static	int		SetFreq(PT1_CHANNEL *channel, FREQUENCY *freq)
 					}
 				}
 #endif
-				ts_lock(channel->ptr->regs,
-						&channel->ptr->lock,
+				// TS-IDロック失敗でも従来通り選局自体は成功扱い
+				if(ts_lock(channel->ptr->regs,
+						&channel->ptr->i2c_lock,
 						channel->address,
-						tmcc.ts_id[freq->slot].ts_id);
+						tmcc.ts_id[freq->slot].ts_id,
+						&channel->stat) < 0){
+					locked = FALSE ;
+				}
 			}
 			break ;
 		case CHANNEL_TYPE_ISDB_T:
 			{
 				if(isdb_t_frequency(channel->ptr->regs,
-						&channel->ptr->lock,
+						&channel->ptr->i2c_lock,
 						channel->address,
-						freq->frequencyno, freq->slot) < 0){
+						freq->frequencyno, freq->slot,
+						&channel->stat) < 0){
 					return -EINVAL ;
 				}
 			}
 	}
+	channel->locked = locked ;
+	channel->tuned = TRUE ;
+	channel->tuned_freq = *freq ;
+	pr_debug("PT1:tune(%d:%d) %lldus\n", freq->frequencyno, freq->slot,
+		   (long long)ktime_us_delta(ktime_get(), start));
 	return 0 ;
 }
+// 信号強度取得(取得値は/proc用に保持)
+static	int		read_signal(PT1_CHANNEL *channel)
+{
+	int		signal = 0 ;
+
+	switch(channel->type){
+		case CHANNEL_TYPE_ISDB_S:
+			signal = isdb_s_read_signal_strength(channel->ptr->regs,
+										&channel->ptr->i2c_lock,
+										channel->address);
+			break ;
+		case CHANNEL_TYPE_ISDB_T:
+			signal = isdb_t_read_signal_strength(channel->ptr->regs,
+										&channel->ptr->i2c_lock, channel->address);
+			break ;
+	}
+	// I2Cエラー(負値)は保持しない
+	if(signal < 0){
+		return signal ;
+	}
+	channel->signal = signal ;
+	channel->signal_jiffies = jiffies ;
+	return signal ;
+}
 
 static int count_used_bs_tuners(PT1_DEVICE *device)
 {
@@ -551,22 +717,90 @@ static long pt1_do_ioctl(struct file  *file, unsigned int cmd, unsigned long arg
 			return 0 ;
 		case STOP_REC:
 			SetStream(channel->ptr->regs, channel->channel, FALSE);
-			schedule_timeout_interruptible(msecs_to_jiffies(100));
+			flush_dma(channel->ptr);
 			return 0 ;
+		case SWITCH_CHANNEL:
+			{
+				FREQUENCY	freq ;
+				FREQUENCY	old ;
+				int			tuned ;
+				ktime_t		start ;
+				if(copy_from_user(&freq, arg, sizeof(FREQUENCY))){
+					return -EFAULT ;
+				}
+				// 停止→選局→開始をチューナロック内で一度に行う
+				// 停止前のデータは同じバッファに順に入るので取り込み待ちは不要
+				// 選局に失敗したら元のチャンネルに戻して転送を再開する
+				// 未選局なら戻す先がないので停止したままにする
+				old = channel->tuned_freq ;
+				tuned = channel->tuned ;
+				start = ktime_get();
+				SetStream(channel->ptr->regs, channel->channel, FALSE);
+				if(SetFreq(channel, &freq) < 0){
+					if(!tuned){
+						return -EIO ;
+					}
+					if(SetFreq(channel, &old) < 0){
+						printk(KERN_INFO "PT1:switch back(%d:%d) NG\n",
+							   old.frequencyno, old.slot);
+					}
+					SetStream(channel->ptr->regs, channel->channel, TRUE);
+					return -EIO ;
+				}
+				SetStream(channel->ptr->regs, channel->channel, TRUE);
+				channel->stat.switch_us = (unsigned int)ktime_us_delta(ktime_get(), start);
+				pr_debug("PT1:switch(%d:%d) %uus\n", freq.frequencyno, freq.slot,
+						 channel->stat.switch_us);
+				return 0 ;
+			}
+		case SET_PID_FILTER:
+			{
+				PID_FILTER	*filter ;
+				// 1KBあるのでスタックには置かない
+				filter = kmalloc(sizeof(PID_FILTER), GFP_KERNEL);
+				if(filter == NULL){
+					return -ENOMEM ;
+				}
+				if(copy_from_user(filter, arg, sizeof(PID_FILTER))){
+					kfree(filter);
+					return -EFAULT ;
+				}
+				mutex_lock(&channel->lock);
+				memcpy(&channel->filter, filter, sizeof(PID_FILTER));
+				mutex_unlock(&channel->lock);
+				kfree(filter);
+				return 0 ;
+			}
+		case SET_TIMESTAMP:
+			{
+				int		mode ;
+				if(copy_from_user(&mode, arg, sizeof(int))){
+					return -EFAULT ;
+				}
+				mutex_lock(&channel->lock);
+				// パケット長が変わるので溜まっているデータは捨てる
+				channel->timestamp = (mode != 0) ;
+				channel->size = 0 ;
+				channel->packet_size = 0 ;
+				if(channel->req_dma == TRUE){
+					channel->req_dma = FALSE ;
+					wake_up(&channel->ptr->dma_wait_q);
+				}
+				mutex_unlock(&channel->lock);
+				return 0 ;
+			}
 		case GET_SIGNAL_STRENGTH:
-			switch(channel->type){
-				case CHANNEL_TYPE_ISDB_S:
-					signal = isdb_s_read_signal_strength(channel->ptr->regs,
-												&channel->ptr->lock,
-												channel->address);
-					break ;
-				case CHANNEL_TYPE_ISDB_T:
-					signal = isdb_t_read_signal_strength(channel->ptr->regs,
-												&channel->ptr->lock, channel->address);
-					break ;
+			signal = read_signal(channel);
+			if(signal < 0){
+				return signal ;
 			}
 			dummy = copy_to_user(arg, &signal, sizeof(int));
 			return 0 ;
+		case GET_TUNE_STAT:
+			if(copy_to_user(arg, &channel->stat, sizeof(TUNE_STAT))){
+				return -EFAULT ;
+			}
+			return 0 ;
 		case LNB_ENABLE:
 			count = count_used_bs_tuners(channel->ptr);
 			if(count <= 1) {
@@ -592,9 +826,9 @@ static long pt1_unlocked_ioctl(struct file  *file, unsigned int cmd, unsigned lo
 	PT1_CHANNEL	*channel = file->private_data;
 	long ret;
 
-	mutex_lock(&channel->lock);
+	mutex_lock(&channel->tuner_lock);
 	ret = pt1_do_ioctl(file, cmd, arg0);
-	mutex_unlock(&channel->lock);
+	mutex_unlock(&channel->tuner_lock);
 
 	return ret;
 }
@@ -624,6 +858,13 @@ static const struct file_operations pt1_fops = {
 	.open		=	pt1_open,
 	.release	=	pt1_release,
 	.read		=	pt1_read,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+	.read_iter	=	pt1_read_iter,
+	.splice_read	=	copy_splice_read,
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+	.read_iter	=	pt1_read_iter,
+	.splice_read	=	generic_file_splice_read,
+#endif
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,36)
 	.ioctl		=	pt1_ioctl,
 #else
@@ -663,7 +904,7 @@ int		pt1_makering(struct pci_dev *pdev, PT1_DEVICE *dev_conf)
 			}
 			dmactl->data[lp2] = dmaptr ;
 			// DMAデータエリア初期化
-			dmaptr[(DMA_SIZE / sizeof(__u32)) - 2] = 0 ;
+			dmaptr[DMA_PAGE_FLAG] = 0 ;
 			addr = (__u32)dmactl->ring_dma[lp2];
 			addr >>= 12 ;
 			memcpy(ptr, &addr, sizeof(__u32));
@@ -797,10 +1038,11 @@ static int __devinit pt1_pci_init_one (struct pci_dev *pdev,
 	settuner_reset(dev_conf->regs, dev_conf->cardtype, LNB_OFF, TUNER_POWER_ON_RESET_DISABLE);
 	schedule_timeout_interruptible(msecs_to_jiffies(100));
 	mutex_init(&dev_conf->lock);
+	mutex_init(&dev_conf->i2c_lock);
 
 	// Tuner 初期化処理
 	for(lp = 0 ; lp < MAX_TUNER ; lp++){
-		rc = tuner_init(dev_conf->regs, dev_conf->cardtype, &dev_conf->lock, lp);
+		rc = tuner_init(dev_conf->regs, dev_conf->cardtype, &dev_conf->i2c_lock, lp);
 		if(rc < 0){
 			printk(KERN_ERR "Error tuner_init\n");
 			goto out_err_fpga;
@@ -808,8 +1050,12 @@ static int __devinit pt1_pci_init_one (struct pci_dev *pdev,
 	}
 	// 初期化完了
 	for(lp = 0 ; lp < MAX_CHANNEL ; lp++){
-		set_sleepmode(dev_conf->regs, &dev_conf->lock,
+		rc = set_sleepmode(dev_conf->regs, &dev_conf->i2c_lock,
 						i2c_address[lp], channeltype[lp], TYPE_SLEEP);
+		if(rc < 0){
+			printk(KERN_ERR "Error set_sleepmode\n");
+			goto out_err_fpga;
+		}
 
 		schedule_timeout_interruptible(msecs_to_jiffies(100));
 	}
@@ -820,9 +1066,11 @@ static int __devinit pt1_pci_init_one (struct pci_dev *pdev,
 
 	// 初期化
 	init_waitqueue_head(&dev_conf->dma_wait_q);
+	init_waitqueue_head(&dev_conf->thread_wait_q);
 
 	minor = MINOR(dev_conf->dev) ;
 	dev_conf->base_minor = minor ;
+	mutex_lock(&device_lock);
 	for(lp = 0 ; lp < MAX_PCI_DEVICE ; lp++){
 		printk(KERN_INFO "PT1:device[%d]=%p\n", lp, device[lp]);
 		if(device[lp] == NULL){
@@ -831,6 +1079,7 @@ static int __devinit pt1_pci_init_one (struct pci_dev *pdev,
 			break ;
 		}
 	}
+	mutex_unlock(&device_lock);
 	for(lp = 0 ; lp < MAX_CHANNEL ; lp++){
 		cdev_init(&dev_conf->cdev[lp], &pt1_fops);
 		dev_conf->cdev[lp].owner = THIS_MODULE;
@@ -844,6 +1093,7 @@ static int __devinit pt1_pci_init_one (struct pci_dev *pdev,
 
 		// 共通情報
 		mutex_init(&channel->lock);
+		mutex_init(&channel->tuner_lock);
 		// 待ち状態を解除
 		channel->req_dma = FALSE ;
 		// マイナー番号設定
@@ -913,6 +1163,11 @@ static int __devinit pt1_pci_init_one (struct pci_dev *pdev,
 out_err_dma:
 	pt1_dma_free(pdev, dev_conf);
 out_err_v4l:
+	mutex_lock(&device_lock);
+	if(device[dev_conf->card_number] == dev_conf){
+		device[dev_conf->card_number] = NULL;
+	}
+	mutex_unlock(&device_lock);
 	for(lp = 0 ; lp < MAX_CHANNEL ; lp++){
 		if(dev_conf->channel[lp] != NULL){
 			if(dev_conf->channel[lp]->buf != NULL){
@@ -944,6 +1199,12 @@ static void __devexit pt1_pci_remove_one(struct pci_dev *pdev)
 	int		i;
 
 	if(dev_conf){
+		// /procとopenから見えなくしてから解放する
+		mutex_lock(&device_lock);
+		if(device[dev_conf->card_number] == dev_conf){
+			device[dev_conf->card_number] = NULL;
+		}
+		mutex_unlock(&device_lock);
 		if(dev_conf->kthread) {
 			kthread_stop(dev_conf->kthread);
 			dev_conf->kthread = NULL;
@@ -979,7 +1240,6 @@ static void __devexit pt1_pci_remove_one(struct pci_dev *pdev)
 		for (i = 0; i < DMA_RING_SIZE; i++) {
 			kfree(dev_conf->dmactl[i]);
 		}
-		device[dev_conf->card_number] = NULL;
 		kfree(dev_conf);
 	}
 	pci_set_drvdata(pdev, NULL);
@@ -999,6 +1259,66 @@ static int pt1_pci_resume (struct pci_dev *pdev)
 #endif /* CONFIG_PM */
 
 
+// 全チューナの状態一覧(オープンせずに参照できる)
+// 使用中のチャネルはsignal_interval毎に信号強度を取り直す
+// 選局中はチューナを待たずに前回値を返す
+static	int		pt1_proc_show(struct seq_file *m, void *v)
+{
+	int		lp ;
+	int		lp2 ;
+	PT1_CHANNEL	*channel ;
+
+	seq_puts(m, "#card minor type valid locked signal drop overflow counterr transerr size switch_us filtered\n");
+	// 表示中にカードが削除されないようdevice_lockを持つ
+	mutex_lock(&device_lock);
+	for(lp = 0 ; lp < MAX_PCI_DEVICE ; lp++){
+		if(device[lp] == NULL){
+			continue ;
+		}
+		for(lp2 = 0 ; lp2 < MAX_CHANNEL ; lp2++){
+			channel = device[lp]->channel[lp2] ;
+			if(channel == NULL){
+				continue ;
+			}
+			if((channel->valid == TRUE) &&
+			   time_after_eq(jiffies, channel->signal_jiffies + msecs_to_jiffies(signal_interval)) &&
+			   mutex_trylock(&channel->tuner_lock)){
+				read_signal(channel);
+				mutex_unlock(&channel->tuner_lock);
+			}
+			seq_printf(m, "%d %u %c %d %d %u %u %u %u %u %u %u %u\n",
+					   device[lp]->card_number, channel->minor,
+					   (channel->type == CHANNEL_TYPE_ISDB_S) ? 'S' : 'T',
+					   (channel->valid == TRUE), channel->locked,
+					   channel->signal, channel->drop, channel->overflow,
+					   channel->counetererr, channel->transerr, channel->size,
+					   channel->stat.switch_us, channel->filtered);
+		}
+	}
+	mutex_unlock(&device_lock);
+	return 0 ;
+}
+static	int		pt1_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pt1_proc_show, NULL);
+}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+static const struct proc_ops pt1_proc_fops = {
+	.proc_open		= pt1_proc_open,
+	.proc_read		= seq_read,
+	.proc_lseek		= seq_lseek,
+	.proc_release	= single_release,
+};
+#else
+static const struct file_operations pt1_proc_fops = {
+	.owner		= THIS_MODULE,
+	.open		= pt1_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
 static struct pci_driver pt1_driver = {
 	.name		= DRV_NAME,
 	.probe		= pt1_pci_init_one,
@@ -1018,12 +1338,17 @@ static int __init pt1_pci_init(void)
 	pt1video_class = class_create(THIS_MODULE, DRIVERNAME);
 	if (IS_ERR(pt1video_class))
 		return PTR_ERR(pt1video_class);
+	// /procは参照用なので、作れなくてもドライバは動かす
+	if(proc_create(PROC_NAME, 0444, NULL, &pt1_proc_fops) == NULL){
+		printk(KERN_WARNING "PT1:cannot create /proc/%s\n", PROC_NAME);
+	}
 	return pci_register_driver(&pt1_driver);
 }
 
 
 static void __exit pt1_pci_cleanup(void)
 {
+	remove_proc_entry(PROC_NAME, NULL);
 	pci_unregister_driver(&pt1_driver);
 	class_destroy(pt1video_class);
 }
@@ -8,6 +8,8 @@
 #include <linux/interrupt.h>
 #include <linux/mutex.h>
 #include <linux/version.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,4,0)
 #include <asm/system.h>
@@ -22,6 +24,27 @@
 #include	"pt1_tuner.h"
 #include	"pt1_tuner_data.h"
 
+// ロック待ちのタイムアウト(ms)
+static	int		pll_timeout = 500;
+static	int		tmcc_timeout = 1500;
+static	int		tslock_timeout = 500;
+static	int		tsid_timeout = 500;
+static	int		wake_timeout = 100;
+static	int		wake_settle = 100;
+
+module_param(pll_timeout, int, 0644);
+module_param(tmcc_timeout, int, 0644);
+module_param(tslock_timeout, int, 0644);
+module_param(tsid_timeout, int, 0644);
+module_param(wake_timeout, int, 0644);
+module_param(wake_settle, int, 0644);
+MODULE_PARM_DESC(pll_timeout, "PLL lock timeout in ms");
+MODULE_PARM_DESC(tmcc_timeout, "TMCC/sync timeout in ms");
+MODULE_PARM_DESC(tslock_timeout, "TS-ID lock timeout in ms");
+MODULE_PARM_DESC(tsid_timeout, "TS-ID list timeout in ms, all pairs together");
+MODULE_PARM_DESC(wake_timeout, "tuner wakeup confirm timeout in ms");
+MODULE_PARM_DESC(wake_settle, "tuner settle time after wakeup in ms");
+
 typedef	struct	_TUNER_INFO{
 	int		isdb_s ;
 	int		isdb_t ;
@@ -50,6 +73,33 @@ isdb_t_freq_add_table	isdb_t_freq_add[10] = {
 	{112, 0x80E4}				// 101〜112迄
 };
 
+// ロック待ち所要時間を記録する
+static	void	tune_stat_add(TUNE_STAT *stat, int phase, ktime_t start, int locked)
+{
+	__u32	us = (__u32)ktime_us_delta(ktime_get(), start);
+	__u32	ms = us / 1000 ;
+	int		pos = 0 ;
+
+	if(stat == NULL){
+		return ;
+	}
+	if(!locked){
+		stat->timeout[phase] += 1 ;
+		printk(KERN_INFO "PT1:phase %d timeout after %uus\n", phase, us);
+		return ;
+	}
+	while(ms && (pos < (TUNE_HIST_SIZE - 1))){
+		ms >>= 1 ;
+		pos += 1 ;
+	}
+	stat->count[phase] += 1 ;
+	stat->last_us[phase] = us ;
+	if(stat->max_us[phase] < us){
+		stat->max_us[phase] = us ;
+	}
+	stat->hist[phase][pos] += 1 ;
+}
+
 void	settuner_reset(void __iomem *regs, int cardtype, __u32 lnb, __u32 tuner)
 {
 	__u32	val = TUNER_POWER_OFF;
@@ -99,7 +149,6 @@ static	int		init_isdb_s(void __iomem *regs, int cardtype, struct mutex *lock, __
 {
 
 	WBLOCK	wk;
-	int		lp ;
 	__u32	val ;
 
 	// ISDB-S/T初期化
@@ -108,53 +157,37 @@ static	int		init_isdb_s(void __iomem *regs, int cardtype, struct mutex *lock, __
 	// 初期化１(なぜかREADなので)
 	memcpy(&wk, &isdb_s_init1, sizeof(WBLOCK));
 	wk.addr = addr;
-	val = i2c_read(regs, lock, &wk, 1);
+	if(i2c_read(regs, lock, &wk, 1, &val) < 0){
+		return -EIO ;
+	}
 
 	if(cardtype == PT1) {
 		if((val & 0xff) != 0x4c) {
 			printk(KERN_INFO "PT1:ISDB-S Read(%x)\n", val);
 			return -EIO ;
 		}
-		for(lp = 0 ; lp < PT1_MAX_ISDB_S_INIT ; lp++) {
-			memcpy(&wk, isdb_s_initial_pt1[lp], sizeof(WBLOCK));
-			wk.addr = addr;
-			i2c_write(regs, lock, &wk);
-		}
+		return i2c_write_blocks(regs, lock, addr, isdb_s_initial_pt1, PT1_MAX_ISDB_S_INIT);
 	}
 	else if(cardtype == PT2) {
 		if((val & 0xff) != 0x52) {
 			printk(KERN_INFO "PT2:ISDB-S Read(%x)\n", val);
 			return -EIO ;
 		}
-		for(lp = 0 ; lp < PT2_MAX_ISDB_S_INIT ; lp++) {
-			memcpy(&wk, isdb_s_initial_pt2[lp], sizeof(WBLOCK));
-			wk.addr = addr;
-			i2c_write(regs, lock, &wk);
-		}
+		return i2c_write_blocks(regs, lock, addr, isdb_s_initial_pt2, PT2_MAX_ISDB_S_INIT);
 	}
 
 	return 0 ;
 }
-static	void	init_isdb_t(void __iomem *regs, int cardtype, struct mutex *lock, __u32 addr)
+static	int		init_isdb_t(void __iomem *regs, int cardtype, struct mutex *lock, __u32 addr)
 {
-	int		lp ;
-	WBLOCK	wk;
-
 	// ISDB-S/T初期化
 	if(cardtype == PT1) {
-		for(lp = 0 ; lp < PT1_MAX_ISDB_T_INIT ; lp++){
-			memcpy(&wk, isdb_t_initial_pt1[lp], sizeof(WBLOCK));
-			wk.addr = addr;
-			i2c_write(regs, lock, &wk);
-		}
+		return i2c_write_blocks(regs, lock, addr, isdb_t_initial_pt1, PT1_MAX_ISDB_T_INIT);
 	}
 	else if(cardtype == PT2) {
-		for(lp = 0 ; lp < PT2_MAX_ISDB_T_INIT ; lp++){
-			memcpy(&wk, isdb_t_initial_pt2[lp], sizeof(WBLOCK));
-			wk.addr = addr;
-			i2c_write(regs, lock, &wk);
-		}
+		return i2c_write_blocks(regs, lock, addr, isdb_t_initial_pt2, PT2_MAX_ISDB_T_INIT);
 	}
+	return 0 ;
 }
 
 int		tuner_init(void __iomem *regs, int cardtype, struct mutex *lock, int tuner_no)
@@ -168,51 +201,53 @@ int		tuner_init(void __iomem *regs, int cardtype, struct mutex *lock, int tuner_
 
 	// 初期化(共通)
 	wk.addr = tuner_info[tuner_no].isdb_t ;
-	i2c_write(regs, lock, &wk);
+	if(i2c_write(regs, lock, &wk) < 0){
+		return -EIO ;
+	}
 	wk.addr = tuner_info[tuner_no].isdb_s ;
-	i2c_write(regs, lock, &wk);
+	if(i2c_write(regs, lock, &wk) < 0){
+		return -EIO ;
+	}
 
 	rc = init_isdb_s(regs, cardtype, lock, tuner_info[tuner_no].isdb_s);
 	if(rc < 0){
 		return rc ;
 	}
-	init_isdb_t(regs, cardtype, lock, tuner_info[tuner_no].isdb_t);
+	rc = init_isdb_t(regs, cardtype, lock, tuner_info[tuner_no].isdb_t);
+	if(rc < 0){
+		return rc ;
+	}
 
 	memcpy(&wk, &isdb_s_init21, sizeof(WBLOCK));
 	wk.addr = tuner_info[tuner_no].isdb_s ;
-	i2c_write(regs, lock, &wk);
+	if(i2c_write(regs, lock, &wk) < 0){
+		return -EIO ;
+	}
 
 	memcpy(&wk, &isdb_t_init17, sizeof(WBLOCK));
 	wk.addr = tuner_info[tuner_no].isdb_t ;
-	i2c_write(regs, lock, &wk);
+	if(i2c_write(regs, lock, &wk) < 0){
+		return -EIO ;
+	}
 
 	return 0 ;
 }
-void	set_sleepmode(void __iomem *regs, struct mutex *lock, int address, int tuner_type, int type)
+int		set_sleepmode(void __iomem *regs, struct mutex *lock, int address, int tuner_type, int type)
 {
+	int		rc = 0 ;
 	WBLOCK	wk;
+	WBLOCK	*isdb_s_wakeup[] = {&isdb_s_wake, &isdb_s_wake2};
+	WBLOCK	*isdb_t_wakeup[] = {&isdb_t_wake, &isdb_t_wake2};
 
 	if(type == TYPE_WAKEUP){
 		switch(tuner_type){
 		case CHANNEL_TYPE_ISDB_S:
 			printk(KERN_INFO "PT1:ISDB-S Wakeup\n");
-			memcpy(&wk, &isdb_s_wake, sizeof(WBLOCK));
-			wk.addr = address;
-			i2c_write(regs, lock, &wk);
-
-			memcpy(&wk, &isdb_s_wake2, sizeof(WBLOCK));
-			wk.addr = address;
-			i2c_write(regs, lock, &wk);
+			rc = i2c_write_blocks(regs, lock, address, isdb_s_wakeup, 2);
 			break ;
 		case CHANNEL_TYPE_ISDB_T:
 			printk(KERN_INFO "PT1:ISDB-T Wakeup\n");
-			memcpy(&wk, &isdb_t_wake, sizeof(WBLOCK));
-			wk.addr = address;
-			i2c_write(regs, lock, &wk);
-
-			memcpy(&wk, &isdb_t_wake2, sizeof(WBLOCK));
-			wk.addr = address;
-			i2c_write(regs, lock, &wk);
+			rc = i2c_write_blocks(regs, lock, address, isdb_t_wakeup, 2);
 			break ;
 		}
 	}
@@ -222,46 +257,93 @@ void	set_sleepmode(void __iomem *regs, struct mutex *lock, int address, int tune
 			printk(KERN_INFO "PT1:ISDB-S Sleep\n");
 			memcpy(&wk, &isdb_s_sleep, sizeof(WBLOCK));
 			wk.addr = address;
-			i2c_write(regs, lock, &wk);
+			rc = i2c_write(regs, lock, &wk);
 			break ;
 		case CHANNEL_TYPE_ISDB_T:
 			printk(KERN_INFO "PT1:ISDB-T Sleep\n");
 			memcpy(&wk, &isdb_t_sleep, sizeof(WBLOCK));
 			wk.addr = address;
-			i2c_write(regs, lock, &wk);
+			rc = i2c_write(regs, lock, &wk);
 			break ;
 		}
 	}
+	if(rc < 0){
+		printk(KERN_INFO "PT1:ERROR Sleepmode(%x:%d)\n", address, type);
+	}
+	return rc ;
 }
 
-int		bs_frequency(void __iomem *regs, struct mutex *lock, int addr, int channel)
+// 省電力解除の完了待ち
+// 省電力レジスタの読み戻しで分かるのは書き込みが届いたことだけで、
+// 復帰完了を示すステータスはないため、その後wake_settleだけ待つ
+int		wait_wakeup(void __iomem *regs, struct mutex *lock, int address, int tuner_type)
+{
+	WBLOCK	wk;
+	__u32	val ;
+	__u32	mask ;
+	unsigned long	deadline ;
+
+	switch(tuner_type){
+	case CHANNEL_TYPE_ISDB_S:
+		memcpy(&wk, &isdb_s_get_sleep, sizeof(WBLOCK));
+		mask = 0x01 ;
+		break ;
+	case CHANNEL_TYPE_ISDB_T:
+		memcpy(&wk, &isdb_t_get_sleep, sizeof(WBLOCK));
+		mask = 0x10 ;
+		break ;
+	default:
+		return -EINVAL ;
+	}
+	wk.addr = address;
+
+	deadline = jiffies + msecs_to_jiffies(wake_timeout);
+	do{
+		if(i2c_read(regs, lock, &wk, 1, &val) < 0){
+			return -EIO ;
+		}
+		if(!(val & mask)){
+			schedule_timeout_uninterruptible(msecs_to_jiffies(wake_settle));
+			return 0 ;
+		}
+		schedule_timeout_interruptible(msecs_to_jiffies(1));
+	}while(time_before(jiffies, deadline));
+	printk(KERN_INFO "PT1:ERROR Wakeup(%x:%x)\n", address, val);
+	return -EIO ;
+}
+int		bs_frequency(void __iomem *regs, struct mutex *lock, int addr, int channel, TUNE_STAT *stat)
 {
-	int		lp ;
 	int		tmcclock = FALSE ;
 	WBLOCK	wk;
 	__u32	val ;
+	unsigned long	deadline ;
+	ktime_t	start ;
 
 	if(channel >= MAX_BS_CHANNEL){
 		return -EIO ;
 	}
-	// ISDB-S PLLロック
-	for(lp = 0 ; lp < MAX_BS_CHANNEL_PLL_COMMAND ; lp++){
-		memcpy(&wk, bs_pll[channel].wblock[lp], sizeof(WBLOCK));
-		wk.addr = addr ;
-		i2c_write(regs, lock, &wk);
+	// ISDB-S PLLロック(PLLコマンドはまとめて送る)
+	if(i2c_write_blocks(regs, lock, addr, bs_pll[channel].wblock, MAX_BS_CHANNEL_PLL_COMMAND) < 0){
+		printk(KERN_INFO "PT1:ISDB-S PLL write NG\n");
+		return -EIO ;
 	}
 
 	// PLLロック確認
 	// チェック用
-	for(lp = 0 ; lp < 200 ; lp++){
+	start = ktime_get();
+	deadline = jiffies + msecs_to_jiffies(pll_timeout);
+	do{
 		memcpy(&wk, &bs_pll_lock, sizeof(WBLOCK));
 		wk.addr = addr;
-		val = i2c_read(regs, lock, &wk, 1);
+		if(i2c_read(regs, lock, &wk, 1, &val) < 0){
+			return -EIO ;
+		}
 		if(((val & 0xFF) != 0) && ((val & 0XFF) != 0XFF)){
 			tmcclock = TRUE ;
 			break ;
 		}
-	}
+	}while(time_before(jiffies, deadline));
+	tune_stat_add(stat, TUNE_PHASE_PLL, start, tmcclock);
 
 	if(tmcclock == FALSE){
 		printk(KERN_INFO "PLL LOCK ERROR\n");
@@ -270,20 +352,27 @@ int		bs_frequency(void __iomem *regs, struct mutex *lock, int addr, int channel)
 
 	memcpy(&wk, &bs_tmcc_get_1, sizeof(WBLOCK));
 	wk.addr = addr;
-	i2c_write(regs, lock, &wk);
+	if(i2c_write(regs, lock, &wk) < 0){
+		return -EIO ;
+	}
 
 	tmcclock = FALSE ;
 
-	for(lp = 0 ; lp < 200 ; lp++){
+	start = ktime_get();
+	deadline = jiffies + msecs_to_jiffies(tmcc_timeout);
+	do{
 		memcpy(&wk, &bs_tmcc_get_2, sizeof(WBLOCK));
 		wk.addr = addr;
 
-		val = i2c_read(regs, lock, &wk, 1);
+		if(i2c_read(regs, lock, &wk, 1, &val) < 0){
+			return -EIO ;
+		}
 		if(((val & 0XFF) != 0XFF) && (!(val & 0x10))){
 			tmcclock = TRUE ;
 			break ;
 		}
-	}
+	}while(time_before(jiffies, deadline));
+	tune_stat_add(stat, TUNE_PHASE_TMCC, start, tmcclock);
 
 	if(tmcclock == FALSE){
 		printk(KERN_INFO "TMCC LOCK ERROR\n");
@@ -292,12 +381,13 @@ int		bs_frequency(void __iomem *regs, struct mutex *lock, int addr, int channel)
 
 	return 0 ;
 }
-int		ts_lock(void __iomem *regs, struct mutex *lock, int addr, __u16 ts_id)
+int		ts_lock(void __iomem *regs, struct mutex *lock, int addr, __u16 ts_id, TUNE_STAT *stat)
 {
 
-	int		lp ;
 	WBLOCK	wk;
 	__u32	val ;
+	unsigned long	deadline ;
+	ktime_t	start ;
 	union{
 		__u8	ts[2];
 		__u16	tsid;
@@ -309,26 +399,36 @@ int		ts_lock(void __iomem *regs, struct mutex *lock, int addr, __u16 ts_id)
 	// TS-ID設定
 	wk.value[1]  = uts_id.ts[1];
 	wk.value[2]  = uts_id.ts[0];
-	i2c_write(regs, lock, &wk);
+	if(i2c_write(regs, lock, &wk) < 0){
+		return -EIO ;
+	}
 
-	for(lp = 0 ; lp < 100 ; lp++){
+	start = ktime_get();
+	deadline = jiffies + msecs_to_jiffies(tslock_timeout);
+	do{
 		memcpy(&wk, &bs_get_ts_lock, sizeof(WBLOCK));
 		wk.addr = addr;
-		val = i2c_read(regs, lock, &wk, 2);
+		if(i2c_read(regs, lock, &wk, 2, &val) < 0){
+			return -EIO ;
+		}
 		if((val & 0xFFFF) == ts_id){
+			tune_stat_add(stat, TUNE_PHASE_TS_LOCK, start, TRUE);
 			return 0 ;
 		}
-	}
+	}while(time_before(jiffies, deadline));
+	tune_stat_add(stat, TUNE_PHASE_TS_LOCK, start, FALSE);
 	printk(KERN_INFO "PT1:ERROR TS-LOCK(%x)\n", ts_id);
 	return -EIO ;
 }
-int		bs_tune(void __iomem *regs, struct mutex *lock, int addr, int channel, ISDB_S_TMCC *tmcc)
+int		bs_tune(void __iomem *regs, struct mutex *lock, int addr, int channel, ISDB_S_TMCC *tmcc, TUNE_STAT *stat)
 {
 
 	int		lp ;
-	int		lp2;
+	int		tsidok ;
 	WBLOCK	wk;
 	__u32	val ;
+	unsigned long	deadline ;
+	ktime_t	start ;
 	ISDB_S_TS_ID	*tsid ;
 	union{
 		__u8	slot[4];
@@ -343,32 +443,44 @@ int		bs_tune(void __iomem *regs, struct mutex *lock, int addr, int channel, ISDB
 		printk(KERN_INFO "Invalid Channel(%d)\n", channel);
 		return -EIO ;
 	}
-	val = bs_frequency(regs, lock, addr, channel);
+	val = bs_frequency(regs, lock, addr, channel, stat);
 	if(val == -EIO){
 		return val ;
 	}
 
 	tsid = &tmcc->ts_id[0] ;
+	tsidok = TRUE ;
 	// 該当周波数のTS-IDを取得
+	// 期限は全ペアで共有し、過ぎた後のペアは1回だけ読む
+	start = ktime_get();
+	deadline = jiffies + msecs_to_jiffies(tsid_timeout);
 	for(lp = 0 ; lp < (MAX_BS_TS_ID / 2) ; lp++){
-		for(lp2 = 0 ; lp2 < 100 ; lp2++){
+		do{
 			memcpy(&wk, bs_get_ts_id[lp], sizeof(WBLOCK));
 			wk.addr = addr;
-			ts_id.tsid = i2c_read(regs, lock, &wk, 4);
+			if(i2c_read(regs, lock, &wk, 4, &ts_id.tsid) < 0){
+				return -EIO ;
+			}
 			// TS-IDが0の場合は再取得する
 			if((ts_id.ts[0] != 0) && (ts_id.ts[1] != 0)){
 				break ;
 			}
+		}while(time_before(jiffies, deadline));
+		if((ts_id.ts[0] == 0) || (ts_id.ts[1] == 0)){
+			tsidok = FALSE ;
 		}
 		tsid->ts_id = ts_id.ts[1] ;
 		tsid += 1;
 		tsid->ts_id = ts_id.ts[0] ;
 		tsid += 1;
 	}
+	tune_stat_add(stat, TUNE_PHASE_TS_ID, start, tsidok);
 
 	memcpy(&wk, &bs_get_agc, sizeof(WBLOCK));
 	wk.addr = addr;
-	tmcc->agc = i2c_read(regs, lock, &wk, 1);
+	if(i2c_read(regs, lock, &wk, 1, &tmcc->agc) < 0){
+		return -EIO ;
+	}
 
 	// TS-ID別の情報を取得
 	tsid = &tmcc->ts_id[0] ;
@@ -377,12 +489,14 @@ int		bs_tune(void __iomem *regs, struct mutex *lock, int addr, int channel, ISDB
 		if(tsid->ts_id == 0xFFFF){
 			continue ;
 		}
-		ts_lock(regs, lock, addr, tsid->ts_id);
+		ts_lock(regs, lock, addr, tsid->ts_id, stat);
 
 		//スロット取得
 		memcpy(&wk, &bs_get_slot, sizeof(WBLOCK));
 		wk.addr = addr;
-		ts_slot.u32slot = i2c_read(regs, lock, &wk, 3);
+		if(i2c_read(regs, lock, &wk, 3, &ts_slot.u32slot) < 0){
+			return -EIO ;
+		}
 		tsid->high_mode = 0;
 		tsid->low_slot  = ts_slot.slot[0] ;
 		tsid->high_slot = ts_slot.slot[1] ;
@@ -391,11 +505,15 @@ int		bs_tune(void __iomem *regs, struct mutex *lock, int addr, int channel, ISDB
 
 	memcpy(&wk, &bs_get_clock, sizeof(WBLOCK));
 	wk.addr = addr;
-	tmcc->clockmargin = i2c_read(regs, lock, &wk, 1);
+	if(i2c_read(regs, lock, &wk, 1, &tmcc->clockmargin) < 0){
+		return -EIO ;
+	}
 
 	memcpy(&wk, &bs_get_carrir, sizeof(WBLOCK));
 	wk.addr = addr;
-	tmcc->carriermargin = i2c_read(regs, lock, &wk, 1);
+	if(i2c_read(regs, lock, &wk, 1, &tmcc->carriermargin) < 0){
+		return -EIO ;
+	}
 	return 0 ;
 }
 int		isdb_s_read_signal_strength(void __iomem *regs, struct mutex *lock, int addr)
@@ -407,11 +525,15 @@ int		isdb_s_read_signal_strength(void __iomem *regs, struct mutex *lock, int add
 
 	memcpy(&wk, &bs_get_signal1, sizeof(WBLOCK));
 	wk.addr = addr;
-	val = i2c_read(regs, lock, &wk, 1);
+	if(i2c_read(regs, lock, &wk, 1, &val) < 0){
+		return -EIO ;
+	}
 
 	memcpy(&wk, &bs_get_signal2, sizeof(WBLOCK));
 	wk.addr = addr;
-	val2 = i2c_read(regs, lock, &wk, 1);
+	if(i2c_read(regs, lock, &wk, 1, &val2) < 0){
+		return -EIO ;
+	}
 	val3 = (((val << 8) & 0XFF00) | (val2 & 0XFF));
 
 	return val3 ;
@@ -448,13 +570,14 @@ __u32	getfrequency(__u32 channel, int addfreq)
 	return frequencyOffset + 400;
 
 }
-int		isdb_t_frequency(void __iomem *regs, struct mutex *lock, int addr, int channel, int addfreq)
+int		isdb_t_frequency(void __iomem *regs, struct mutex *lock, int addr, int channel, int addfreq, TUNE_STAT *stat)
 {
 
-	int		lp ;
 	WBLOCK	wk;
 	__u32	val ;
 	int		tmcclock = FALSE ;
+	unsigned long	deadline ;
+	ktime_t	start ;
 	union{
 		__u8	charfreq[2];
 		__u16	freq;
@@ -481,17 +604,24 @@ int		isdb_t_frequency(void __iomem *regs, struct mutex *lock, int addr, int chan
 	wk.value[wk.count] = freq[1].charfreq[0];
 	wk.count += 1 ;
 
-	i2c_write(regs, lock, &wk);
+	if(i2c_write(regs, lock, &wk) < 0){
+		return -EIO ;
+	}
 
-	for(lp = 0 ; lp < 100 ; lp++){
+	start = ktime_get();
+	deadline = jiffies + msecs_to_jiffies(pll_timeout);
+	do{
 		memcpy(&wk, &isdb_t_pll_lock, sizeof(WBLOCK));
 		wk.addr = addr;
-		val = i2c_read(regs, lock, &wk, 1);
+		if(i2c_read(regs, lock, &wk, 1, &val) < 0){
+			return -EIO ;
+		}
 		if(((val & 0xFF) != 0XFF) && ((val & 0X50) == 0x50)){
 			tmcclock = TRUE ;
 			break ;
 		}
-	}
+	}while(time_before(jiffies, deadline));
+	tune_stat_add(stat, TUNE_PHASE_PLL, start, tmcclock);
 	if(tmcclock != TRUE){
 		printk(KERN_INFO "PT1:ISDB-T LOCK NG(%08x)\n", val);
 		return -EIO ;
@@ -499,18 +629,25 @@ int		isdb_t_frequency(void __iomem *regs, struct mutex *lock, int addr, int chan
 
 	memcpy(&wk, &isdb_t_check_tune, sizeof(WBLOCK));
 	wk.addr = addr ;
-	i2c_write(regs, lock, &wk);
+	if(i2c_write(regs, lock, &wk) < 0){
+		return -EIO ;
+	}
 
 	tmcclock = FALSE ;
-	for(lp = 0 ; lp < 1000 ; lp++){
+	start = ktime_get();
+	deadline = jiffies + msecs_to_jiffies(tmcc_timeout);
+	do{
 		memcpy(&wk, &isdb_t_tune_read, sizeof(WBLOCK));
 		wk.addr = addr;
-		val = i2c_read(regs, lock, &wk, 1);
+		if(i2c_read(regs, lock, &wk, 1, &val) < 0){
+			return -EIO ;
+		}
 		if(((val & 0xFF) != 0XFF) && ((val & 0X8) != 8)){
 			tmcclock = TRUE ;
 			break ;
 		}
-	}
+	}while(time_before(jiffies, deadline));
+	tune_stat_add(stat, TUNE_PHASE_TMCC, start, tmcclock);
 	if(tmcclock != TRUE){
 		return -EIO ;
 	}
@@ -525,12 +662,16 @@ int		isdb_t_read_signal_strength(void __iomem *regs, struct mutex *lock, int add
 
 	memcpy(&wk, &isdb_t_signal1, sizeof(WBLOCK));
 	wk.addr = addr;
-	val = i2c_read(regs, lock, &wk, 1);
-	printk(KERN_INFO "CN(1)Val(%x)\n", val);
+	if(i2c_read(regs, lock, &wk, 1, &val) < 0){
+		return -EIO ;
+	}
+	pr_debug("CN(1)Val(%x)\n", val);
 
 	memcpy(&wk, &isdb_t_signal2, sizeof(WBLOCK));
 	wk.addr = addr;
-	val2 = i2c_read(regs, lock, &wk, 1);
+	if(i2c_read(regs, lock, &wk, 1, &val2) < 0){
+		return -EIO ;
+	}
 	val3 = (((val << 8) & 0XFF00) | (val2 & 0XFF));
 	return val3 ;
 }
@@ -575,7 +716,7 @@ int		isdb_t_tune(void __iomem *regs, struct mutex *lock, int addr, int channel,
 	memcpy(&wk, &isdb_t_cn_1, sizeof(WBLOCK));
 	wk.addr = addr;
 	val = i2c_read(regs, lock, &wk, 1);
-	printk(KERN_INFO "CN(1)Val(%x)\n", val);
+	pr_debug("CN(1)Val(%x)\n", val);
 
 	memcpy(&wk, &isdb_t_cn_2, sizeof(WBLOCK));
 	wk.addr = addr;
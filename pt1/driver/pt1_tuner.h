@@ -1,5 +1,6 @@
 #ifndef		__PT1_TUNER_H__
 #define		__PT1_TUNER_H__
+#include	"pt1_ioctl.h"
 /***************************************************************************/
 /* チューナ状態定義                                                        */
 /***************************************************************************/
@@ -111,13 +112,14 @@ typedef	struct	_ISDB_T_TMCC {
 /***************************************************************************/
 extern	void	settuner_reset(void __iomem *, int, __u32, __u32);
 extern	int		tuner_init(void __iomem *, int, struct mutex *, int);
-extern	void	set_sleepmode(void __iomem *, struct mutex *, int, int, int);
+extern	int		set_sleepmode(void __iomem *, struct mutex *, int, int, int);
+extern	int		wait_wakeup(void __iomem *, struct mutex *, int, int);
 
-extern	int		bs_tune(void __iomem *, struct mutex *, int, int, ISDB_S_TMCC *);
-extern  int     ts_lock(void __iomem *, struct mutex *, int, __u16);
+extern	int		bs_tune(void __iomem *, struct mutex *, int, int, ISDB_S_TMCC *, TUNE_STAT *);
+extern  int     ts_lock(void __iomem *, struct mutex *, int, __u16, TUNE_STAT *);
 
 extern	int		isdb_t_tune(void __iomem *, struct mutex *, int, int, ISDB_T_TMCC *);
-extern	int		isdb_t_frequency(void __iomem *, struct mutex *, int, int, int);
+extern	int		isdb_t_frequency(void __iomem *, struct mutex *, int, int, int, TUNE_STAT *);
 extern	int		isdb_s_read_signal_strength(void __iomem *, struct mutex *, int);
 extern	int		isdb_t_read_signal_strength(void __iomem *, struct mutex *, int);
 
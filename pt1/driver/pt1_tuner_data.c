@@ -46,6 +46,11 @@ WBLOCK	isdb_s_wake2 = {
 	2,
 	{0x17, 0x00}
 };
+WBLOCK	isdb_s_get_sleep = {
+	0,
+	1,
+	{0x17}
+};
 
 /*
 ISDB-T省電力
@@ -70,6 +75,11 @@ WBLOCK	isdb_t_wake2 = {
 	2,
 	{0x03, 0x80}
 };
+WBLOCK	isdb_t_get_sleep = {
+	0,
+	1,
+	{0x03}
+};
 
 /***************************************************************************/
 /* 初期化データ定義(共通)                                                  */
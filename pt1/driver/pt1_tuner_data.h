@@ -76,6 +76,8 @@ extern	WBLOCK	isdb_t_wake2;
 
 extern	WBLOCK	isdb_s_sleep;
 extern	WBLOCK	isdb_t_sleep;
+extern	WBLOCK	isdb_s_get_sleep;
+extern	WBLOCK	isdb_t_get_sleep;
 
 extern	ISDB_S_CH_TABLE	isdb_t_table[11];
 
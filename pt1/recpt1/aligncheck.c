@@ -0,0 +1,362 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * aligncheck: packet alignment of the block writers across block
+ * boundaries.  A synthetic stream (PAT, a PMT on PMT_PID, MPEG-2 video
+ * on VIDEO_PID with random_access_indicator every RAP_EVERY packets) is
+ * fed in blocks that split packets at every awkward place.  Each video
+ * payload holds one stray sync byte, never at the same place in two
+ * packets in a row, so a writer that resyncs on a bare 0x47 after a
+ * split is caught.  The indexed stream starts with JUNK bytes to be
+ * synced past.
+ *
+ *   index    every tsindex entry points at a packet start
+ *   rap      the scanner (reading the PAT and PMT itself) finds every
+ *            RAP packet not split by a block and nothing else,
+ *            rapscan_sync() is a packet start after every block, and
+ *            index entries given the scan sit on its first RAP
+ *   segment  1 MB segments cut on RAPs: whole packets, each segment
+ *            after the first starts with the PAT, the PMT and a RAP,
+ *            and sync_offset is a packet start after every block
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tsindex.h"
+#include "segment.h"
+
+#define TS_PACKET_SIZE  188
+#define TS_SYNC         0x47
+#define PACKETS         20000
+#define JUNK            100
+#define PMT_PID         0x1f0
+#define VIDEO_PID       0x100
+#define RAP_EVERY       100
+#define RAP_PACKET      2       /* within each RAP_EVERY */
+#define INDEX_FILE      "aligntest.tsidx"
+#define SEGMENT_FILE    "aligntest-%d.ts"
+#define SEGMENT_MB      1
+
+/* after the first, cycled; every split of a packet against a block */
+static const size_t block_sizes[] = {
+    1, 187, 188, 189, 376, 95, 4093, 6000, 2, 65536, 188 * 7 + 1, 1000
+};
+
+typedef struct stream {
+    uint8_t *data;
+    size_t len;
+    uint8_t *is_start;      /* by offset, 1 at each packet's sync byte */
+} stream;
+
+static void
+make_packet(uint8_t *p, int n)
+{
+    int cc = n & 0x0f, i, pos;
+
+    memset(p, 0xff, TS_PACKET_SIZE);
+    p[0] = TS_SYNC;
+    switch(n % RAP_EVERY) {
+    case 0:     /* PAT: program 1 on PMT_PID */
+        p[1] = 0x40;
+        p[2] = 0x00;
+        p[3] = 0x10 | cc;
+        p[4] = 0x00;
+        p[5] = 0x00;
+        p[6] = 0xb0;
+        p[7] = 13;
+        p[8] = 0x00; p[9] = 0x01; p[10] = 0xc1; p[11] = 0x00; p[12] = 0x00;
+        p[13] = 0x00; p[14] = 0x01;
+        p[15] = 0xe0 | (PMT_PID >> 8); p[16] = PMT_PID & 0xff;
+        return;
+    case 1:     /* PMT: one MPEG-2 video ES, also the PCR PID */
+        p[1] = 0x40 | (PMT_PID >> 8);
+        p[2] = PMT_PID & 0xff;
+        p[3] = 0x10 | cc;
+        p[4] = 0x00;
+        p[5] = 0x02;
+        p[6] = 0xb0;
+        p[7] = 18;
+        p[8] = 0x00; p[9] = 0x01; p[10] = 0xc1; p[11] = 0x00; p[12] = 0x00;
+        p[13] = 0xe0 | (VIDEO_PID >> 8); p[14] = VIDEO_PID & 0xff;
+        p[15] = 0xf0; p[16] = 0x00;
+        p[17] = 0x02;
+        p[18] = 0xe0 | (VIDEO_PID >> 8); p[19] = VIDEO_PID & 0xff;
+        p[20] = 0xf0; p[21] = 0x00;
+        return;
+    }
+    p[1] = VIDEO_PID >> 8;
+    p[2] = VIDEO_PID & 0xff;
+    pos = 4;
+    if(n % RAP_EVERY == RAP_PACKET) {
+        p[3] = 0x30 | cc;
+        p[4] = 7;
+        p[5] = 0x40;    /* random_access_indicator */
+        pos = 12;
+    }
+    else
+        p[3] = 0x10 | cc;
+    for(i = pos; i < TS_PACKET_SIZE; i++)
+        p[i] = (uint8_t)(n * 13 + i) == TS_SYNC ? 0 : (uint8_t)(n * 13 + i);
+    p[12 + n * 37 % (TS_PACKET_SIZE - 12)] = TS_SYNC;
+}
+
+static int
+make_stream(stream *s, size_t junk)
+{
+    size_t i;
+
+    s->len = junk + (size_t)PACKETS * TS_PACKET_SIZE;
+    s->data = malloc(s->len);
+    s->is_start = calloc(s->len + 1, 1);
+    if(!s->data || !s->is_start)
+        return -1;
+    for(i = 0; i < junk; i++)
+        s->data[i] = (uint8_t)i == TS_SYNC ? 0 : (uint8_t)i;
+    for(i = 0; i < PACKETS; i++) {
+        make_packet(s->data + junk + i * TS_PACKET_SIZE, i);
+        s->is_start[junk + i * TS_PACKET_SIZE] = 1;
+    }
+    s->is_start[s->len] = 1;    /* the boundary after the last packet */
+    return 0;
+}
+
+/* the next block: the first one takes the junk and a few packets */
+static size_t
+next_block(const stream *s, size_t offset, int n)
+{
+    size_t len = n ? block_sizes[(n - 1) % (sizeof(block_sizes) /
+                                            sizeof(block_sizes[0]))] :
+        JUNK + 4 * TS_PACKET_SIZE + 7;
+
+    return len < s->len - offset ? len : s->len - offset;
+}
+
+static int
+check_index(const stream *s)
+{
+    const tsindex_header *hdr;
+    const tsindex_entry *ent;
+    tsindex *ix;
+    size_t offset, len, count, map_size, i;
+    int n, blocks = 0, errors = 0;
+
+    ix = tsindex_create(INDEX_FILE, 1);
+    if(!ix)
+        return 1;
+    for(offset = 0, n = 0; offset < s->len; offset += len, n++) {
+        len = next_block(s, offset, n);
+        ix->scan.next_ns = 0;   /* an entry from every block */
+        if(tsindex_add(ix, s->data + offset, len, NULL) < 0) {
+            perror(INDEX_FILE);
+            errors++;
+        }
+        blocks++;
+    }
+    tsindex_close(ix);
+
+    ent = tsindex_map(INDEX_FILE, &count, &hdr, &map_size);
+    if(!ent) {
+        perror(INDEX_FILE);
+        return 1;
+    }
+    for(i = 0; i < count; i++) {
+        if(ent[i].offset >= s->len || !s->is_start[ent[i].offset]) {
+            if(!errors)
+                printf("index: entry %zu at %llu is not a packet start\n", i,
+                       (unsigned long long)ent[i].offset);
+            errors++;
+        }
+    }
+    printf("index: %d blocks, %zu entries, %d misplaced\n", blocks, count,
+           errors);
+    munmap((void *)hdr, map_size);
+    unlink(INDEX_FILE);
+    return errors || count < (size_t)blocks / 2;
+}
+
+static int
+is_rap(const stream *s, uint64_t offset)
+{
+    size_t junk = s->len - (size_t)PACKETS * TS_PACKET_SIZE;
+
+    return offset < s->len && s->is_start[offset] && offset >= junk &&
+        (offset - junk) / TS_PACKET_SIZE % RAP_EVERY == RAP_PACKET;
+}
+
+static int
+check_raps(const stream *s)
+{
+    tsindex_scan sc;
+    tsindex_entry ent;
+    rapscan *rs;
+    size_t junk = s->len - (size_t)PACKETS * TS_PACKET_SIZE;
+    size_t offset, len, p;
+    uint64_t want = 0, sync;
+    int n, k, entries = 0, errors = 0;
+
+    rs = rapscan_create(NULL);
+    if(!rs)
+        return 1;
+    tsindex_scan_init(&sc, 1);
+    for(offset = 0, n = 0; offset < s->len; offset += len, n++) {
+        len = next_block(s, offset, n);
+        rapscan_chunk(rs, s->data + offset, len);
+
+        /* RAP packets lying whole in this block */
+        p = offset <= junk ? junk : junk + (offset - junk + TS_PACKET_SIZE - 1) /
+            TS_PACKET_SIZE * TS_PACKET_SIZE;
+        for(; p + TS_PACKET_SIZE <= offset + len; p += TS_PACKET_SIZE)
+            want += is_rap(s, p);
+        for(k = 0; k < rs->count; k++) {
+            if(!is_rap(s, offset + rs->rap[k])) {
+                printf("rap: block %d: %llu is not a RAP packet\n", n,
+                       (unsigned long long)(offset + rs->rap[k]));
+                errors++;
+            }
+        }
+        sync = rapscan_sync(rs);
+        if(sync > s->len || !s->is_start[sync]) {
+            if(!errors)
+                printf("rap: rapscan_sync %llu after block %d is not a "
+                       "packet start\n", (unsigned long long)sync, n);
+            errors++;
+        }
+
+        sc.next_ns = 0;
+        if(tsindex_scan_chunk(&sc, offset, s->data + offset, len, rs, &ent)) {
+            entries++;
+            if(rs->count > 0 ? !is_rap(s, ent.offset) :
+               ent.offset >= s->len || !s->is_start[ent.offset]) {
+                printf("rap: index entry at %llu is misplaced\n",
+                       (unsigned long long)ent.offset);
+                errors++;
+            }
+        }
+    }
+    if(rs->total != want) {
+        printf("rap: %llu RAPs found, want %llu\n",
+               (unsigned long long)rs->total, (unsigned long long)want);
+        errors++;
+    }
+    printf("rap: %d blocks, %llu RAPs, %d index entries, %d errors\n", n,
+           (unsigned long long)rs->total, entries, errors);
+    rapscan_destroy(rs);
+    return errors || want == 0;
+}
+
+static int
+packet_pid(const uint8_t *p)
+{
+    return ((p[1] & 0x1f) << 8) | p[2];
+}
+
+/* whole synced packets; after the first, PAT, PMT, then the RAP cut on */
+static int
+check_segment_file(const char *path, int number, size_t *size)
+{
+    uint8_t pk[TS_PACKET_SIZE], head[3][TS_PACKET_SIZE];
+    struct stat st;
+    FILE *fp;
+    size_t n = 0;
+    int errors = 0;
+
+    fp = fopen(path, "rb");
+    if(!fp)
+        return -1;
+    if(fstat(fileno(fp), &st) < 0 || st.st_size % TS_PACKET_SIZE) {
+        printf("segment: %s is not whole packets\n", path);
+        errors++;
+    }
+    *size = st.st_size;
+    while(fread(pk, 1, TS_PACKET_SIZE, fp) == TS_PACKET_SIZE) {
+        if(pk[0] != TS_SYNC) {
+            printf("segment: %s: packet %zu without sync\n", path, n);
+            errors++;
+            break;
+        }
+        if(n < 3)
+            memcpy(head[n], pk, TS_PACKET_SIZE);
+        n++;
+    }
+    fclose(fp);
+    if(number > 0 && !errors &&
+       (n < 3 || packet_pid(head[0]) != 0 || packet_pid(head[1]) != PMT_PID ||
+        packet_pid(head[2]) != VIDEO_PID || !(head[2][3] & 0x20) ||
+        !(head[2][5] & 0x40))) {
+        printf("segment: %s does not start with PAT, PMT and a RAP\n", path);
+        errors++;
+    }
+    return errors;
+}
+
+static int
+check_segments(const stream *s)
+{
+    char path[64];
+    segmenter *seg;
+    rapscan *rs;
+    size_t offset, len, size, total = 0;
+    int n, number, r, errors = 0;
+
+    seg = segment_open(SEGMENT_FILE, 0, SEGMENT_MB, 1, NULL);
+    rs = rapscan_create(NULL);
+    if(!seg || !rs)
+        return 1;
+    for(offset = 0, n = 0; offset < s->len; offset += len, n++) {
+        len = next_block(s, offset, n);
+        rapscan_chunk(rs, s->data + offset, len);
+        if(segment_write(seg, s->data + offset, len, rs) < 0) {
+            perror("segment_write");
+            errors++;
+            break;
+        }
+        if(seg->sync_offset > s->len || !s->is_start[seg->sync_offset]) {
+            if(!errors)
+                printf("segment: sync_offset %llu after block %d is not a "
+                       "packet start\n", (unsigned long long)seg->sync_offset,
+                       n);
+            errors++;
+        }
+    }
+    segment_close(seg);
+    rapscan_destroy(rs);
+
+    for(number = 0; ; number++) {
+        snprintf(path, sizeof(path), SEGMENT_FILE, number);
+        r = check_segment_file(path, number, &size);
+        if(r < 0)
+            break;
+        errors += r;
+        total += size;
+        unlink(path);
+    }
+    /* the stream, and a PAT and a PMT ahead of every cut */
+    if(total != s->len + (number - 1) * 2 * TS_PACKET_SIZE) {
+        printf("segment: %zu bytes written for %zu\n", total, s->len);
+        errors++;
+    }
+    printf("segment: %d blocks, %d segments, %d errors\n", n, number,
+           errors);
+    return errors || number < 3;
+}
+
+int
+main(void)
+{
+    stream junked, clean;
+    int errors = 0;
+
+    if(make_stream(&junked, JUNK) < 0 || make_stream(&clean, 0) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    errors += check_index(&junked);
+    errors += check_raps(&junked);
+    errors += check_segments(&clean);
+    printf("%s\n", errors ? "FAIL" : "ok");
+    return errors ? 1 : 0;
+}
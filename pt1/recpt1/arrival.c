@@ -0,0 +1,222 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arrival.h"
+
+#define TS_PACKET_SIZE  188
+#define INITIAL_SIZE    (1 << 16)
+#define MAX_SIZE        (1 << 22)   /* queued stamps, ~750MB of TS behind */
+#define MAX_SCAN        (1 << 16)   /* queued stamps searched per packet */
+
+static uint32_t
+get_stamp(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]) &
+        ARRIVAL_MASK;
+}
+
+static void
+put_stamp(uint8_t *p, uint32_t stamp)
+{
+    p[0] = (stamp >> 24) & 0x3f;    /* copy_permission_indicator 0 */
+    p[1] = stamp >> 16;
+    p[2] = stamp >> 8;
+    p[3] = stamp;
+}
+
+arrival *
+arrival_create(int m2ts)
+{
+    arrival *a = calloc(1, sizeof(arrival));
+
+    if(!a)
+        return NULL;
+    pthread_mutex_init(&a->lock, NULL);
+    a->m2ts = m2ts;
+    if(m2ts) {
+        a->size = INITIAL_SIZE;
+        a->stamp = malloc(a->size * sizeof(*a->stamp));
+        a->pid = malloc(a->size * sizeof(*a->pid));
+        if(!a->stamp || !a->pid) {
+            arrival_destroy(a);
+            return NULL;
+        }
+    }
+    return a;
+}
+
+void
+arrival_destroy(arrival *a)
+{
+    if(!a)
+        return;
+    pthread_mutex_destroy(&a->lock);
+    free(a->stamp);
+    free(a->pid);
+    free(a->out);
+    free(a);
+}
+
+/* double the queue, keeping the entries at the same ring positions */
+static int
+grow(arrival *a)
+{
+    size_t size = a->size * 2;
+    uint32_t *stamp = malloc(size * sizeof(*stamp));
+    uint16_t *pid = malloc(size * sizeof(*pid));
+    uint64_t i;
+
+    if(!stamp || !pid) {
+        free(stamp);
+        free(pid);
+        return -1;
+    }
+    for(i = a->tail; i < a->head; i++) {
+        stamp[i & (size - 1)] = a->stamp[i & (a->size - 1)];
+        pid[i & (size - 1)] = a->pid[i & (a->size - 1)];
+    }
+    free(a->stamp);
+    free(a->pid);
+    a->stamp = stamp;
+    a->pid = pid;
+    a->size = size;
+    return 0;
+}
+
+/* 192 byte units from the driver -> 188 byte packets, in place */
+int
+arrival_strip(arrival *a, uint8_t *data, int len)
+{
+    int in, out = 0;
+    uint32_t stamp, gap;
+
+    if(a->m2ts)
+        pthread_mutex_lock(&a->lock);
+    for(in = 0; in + ARRIVAL_UNIT <= len; in += ARRIVAL_UNIT) {
+        const uint8_t *p = data + in + ARRIVAL_STAMP_SIZE;
+
+        stamp = get_stamp(data + in);
+        if(a->restart)
+            a->restart = 0;
+        else if(a->packets) {
+            gap = (stamp - a->prev) & ARRIVAL_MASK;
+            if(gap < ARRIVAL_MASK / 2 && gap > a->max_gap)
+                a->max_gap = gap;
+        }
+        a->prev = stamp;
+        a->packets++;
+
+        if(a->m2ts) {
+            /* full: grow up to MAX_SIZE, then forget the oldest stamp */
+            if(a->head - a->tail == a->size &&
+               (a->size >= MAX_SIZE || grow(a) < 0))
+                a->tail++;
+            a->stamp[a->head & (a->size - 1)] = stamp;
+            a->pid[a->head & (a->size - 1)] = ((p[1] & 0x1f) << 8) | p[2];
+            a->head++;
+        }
+        memmove(data + out, p, TS_PACKET_SIZE);
+        out += TS_PACKET_SIZE;
+    }
+    if(a->m2ts)
+        pthread_mutex_unlock(&a->lock);
+    return out;
+}
+
+/* stamp of the next queued packet of pid, dropping the ones skipped */
+static uint32_t
+match(arrival *a, int pid)
+{
+    uint64_t i, end = a->head;
+
+    if(end - a->tail > MAX_SCAN)
+        end = a->tail + MAX_SCAN;
+    for(i = a->tail; i < end; i++) {
+        if(a->pid[i & (a->size - 1)] == pid) {
+            a->last = a->stamp[i & (a->size - 1)];
+            a->tail = i + 1;
+            return a->last;
+        }
+    }
+    /* not queued: reuse the previous stamp.  if the whole window was
+       searched, the packet lies beyond it, and so does every later
+       output packet: nothing in the window can match any more */
+    a->unmatched++;
+    if(end - a->tail == MAX_SCAN)
+        a->tail = end;
+    return a->last;
+}
+
+static void
+emit(arrival *a, const uint8_t *p, uint8_t *out)
+{
+    put_stamp(out, match(a, ((p[1] & 0x1f) << 8) | p[2]));
+    memcpy(out + ARRIVAL_STAMP_SIZE, p, TS_PACKET_SIZE);
+}
+
+/* 188 byte output packets -> 192 byte M2TS units */
+const uint8_t *
+arrival_m2ts(arrival *a, const uint8_t *data, size_t len, size_t *out_len)
+{
+    size_t need = (a->carry_len + len) / TS_PACKET_SIZE * ARRIVAL_UNIT;
+    size_t pos = 0, out = 0;
+
+    if(need > a->out_size) {
+        uint8_t *p = realloc(a->out, need);
+
+        if(!p) {
+            *out_len = 0;
+            return NULL;
+        }
+        a->out = p;
+        a->out_size = need;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    if(a->carry_len) {
+        size_t fill = TS_PACKET_SIZE - a->carry_len;
+
+        if(fill > len)
+            fill = len;
+        memcpy(a->carry + a->carry_len, data, fill);
+        a->carry_len += fill;
+        pos = fill;
+        if(a->carry_len == TS_PACKET_SIZE) {
+            emit(a, a->carry, a->out);
+            out = ARRIVAL_UNIT;
+            a->carry_len = 0;
+        }
+    }
+    for(; pos + TS_PACKET_SIZE <= len; pos += TS_PACKET_SIZE) {
+        emit(a, data + pos, a->out + out);
+        out += ARRIVAL_UNIT;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if(pos < len) {
+        memcpy(a->carry + a->carry_len, data + pos, len - pos);
+        a->carry_len += len - pos;
+    }
+    *out_len = out;
+    return a->out;
+}
+
+/* the tuner was re-opened: its clock is not the one of the last stamp */
+void
+arrival_restart(arrival *a)
+{
+    a->restart = 1;
+}
+
+void
+arrival_report(const arrival *a)
+{
+    fprintf(stderr, "arrival: %llu packets, max gap %.3f ms",
+            (unsigned long long)a->packets, a->max_gap * 1000.0 / ARRIVAL_CLOCK);
+    if(a->m2ts)
+        fprintf(stderr, ", %llu without a stamp",
+                (unsigned long long)a->unmatched);
+    fprintf(stderr, "\n");
+}
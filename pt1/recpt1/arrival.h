@@ -0,0 +1,58 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _ARRIVAL_H_
+#define _ARRIVAL_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * Arrival timestamps for recpt1 --timestamp.  With SET_TIMESTAMP the
+ * driver prefixes every packet with a 4 byte header carrying a 30 bit
+ * 27MHz arrival time, as in the TP_extra_header of M2TS.  The capture
+ * loop strips the headers right after read(), so b25, the splitter and
+ * every other writer keep seeing 188 byte packets.
+ *
+ * For m2ts output the stamps are queued with their PID and put back in
+ * front of the packets that reach the output file.  b25 and the
+ * splitter only ever drop packets and keep their order and PIDs, so an
+ * output packet takes the stamp of the next queued packet of its PID.
+ */
+
+#define ARRIVAL_STAMP_SIZE  4
+#define ARRIVAL_UNIT        (ARRIVAL_STAMP_SIZE + 188)
+#define ARRIVAL_CLOCK       27000000
+#define ARRIVAL_MASK        0x3fffffff
+
+typedef struct arrival {
+    pthread_mutex_t lock;
+    int m2ts;               /* queue stamps for arrival_m2ts() */
+    /* capture side -> output side, a ring grown as needed */
+    uint32_t *stamp;
+    uint16_t *pid;
+    size_t size;            /* power of two */
+    uint64_t head;          /* stamps queued */
+    uint64_t tail;          /* stamps consumed */
+    uint32_t last;          /* stamp of the last output packet */
+    uint64_t unmatched;     /* output packets without a queued stamp */
+    /* output buffer for arrival_m2ts() */
+    uint8_t *out;
+    size_t out_size;
+    uint8_t carry[188];     /* partial packet left by the last block */
+    int carry_len;
+    /* arrival statistics */
+    uint64_t packets;
+    uint32_t prev;
+    uint32_t max_gap;       /* in 27MHz ticks */
+    volatile int restart;   /* next stamp starts a new clock, no gap */
+} arrival;
+
+arrival *arrival_create(int m2ts);
+int arrival_strip(arrival *a, uint8_t *data, int len);
+const uint8_t *arrival_m2ts(arrival *a, const uint8_t *data, size_t len,
+                            size_t *out_len);
+void arrival_restart(arrival *a);
+void arrival_report(const arrival *a);
+void arrival_destroy(arrival *a);
+
+#endif
@@ -0,0 +1,390 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "bcas.h"
+
+#ifdef HAVE_LIBARIB25
+
+typedef struct ecm_entry {
+    int len;                    /* 0: unused */
+    uint8_t ecm[BCAS_ECM_MAX];
+    B_CAS_ECM_RESULT result;
+    unsigned long used;         /* for LRU replacement */
+} ecm_entry;
+
+/* card_lock: the card, users and held.  cache_lock: the ECM cache and
+   the counters, so hits do not wait for a card command in progress. */
+static pthread_mutex_t card_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static B_CAS_CARD *card;
+static int users;
+static int held;
+static ecm_entry cache[BCAS_ECM_CACHE];
+static unsigned long cache_clock;
+static bcas_stats stats;
+
+/* stub card: every ECM is answered with a key made of its bytes, except
+   that one starting with 0xff is refused as without contract */
+static void
+stub_release(void *bcas)
+{
+    free(bcas);
+}
+
+static int
+stub_init(void *bcas)
+{
+    return 0;
+}
+
+static int
+stub_get_init_status(void *bcas, B_CAS_INIT_STATUS *stat)
+{
+    memset(stat, 0, sizeof(B_CAS_INIT_STATUS));
+    return 0;
+}
+
+static int
+stub_get_id(void *bcas, B_CAS_ID *dst)
+{
+    static int64_t id = 0;
+
+    dst->data = &id;
+    dst->count = 1;
+    return 0;
+}
+
+static int
+stub_get_pwr_on_ctrl(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst)
+{
+    dst->data = NULL;
+    dst->count = 0;
+    return 0;
+}
+
+static int
+stub_proc_ecm(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len)
+{
+    int i;
+
+    if(len <= 0)
+        return -1;
+    for(i = 0; i < 16; i++)
+        dst->scramble_key[i] = src[i % len] ^ i;
+    if(src[0] == 0xff)
+        dst->return_code = 0xa103;  /* no contract */
+    else
+        dst->return_code = 0x0800;  /* purchased: tier */
+    return 0;
+}
+
+static int
+stub_proc_emm(void *bcas, uint8_t *src, int len)
+{
+    return 0;
+}
+
+static B_CAS_CARD *
+create_stub_card(void)
+{
+    B_CAS_CARD *c = calloc(1, sizeof(B_CAS_CARD));
+
+    if(c) {
+        c->release = stub_release;
+        c->init = stub_init;
+        c->get_init_status = stub_get_init_status;
+        c->get_id = stub_get_id;
+        c->get_pwr_on_ctrl = stub_get_pwr_on_ctrl;
+        c->proc_ecm = stub_proc_ecm;
+        c->proc_emm = stub_proc_emm;
+    }
+    return c;
+}
+
+static double
+elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 +
+        (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* with card_lock held */
+static int
+open_card(void)
+{
+    const char *env = getenv("RECPT1_BCAS");
+    struct timespec start;
+    B_CAS_CARD *c;
+    double ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(env && !strcmp(env, "stub"))
+        c = create_stub_card();
+    else
+        c = create_b_cas_card();
+    if(!c) {
+        fprintf(stderr, "create_b_cas_card failed\n");
+        return -1;
+    }
+    if(c->init(c) < 0) {
+        fprintf(stderr, "bcas->init failed\n");
+        c->release(c);
+        return -1;
+    }
+    ms = elapsed_ms(&start);
+
+    pthread_mutex_lock(&cache_lock);
+    /* answers of another card session may not hold */
+    memset(cache, 0, sizeof(cache));
+    stats.opens++;
+    stats.open_ms += ms;
+    pthread_mutex_unlock(&cache_lock);
+    card = c;
+    return 0;
+}
+
+/* with card_lock held */
+static void
+close_card(void)
+{
+    card->release(card);
+    card = NULL;
+}
+
+/* with cache_lock held */
+static ecm_entry *
+cache_find(const uint8_t *src, int len)
+{
+    int i;
+
+    for(i = 0; i < BCAS_ECM_CACHE; i++) {
+        if(cache[i].len == len && !memcmp(cache[i].ecm, src, len)) {
+            cache[i].used = ++cache_clock;
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+/* with cache_lock held */
+static void
+cache_add(const uint8_t *src, int len, const B_CAS_ECM_RESULT *result)
+{
+    ecm_entry *e = &cache[0];
+    int i;
+
+    for(i = 1; i < BCAS_ECM_CACHE && e->len; i++) {
+        if(!cache[i].len || cache[i].used < e->used)
+            e = &cache[i];
+    }
+    e->len = len;
+    memcpy(e->ecm, src, len);
+    e->result = *result;
+    e->used = ++cache_clock;
+}
+
+/* answers arib25 descrambles with, as in its ECM check.  a refusal
+   may not hold for long (the contract may come with the next EMM), so
+   only these are cached */
+static int
+ecm_ok(const B_CAS_ECM_RESULT *result)
+{
+    switch(result->return_code) {
+    case 0x0200:    /* purchased: PPV, deferred payment */
+    case 0x0400:    /* purchased: PPV, prepaid */
+    case 0x0800:    /* purchased: tier */
+        return 1;
+    }
+    return 0;
+}
+
+/* proxy card handed to each decoder */
+static void
+proxy_release(void *bcas)
+{
+    pthread_mutex_lock(&card_lock);
+    if(--users == 0 && !held)
+        close_card();
+    pthread_mutex_unlock(&card_lock);
+    free(bcas);
+}
+
+static int
+proxy_init(void *bcas)
+{
+    return 0;   /* bcas_attach() has opened the card */
+}
+
+static int
+proxy_get_init_status(void *bcas, B_CAS_INIT_STATUS *stat)
+{
+    int rv;
+
+    pthread_mutex_lock(&card_lock);
+    rv = card->get_init_status(card, stat);
+    pthread_mutex_unlock(&card_lock);
+    return rv;
+}
+
+static int
+proxy_get_id(void *bcas, B_CAS_ID *dst)
+{
+    int rv;
+
+    pthread_mutex_lock(&card_lock);
+    rv = card->get_id(card, dst);
+    pthread_mutex_unlock(&card_lock);
+    return rv;
+}
+
+static int
+proxy_get_pwr_on_ctrl(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst)
+{
+    int rv;
+
+    pthread_mutex_lock(&card_lock);
+    rv = card->get_pwr_on_ctrl(card, dst);
+    pthread_mutex_unlock(&card_lock);
+    return rv;
+}
+
+static int
+proxy_proc_ecm(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len)
+{
+    int cacheable = len > 0 && len <= BCAS_ECM_MAX;
+    ecm_entry *e;
+    int rv;
+
+    pthread_mutex_lock(&cache_lock);
+    stats.ecm_calls++;
+    e = cacheable ? cache_find(src, len) : NULL;
+    if(e)
+        *dst = e->result;
+    pthread_mutex_unlock(&cache_lock);
+    if(e)
+        return 0;
+
+    pthread_mutex_lock(&card_lock);
+    /* another stream may have asked for it while we waited */
+    pthread_mutex_lock(&cache_lock);
+    e = cacheable ? cache_find(src, len) : NULL;
+    if(e)
+        *dst = e->result;
+    pthread_mutex_unlock(&cache_lock);
+    if(e) {
+        pthread_mutex_unlock(&card_lock);
+        return 0;
+    }
+
+    rv = card->proc_ecm(card, dst, src, len);
+
+    pthread_mutex_lock(&cache_lock);
+    stats.ecm_card++;
+    if(rv >= 0 && cacheable && ecm_ok(dst))
+        cache_add(src, len, dst);
+    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&card_lock);
+    return rv;
+}
+
+static int
+proxy_proc_emm(void *bcas, uint8_t *src, int len)
+{
+    int rv;
+
+    pthread_mutex_lock(&card_lock);
+    rv = card->proc_emm(card, src, len);
+    pthread_mutex_unlock(&card_lock);
+
+    pthread_mutex_lock(&cache_lock);
+    stats.emm_calls++;
+    pthread_mutex_unlock(&cache_lock);
+    return rv;
+}
+
+B_CAS_CARD *
+bcas_attach(void)
+{
+    B_CAS_CARD *proxy = calloc(1, sizeof(B_CAS_CARD));
+
+    if(!proxy)
+        return NULL;
+
+    pthread_mutex_lock(&card_lock);
+    if(!card && open_card() < 0) {
+        pthread_mutex_unlock(&card_lock);
+        free(proxy);
+        return NULL;
+    }
+    users++;
+    pthread_mutex_unlock(&card_lock);
+
+    proxy->release = proxy_release;
+    proxy->init = proxy_init;
+    proxy->get_init_status = proxy_get_init_status;
+    proxy->get_id = proxy_get_id;
+    proxy->get_pwr_on_ctrl = proxy_get_pwr_on_ctrl;
+    proxy->proc_ecm = proxy_proc_ecm;
+    proxy->proc_emm = proxy_proc_emm;
+    return proxy;
+}
+
+int
+bcas_hold(int on)
+{
+    int rv = 0;
+
+    pthread_mutex_lock(&card_lock);
+    held = on;
+    if(on && !card)
+        rv = open_card();
+    else if(!on && !users && card)
+        close_card();
+    pthread_mutex_unlock(&card_lock);
+    return rv;
+}
+
+void
+bcas_get_stats(bcas_stats *st)
+{
+    pthread_mutex_lock(&cache_lock);
+    *st = stats;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+#else
+
+int
+bcas_hold(int on)
+{
+    return on ? -1 : 0;
+}
+
+void
+bcas_get_stats(bcas_stats *st)
+{
+    memset(st, 0, sizeof(bcas_stats));
+}
+
+#endif
+
+void
+bcas_report(FILE *fp)
+{
+    bcas_stats st;
+
+    bcas_get_stats(&st);
+    if(!st.opens)
+        return;
+    fprintf(fp, "bcas          %lu opens in %.1f ms, %lu ECMs, %lu from the card, "
+            "%lu EMMs\n", st.opens, st.open_ms, st.ecm_calls, st.ecm_card,
+            st.emm_calls);
+}
@@ -0,0 +1,48 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _BCAS_H_
+#define _BCAS_H_
+
+#include <stdio.h>
+#include "config.h"
+
+/*
+ * B-CAS card shared by every b25 decoder in the process.  Opening the
+ * card (PC/SC context, reader connect, card init) takes a good part of
+ * a second and the card answers one command at a time, so the session
+ * is opened once and each decoder gets a proxy B_CAS_CARD that forwards
+ * to it under a lock.  Streams of the same service carry the same ECMs
+ * and the answers that let them descramble are cached, so the card sees
+ * each ECM once however many recordings decode it.
+ *
+ * The session closes with the last decoder unless bcas_hold() keeps it
+ * open for a process that records again later.  RECPT1_BCAS=stub in the
+ * environment replaces the card with a stub that answers every ECM with
+ * a key derived from it (refusing those starting with 0xff), to run the
+ * b25 paths without a card reader.
+ */
+
+#define BCAS_ECM_CACHE      16      /* ECMs remembered */
+#define BCAS_ECM_MAX        256     /* longest ECM cached */
+
+typedef struct bcas_stats {
+    unsigned long opens;        /* card sessions opened */
+    double open_ms;             /* time spent opening them */
+    unsigned long ecm_calls;    /* ECMs from decoders */
+    unsigned long ecm_card;     /* ECMs the card had to answer */
+    unsigned long emm_calls;
+} bcas_stats;
+
+#ifdef HAVE_LIBARIB25
+#include <arib25/b_cas_card.h>
+
+/* a card for one decoder, NULL if the card cannot be opened.
+   release() it when the decoder is done. */
+B_CAS_CARD *bcas_attach(void);
+#endif
+
+/* on: open the card now and keep it open without decoders */
+int bcas_hold(int on);
+void bcas_get_stats(bcas_stats *st);
+void bcas_report(FILE *fp);
+
+#endif
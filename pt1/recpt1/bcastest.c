@@ -0,0 +1,123 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * bcastest: two decoders' cards on one RECPT1_BCAS=stub session, each
+ * sending the same ECMs from its own thread as two recordings of one
+ * service would.  The card must see every distinct ECM once, both
+ * decoders must get the same keys, and a refused ECM (the stub refuses
+ * those starting with 0xff) must go to the card every time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "bcas.h"
+
+#ifdef HAVE_LIBARIB25
+
+#define DECODERS    2
+#define ECMS        8           /* distinct, fewer than BCAS_ECM_CACHE */
+#define ROUNDS      4           /* each ECM is sent this often */
+#define REFUSED     2           /* refused ECMs sent per decoder */
+#define ECM_LEN     148
+
+typedef struct decoder_card {
+    B_CAS_CARD *card;
+    pthread_t thread;
+    uint8_t key[ECMS][16];
+    int errors;
+} decoder_card;
+
+static void
+make_ecm(uint8_t *ecm, int n)
+{
+    int i;
+
+    for(i = 0; i < ECM_LEN; i++)
+        ecm[i] = (uint8_t)(n * 31 + i);
+    ecm[0] = n < 0 ? 0xff : (uint8_t)n;
+}
+
+static void *
+decoder_func(void *p)
+{
+    decoder_card *d = p;
+    B_CAS_ECM_RESULT res;
+    uint8_t ecm[ECM_LEN];
+    int r, n;
+
+    for(r = 0; r < ROUNDS; r++) {
+        for(n = 0; n < ECMS; n++) {
+            make_ecm(ecm, n);
+            if(d->card->proc_ecm(d->card, &res, ecm, ECM_LEN) < 0 ||
+               res.return_code != 0x0800) {
+                d->errors++;
+                continue;
+            }
+            if(r == 0)
+                memcpy(d->key[n], res.scramble_key, 16);
+            else if(memcmp(d->key[n], res.scramble_key, 16))
+                d->errors++;
+        }
+    }
+    make_ecm(ecm, -1);
+    for(r = 0; r < REFUSED; r++) {
+        if(d->card->proc_ecm(d->card, &res, ecm, ECM_LEN) < 0 ||
+           res.return_code == 0x0800)
+            d->errors++;
+    }
+    return NULL;
+}
+
+int
+main(void)
+{
+    decoder_card dec[DECODERS];
+    bcas_stats st;
+    unsigned long want_calls = DECODERS * (ECMS * ROUNDS + REFUSED);
+    unsigned long want_card = ECMS + DECODERS * REFUSED;
+    int i, errors = 0;
+
+    setenv("RECPT1_BCAS", "stub", 1);
+    memset(dec, 0, sizeof(dec));
+    for(i = 0; i < DECODERS; i++) {
+        dec[i].card = bcas_attach();
+        if(!dec[i].card) {
+            fprintf(stderr, "bcas_attach failed\n");
+            return 1;
+        }
+    }
+    for(i = 0; i < DECODERS; i++)
+        pthread_create(&dec[i].thread, NULL, decoder_func, &dec[i]);
+    for(i = 0; i < DECODERS; i++) {
+        pthread_join(dec[i].thread, NULL);
+        errors += dec[i].errors;
+        if(i && memcmp(dec[i].key, dec[0].key, sizeof(dec[0].key)))
+            errors++;
+    }
+
+    bcas_get_stats(&st);
+    printf("%d decoders: %lu ECMs, %lu to the card, %lu cache hits "
+           "(want %lu, %lu, %lu), %lu open\n",
+           DECODERS, st.ecm_calls, st.ecm_card, st.ecm_calls - st.ecm_card,
+           want_calls, want_card, want_calls - want_card, st.opens);
+    if(st.ecm_calls != want_calls || st.ecm_card != want_card || st.opens != 1)
+        errors++;
+
+    for(i = 0; i < DECODERS; i++)
+        dec[i].card->release(dec[i].card);
+    printf("%s\n", errors ? "FAIL" : "ok");
+    return errors ? 1 : 0;
+}
+
+#else
+
+int
+main(void)
+{
+    printf("built without b25 support (configure --enable-b25): skipped\n");
+    return 0;
+}
+
+#endif
@@ -26,20 +26,20 @@
 #include "config.h"
 #include "decoder.h"
 #include "recpt1core.h"
+#include "cnlut.h"
 #include "mkpath.h"
 
 #include <sys/ipc.h>
 #include <sys/msg.h>
 #include "tssplitter_lite.h"
 
-/* prototypes */
-int tune(char *channel, thread_data *tdata, char *device);
-int close_tuner(thread_data *tdata);
+static volatile boolean f_exit = FALSE;
 
 void
-cleanup(thread_data *tdata)
+cleanup(recpt1_tuner *t)
 {
     f_exit = TRUE;
+    t->cancel = TRUE;
 }
 
 /* will be signal handler thread */
@@ -48,7 +48,7 @@ process_signals(void *data)
 {
     sigset_t waitset;
     int sig;
-    thread_data *tdata = (thread_data *)data;
+    recpt1_tuner *tdata = (recpt1_tuner *)data;
 
     sigemptyset(&waitset);
     sigaddset(&waitset, SIGINT);
@@ -75,7 +75,7 @@ process_signals(void *data)
 }
 
 void
-init_signal_handlers(pthread_t *signal_thread, thread_data *tdata)
+init_signal_handlers(pthread_t *signal_thread, recpt1_tuner *tdata)
 {
     sigset_t blockset;
 
@@ -93,7 +93,7 @@ init_signal_handlers(pthread_t *signal_thread, thread_data *tdata)
 void
 show_usage(char *cmd)
 {
-    fprintf(stderr, "Usage: \n%s [--device devicefile] [--lnb voltage] [--bell] channel\n", cmd);
+    fprintf(stderr, "Usage: \n%s [--device devicefile] [--lnb voltage] [--bell] [--stat] channel\n", cmd);
     fprintf(stderr, "\n");
 }
 
@@ -104,6 +104,7 @@ show_options(void)
     fprintf(stderr, "--device devicefile: Specify devicefile to use\n");
     fprintf(stderr, "--lnb voltage:       Specify LNB voltage (0, 11, 15)\n");
     fprintf(stderr, "--bell:              Notify signal quality by bell\n");
+    fprintf(stderr, "--stat:              Show tuning time statistics and exit\n");
     fprintf(stderr, "--help:              Show this help\n");
     fprintf(stderr, "--version:           Show version\n");
     fprintf(stderr, "--list:              Show channel list\n");
@@ -113,11 +114,12 @@ int
 main(int argc, char **argv)
 {
     pthread_t signal_thread;
-    static thread_data tdata;
+    static recpt1_tuner tdata = { .tfd = -1 };
     int result;
     int option_index;
     struct option long_options[] = {
         { "bell",      0, NULL, 'b'},
+        { "stat",      0, NULL, 's'},
         { "help",      0, NULL, 'h'},
         { "version",   0, NULL, 'v'},
         { "list",      0, NULL, 'l'},
@@ -131,13 +133,17 @@ main(int argc, char **argv)
     int val;
     char *voltage[] = {"0V", "11V", "15V"};
     boolean use_bell = FALSE;
+    boolean show_stat = FALSE;
 
-    while((result = getopt_long(argc, argv, "bhvln:d:",
+    while((result = getopt_long(argc, argv, "bshvln:d:",
                                 long_options, &option_index)) != -1) {
         switch(result) {
         case 'b':
             use_bell = TRUE;
             break;
+        case 's':
+            show_stat = TRUE;
+            break;
         case 'h':
             fprintf(stderr, "\n");
             show_usage(argv[0]);
@@ -188,6 +194,9 @@ main(int argc, char **argv)
     /* set tune_persistent flag */
     tdata.tune_persistent = TRUE;
 
+    /* build C/N tables before any thread polls signal */
+    cnlut_init();
+
     /* spawn signal handler thread */
     init_signal_handlers(&signal_thread, &tdata);
 
@@ -195,6 +204,11 @@ main(int argc, char **argv)
     if(tune(argv[optind], &tdata, device) != 0)
         return 1;
 
+    if(show_stat) {
+        result = show_tune_stat(tdata.tfd);
+        f_exit = TRUE;
+    }
+
     while(1) {
         if(f_exit)
             break;
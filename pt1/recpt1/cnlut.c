@@ -0,0 +1,92 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <sys/types.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "recpt1.h"
+#include "cnlut.h"
+
+static float cn_isdb_s[CNLUT_SIZE];
+static float cn_isdb_t[CNLUT_SIZE];
+static pthread_once_t cnlut_once = PTHREAD_ONCE_INIT;
+
+static float
+isdb_s_cn(unsigned int signal)
+{
+    /* apply linear interpolation */
+    static const float afLevelTable[] = {
+        24.07f,    // 00    00    0        24.07dB
+        24.07f,    // 10    00    4096     24.07dB
+        18.61f,    // 20    00    8192     18.61dB
+        15.21f,    // 30    00    12288    15.21dB
+        12.50f,    // 40    00    16384    12.50dB
+        10.19f,    // 50    00    20480    10.19dB
+        8.140f,    // 60    00    24576    8.140dB
+        6.270f,    // 70    00    28672    6.270dB
+        4.550f,    // 80    00    32768    4.550dB
+        3.730f,    // 88    00    34816    3.730dB
+        3.630f,    // 88    FF    35071    3.630dB
+        2.940f,    // 90    00    36864    2.940dB
+        1.420f,    // A0    00    40960    1.420dB
+        0.000f     // B0    00    45056    -0.01dB
+    };
+    unsigned int hi = (signal >> 8) & 0xFF;
+
+    if(hi <= 0x10U) {
+        /* clipped maximum */
+        return 24.07f;
+    }
+    else if(hi >= 0xB0U) {
+        /* clipped minimum */
+        return 0.0f;
+    }
+    else {
+        /* linear interpolation between the 0x1000 steps of the table
+           index, using both the upper and the lower byte */
+        const float fMixRate = (float)(signal & 0x0FFFU) / 4096.0f;
+        return afLevelTable[hi >> 4] * (1.0f - fMixRate) +
+            afLevelTable[(hi >> 4) + 0x01U] * fMixRate;
+    }
+}
+
+static float
+isdb_t_cn(unsigned int signal)
+{
+    double P;
+
+    /* 0 would be log10(inf); treat it as the weakest measurable value */
+    if(signal == 0)
+        signal = 1;
+    P = log10(5505024/(double)signal) * 10;
+    return (0.000024 * P * P * P * P) - (0.0016 * P * P * P) +
+        (0.0398 * P * P) + (0.5491 * P)+3.0965;
+}
+
+static void
+build_tables(void)
+{
+    unsigned int i;
+
+    for(i = 0; i < CNLUT_SIZE; i++) {
+        cn_isdb_s[i] = isdb_s_cn(i);
+        cn_isdb_t[i] = isdb_t_cn(i);
+    }
+}
+
+void
+cnlut_init(void)
+{
+    /* pipelines in one process may tune concurrently */
+    pthread_once(&cnlut_once, build_tables);
+}
+
+double
+cnlut_lookup(int type, int raw)
+{
+    cnlut_init();
+    raw &= CNLUT_SIZE - 1;
+    if(type == CHTYPE_GROUND)
+        return cn_isdb_t[raw];
+    else
+        return cn_isdb_s[raw];
+}
@@ -0,0 +1,19 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _CNLUT_H_
+#define _CNLUT_H_
+
+/*
+ * C/N lookup tables.  GET_SIGNAL_STRENGTH returns a 16-bit register
+ * value for both ISDB-S and ISDB-T; every value is mapped to dB once in
+ * cnlut_init() so that a lookup is a single table read.
+ */
+
+#define CNLUT_SIZE 65536
+
+/* build the tables; safe to call from any thread, any number of times */
+void cnlut_init(void);
+
+/* C/N in dB for a raw GET_SIGNAL_STRENGTH value */
+double cnlut_lookup(int type, int raw);
+
+#endif
@@ -0,0 +1,122 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * cnlutcheck: compare every cnlut table entry with the formulas the
+ * tables replaced.
+ *
+ *   ISDB-T  the log10 polynomial in double precision, within
+ *           ISDB_T_TOLERANCE (the tables hold floats).  0 maps to 1.
+ *   ISDB-S  the old getsignal_isdb_s(), which read only the upper byte.
+ *           Exact where upper byte == lower byte, the only points the
+ *           old formula got right; elsewhere within ISDB_S_TOLERANCE,
+ *           the steepest segment (24.07 - 18.61 dB per 0x1000) over the
+ *           at most 0xff the old formula was off by.  The curve must
+ *           also never rise with the raw value.
+ */
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "recpt1.h"
+#include "cnlut.h"
+
+#define ISDB_T_TOLERANCE    1e-4
+#define ISDB_S_EXACT        1e-6
+#define ISDB_S_TOLERANCE    ((24.07 - 18.61) * 0xff / 4096)
+
+/* recpt1core.c before cnlut, unchanged */
+static float
+getsignal_isdb_s(int signal)
+{
+    /* apply linear interpolation */
+    static const float afLevelTable[] = {
+        24.07f,    // 00    00    0        24.07dB
+        24.07f,    // 10    00    4096     24.07dB
+        18.61f,    // 20    00    8192     18.61dB
+        15.21f,    // 30    00    12288    15.21dB
+        12.50f,    // 40    00    16384    12.50dB
+        10.19f,    // 50    00    20480    10.19dB
+        8.140f,    // 60    00    24576    8.140dB
+        6.270f,    // 70    00    28672    6.270dB
+        4.550f,    // 80    00    32768    4.550dB
+        3.730f,    // 88    00    34816    3.730dB
+        3.630f,    // 88    FF    35071    3.630dB
+        2.940f,    // 90    00    36864    2.940dB
+        1.420f,    // A0    00    40960    1.420dB
+        0.000f     // B0    00    45056    -0.01dB
+    };
+
+    unsigned char sigbuf[4];
+    memset(sigbuf, '\0', sizeof(sigbuf));
+    sigbuf[0] =  (((signal & 0xFF00) >> 8) & 0XFF);
+    sigbuf[1] =  (signal & 0xFF);
+
+    /* calculate signal level */
+    if(sigbuf[0] <= 0x10U) {
+        /* clipped maximum */
+        return 24.07f;
+    }
+    else if (sigbuf[0] >= 0xB0U) {
+        /* clipped minimum */
+        return 0.0f;
+    }
+    else {
+        /* linear interpolation */
+        const float fMixRate =
+            (float)(((unsigned short)(sigbuf[0] & 0x0FU) << 8) |
+                    (unsigned short)sigbuf[0]) / 4096.0f;
+        return afLevelTable[sigbuf[0] >> 4] * (1.0f - fMixRate) +
+            afLevelTable[(sigbuf[0] >> 4) + 0x01U] * fMixRate;
+    }
+}
+
+static double
+isdb_t_formula(int signal)
+{
+    double P = log10(5505024/(double)signal) * 10;
+
+    return (0.000024 * P * P * P * P) - (0.0016 * P * P * P) +
+        (0.0398 * P * P) + (0.5491 * P)+3.0965;
+}
+
+int
+main(void)
+{
+    double worst_t = 0, worst_s = 0, diff, cn, prev = 1e9;
+    int raw, errors = 0;
+
+    cnlut_init();
+
+    for(raw = 1; raw < CNLUT_SIZE; raw++) {
+        diff = fabs(cnlut_lookup(CHTYPE_GROUND, raw) - isdb_t_formula(raw));
+        if(diff > worst_t)
+            worst_t = diff;
+        if(diff > ISDB_T_TOLERANCE && errors++ < 10)
+            fprintf(stderr, "ISDB-T %#06x: %f, formula %f\n", raw,
+                    cnlut_lookup(CHTYPE_GROUND, raw), isdb_t_formula(raw));
+    }
+    if(cnlut_lookup(CHTYPE_GROUND, 0) != cnlut_lookup(CHTYPE_GROUND, 1) &&
+       errors++ < 10)
+        fprintf(stderr, "ISDB-T 0 does not map to 1\n");
+
+    for(raw = 0; raw < CNLUT_SIZE; raw++) {
+        cn = cnlut_lookup(CHTYPE_SATELLITE, raw);
+        diff = fabs(cn - getsignal_isdb_s(raw));
+        if(diff > worst_s)
+            worst_s = diff;
+        if(diff > ((raw >> 8) == (raw & 0xff) ? ISDB_S_EXACT : ISDB_S_TOLERANCE)
+           && errors++ < 10)
+            fprintf(stderr, "ISDB-S %#06x: %f, old %f\n", raw, cn,
+                    getsignal_isdb_s(raw));
+        if(cn > prev && errors++ < 10)
+            fprintf(stderr, "ISDB-S %#06x: %f rises from %f\n", raw, cn, prev);
+        prev = cn;
+    }
+
+    printf("ISDB-T: worst %.2e dB (tolerance %.0e)\n", worst_t, ISDB_T_TOLERANCE);
+    printf("ISDB-S: worst %.3f dB (tolerance %.3f, exact where hi == lo)\n",
+           worst_s, ISDB_S_TOLERANCE);
+    printf("%s\n", errors ? "FAIL" : "ok");
+    return errors ? 1 : 0;
+}
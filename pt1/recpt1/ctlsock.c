@@ -0,0 +1,692 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* accept4, struct ucred */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "ctlsock.h"
+
+static void *ctl_thread(void *arg);
+static void *ctl_worker(void *arg);
+
+static void
+kick(recpt1_ctl *c)
+{
+    uint64_t one = 1;
+
+    if(write(c->efd, &one, sizeof(one)) < 0)
+        ;   /* counter full: the server is awake anyway */
+}
+
+/* "@name": abstract namespace, else a file */
+static socklen_t
+ctl_addr(const char *path, struct sockaddr_un *addr)
+{
+    size_t len = strlen(path);
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(len == 0 || len >= sizeof(addr->sun_path))
+        return 0;
+    memcpy(addr->sun_path, path, len);
+    if(path[0] == '@')
+        addr->sun_path[0] = '\0';
+    return offsetof(struct sockaddr_un, sun_path) + len;
+}
+
+/* nobody answers on the socket file */
+static int
+stale(const struct sockaddr_un *addr, socklen_t addrlen)
+{
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    int rv;
+
+    if(fd < 0)
+        return 0;
+    rv = connect(fd, (const struct sockaddr *)addr, addrlen) < 0 &&
+        errno == ECONNREFUSED;
+    close(fd);
+    return rv;
+}
+
+recpt1_ctl *
+recpt1_ctl_start(const char *path)
+{
+    recpt1_ctl *c = calloc(1, sizeof(recpt1_ctl));
+    struct sockaddr_un addr;
+    socklen_t addrlen = ctl_addr(path, &addr);
+    struct epoll_event ev;
+
+    if(!c)
+        return NULL;
+    c->lfd = c->efd = c->epfd = -1;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    pthread_mutex_init(&c->ev_lock, NULL);
+    if(!addrlen) {
+        fprintf(stderr, "Invalid control socket: %s\n", path);
+        goto fail;
+    }
+
+    c->lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    0);
+    if(c->lfd < 0) {
+        perror("socket");
+        goto fail;
+    }
+    if(bind(c->lfd, (struct sockaddr *)&addr, addrlen) < 0) {
+        /* a file left by a recpt1 that died may go */
+        if(errno != EADDRINUSE || path[0] == '@' ||
+           !stale(&addr, addrlen) || unlink(path) < 0 ||
+           bind(c->lfd, (struct sockaddr *)&addr, addrlen) < 0) {
+            perror(path);
+            goto fail;
+        }
+    }
+    if(listen(c->lfd, 16) < 0) {
+        perror(path);
+        goto fail;
+    }
+    if(path[0] != '@') {
+        snprintf(c->path, sizeof(c->path), "%s", path);
+        chmod(path, 0600);
+    }
+
+    c->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    c->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(c->efd < 0 || c->epfd < 0) {
+        perror("epoll");
+        goto fail;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &c->lfd;
+    epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->lfd, &ev);
+    ev.data.ptr = &c->efd;
+    epoll_ctl(c->epfd, EPOLL_CTL_ADD, c->efd, &ev);
+
+    if(pthread_create(&c->worker, NULL, ctl_worker, c) != 0)
+        goto fail;
+    if(pthread_create(&c->thread, NULL, ctl_thread, c) != 0) {
+        pthread_mutex_lock(&c->lock);
+        c->stop = 1;
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+        pthread_join(c->worker, NULL);
+        goto fail;
+    }
+    return c;
+
+fail:
+    if(c->epfd >= 0)
+        close(c->epfd);
+    if(c->efd >= 0)
+        close(c->efd);
+    if(c->lfd >= 0)
+        close(c->lfd);
+    if(c->path[0])
+        unlink(c->path);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->ev_lock);
+    free(c);
+    return NULL;
+}
+
+/* recpt1_event_func: runs in a recording thread, so only queue it */
+static void
+ctl_event(void *arg, const char *event)
+{
+    ctl_rec *r = arg;
+    recpt1_ctl *c = r->ctl;
+
+    pthread_mutex_lock(&c->ev_lock);
+    if(!c->subscribers) {
+        pthread_mutex_unlock(&c->ev_lock);
+        return;
+    }
+    if(c->ev_head - c->ev_tail < CTL_EVENTS) {
+        snprintf(c->event[c->ev_head % CTL_EVENTS], CTL_EVENT_LEN,
+                 "* %s %s", r->name, event);
+        c->ev_head++;
+    }
+    else
+        c->ev_lost++;
+    pthread_mutex_unlock(&c->ev_lock);
+    kick(c);
+}
+
+int
+recpt1_ctl_add(recpt1_ctl *c, const char *name, recpt1_pipeline *p)
+{
+    ctl_rec *r, *o;
+
+    if(strlen(name) >= CTL_NAME_MAX || strchr(name, ' ')) {
+        errno = EINVAL;
+        return -1;
+    }
+    r = calloc(1, sizeof(ctl_rec));
+    if(!r)
+        return -1;
+    strcpy(r->name, name);
+    r->pipeline = p;
+    r->ctl = c;
+
+    pthread_mutex_lock(&c->lock);
+    for(o = c->recs; o; o = o->next) {
+        if(!strcmp(o->name, name) || o->pipeline == p) {
+            pthread_mutex_unlock(&c->lock);
+            free(r);
+            errno = EEXIST;
+            return -1;
+        }
+    }
+    r->next = c->recs;
+    c->recs = r;
+    recpt1_pipeline_set_event(p, ctl_event, r);
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+void
+recpt1_ctl_remove(recpt1_ctl *c, recpt1_pipeline *p)
+{
+    ctl_rec **rp, *r = NULL;
+    ctl_job **jp, *j;
+
+    pthread_mutex_lock(&c->lock);
+    for(rp = &c->recs; *rp; rp = &(*rp)->next) {
+        if((*rp)->pipeline == p) {
+            r = *rp;
+            *rp = r->next;
+            break;
+        }
+    }
+    /* jobs not started yet fail; a running one is waited for */
+    for(jp = &c->jobs; (j = *jp); ) {
+        if(j->pipeline != p) {
+            jp = &j->next;
+            continue;
+        }
+        *jp = j->next;
+        if(j->conn) {
+            j->result = -1;
+            j->next = c->done;
+            c->done = j;
+        }
+        else
+            free(j);
+    }
+    while(c->busy == p)
+        pthread_cond_wait(&c->cond, &c->lock);
+    if(r)
+        recpt1_pipeline_set_event(p, NULL, NULL);
+    pthread_mutex_unlock(&c->lock);
+    kick(c);
+    free(r);
+}
+
+/* channel: CTL_CHANNEL only, sec: CTL_TIME only */
+static int
+queue_job(recpt1_ctl *c, recpt1_pipeline *p, ctl_verb verb,
+          const char *channel, int sec, unsigned long conn, const char *id)
+{
+    ctl_job *j, **jp;
+
+    if(verb == CTL_CHANNEL &&
+       (strlen(channel) >= sizeof(j->channel) ||
+        recpt1_channel_valid(channel) != 0))
+        return -1;
+    j = calloc(1, sizeof(ctl_job));
+    if(!j)
+        return -1;
+    j->conn = conn;
+    snprintf(j->id, sizeof(j->id), "%s", id);
+    j->pipeline = p;
+    j->verb = verb;
+    if(verb == CTL_CHANNEL)
+        strcpy(j->channel, channel);
+    j->sec = sec;
+
+    /* with lock held */
+    for(jp = &c->jobs; *jp; jp = &(*jp)->next)
+        ;
+    *jp = j;
+    pthread_cond_broadcast(&c->cond);
+    return 0;
+}
+
+int
+recpt1_ctl_switch(recpt1_ctl *c, recpt1_pipeline *p, const char *channel)
+{
+    int rv;
+
+    pthread_mutex_lock(&c->lock);
+    rv = queue_job(c, p, CTL_CHANNEL, channel, 0, 0, "");
+    pthread_mutex_unlock(&c->lock);
+    return rv;
+}
+
+static void *
+ctl_worker(void *arg)
+{
+    recpt1_ctl *c = arg;
+    ctl_job *j;
+
+    pthread_mutex_lock(&c->lock);
+    while(1) {
+        while(!c->stop && !c->jobs)
+            pthread_cond_wait(&c->cond, &c->lock);
+        if(c->stop)
+            break;
+        j = c->jobs;
+        c->jobs = j->next;
+        c->busy = j->pipeline;
+        pthread_mutex_unlock(&c->lock);
+
+        switch(j->verb) {
+        case CTL_CHANNEL:
+            j->result = recpt1_pipeline_switch(j->pipeline, j->channel);
+            break;
+        case CTL_TIME:
+            /* stops the recording if that time has passed */
+            recpt1_pipeline_set_recsec(j->pipeline, j->sec);
+            break;
+        case CTL_STOP:
+            recpt1_pipeline_stop(j->pipeline);
+            break;
+        }
+
+        pthread_mutex_lock(&c->lock);
+        c->busy = NULL;
+        pthread_cond_broadcast(&c->cond);
+        if(j->conn) {
+            j->next = c->done;
+            c->done = j;
+            kick(c);
+        }
+        else
+            free(j);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+static void
+drop_conn(recpt1_ctl *c, ctl_conn *conn)
+{
+    ctl_conn **pp;
+
+    for(pp = &c->conns; *pp; pp = &(*pp)->next) {
+        if(*pp == conn) {
+            *pp = conn->next;
+            break;
+        }
+    }
+    if(conn->subscribed) {
+        pthread_mutex_lock(&c->ev_lock);
+        c->subscribers--;
+        pthread_mutex_unlock(&c->ev_lock);
+    }
+    epoll_ctl(c->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn);
+}
+
+/* a reply or event the peer cannot take now means it is not reading:
+   -1, and the caller drops the connection either way */
+static int
+send_msg(ctl_conn *conn, const char *msg, size_t len)
+{
+    ssize_t wc;
+
+    do
+        wc = send(conn->fd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    while(wc < 0 && errno == EINTR);
+    return wc < 0 ? -1 : 0;
+}
+
+static void
+accept_conns(recpt1_ctl *c)
+{
+    while(1) {
+        struct epoll_event ev;
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        ctl_conn *conn;
+        int fd = accept4(c->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if(fd < 0)
+            return;
+        /* abstract sockets have no file permissions to lean on */
+        if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+           (cred.uid != geteuid() && cred.uid != 0)) {
+            close(fd);
+            continue;
+        }
+        conn = calloc(1, sizeof(ctl_conn));
+        if(!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->serial = ++c->serial;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if(epoll_ctl(c->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->next = c->conns;
+        c->conns = conn;
+    }
+}
+
+static ctl_rec *
+find_rec(recpt1_ctl *c, const char *name)
+{
+    ctl_rec *r;
+
+    if(!name)
+        return c->recs && !c->recs->next ? c->recs : NULL;
+    for(r = c->recs; r; r = r->next) {
+        if(!strcmp(r->name, name))
+            return r;
+    }
+    return NULL;
+}
+
+static int
+parse_sec(const char *arg, int *sec)
+{
+    char *end;
+    long v;
+
+    if(!arg)
+        return -1;
+    v = strtol(arg, &end, 10);
+    if(end == arg || *end || v < 0 || v > 0x7fffffff)
+        return -1;
+    *sec = (int)v;
+    return 0;
+}
+
+/* one request; returns -1 to drop the connection */
+static int
+handle_request(recpt1_ctl *c, ctl_conn *conn, char *req)
+{
+    char out[CTL_MSG_MAX];
+    char *save = NULL;
+    char *id, *name = NULL, *verb, *arg;
+    const char *err = NULL;
+    ctl_rec *r;
+    int n, sec;
+
+    id = strtok_r(req, " \n", &save);
+    verb = strtok_r(NULL, " \n", &save);
+    if(!id || strlen(id) >= CTL_ID_MAX)
+        return -1;
+    if(verb && verb[0] == '@') {
+        name = verb + 1;
+        verb = strtok_r(NULL, " \n", &save);
+    }
+    arg = strtok_r(NULL, " \n", &save);
+    n = snprintf(out, sizeof(out), "%s ok", id);
+    if(!verb) {
+        err = "no command";
+        goto reply;
+    }
+
+    /* verbs without a recording */
+    if(!strcmp(verb, "ping"))
+        goto reply;
+    if(!strcmp(verb, "subscribe") || !strcmp(verb, "unsubscribe")) {
+        int on = verb[0] == 's';
+
+        if(conn->subscribed != on) {
+            pthread_mutex_lock(&c->ev_lock);
+            c->subscribers += on ? 1 : -1;
+            pthread_mutex_unlock(&c->ev_lock);
+        }
+        conn->subscribed = on;
+        goto reply;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if(!strcmp(verb, "list")) {
+        for(r = c->recs; r && n < (int)sizeof(out); r = r->next)
+            n += snprintf(out + n, sizeof(out) - n, " %s", r->name);
+        goto unlock;
+    }
+    r = find_rec(c, name);
+    if(!r) {
+        err = name ? "no such recording" : "name a recording";
+        goto unlock;
+    }
+    if(!strcmp(verb, "status") || !strcmp(verb, "stats")) {
+        int len;
+
+        out[n++] = ' ';
+        if(!strcmp(verb, "status"))
+            len = recpt1_pipeline_status(r->pipeline, out + n,
+                                         sizeof(out) - n);
+        else
+            len = recpt1_pipeline_stats(r->pipeline, out + n,
+                                        sizeof(out) - n);
+        if(len < 0)
+            err = "too long";
+        else {
+            n += len;
+            /* the stats line ends in a newline */
+            if(out[n - 1] == '\n')
+                out[--n] = '\0';
+        }
+    }
+    else if(!strcmp(verb, "channel")) {
+        if(!arg || queue_job(c, r->pipeline, CTL_CHANNEL, arg, 0,
+                             conn->serial, id) < 0)
+            err = "unknown channel";
+        else
+            n = -1;     /* replied by the worker */
+    }
+    else if(!strcmp(verb, "sid")) {
+        if(!arg)
+            err = "no SID";
+        else if(recpt1_pipeline_set_sid(r->pipeline, arg) < 0)
+            err = errno == EBUSY ? "raw recording" : "invalid SID";
+    }
+    else if(!strcmp(verb, "extend")) {
+        if(parse_sec(arg, &sec) < 0)
+            err = "bad time";
+        else
+            recpt1_pipeline_extend(r->pipeline, sec);
+    }
+    else if(!strcmp(verb, "time")) {
+        if(parse_sec(arg, &sec) < 0)
+            err = "bad time";
+        else if(queue_job(c, r->pipeline, CTL_TIME, NULL, sec,
+                          conn->serial, id) < 0)
+            err = "out of memory";
+        else
+            n = -1;
+    }
+    else if(!strcmp(verb, "stop")) {
+        if(queue_job(c, r->pipeline, CTL_STOP, NULL, 0, conn->serial, id) < 0)
+            err = "out of memory";
+        else
+            n = -1;
+    }
+    else
+        err = "unknown command";
+unlock:
+    pthread_mutex_unlock(&c->lock);
+reply:
+    if(err)
+        n = snprintf(out, sizeof(out), "%s err %s", id, err);
+    if(n < 0)
+        return 0;
+    if(n >= (int)sizeof(out))
+        n = sizeof(out) - 1;
+    return send_msg(conn, out, n);
+}
+
+/* EPOLLIN on a connection: one message, or EOF */
+static int
+conn_read(recpt1_ctl *c, ctl_conn *conn)
+{
+    char req[CTL_MSG_MAX], out[CTL_ID_MAX + 16];
+    char *save = NULL, *id;
+    /* MSG_TRUNC: the full length, even if it did not fit */
+    ssize_t rc = recv(conn->fd, req, sizeof(req) - 1,
+                      MSG_DONTWAIT | MSG_TRUNC);
+
+    if(rc <= 0)
+        return rc < 0 && (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    if(rc < (ssize_t)sizeof(req)) {
+        req[rc] = '\0';
+        return handle_request(c, conn, req);
+    }
+    /* a cut request must not run as another */
+    req[sizeof(req) - 1] = '\0';
+    id = strtok_r(req, " \n", &save);
+    if(!id || strlen(id) >= CTL_ID_MAX)
+        return -1;
+    rc = snprintf(out, sizeof(out), "%s err too long", id);
+    return send_msg(conn, out, rc);
+}
+
+/* replies of finished switches, then queued events */
+static void
+flush(recpt1_ctl *c)
+{
+    ctl_job *done, *j;
+    ctl_conn *conn, *next;
+    char out[CTL_EVENT_LEN];
+    int n;
+
+    pthread_mutex_lock(&c->lock);
+    done = c->done;
+    c->done = NULL;
+    pthread_mutex_unlock(&c->lock);
+    while((j = done)) {
+        done = j->next;
+        for(conn = c->conns; conn; conn = conn->next) {
+            if(conn->serial != j->conn)
+                continue;
+            /* a job for a removed recording fails too */
+            n = snprintf(out, sizeof(out), "%s %s", j->id,
+                         j->result == 0 ? "ok" :
+                         j->verb == CTL_CHANNEL ? "err cannot tune" :
+                         "err no such recording");
+            if(send_msg(conn, out, n) < 0)
+                drop_conn(c, conn);
+            break;
+        }
+        free(j);
+    }
+
+    while(1) {
+        /* the recording threads must not wait for the sends */
+        pthread_mutex_lock(&c->ev_lock);
+        if(c->ev_tail == c->ev_head) {
+            pthread_mutex_unlock(&c->ev_lock);
+            break;
+        }
+        n = snprintf(out, sizeof(out), "%s", c->event[c->ev_tail % CTL_EVENTS]);
+        c->ev_tail++;
+        pthread_mutex_unlock(&c->ev_lock);
+
+        for(conn = c->conns; conn; conn = next) {
+            next = conn->next;
+            if(conn->subscribed && send_msg(conn, out, n) < 0)
+                drop_conn(c, conn);
+        }
+    }
+}
+
+static void *
+ctl_thread(void *arg)
+{
+    recpt1_ctl *c = arg;
+    struct epoll_event ev[CTL_MAX_EVENTS];
+    int i, n;
+
+    while(1) {
+        n = epoll_wait(c->epfd, ev, CTL_MAX_EVENTS, -1);
+        for(i = 0; i < n; i++) {
+            ctl_conn *conn;
+
+            if(ev[i].data.ptr == &c->lfd) {
+                accept_conns(c);
+                continue;
+            }
+            if(ev[i].data.ptr == &c->efd) {
+                uint64_t count;
+
+                if(read(c->efd, &count, sizeof(count)) < 0)
+                    ;   /* already cleared */
+                continue;
+            }
+            conn = ev[i].data.ptr;
+            if((ev[i].events & EPOLLIN) && conn_read(c, conn) == 0)
+                continue;
+            if(ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                drop_conn(c, conn);
+        }
+        /* events queued before the stop still go out */
+        flush(c);
+        if(c->stop)
+            break;
+    }
+    return NULL;
+}
+
+void
+recpt1_ctl_stop(recpt1_ctl *c)
+{
+    if(!c)
+        return;
+    pthread_mutex_lock(&c->lock);
+    c->stop = 1;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    kick(c);
+    pthread_join(c->thread, NULL);
+    pthread_join(c->worker, NULL);
+
+    while(c->conns)
+        drop_conn(c, c->conns);
+    while(c->recs)
+        recpt1_ctl_remove(c, c->recs->pipeline);
+    while(c->jobs) {
+        ctl_job *j = c->jobs;
+
+        c->jobs = j->next;
+        free(j);
+    }
+    while(c->done) {
+        ctl_job *j = c->done;
+
+        c->done = j->next;
+        free(j);
+    }
+    close(c->epfd);
+    close(c->efd);
+    close(c->lfd);
+    if(c->path[0])
+        unlink(c->path);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->ev_lock);
+    free(c);
+}
@@ -0,0 +1,112 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _CTLSOCK_H_
+#define _CTLSOCK_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "librecpt1.h"
+
+/*
+ * Control socket of librecpt1 (recpt1_ctl_*), spoken by recpt1ctl.  A
+ * Unix SOCK_SEQPACKET socket carries one text message per request,
+ * reply and event, so nothing needs framing:
+ *
+ *   request    ID [@NAME] VERB [ARG]
+ *   reply      ID ok [DATA]    or    ID err MESSAGE
+ *   event      * NAME EVENT            after "subscribe"
+ *
+ * ID is the client's own token, echoed back, so requests may be
+ * pipelined.  @NAME picks a recording and may be left out while only
+ * one is registered.
+ *
+ *   ping                   ok
+ *   list                   ok NAME...
+ *   status                 ok {JSON}   channel, sid, recsec, elapsed
+ *   stats                  ok {JSON}   pipeline statistics
+ *   channel NAME           switch; the reply comes once it is tuned
+ *   sid LIST|off           new splitter SIDs, taken at the next block
+ *   extend SEC, time SEC   recording time, as recpt1 --time
+ *   stop                   end the recording
+ *   subscribe, unsubscribe pipeline events (recpt1_event_func)
+ *
+ * One epoll thread answers all but channel, time and stop on the spot,
+ * so a query costs a round trip through the socket.  Those three may
+ * wait for the tuner (a switch, STOP_REC behind another switch), so
+ * they queue for a worker thread whose replies come back through an
+ * eventfd.  The recording threads queue events under ev_lock and kick
+ * the same eventfd.  Nothing waits for a peer: events that find the
+ * queue full are lost (ev_lost), and a peer whose socket cannot take a
+ * reply or an event is dropped.  Peers must run as the same user as the server, or as root.
+ *
+ * Lock order: lock, then a pipeline's event_lock, then ev_lock.
+ */
+
+#define CTL_MSG_MAX         8192
+#define CTL_ID_MAX          16
+#define CTL_NAME_MAX        32
+#define CTL_EVENTS          256
+#define CTL_EVENT_LEN       (CTL_NAME_MAX + RECPT1_EVENT_MAX + 4)
+#define CTL_MAX_EVENTS      32      /* per epoll_wait */
+
+typedef struct ctl_rec {
+    char name[CTL_NAME_MAX];
+    recpt1_pipeline *pipeline;
+    struct recpt1_ctl *ctl;
+    struct ctl_rec *next;
+} ctl_rec;
+
+typedef struct ctl_conn {
+    int fd;
+    unsigned long serial;   /* jobs find their connection by it */
+    int subscribed;
+    struct ctl_conn *next;
+} ctl_conn;
+
+typedef enum ctl_verb {
+    CTL_CHANNEL,
+    CTL_TIME,
+    CTL_STOP
+} ctl_verb;
+
+/* a request for the worker, then its reply */
+typedef struct ctl_job {
+    unsigned long conn;     /* serial of the asking connection, 0: none */
+    char id[CTL_ID_MAX];
+    recpt1_pipeline *pipeline;
+    ctl_verb verb;
+    char channel[16];       /* CTL_CHANNEL */
+    int sec;                /* CTL_TIME */
+    int result;
+    struct ctl_job *next;
+} ctl_job;
+
+struct recpt1_ctl {
+    int lfd;                /* listening socket */
+    int efd;                /* eventfd: jobs done or events queued */
+    int epfd;
+    char path[108];         /* unlinked at stop, "" if abstract */
+    volatile int stop;
+    pthread_t thread;
+    pthread_t worker;
+
+    pthread_mutex_t lock;   /* recs, jobs, done, busy */
+    pthread_cond_t cond;    /* jobs queued, busy cleared */
+    ctl_rec *recs;
+    ctl_job *jobs;          /* FIFO for the worker */
+    ctl_job *done;          /* replies for the epoll thread */
+    recpt1_pipeline *busy;  /* the worker is running a job on it */
+
+    /* epoll thread only */
+    ctl_conn *conns;
+    unsigned long serial;
+
+    pthread_mutex_t ev_lock;    /* the event queue and both counters */
+    char event[CTL_EVENTS][CTL_EVENT_LEN];
+    unsigned int ev_head;
+    unsigned int ev_tail;
+    int subscribers;        /* changed by the epoll thread only */
+    unsigned long ev_lost;  /* events the queue had no room for */
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include <stdio.h>
 
 #include "decoder.h"
+#include "bcas.h"
 
 #ifdef HAVE_LIBARIB25
 
@@ -36,14 +37,10 @@ b25_startup(decoder_options *opt)
         goto error;
     }
 
-    dec->bcas = create_b_cas_card();
+    /* the card session is shared with the other decoders */
+    dec->bcas = bcas_attach();
     if(!dec->bcas) {
-        err = "create_b_cas_card failed";
-        goto error;
-    }
-    code = dec->bcas->init(dec->bcas);
-    if(code < 0) {
-        err = "bcas->init failed";
+        err = "Cannot open B-CAS card";
         goto error;
     }
 
@@ -57,6 +54,10 @@ b25_startup(decoder_options *opt)
 
 error:
     fprintf(stderr, "%s\n", err);
+    if(dec->bcas)
+        dec->bcas->release(dec->bcas);
+    if(dec->b25)
+        dec->b25->release(dec->b25);
     free(dec);
     return NULL;
 }
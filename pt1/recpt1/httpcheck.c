@@ -0,0 +1,207 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * httpcheck: a client for recpt1 --http on localhost.
+ *
+ *   GET /status        200, application/json
+ *   GET /nothing       404
+ *   GET / twice        200, video/mp2t, each body whole synced packets
+ *                      from its first byte; /status counts both
+ *   GET /ch/NAME       409 while they stream, then 200 and a synced
+ *                      body once they are gone
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TS_PACKET_SIZE  188
+#define TS_SYNC         0x47
+#define STREAM_BYTES    (2 * 1024 * 1024)
+#define TIMEOUT_SEC     5
+
+static int port = 8080;
+
+/* send a request and read the response header; the body follows on
+   the returned socket.  -1 on a connection error */
+static int
+request(const char *path, int *status, char type[64])
+{
+    struct sockaddr_in addr;
+    struct timeval tv = { TIMEOUT_SEC, 0 };
+    char hdr[2048], req[300];
+    size_t len = 0;
+    char *p;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    snprintf(req, sizeof(req), "GET %s HTTP/1.0\r\n\r\n", path);
+    if(send(fd, req, strlen(req), 0) < 0)
+        goto fail;
+
+    /* a byte at a time, so no body byte is taken with the header */
+    while(len < sizeof(hdr) - 1) {
+        if(recv(fd, hdr + len, 1, 0) != 1)
+            goto fail;
+        hdr[++len] = '\0';
+        if(len >= 4 && !strcmp(hdr + len - 4, "\r\n\r\n"))
+            break;
+    }
+    if(sscanf(hdr, "HTTP/1.%*d %d", status) != 1)
+        goto fail;
+    type[0] = '\0';
+    p = strstr(hdr, "Content-Type: ");
+    if(p)
+        sscanf(p + 14, "%63[^\r]", type);
+    return fd;
+
+fail:
+    fprintf(stderr, "%s: no response\n", path);
+    close(fd);
+    return -1;
+}
+
+/* status and type of a whole response, its body in body */
+static int
+expect(const char *path, int want_status, const char *want_type,
+       char *body, size_t body_size)
+{
+    char type[64];
+    ssize_t n;
+    size_t len = 0;
+    int fd, status;
+
+    fd = request(path, &status, type);
+    if(fd < 0)
+        return 1;
+    while(len < body_size - 1 &&
+          (n = recv(fd, body + len, body_size - 1 - len, 0)) > 0)
+        len += n;
+    body[len] = '\0';
+    close(fd);
+    printf("GET %s: %d %s\n", path, status, type);
+    return status != want_status || (want_type && strcmp(type, want_type));
+}
+
+/* a stream response: 200, video/mp2t, fd left at the body */
+static int
+open_stream(const char *path)
+{
+    char type[64];
+    int fd, status;
+
+    fd = request(path, &status, type);
+    if(fd < 0)
+        return -1;
+    printf("GET %s: %d %s\n", path, status, type);
+    if(status != 200 || strcmp(type, "video/mp2t")) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* read bytes of body; a sync byte must start every packet */
+static int
+check_stream(const char *name, int fd, size_t bytes)
+{
+    uint8_t buf[64 * 1024];
+    size_t total = 0, off = 0, bad = 0;
+    ssize_t n, i;
+
+    while(total < bytes) {
+        n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0)
+            break;
+        /* off: position in the packet of buf[0] */
+        for(i = (TS_PACKET_SIZE - off) % TS_PACKET_SIZE; i < n;
+            i += TS_PACKET_SIZE)
+            bad += buf[i] != TS_SYNC;
+        off = (off + n) % TS_PACKET_SIZE;
+        total += n;
+    }
+    printf("%s: %zu bytes, %zu packets without sync\n", name, total, bad);
+    return total < bytes || bad;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "port",    1, NULL, 'p'},
+        { "channel", 1, NULL, 'c'},
+        { NULL,      0, NULL, 0 }
+    };
+    const char *channel = NULL;
+    char body[512], path[64];
+    int fd[2], i, c, errors = 0;
+
+    while((c = getopt_long(argc, argv, "p:c:", options, NULL)) != -1) {
+        switch(c) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            channel = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s --port N [--channel NAME]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    errors += expect("/status", 200, "application/json", body, sizeof(body));
+    errors += body[0] != '{';
+    errors += expect("/nothing", 404, NULL, body, sizeof(body));
+
+    for(i = 0; i < 2; i++)
+        fd[i] = open_stream("/");
+    if(fd[0] < 0 || fd[1] < 0) {
+        errors++;
+        goto done;
+    }
+    errors += check_stream("client 1", fd[0], STREAM_BYTES);
+    errors += check_stream("client 2", fd[1], STREAM_BYTES);
+    errors += expect("/status", 200, "application/json", body, sizeof(body));
+    printf("%s", body);
+    errors += !strstr(body, "\"clients\":2,");
+
+    if(channel) {
+        snprintf(path, sizeof(path), "/ch/%s", channel);
+        errors += expect(path, 409, NULL, body, sizeof(body));
+        close(fd[0]);
+        close(fd[1]);
+        fd[0] = fd[1] = -1;
+        usleep(500 * 1000);     /* the server notices the hangups */
+        fd[0] = open_stream(path);
+        if(fd[0] < 0)
+            errors++;
+        else
+            errors += check_stream(path, fd[0], STREAM_BYTES);
+    }
+
+done:
+    for(i = 0; i < 2; i++) {
+        if(fd[i] >= 0)
+            close(fd[i]);
+    }
+    printf("%s\n", errors ? "FAIL" : "ok");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,475 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* accept4 */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "httpd.h"
+
+#define TS_PACKET_SIZE  188
+#define MAX_EVENTS      64
+
+static const char stream_header[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: video/mp2t\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n\r\n";
+
+static void *httpd_thread(void *arg);
+
+httpd *
+httpd_start(int port, size_t ring_size, httpd_tune_func tune, void *tune_arg)
+{
+    httpd *h = calloc(1, sizeof(httpd));
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+    int on = 1;
+
+    if(!h)
+        return NULL;
+    h->lfd = h->efd = h->epfd = -1;
+    h->ring_size = ring_size - ring_size % TS_PACKET_SIZE;
+    h->ring = malloc(h->ring_size);
+    h->tune = tune;
+    h->tune_arg = tune_arg;
+    if(!h->ring)
+        goto fail;
+
+    h->lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(h->lfd < 0) {
+        perror("socket");
+        goto fail;
+    }
+    setsockopt(h->lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(h->lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(h->lfd, 16) < 0) {
+        perror("http");
+        goto fail;
+    }
+
+    h->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    h->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(h->efd < 0 || h->epfd < 0) {
+        perror("epoll");
+        goto fail;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &h->lfd;
+    epoll_ctl(h->epfd, EPOLL_CTL_ADD, h->lfd, &ev);
+    ev.data.ptr = &h->efd;
+    epoll_ctl(h->epfd, EPOLL_CTL_ADD, h->efd, &ev);
+
+    if(pthread_create(&h->thread, NULL, httpd_thread, h) != 0)
+        goto fail;
+    return h;
+
+fail:
+    if(h->epfd >= 0)
+        close(h->epfd);
+    if(h->efd >= 0)
+        close(h->efd);
+    if(h->lfd >= 0)
+        close(h->lfd);
+    free(h->ring);
+    free(h);
+    return NULL;
+}
+
+/* called from the reader thread only; never blocks */
+void
+httpd_write(httpd *h, const uint8_t *data, size_t len, const rapscan *rs)
+{
+    uint64_t head = h->head;
+    size_t pos, n;
+
+    if(len == 0)
+        return;
+    if(len > h->ring_size) {
+        data += len - h->ring_size;
+        head += len - h->ring_size;
+        len = h->ring_size;
+        rs = NULL;
+    }
+
+    h->reserved = head + len;
+    __sync_synchronize();
+    pos = head % h->ring_size;
+    n = len < h->ring_size - pos ? len : h->ring_size - pos;
+    memcpy(h->ring + pos, data, n);
+    memcpy(h->ring, data + n, len - n);
+    if(rs) {
+        if(rs->count > 0)
+            h->last_rap = head + rs->rap[rs->count - 1];
+        h->sync = head + (rapscan_sync(rs) - (rs->offset - len));
+    }
+    __sync_synchronize();
+    h->head = head + len;
+
+    /* pairs with the barrier in httpd_thread before it sleeps */
+    __sync_synchronize();
+    if(h->idle) {
+        uint64_t one = 1;
+
+        h->idle = 0;
+        if(write(h->efd, &one, sizeof(one)) < 0)
+            ;   /* counter full: the server is awake anyway */
+    }
+}
+
+static void
+set_events(httpd *h, httpd_client *c, int out)
+{
+    struct epoll_event ev;
+
+    if(c->want_out == out)
+        return;
+    ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(h->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = out;
+}
+
+static void
+drop_client(httpd *h, httpd_client *c)
+{
+    httpd_client **pp;
+
+    for(pp = &h->clients; *pp; pp = &(*pp)->next) {
+        if(*pp == c) {
+            *pp = c->next;
+            break;
+        }
+    }
+    if(c->streaming)
+        h->num_streaming--;
+    epoll_ctl(h->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c);
+}
+
+/* send what is buffered in out[]; 1 when done, 0 to wait, -1 on error */
+static int
+flush_out(httpd *h, httpd_client *c)
+{
+    while(c->out_sent < c->out_len) {
+        ssize_t wc = send(c->fd, c->out + c->out_sent,
+                          c->out_len - c->out_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if(wc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN) {
+                set_events(h, c, 1);
+                return 0;
+            }
+            return -1;
+        }
+        c->out_sent += wc;
+    }
+    return 1;
+}
+
+static int
+too_slow(httpd *h, httpd_client *c)
+{
+    if(h->head - c->pos <= HTTPD_MAX_LAG(h->ring_size))
+        return 0;
+    fprintf(stderr, "http: dropping slow client\n");
+    h->dropped++;
+    return 1;
+}
+
+/* send ring data up to head; -1 drops the client */
+static int
+pump(httpd *h, httpd_client *c)
+{
+    int done = flush_out(h, c);
+
+    if(done <= 0)
+        return done;
+    if(!c->streaming)
+        return -1;  /* the reply was complete */
+
+    while(c->pos < h->head) {
+        uint64_t head = h->head;
+        size_t off = c->pos % h->ring_size;
+        size_t n = head - c->pos;
+        ssize_t wc;
+
+        if(too_slow(h, c))
+            return -1;
+        if(n > h->ring_size - off)
+            n = h->ring_size - off;
+        if(n > HTTPD_SEND_MAX)
+            n = HTTPD_SEND_MAX;
+
+        wc = send(c->fd, h->ring + off, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(wc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN) {
+                set_events(h, c, 1);
+                return 0;
+            }
+            return -1;
+        }
+        /* the writer lapped us while the kernel copied */
+        __sync_synchronize();
+        if(h->reserved > h->ring_size &&
+           h->reserved - h->ring_size > c->pos) {
+            fprintf(stderr, "http: dropping overrun client\n");
+            h->dropped++;
+            return -1;
+        }
+        c->pos += wc;
+    }
+    set_events(h, c, 0);
+    return 0;
+}
+
+static void
+accept_clients(httpd *h)
+{
+    while(1) {
+        struct epoll_event ev;
+        httpd_client *c;
+        int fd = accept4(h->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if(fd < 0)
+            return;
+        c = calloc(1, sizeof(httpd_client));
+        if(!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if(epoll_ctl(h->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->next = h->clients;
+        h->clients = c;
+    }
+}
+
+static void
+reply(httpd_client *c, const char *status, const char *type,
+      const char *body)
+{
+    c->out_len = snprintf(c->out, sizeof(c->out),
+                          "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+                          "Content-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                          status, type, strlen(body), body);
+    if(c->out_len >= (int)sizeof(c->out))
+        c->out_len = sizeof(c->out) - 1;
+}
+
+static int
+valid_channel(const char *ch)
+{
+    size_t len = strlen(ch);
+    size_t i;
+
+    if(len == 0 || len > 15)
+        return 0;
+    for(i = 0; i < len; i++) {
+        if(!(ch[i] >= '0' && ch[i] <= '9') && !(ch[i] >= 'A' && ch[i] <= 'Z') &&
+           !(ch[i] >= 'a' && ch[i] <= 'z') && ch[i] != '_')
+            return 0;
+    }
+    return 1;
+}
+
+static void
+start_stream(httpd *h, httpd_client *c, int switched)
+{
+    uint64_t head = h->head;
+
+    c->streaming = 1;
+    h->num_streaming++;
+    h->served++;
+    memcpy(c->out, stream_header, sizeof(stream_header) - 1);
+    c->out_len = sizeof(stream_header) - 1;
+
+    /* start where a decoder can: the latest RAP, else a packet boundary */
+    if(!switched && h->last_rap && head - h->last_rap < h->ring_size / 2)
+        c->pos = h->last_rap;
+    else if(h->sync && h->sync <= head && head - h->sync < h->ring_size / 2)
+        c->pos = h->sync;
+    else
+        c->pos = head;
+}
+
+/* parse the request once the header is complete */
+static void
+handle_request(httpd *h, httpd_client *c)
+{
+    char method[8], path[256];
+
+    if(sscanf(c->req, "%7s %255s", method, path) != 2) {
+        reply(c, "400 Bad Request", "text/plain", "bad request\n");
+        return;
+    }
+    if(strcmp(method, "GET")) {
+        reply(c, "405 Method Not Allowed", "text/plain", "GET only\n");
+        return;
+    }
+    if(!strcmp(path, "/") || !strcmp(path, "/stream")) {
+        start_stream(h, c, 0);
+        return;
+    }
+    if(!strncmp(path, "/ch/", 4)) {
+        const char *ch = path + 4;
+
+        if(!h->tune || !valid_channel(ch)) {
+            reply(c, "404 Not Found", "text/plain", "unknown channel\n");
+            return;
+        }
+        /* the tuner is shared: only switch it for a lone viewer */
+        if(h->num_streaming > 0) {
+            reply(c, "409 Conflict", "text/plain", "tuner in use\n");
+            return;
+        }
+        if(h->tune(h->tune_arg, ch) < 0) {
+            reply(c, "404 Not Found", "text/plain", "unknown channel\n");
+            return;
+        }
+        start_stream(h, c, 1);
+        return;
+    }
+    if(!strcmp(path, "/status")) {
+        char body[256];
+
+        snprintf(body, sizeof(body),
+                 "{\"clients\":%d,\"served\":%lu,\"dropped\":%lu,"
+                 "\"bytes\":%llu}\n",
+                 h->num_streaming, h->served, h->dropped,
+                 (unsigned long long)h->head);
+        reply(c, "200 OK", "application/json", body);
+        return;
+    }
+    reply(c, "404 Not Found", "text/plain", "not found\n");
+}
+
+/* EPOLLIN on a client: request bytes, or EOF */
+static int
+client_read(httpd *h, httpd_client *c)
+{
+    char discard[512];
+    ssize_t rc;
+
+    if(c->streaming || c->out_len) {
+        /* nothing more is expected; notice a hangup */
+        rc = recv(c->fd, discard, sizeof(discard), MSG_DONTWAIT);
+        return rc == 0 || (rc < 0 && errno != EAGAIN && errno != EINTR) ? -1 : 0;
+    }
+    rc = recv(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len,
+              MSG_DONTWAIT);
+    if(rc <= 0)
+        return rc < 0 && (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    c->req_len += rc;
+    c->req[c->req_len] = '\0';
+
+    if(strstr(c->req, "\r\n\r\n") || strstr(c->req, "\n\n"))
+        handle_request(h, c);
+    else if(c->req_len >= (int)sizeof(c->req) - 1)
+        reply(c, "431 Request Header Fields Too Large", "text/plain",
+              "request too large\n");
+    else
+        return 0;
+    return pump(h, c);
+}
+
+static void *
+httpd_thread(void *arg)
+{
+    httpd *h = arg;
+    struct epoll_event ev[MAX_EVENTS];
+    uint64_t seen = 0;
+    int i, n, timeout = 0;
+
+    while(!h->stop) {
+        httpd_client *c, *next;
+
+        n = epoll_wait(h->epfd, ev, MAX_EVENTS, timeout);
+        h->idle = 0;
+        for(i = 0; i < n; i++) {
+            if(ev[i].data.ptr == &h->lfd) {
+                accept_clients(h);
+                continue;
+            }
+            if(ev[i].data.ptr == &h->efd) {
+                uint64_t count;
+
+                if(read(h->efd, &count, sizeof(count)) < 0)
+                    ;   /* already cleared */
+                continue;
+            }
+            c = ev[i].data.ptr;
+            if(ev[i].events & (EPOLLERR | EPOLLHUP)) {
+                drop_client(h, c);
+                continue;
+            }
+            if((ev[i].events & EPOLLIN) && client_read(h, c) < 0) {
+                drop_client(h, c);
+                continue;
+            }
+            if((ev[i].events & EPOLLOUT) && pump(h, c) < 0)
+                drop_client(h, c);
+        }
+
+        /* feed clients that had caught up; a client blocked on a full
+           socket may not see EPOLLOUT for long, so check its lag here */
+        seen = h->head;
+        for(c = h->clients; c; c = next) {
+            next = c->next;
+            if(!c->streaming || c->pos >= seen)
+                continue;
+            if(c->want_out ? too_slow(h, c) : pump(h, c) < 0)
+                drop_client(h, c);
+        }
+
+        /* sleep until httpd_write kicks us, unless data arrived meanwhile */
+        h->idle = 1;
+        __sync_synchronize();
+        timeout = h->head != seen ? 0 : 1000;
+    }
+    return NULL;
+}
+
+void
+httpd_stop(httpd *h)
+{
+    uint64_t one = 1;
+
+    if(!h)
+        return;
+    h->stop = 1;
+    if(write(h->efd, &one, sizeof(one)) < 0)
+        ;
+    pthread_join(h->thread, NULL);
+    while(h->clients)
+        drop_client(h, h->clients);
+    close(h->epfd);
+    close(h->efd);
+    close(h->lfd);
+    free(h->ring);
+    free(h);
+}
@@ -0,0 +1,74 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _HTTPD_H_
+#define _HTTPD_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "rapscan.h"
+
+/*
+ * Live HTTP streaming for recpt1 --http.  The reader thread copies each
+ * block (after b25 and split) into a shared in-memory ring; one epoll
+ * thread serves every client straight out of that ring with
+ * non-blocking send(), so the recording path never waits on a socket.
+ * A client that falls more than HTTPD_MAX_LAG of the ring behind, or
+ * whose data is overwritten while being sent, is dropped.
+ *
+ *   GET /           live stream, starting at the latest random access
+ *   GET /ch/NAME    switch to channel NAME first (only client streaming)
+ *   GET /status     clients and counters as JSON
+ *
+ * head/reserved work as in the time-shift ring: the writer raises
+ * reserved before overwriting ring bytes and head after.
+ */
+
+#define HTTPD_REQ_MAX       2048
+#define HTTPD_SEND_MAX      (256 * 1024)
+#define HTTPD_MAX_LAG(ring) ((ring) / 4 * 3)
+
+typedef struct httpd_client {
+    int fd;
+    int streaming;
+    int want_out;           /* EPOLLOUT armed */
+    char req[HTTPD_REQ_MAX];
+    int req_len;
+    char out[512];          /* response header, or the status body */
+    int out_len;
+    int out_sent;
+    uint64_t pos;           /* next ring offset to send */
+    struct httpd_client *next;
+} httpd_client;
+
+/* returns 0 if the switch was requested, -1 for an unknown channel */
+typedef int (*httpd_tune_func)(void *arg, const char *channel);
+
+typedef struct httpd {
+    int lfd;                /* listening socket */
+    int efd;                /* eventfd: new data while idle */
+    int epfd;
+    uint8_t *ring;
+    size_t ring_size;
+    volatile uint64_t reserved;
+    volatile uint64_t head;         /* bytes published */
+    volatile uint64_t last_rap;     /* offset of the latest RAP */
+    volatile uint64_t sync;         /* a recent packet boundary */
+    volatile int idle;              /* server sleeps until kicked */
+    volatile int stop;
+    pthread_t thread;
+    httpd_client *clients;
+    int num_streaming;
+    unsigned long served;
+    unsigned long dropped;
+    httpd_tune_func tune;
+    void *tune_arg;
+} httpd;
+
+httpd *httpd_start(int port, size_t ring_size, httpd_tune_func tune,
+                   void *tune_arg);
+void httpd_write(httpd *h, const uint8_t *data, size_t len,
+                 const rapscan *rs);
+void httpd_stop(httpd *h);
+
+#endif
@@ -0,0 +1,1702 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* CPU_SET, pthread_setaffinity_np */
+#endif
+#include <stdio.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <libgen.h>
+
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <sys/ioctl.h>
+#include "pt1_ioctl.h"
+
+#include "config.h"
+#include "decoder.h"
+#include "recpt1core.h"
+#include "cnlut.h"
+#include "recpt1.h"
+#include "mkpath.h"
+
+#include "tssplitter_lite.h"
+#include "pipestat.h"
+#include "bcas.h"
+#include "librecpt1.h"
+
+/* maximum write length at once */
+#define SIZE_CHANK 1316
+
+static void pipeline_fail(thread_data *tdata, int err);
+
+/* tell the event listener, if any; never from under event_lock */
+static void
+pipeline_event(thread_data *tdata, const char *fmt, ...)
+{
+    char event[RECPT1_EVENT_MAX];
+    va_list ap;
+
+    if(!tdata->event)
+        return;
+    va_start(ap, fmt);
+    vsnprintf(event, sizeof(event), fmt, ap);
+    va_end(ap);
+    pthread_mutex_lock(&tdata->event_lock);
+    if(tdata->event)
+        tdata->event(tdata->event_arg, event);
+    pthread_mutex_unlock(&tdata->event_lock);
+}
+
+static double
+elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 +
+        (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static QUEUE_T *
+create_queue(size_t size, volatile int *f_exit)
+{
+    QUEUE_T *p_queue;
+    int memsize = sizeof(QUEUE_T) + size * sizeof(BUFSZ*);
+
+    p_queue = (QUEUE_T*)calloc(memsize, sizeof(char));
+
+    if(p_queue != NULL) {
+        p_queue->size = size;
+        p_queue->num_avail = size;
+        p_queue->num_used = 0;
+        p_queue->f_exit = f_exit;
+        pthread_mutex_init(&p_queue->mutex, NULL);
+        pthread_cond_init(&p_queue->cond_avail, NULL);
+        pthread_cond_init(&p_queue->cond_used, NULL);
+    }
+
+    return p_queue;
+}
+
+static void
+destroy_queue(QUEUE_T *p_queue)
+{
+    if(!p_queue)
+        return;
+
+    pthread_mutex_destroy(&p_queue->mutex);
+    pthread_cond_destroy(&p_queue->cond_avail);
+    pthread_cond_destroy(&p_queue->cond_used);
+    free(p_queue);
+}
+
+/* enqueue data. this function will block if queue is full.
+   returns 0, or -1 if the consumer took nothing for a second after
+   f_exit was set; data then still belongs to the caller. */
+static int
+enqueue(QUEUE_T *p_queue, BUFSZ *data)
+{
+    struct timeval now;
+    struct timespec spec;
+    int retry_count = 0;
+    int rc;
+
+    pthread_mutex_lock(&p_queue->mutex);
+    /* entered critical section */
+
+    /* the consumer is behind */
+    if(p_queue->num_avail == 0)
+        p_queue->stalls++;
+
+    /* wait while queue is full */
+    while(p_queue->num_avail == 0) {
+
+        gettimeofday(&now, NULL);
+        spec.tv_sec = now.tv_sec + 1;
+        spec.tv_nsec = now.tv_usec * 1000;
+
+        rc = pthread_cond_timedwait(&p_queue->cond_avail,
+                                    &p_queue->mutex, &spec);
+        if(p_queue->num_avail > 0)
+            break;
+        retry_count++;
+        if(retry_count > 60) {
+            fprintf(stderr, "Queue full for 60sec. giving up\n");
+            *p_queue->f_exit = TRUE;
+        }
+        /* a consumer still draining the queue gets the tail too */
+        if(*p_queue->f_exit && (rc == ETIMEDOUT || retry_count > 60)) {
+            pthread_mutex_unlock(&p_queue->mutex);
+            return -1;
+        }
+    }
+
+    p_queue->buffer[p_queue->in] = data;
+
+    /* move position marker for input to next position */
+    p_queue->in++;
+    p_queue->in %= p_queue->size;
+
+    /* update counters */
+    p_queue->num_avail--;
+    p_queue->num_used++;
+    if(p_queue->num_used > p_queue->hwm)
+        p_queue->hwm = p_queue->num_used;
+
+    /* leaving critical section */
+    pthread_mutex_unlock(&p_queue->mutex);
+    pthread_cond_signal(&p_queue->cond_used);
+    return 0;
+}
+
+/* queue the end of stream marker. if the queue stays full, set f_exit
+   and wake the consumer instead: dequeue() returns NULL once the queue
+   is empty and f_exit is set, so the consumer ends either way. */
+static void
+enqueue_end(QUEUE_T *p_queue)
+{
+    if(enqueue(p_queue, NULL) == 0)
+        return;
+    pthread_mutex_lock(&p_queue->mutex);
+    *p_queue->f_exit = TRUE;
+    pthread_mutex_unlock(&p_queue->mutex);
+    pthread_cond_broadcast(&p_queue->cond_used);
+}
+
+/* dequeue data. this function will block if queue is empty. */
+static BUFSZ *
+dequeue(QUEUE_T *p_queue)
+{
+    struct timeval now;
+    struct timespec spec;
+    BUFSZ *buffer;
+    int retry_count = 0;
+
+    pthread_mutex_lock(&p_queue->mutex);
+    /* entered the critical section*/
+
+    /* wait while queue is empty */
+    while(p_queue->num_used == 0) {
+
+        gettimeofday(&now, NULL);
+        spec.tv_sec = now.tv_sec + 1;
+        spec.tv_nsec = now.tv_usec * 1000;
+
+        pthread_cond_timedwait(&p_queue->cond_used,
+                               &p_queue->mutex, &spec);
+        retry_count++;
+        if(retry_count > 60) {
+            fprintf(stderr, "No data for 60sec. giving up\n");
+            *p_queue->f_exit = TRUE;
+        }
+        if(*p_queue->f_exit) {
+            pthread_mutex_unlock(&p_queue->mutex);
+            return NULL;
+        }
+    }
+
+    /* take buffer address */
+    buffer = p_queue->buffer[p_queue->out];
+
+    /* move position marker for output to next position */
+    p_queue->out++;
+    p_queue->out %= p_queue->size;
+
+    /* update counters */
+    p_queue->num_avail++;
+    p_queue->num_used--;
+
+    /* leaving the critical section */
+    pthread_mutex_unlock(&p_queue->mutex);
+    /* wake both enqueue() and wait_queue_drain() */
+    pthread_cond_broadcast(&p_queue->cond_avail);
+
+    return buffer;
+}
+
+/* block until the reader thread has taken every queued buffer. */
+static void
+wait_queue_drain(QUEUE_T *p_queue)
+{
+    struct timeval now;
+    struct timespec spec;
+
+    pthread_mutex_lock(&p_queue->mutex);
+    while(p_queue->num_used > 0 && !*p_queue->f_exit) {
+        gettimeofday(&now, NULL);
+        spec.tv_sec = now.tv_sec + 1;
+        spec.tv_nsec = now.tv_usec * 1000;
+
+        pthread_cond_timedwait(&p_queue->cond_avail,
+                               &p_queue->mutex, &spec);
+    }
+    pthread_mutex_unlock(&p_queue->mutex);
+}
+
+/* copy decoder output into queue buffers. the decoder reuses dbuf on
+   the next call, so it cannot be handed over as is.
+   returns -1 if the queue gave up or memory ran out. */
+static int
+enqueue_copy(QUEUE_T *p_queue, const ARIB_STD_B25_BUFFER *dbuf)
+{
+    int offset = 0;
+    BUFSZ *bufptr;
+
+    while(offset < dbuf->size) {
+        int len = dbuf->size - offset;
+        if(len > MAX_READ_SIZE)
+            len = MAX_READ_SIZE;
+        bufptr = malloc(sizeof(BUFSZ));
+        if(!bufptr) {
+            *p_queue->f_exit = TRUE;
+            return -1;
+        }
+        memcpy(bufptr->buffer, dbuf->data + offset, len);
+        bufptr->size = len;
+        if(enqueue(p_queue, bufptr) < 0) {
+            free(bufptr);
+            return -1;
+        }
+        offset += len;
+    }
+    return 0;
+}
+
+/* pin the calling thread to one cpu. -1 leaves it unpinned. */
+static void
+set_thread_cpu(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+
+    if(cpu < 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        fprintf(stderr, "Cannot bind decoder to cpu %d\n", cpu);
+    else
+        fprintf(stderr, "decoder bound to cpu %d\n", cpu);
+#endif
+}
+
+/* choose a cpu for the decoder. "auto" spreads tuners over the online
+   cpus by device minor number so concurrent recordings use separate cores. */
+static int
+pick_decode_cpu(const char *arg, int tfd)
+{
+    struct stat st;
+    long ncpu;
+
+    if(strcmp(arg, "auto"))
+        return atoi(arg);
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if(ncpu <= 1 || fstat(tfd, &st) < 0)
+        return -1;
+    return minor(st.st_rdev) % ncpu;
+}
+
+/* this function will be decoder thread.
+   descrambling is stateful, so one stream has exactly one decoder thread
+   and buffers stay in capture order. */
+static void *
+decoder_func(void *p)
+{
+    thread_data *tdata = (thread_data *)p;
+    QUEUE_T *in_queue = tdata->queue;
+    QUEUE_T *out_queue = tdata->dec_queue;
+    decoder *dec = tdata->decoder;
+    boolean use_b25 = TRUE;
+    BUFSZ *qbuf;
+    ARIB_STD_B25_BUFFER sbuf, dbuf;
+    uint64_t start;
+    int code;
+
+    set_thread_cpu(tdata->decode_cpu);
+
+    while(1) {
+        qbuf = dequeue(in_queue);
+        /* end of stream */
+        if(qbuf == NULL)
+            break;
+
+        if(!use_b25) {
+            if(enqueue(out_queue, qbuf) < 0) {
+                free(qbuf);
+                break;
+            }
+            continue;
+        }
+
+        sbuf.data = qbuf->buffer;
+        sbuf.size = qbuf->size;
+        start = pipestat_now();
+        code = b25_decode(dec, &sbuf, &dbuf);
+        if(code < 0) {
+            pipestat_error(&tdata->stat, STAGE_DECODE);
+            fprintf(stderr, "b25_decode failed (code=%d). fall back to encrypted recording.\n", code);
+            use_b25 = FALSE;
+            if(enqueue(out_queue, qbuf) < 0) {
+                free(qbuf);
+                break;
+            }
+            continue;
+        }
+        pipestat_add(&tdata->stat, STAGE_DECODE, start, sbuf.size, dbuf.size);
+        free(qbuf);
+        if(enqueue_copy(out_queue, &dbuf) < 0) {
+            /* the writer is gone: nothing left to finish */
+            use_b25 = FALSE;
+            break;
+        }
+    }
+
+    if(use_b25) {
+        code = b25_finish(dec, &sbuf, &dbuf);
+        if(code < 0)
+            fprintf(stderr, "b25_finish failed\n");
+        else
+            enqueue_copy(out_queue, &dbuf);
+    }
+
+    tdata->dec_done = TRUE;
+    enqueue_end(out_queue);
+
+    return NULL;
+}
+
+/* let the driver drop what the splitter and b25 --strip would throw away
+   anyway, so it never crosses the DMA ring, read() or the queue.
+   reset: load the filter even if it lets everything through.
+   returns -1 if the driver has no PID filter. */
+static int
+set_pid_filter(thread_data *tdata, splitter *sp, boolean reset)
+{
+    PID_FILTER filter;
+    int pid;
+
+    memset(&filter, 0, sizeof(filter));
+    if(tdata->decoder && tdata->dopt.strip)
+        filter.flags |= PID_FILTER_DROP_NULL;
+    /* EMM PIDs come from the CAT and are not known to the splitter */
+    if(sp && !(tdata->decoder && tdata->dopt.emm)) {
+        filter.flags |= PID_FILTER_ENABLE;
+        PID_FILTER_SET(&filter, 0x0000);    /* PAT */
+        PID_FILTER_SET(&filter, 0x0001);    /* CAT */
+        for(pid = 0; pid < MAX_PID; pid++) {
+            if(sp->pids[pid] || sp->pmt_pids[pid])
+                PID_FILTER_SET(&filter, pid);
+        }
+        if(!sp->pids[0x1fff])
+            filter.flags |= PID_FILTER_DROP_NULL;
+    }
+    if(!filter.flags && !reset)
+        return 0;
+
+    if(ioctl(tdata->tuner->tfd, SET_PID_FILTER, &filter) < 0) {
+        fprintf(stderr, "PID filter not supported by the driver\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* this function will be reader thread */
+static void *
+reader_func(void *p)
+{
+    thread_data *tdata = (thread_data *)p;
+    /* with a decoder thread, read its output instead of the capture queue */
+    QUEUE_T *p_queue = tdata->dec_queue ? tdata->dec_queue : tdata->queue;
+    decoder *dec = tdata->dec_queue ? NULL : tdata->decoder;
+    splitter *splitter = tdata->splitter;
+    int wfd = tdata->wfd;
+    boolean use_b25 = dec ? TRUE : FALSE;
+    udpout *udp = tdata->udp;
+    boolean fileless = FALSE;
+    boolean use_splitter = splitter ? TRUE : FALSE;
+    timeshift *tshift = tdata->tshift;
+    tsindex *tindex = tdata->tindex;
+    segmenter *segment = tdata->segment;
+    httpd *httpd = tdata->httpd;
+    shmring *shm = tdata->shm;
+    pipeout *pout = tdata->pout;
+    /* arrival stamps go back in front of each packet, for m2ts output
+       and udp pacing */
+    arrival *stamps = tdata->arrival && tdata->arrival->m2ts ? tdata->arrival : NULL;
+    boolean m2ts = stamps && tdata->m2ts;
+    const uint8_t *sdata;
+    size_t slen;
+    rapscan *rscan = NULL;
+    BUFSZ *qbuf;
+    splitbuf_t splitbuf;
+    ARIB_STD_B25_BUFFER sbuf, dbuf, buf;
+    int code;
+    int split_select_finish = TSS_ERROR;
+    int filter_gen = 0;     /* splitter->pid_gen the driver filter matches */
+    time_t split_start = tdata->start_time;
+    uint64_t start;
+
+    buf.size = 0;
+    buf.data = NULL;
+    splitbuf.buffer_size = 0;
+    splitbuf.buffer = NULL;
+
+    if(wfd == -1)
+        fileless = TRUE;
+
+    /* nothing to select yet; just drop null packets if b25 strips them */
+    if(!use_splitter && set_pid_filter(tdata, NULL, FALSE) < 0)
+        filter_gen = -1;
+
+    /* the writers place cuts and index entries on random access points */
+    if(segment || tindex || tshift || httpd || shm)
+        rscan = rapscan_create(use_splitter ? splitter->stream_type : NULL);
+
+    while(1) {
+        ssize_t wc = 0;
+        int file_err = 0;
+        qbuf = dequeue(p_queue);
+        /* no entry in the queue */
+        if(qbuf == NULL) {
+            /* keep going until the decoder has flushed */
+            if(tdata->dec_queue && !tdata->dec_done)
+                continue;
+            break;
+        }
+
+        /* a new SID selection from recpt1_pipeline_set_sid() */
+        if(tdata->sid_change) {
+            struct splitter *old = splitter;
+            char sid[RECPT1_EVENT_MAX];
+
+            pthread_mutex_lock(&tdata->sid_lock);
+            splitter = tdata->sid_next;
+            tdata->sid_next = NULL;
+            tdata->sid_change = FALSE;
+            tdata->splitter = splitter;
+            snprintf(sid, sizeof(sid), "%s", tdata->sid ? tdata->sid : "off");
+            pthread_mutex_unlock(&tdata->sid_lock);
+            if(old)
+                split_shutdown(old);
+
+            use_splitter = splitter ? TRUE : FALSE;
+            split_select_finish = TSS_ERROR;
+            time(&split_start);
+            /* the new programs may use PIDs the driver drops now */
+            if(filter_gen >= 0) {
+                filter_gen = 0;
+                if(set_pid_filter(tdata, NULL, TRUE) < 0)
+                    filter_gen = -1;
+            }
+            if(rscan)
+                rscan->stream_type = use_splitter ? splitter->stream_type :
+                    rscan->own_type;
+            pipeline_event(tdata, "sid %s", sid);
+        }
+
+        /* a channel switch cleared the driver filter: load it again */
+        if(tdata->filter_reset) {
+            tdata->filter_reset = FALSE;
+            if(filter_gen >= 0) {
+                filter_gen = 0;
+                if(!use_splitter && set_pid_filter(tdata, NULL, FALSE) < 0)
+                    filter_gen = -1;
+            }
+        }
+
+        sbuf.data = qbuf->buffer;
+        sbuf.size = qbuf->size;
+
+        buf = sbuf; /* default */
+
+        if(use_b25) {
+            start = pipestat_now();
+            code = b25_decode(dec, &sbuf, &dbuf);
+            if(code < 0) {
+                pipestat_error(&tdata->stat, STAGE_DECODE);
+                fprintf(stderr, "b25_decode failed (code=%d). fall back to encrypted recording.\n", code);
+                use_b25 = FALSE;
+            }
+            else {
+                pipestat_add(&tdata->stat, STAGE_DECODE, start, sbuf.size, dbuf.size);
+                buf = dbuf;
+            }
+        }
+
+
+        if(use_splitter) {
+            int split_in = buf.size;
+
+            start = pipestat_now();
+            splitbuf.buffer_filled = 0;
+
+            /* allocate split buffer */
+            if(splitbuf.buffer_size < buf.size && buf.size > 0) {
+                splitbuf.buffer = realloc(splitbuf.buffer, buf.size);
+                if(splitbuf.buffer == NULL) {
+                    fprintf(stderr, "split buffer allocation failed\n");
+                    use_splitter = FALSE;
+                    goto fin;
+                }
+            }
+
+            while(buf.size) {
+                /* 分離対象PIDの抽出 */
+                if(split_select_finish != TSS_SUCCESS) {
+                    split_select_finish = split_select(splitter, &buf);
+                    if(split_select_finish == TSS_NULL) {
+                        /* mallocエラー発生 */
+                        fprintf(stderr, "split_select malloc failed\n");
+                        use_splitter = FALSE;
+                        goto fin;
+                    }
+                    else if(split_select_finish != TSS_SUCCESS) {
+                        /* 分離対象PIDが完全に抽出できるまで出力しない
+                         * 1秒程度余裕を見るといいかも
+                         */
+                        time_t cur_time;
+                        time(&cur_time);
+                        if(cur_time - split_start > 4) {
+                            use_splitter = FALSE;
+                            goto fin;
+                        }
+                        break;
+                    }
+                }
+
+                /* 分離対象以外をふるい落とす */
+                code = split_ts(splitter, &buf, &splitbuf);
+                if(code == TSS_NULL) {
+                    fprintf(stderr, "PMT reading..\n");
+                }
+                else if(code != TSS_SUCCESS) {
+                    pipestat_error(&tdata->stat, STAGE_SPLIT);
+                    fprintf(stderr, "split_ts failed\n");
+                    break;
+                }
+
+                break;
+            } /* while */
+
+            buf.size = splitbuf.buffer_filled;
+            buf.data = splitbuf.buffer;
+            pipestat_add(&tdata->stat, STAGE_SPLIT, start, split_in, buf.size);
+        fin:
+            ;
+        } /* if */
+
+        /* narrow the driver filter whenever the splitter settles its PIDs */
+        if(use_splitter && filter_gen >= 0 &&
+           split_select_finish == TSS_SUCCESS &&
+           splitter->pid_gen != filter_gen) {
+            if(set_pid_filter(tdata, splitter, FALSE) < 0)
+                filter_gen = -1;
+            else
+                filter_gen = splitter->pid_gen;
+        }
+
+        /* seek indexes and the udp pacer follow the PCR_PID of the PMT */
+        if(use_splitter && splitter->pcr_pid < MAX_PID - 1) {
+            if(tindex)
+                tsindex_set_pcr_pid(tindex, splitter->pcr_pid);
+            if(tshift)
+                timeshift_set_pcr_pid(tshift, splitter->pcr_pid);
+            if(udp)
+                udpout_set_pcr_pid(udp, splitter->pcr_pid);
+        }
+
+        if(rscan) {
+            start = pipestat_now();
+            rapscan_chunk(rscan, buf.data, buf.size);
+            pipestat_add(&tdata->stat, STAGE_SCAN, start, buf.size, buf.size);
+        }
+
+        if(tdata->pidstat) {
+            start = pipestat_now();
+            pidstat_chunk(tdata->pidstat, buf.data, buf.size);
+            pipestat_add(&tdata->stat, STAGE_ANALYZE, start, buf.size,
+                         buf.size);
+        }
+
+        /* one pass over the stamps serves the file and udp */
+        sdata = stamps ? arrival_m2ts(stamps, buf.data, buf.size, &slen) : NULL;
+
+
+        if(!fileless) {
+            /* write data to output file */
+            const uint8_t *wdata = buf.data;
+            int size_remain = buf.size;
+            int offset = 0;
+
+            start = pipestat_now();
+            if(m2ts) {
+                wdata = sdata;
+                size_remain = sdata ? slen : 0;
+            }
+            if(pout && size_remain > 0) {
+                /* the capture buffer itself goes down the pipe */
+                if(wdata == qbuf->buffer) {
+                    wc = pipeout_give(pout, wdata, size_remain, qbuf);
+                    if(wc == 0)
+                        qbuf = NULL;
+                }
+                else
+                    wc = pipeout_write(pout, wdata, size_remain);
+                if(wc < 0) {
+                    perror("vmsplice");
+                    file_err = 1;
+                    pipestat_error(&tdata->stat, STAGE_WRITE);
+                    pipeline_fail(tdata, errno);
+                }
+                else
+                    offset = size_remain;
+                size_remain = 0;
+            }
+            while(size_remain > 0) {
+                int ws = size_remain < SIZE_CHANK ? size_remain : SIZE_CHANK;
+
+                wc = write(wfd, wdata + offset, ws);
+                if(wc < 0) {
+                    perror("write");
+                    file_err = 1;
+                    pipestat_error(&tdata->stat, STAGE_WRITE);
+                    pipeline_fail(tdata, errno);
+                    break;
+                }
+                size_remain -= wc;
+                offset += wc;
+            }
+            pipestat_add(&tdata->stat, STAGE_WRITE, start, buf.size, offset);
+            if(tindex && tsindex_add(tindex, buf.data, offset, rscan) < 0) {
+                perror("index");
+                tdata->tindex = tindex = NULL;
+            }
+        }
+
+        if(tshift) {
+            /* write data to time-shift ring */
+            start = pipestat_now();
+            if(timeshift_write(tshift, buf.data, buf.size, rscan) < 0) {
+                perror("timeshift");
+                file_err = 1;
+                pipestat_error(&tdata->stat, STAGE_WRITE);
+                pipeline_fail(tdata, errno);
+            }
+            else
+                pipestat_add(&tdata->stat, STAGE_WRITE, start, buf.size, buf.size);
+        }
+
+        if(segment) {
+            /* write data to the current segment */
+            start = pipestat_now();
+            if(segment_write(segment, buf.data, buf.size, rscan) < 0) {
+                perror("segment");
+                file_err = 1;
+                pipestat_error(&tdata->stat, STAGE_WRITE);
+                pipeline_fail(tdata, errno);
+            }
+            else
+                pipestat_add(&tdata->stat, STAGE_WRITE, start, buf.size, buf.size);
+        }
+
+        if(udp) {
+            /* queue for the paced sender, or send right away */
+            start = pipestat_now();
+            if(stamps)
+                wc = sdata ? udpout_write_m2ts(udp, sdata, slen) : 0;
+            else
+                wc = udpout_write(udp, buf.data, buf.size);
+            if(wc < 0) {
+                pipestat_error(&tdata->stat, STAGE_UDP);
+                if(errno == EPIPE)
+                    pipeline_fail(tdata, EPIPE);
+            }
+            else
+                pipestat_add(&tdata->stat, STAGE_UDP, start, buf.size, buf.size);
+        }
+
+        if(httpd) {
+            /* publish to http clients */
+            start = pipestat_now();
+            httpd_write(httpd, buf.data, buf.size, rscan);
+            pipestat_add(&tdata->stat, STAGE_HTTP, start, buf.size, buf.size);
+        }
+
+        if(shm) {
+            /* publish to local readers */
+            start = pipestat_now();
+            shmring_write(shm, buf.data, buf.size, rscan);
+            pipestat_add(&tdata->stat, STAGE_SHM, start, buf.size, buf.size);
+        }
+
+        /* given to the pipe: freed once the consumer has read it */
+        free(qbuf);
+        qbuf = NULL;
+
+        /* normal exit */
+        if((tdata->f_exit && !p_queue->num_used &&
+            (!tdata->dec_queue || tdata->dec_done)) || file_err) {
+
+            /* the decoder thread has already flushed b25 */
+            if(tdata->dec_queue) {
+                if(use_splitter) {
+                    free(splitbuf.buffer);
+                    splitbuf.buffer = NULL;
+                    splitbuf.buffer_size = 0;
+                }
+                break;
+            }
+
+            buf = sbuf; /* default */
+
+            if(use_b25) {
+                code = b25_finish(dec, &sbuf, &dbuf);
+                if(code < 0)
+                    fprintf(stderr, "b25_finish failed\n");
+                else
+                    buf = dbuf;
+            }
+
+            if(use_splitter) {
+                /* 分離対象以外をふるい落とす */
+                code = split_ts(splitter, &buf, &splitbuf);
+                if(code == TSS_NULL) {
+                    split_select_finish = TSS_ERROR;
+                    fprintf(stderr, "PMT reading..\n");
+                }
+                else if(code != TSS_SUCCESS) {
+                    fprintf(stderr, "split_ts failed\n");
+                    break;
+                }
+
+                buf.data = splitbuf.buffer;
+                buf.size = splitbuf.buffer_size;
+            }
+
+            if(rscan)
+                rapscan_chunk(rscan, buf.data, buf.size);
+            if(tdata->pidstat)
+                pidstat_chunk(tdata->pidstat, buf.data, buf.size);
+
+            sdata = stamps ? arrival_m2ts(stamps, buf.data, buf.size, &slen) : NULL;
+
+            if(!fileless && !file_err) {
+                if(m2ts) {
+                    if(!sdata)
+                        wc = 0;
+                    else if(pout)
+                        wc = pipeout_write(pout, sdata, slen) < 0 ? -1 : slen;
+                    else
+                        wc = write(wfd, sdata, slen);
+                }
+                else if(pout)
+                    wc = pipeout_write(pout, buf.data, buf.size) < 0 ?
+                        -1 : buf.size;
+                else
+                    wc = write(wfd, buf.data, buf.size);
+                if(wc < 0) {
+                    perror("write");
+                    file_err = 1;
+                    pipeline_fail(tdata, errno);
+                }
+                else if(tindex)
+                    tsindex_add(tindex, buf.data, wc, rscan);
+            }
+
+            if(tshift && !file_err)
+                timeshift_write(tshift, buf.data, buf.size, rscan);
+
+            if(segment && !file_err)
+                segment_write(segment, buf.data, buf.size, rscan);
+
+            if(httpd)
+                httpd_write(httpd, buf.data, buf.size, rscan);
+
+            if(shm)
+                shmring_write(shm, buf.data, buf.size, rscan);
+
+            if(udp) {
+                if(stamps)
+                    wc = sdata ? udpout_write_m2ts(udp, sdata, slen) : 0;
+                else
+                    wc = udpout_write(udp, buf.data, buf.size);
+                if(wc < 0 && errno == EPIPE)
+                    pipeline_fail(tdata, EPIPE);
+            }
+
+            if(use_splitter) {
+                free(splitbuf.buffer);
+                splitbuf.buffer = NULL;
+                splitbuf.buffer_size = 0;
+            }
+
+            break;
+        }
+    }
+
+    rapscan_destroy(rscan);
+
+    time_t cur_time;
+    time(&cur_time);
+    fprintf(stderr, "Recorded %dsec\n",
+            (int)(cur_time - tdata->start_time));
+
+    return NULL;
+}
+
+/* raw recording: splice the tuner into a pipe and the pipe into the
+   output, so the stream never passes through userspace buffers.
+   returns -1 before anything is read if the driver cannot splice. */
+static int
+splice_record(thread_data *tdata)
+{
+    int pfd[2];
+    ssize_t n, w, remain;
+    boolean spliced = FALSE;
+    boolean stopping = FALSE;
+    uint64_t start;
+    time_t cur_time;
+
+    if(pipe(pfd) < 0)
+        return -1;
+    /* a bigger pipe takes a whole wakeup of the driver in one call */
+    fcntl(pfd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+    while(!tdata->f_exit) {
+        start = pipestat_now();
+        n = splice(tdata->tuner->tfd, NULL, pfd[1], NULL, SPLICE_PIPE_SIZE,
+                   SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            if(!spliced) {
+                close(pfd[0]);
+                close(pfd[1]);
+                return -1;
+            }
+            perror("splice");
+            pipestat_error(&tdata->stat, STAGE_READ);
+            break;
+        }
+        spliced = TRUE;
+        if(n > 0)
+            pipestat_add(&tdata->stat, STAGE_READ, start, SPLICE_PIPE_SIZE, n);
+        else
+            pipestat_error(&tdata->stat, STAGE_READ);
+
+        /* drain the pipe into the output */
+        start = pipestat_now();
+        for(remain = n; remain > 0; remain -= w) {
+            w = splice(pfd[0], NULL, tdata->wfd, NULL, remain,
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+            if(w < 0 && errno == EINTR) {
+                w = 0;
+                continue;
+            }
+            if(w <= 0) {
+                perror("write");
+                pipestat_error(&tdata->stat, STAGE_WRITE);
+                pipeline_fail(tdata, errno);
+                goto done;
+            }
+        }
+        if(n > 0)
+            pipestat_add(&tdata->stat, STAGE_WRITE, start, n, n);
+
+        /* stop recording, then take what the driver still holds */
+        if(stopping && n == 0)
+            break;
+        time(&cur_time);
+        if(!stopping && !tdata->indefinite &&
+           (cur_time - tdata->start_time) >= tdata->recsec) {
+            ioctl(tdata->tuner->tfd, STOP_REC, 0);
+            stopping = TRUE;
+        }
+    }
+done:
+    close(pfd[0]);
+    close(pfd[1]);
+    return 0;
+}
+
+/* a stage failed: end the recording and keep the first error for
+   recpt1_pipeline_wait() */
+static void
+pipeline_fail(thread_data *tdata, int err)
+{
+    if(!err)
+        err = EIO;
+    if(__sync_bool_compare_and_swap(&tdata->error, 0, err)) {
+        if(err == EPIPE)
+            fprintf(stderr, "\nBroken pipe. cleaning up...\n");
+        else
+            fprintf(stderr, "Detected an error. cleaning up...\n");
+        pipeline_event(tdata, "error %d", err);
+    }
+    recpt1_pipeline_stop(tdata);
+}
+
+/* this function will be capture thread: tuner -> queue */
+static void *
+capture_func(void *p)
+{
+    thread_data *tdata = (thread_data *)p;
+    QUEUE_T *p_queue = tdata->queue;
+    BUFSZ *bufptr;
+    uint64_t read_start;
+    time_t cur_time;
+
+    /* nothing to do in userspace: let the kernel move the data.  the
+       reader never sees it, so no SID selection can be made meanwhile */
+    pthread_mutex_lock(&tdata->sid_lock);
+    tdata->spliced = tdata->use_splice && !tdata->decoder &&
+        !tdata->splitter && !tdata->sid_change &&
+        !tdata->udp && tdata->wfd >= 0 && !tdata->arrival &&
+        !tdata->tshift && !tdata->segment && !tdata->tindex &&
+        !tdata->httpd && !tdata->shm && !tdata->pidstat;
+    pthread_mutex_unlock(&tdata->sid_lock);
+    if(tdata->spliced) {
+        if(splice_record(tdata) == 0) {
+            tdata->f_exit = TRUE;
+            enqueue_end(p_queue);
+        }
+        else {
+            pthread_mutex_lock(&tdata->sid_lock);
+            tdata->spliced = FALSE;
+            pthread_mutex_unlock(&tdata->sid_lock);
+        }
+    }
+
+    /* read from tuner */
+    while(1) {
+        if(tdata->f_exit)
+            break;
+
+        time(&cur_time);
+        bufptr = malloc(sizeof(BUFSZ));
+        if(!bufptr) {
+            tdata->f_exit = TRUE;
+            break;
+        }
+        read_start = pipestat_now();
+        bufptr->size = read(tdata->tuner->tfd, bufptr->buffer, MAX_READ_SIZE);
+        if(bufptr->size > 0)
+            pipestat_add(&tdata->stat, STAGE_READ, read_start, MAX_READ_SIZE,
+                         bufptr->size);
+        else
+            pipestat_error(&tdata->stat, STAGE_READ);
+        if(tdata->arrival && bufptr->size > 0)
+            bufptr->size = arrival_strip(tdata->arrival, bufptr->buffer,
+                                         bufptr->size);
+        if(bufptr->size <= 0) {
+            if((cur_time - tdata->start_time) >= tdata->recsec && !tdata->indefinite) {
+                tdata->f_exit = TRUE;
+                enqueue_end(p_queue);
+                break;
+            }
+            else {
+                free(bufptr);
+                continue;
+            }
+        }
+        if(enqueue(p_queue, bufptr) < 0) {
+            free(bufptr);
+            break;
+        }
+
+        /* stop recording */
+        time(&cur_time);
+        if((cur_time - tdata->start_time) >= tdata->recsec && !tdata->indefinite) {
+            ioctl(tdata->tuner->tfd, STOP_REC, 0);
+            /* read remaining data */
+            while(1) {
+                bufptr = malloc(sizeof(BUFSZ));
+                if(!bufptr) {
+                    tdata->f_exit = TRUE;
+                    break;
+                }
+                read_start = pipestat_now();
+                bufptr->size = read(tdata->tuner->tfd, bufptr->buffer,
+                                    MAX_READ_SIZE);
+                if(bufptr->size <= 0) {
+                    free(bufptr);
+                    tdata->f_exit = TRUE;
+                    enqueue_end(p_queue);
+                    break;
+                }
+                pipestat_add(&tdata->stat, STAGE_READ, read_start,
+                             MAX_READ_SIZE, bufptr->size);
+                if(tdata->arrival)
+                    bufptr->size = arrival_strip(tdata->arrival, bufptr->buffer,
+                                                 bufptr->size);
+                if(enqueue(p_queue, bufptr) < 0) {
+                    free(bufptr);
+                    break;
+                }
+            }
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* destfile: a time-shift ring, segments, stdout or a plain file */
+static int
+open_output(thread_data *tdata, const recpt1_options *opt)
+{
+    const char *destfile = opt->destfile;
+    char *path;
+
+    if(opt->timeshift_mb > 0) {
+        if(!destfile || !strcmp("-", destfile)) {
+            fprintf(stderr, "--timeshift needs a ring file\n");
+            return -1;
+        }
+        tdata->tshift = timeshift_create(destfile,
+                                         (uint64_t)opt->timeshift_mb << 20,
+                                         opt->timeshift_interval);
+        if(!tdata->tshift) {
+            fprintf(stderr, "Cannot open time-shift ring: %s\n", destfile);
+            return -1;
+        }
+        fprintf(stderr, "Time-shift ring: %s (%ldMB)\n", destfile,
+                opt->timeshift_mb);
+    }
+    else if(opt->segment_sec > 0 || opt->segment_mb > 0) {
+        if(!destfile || !strcmp("-", destfile)) {
+            fprintf(stderr, "Segmented output needs a file name\n");
+            return -1;
+        }
+        path = strdup(destfile);
+        if(mkpath(dirname(path), 0777) == -1)
+            perror("mkpath");
+        free(path);
+
+        tdata->segment = segment_open(destfile, opt->segment_sec,
+                                      opt->segment_mb, opt->segment_rap,
+                                      opt->playlist);
+        if(!tdata->segment)
+            return -1;
+        if(opt->index_interval)
+            fprintf(stderr, "--index is not supported with segmented output\n");
+    }
+    else if(destfile && !strcmp("-", destfile)) {
+        tdata->use_stdout = TRUE;
+        tdata->wfd = 1; /* stdout */
+    }
+    else if(destfile) {
+        path = strdup(destfile);
+        if(mkpath(dirname(path), 0777) == -1)
+            perror("mkpath");
+        free(path);
+
+        tdata->wfd = open(destfile, (O_RDWR | O_CREAT | O_TRUNC), 0666);
+        if(tdata->wfd < 0) {
+            fprintf(stderr, "Cannot open output file: %s\n", destfile);
+            return -1;
+        }
+        if(opt->index_interval) {
+            char *ipath = malloc(strlen(destfile) + sizeof(TSINDEX_EXT));
+
+            if(ipath) {
+                sprintf(ipath, "%s%s", destfile, TSINDEX_EXT);
+                tdata->tindex = tsindex_create(ipath, opt->index_interval);
+                free(ipath);
+            }
+            if(!tdata->tindex)
+                fprintf(stderr, "Cannot create seek index, recording without it\n");
+        }
+    }
+    return 0;
+}
+
+/* http /ch/NAME without an http_tune of the caller: switch right away */
+static int
+http_switch(void *arg, const char *channel)
+{
+    return recpt1_pipeline_switch((recpt1_pipeline *)arg, channel);
+}
+
+void
+recpt1_options_init(recpt1_options *opt)
+{
+    memset(opt, 0, sizeof(recpt1_options));
+    opt->recsec = -1;
+    opt->round = 4;
+    opt->udp_port = 1234;
+    opt->timeshift_interval = 500;
+    opt->http_ring_mb = 32;
+    opt->shm_ring_mb = 16;
+    opt->splice = TRUE;
+    opt->pipe_mb = 1;
+    opt->udp_pace = TRUE;
+}
+
+recpt1_pipeline *
+recpt1_pipeline_create(recpt1_tuner *t, const recpt1_options *opt)
+{
+    thread_data *tdata;
+
+    if(t->tfd < 0) {
+        fprintf(stderr, "Tuner is not tuned\n");
+        return NULL;
+    }
+    if(!opt->destfile && !opt->udp_host && !opt->http_port &&
+       !opt->shm_name) {
+        fprintf(stderr, "No output\n");
+        return NULL;
+    }
+
+    tdata = calloc(1, sizeof(thread_data));
+    if(!tdata)
+        return NULL;
+    tdata->tuner = t;
+    tdata->wfd = -1;
+    tdata->recsec = opt->recsec;
+    tdata->indefinite = opt->recsec == -1 ? TRUE : FALSE;
+    tdata->use_splice = opt->splice ? TRUE : FALSE;
+    tdata->decode_cpu = -1;
+    tdata->dopt.round = opt->round;
+    tdata->dopt.strip = opt->strip;
+    tdata->dopt.emm = opt->emm;
+    pthread_mutex_init(&tdata->switch_lock, NULL);
+    pthread_mutex_init(&tdata->sid_lock, NULL);
+    pthread_mutex_init(&tdata->event_lock, NULL);
+
+    tdata->queue = create_queue(MAX_QUEUE, &tdata->f_exit);
+    if(!tdata->queue)
+        goto fail;
+
+    /* open output file */
+    if(open_output(tdata, opt) < 0)
+        goto fail;
+
+    /* initialize decoder */
+    if(opt->b25) {
+        tdata->decoder = b25_startup(&tdata->dopt);
+        if(!tdata->decoder) {
+            fprintf(stderr, "Cannot start b25 decoder\n");
+            fprintf(stderr, "Fall back to encrypted recording\n");
+        }
+    }
+    /* decoder runs as its own stage */
+    if(tdata->decoder) {
+        tdata->dec_queue = create_queue(MAX_DEC_QUEUE, &tdata->f_exit);
+        if(!tdata->dec_queue)
+            goto fail;
+        if(opt->decode_cpu)
+            tdata->decode_cpu = pick_decode_cpu(opt->decode_cpu, t->tfd);
+    }
+    /* initialize splitter */
+    if(opt->sid) {
+        tdata->splitter = split_startup((char *)opt->sid);
+        if(!tdata->splitter || tdata->splitter->sid_list == NULL) {
+            fprintf(stderr, "Cannot start TS splitter\n");
+            goto fail;
+        }
+        tdata->sid = strdup(opt->sid);
+    }
+
+    /* initialize udp connection */
+    if(opt->udp_host) {
+        udpout_options uopt;
+
+        udpout_options_init(&uopt);
+        uopt.rtp = opt->udp_rtp;
+        uopt.ttl = opt->udp_ttl;
+        uopt.iface = opt->udp_iface;
+        uopt.pace = opt->udp_pace;
+        uopt.txtime = opt->udp_txtime;
+        uopt.delay_ms = opt->udp_delay_ms;
+        tdata->udp = udpout_open(opt->udp_host, opt->udp_port, &uopt);
+        if(!tdata->udp)
+            goto fail;
+    }
+
+    /* start http server */
+    if(opt->http_port) {
+        tdata->http_tune = opt->http_tune ? opt->http_tune : http_switch;
+        tdata->http_tune_arg = opt->http_tune ? opt->http_tune_arg : tdata;
+        tdata->httpd = httpd_start(opt->http_port,
+                                   (size_t)opt->http_ring_mb << 20,
+                                   tdata->http_tune, tdata->http_tune_arg);
+        if(!tdata->httpd) {
+            fprintf(stderr, "Cannot start http server on port %d\n",
+                    opt->http_port);
+            goto fail;
+        }
+        fprintf(stderr, "HTTP streaming on port %d\n", opt->http_port);
+    }
+
+    /* shared-memory ring for local consumers */
+    if(opt->shm_name) {
+        tdata->shm = shmring_create(opt->shm_name,
+                                    (size_t)opt->shm_ring_mb << 20);
+        if(!tdata->shm) {
+            fprintf(stderr, "Cannot create shared-memory ring %s\n",
+                    opt->shm_name);
+            goto fail;
+        }
+        fprintf(stderr, "Publishing to /dev/shm/%s\n",
+                opt->shm_name[0] == '/' ? opt->shm_name + 1 : opt->shm_name);
+    }
+
+    /* arrival timestamps from the driver */
+    if(opt->timestamp) {
+        int on = 1;
+
+        /* offsets in the other outputs count 188 byte packets */
+        if(opt->timestamp == 2 &&
+           (tdata->tshift || tdata->segment || tdata->tindex ||
+            !opt->destfile)) {
+            fprintf(stderr, "--timestamp m2ts needs plain file output\n");
+            goto fail;
+        }
+        if(ioctl(t->tfd, SET_TIMESTAMP, &on) < 0) {
+            fprintf(stderr, "Tuner cannot add arrival timestamps\n");
+            goto fail;
+        }
+        /* stamps are queued for m2ts output and the udp pacer */
+        tdata->m2ts = opt->timestamp == 2;
+        tdata->arrival = arrival_create(tdata->m2ts ||
+                                        (tdata->udp && opt->udp_pace));
+        if(!tdata->arrival) {
+            fprintf(stderr, "Cannot allocate arrival timestamps\n");
+            goto fail;
+        }
+    }
+
+    /* per-PID packet, continuity and bitrate counters */
+    if(opt->analyze) {
+        tdata->pidstat = pidstat_create(0);
+        if(!tdata->pidstat)
+            goto fail;
+    }
+
+    /* stdout into a pipe: hand the pages over instead of copying */
+    if(tdata->use_stdout && tdata->use_splice)
+        tdata->pout = pipeout_open(tdata->wfd, (size_t)opt->pipe_mb << 20);
+
+    return tdata;
+
+fail:
+    recpt1_pipeline_destroy(tdata);
+    return NULL;
+}
+
+int
+recpt1_pipeline_start(recpt1_pipeline *tdata)
+{
+    if(tdata->started)
+        return -1;
+
+    /* spawn decoder and reader threads */
+    time(&tdata->start_time);
+    if(tdata->dec_queue)
+        pthread_create(&tdata->decoder_thread, NULL, decoder_func, tdata);
+    pthread_create(&tdata->reader_thread, NULL, reader_func, tdata);
+
+    /* start recording */
+    if(ioctl(tdata->tuner->tfd, START_REC, 0) < 0) {
+        fprintf(stderr, "Tuner cannot start recording\n");
+        tdata->error = EIO;
+        recpt1_pipeline_stop(tdata);
+        if(tdata->dec_queue)
+            pthread_join(tdata->decoder_thread, NULL);
+        pthread_join(tdata->reader_thread, NULL);
+        return -1;
+    }
+
+    fprintf(stderr, "\nRecording...\n");
+
+    time(&tdata->start_time);
+    pthread_create(&tdata->capture_thread, NULL, capture_func, tdata);
+    tdata->started = TRUE;
+
+    return 0;
+}
+
+void
+recpt1_pipeline_stop(recpt1_pipeline *tdata)
+{
+    /* stop recording */
+    ioctl(tdata->tuner->tfd, STOP_REC, 0);
+
+    tdata->f_exit = TRUE;
+
+    pthread_cond_signal(&tdata->queue->cond_avail);
+    pthread_cond_signal(&tdata->queue->cond_used);
+    if(tdata->dec_queue) {
+        pthread_cond_signal(&tdata->dec_queue->cond_avail);
+        pthread_cond_signal(&tdata->dec_queue->cond_used);
+    }
+}
+
+int
+recpt1_pipeline_wait(recpt1_pipeline *tdata)
+{
+    if(!tdata->started)
+        return tdata->error;
+
+    /* the capture thread ends at recsec or on stop; then let the
+       later stages drain what it queued */
+    pthread_join(tdata->capture_thread, NULL);
+    recpt1_pipeline_stop(tdata);
+    if(tdata->dec_queue)
+        pthread_join(tdata->decoder_thread, NULL);
+    pthread_join(tdata->reader_thread, NULL);
+    tdata->started = FALSE;
+
+    /* the reader thread has stopped publishing */
+    httpd_stop(tdata->httpd);
+    tdata->httpd = NULL;
+    shmring_close(tdata->shm);
+    tdata->shm = NULL;
+    udpout_drain(tdata->udp);
+    pipeline_event(tdata, "end %d", tdata->error);
+
+    return tdata->error;
+}
+
+int
+recpt1_pipeline_switch(recpt1_pipeline *tdata, const char *channel)
+{
+    recpt1_tuner *t = tdata->tuner;
+    ISDB_T_FREQ_CONV_TABLE *table;
+    bs_channel bs;
+    struct timespec switch_start;
+    int current_type;
+    int rv = -1;
+
+    pthread_mutex_lock(&tdata->switch_lock);
+    if(!strcmp(channel, t->table->parm_freq)) {
+        rv = 0;
+        goto done;
+    }
+    table = searchrecoff((char *)channel, &bs);
+    if(table == NULL) {
+        fprintf(stderr, "Invalid Channel: %s\n", channel);
+        goto done;
+    }
+    current_type = t->table->type;
+    clock_gettime(CLOCK_MONOTONIC, &switch_start);
+
+    if(table->type == current_type) {
+        /* stop, retune and restart in one call */
+        const FREQUENCY freq = {
+          .frequencyno = table->set_freq,
+          .slot = table->add_freq,
+        };
+        if(ioctl(t->tfd, SWITCH_CHANNEL, &freq) == 0) {
+            fprintf(stderr, "Channel switched in %.1f ms\n",
+                    elapsed_ms(&switch_start));
+            goto switched;
+        }
+        if(errno != EINVAL && errno != ENOTTY) {
+            fprintf(stderr, "Cannot tune to the specified channel\n");
+            goto done;
+        }
+        /* older driver: fall through to STOP_REC/SET_CHANNEL */
+    }
+
+    /* stop stream */
+    ioctl(t->tfd, STOP_REC, 0);
+
+    /* wait for remainder */
+    wait_queue_drain(tdata->queue);
+
+    if(table->type != current_type) {
+        /* re-open device */
+        if(close_tuner(t) != 0 || tune((char *)channel, t, NULL) != 0) {
+            pipeline_fail(tdata, EIO);
+            goto done;
+        }
+        /* a new open starts without arrival timestamps */
+        if(tdata->arrival) {
+            int on = 1;
+
+            if(ioctl(t->tfd, SET_TIMESTAMP, &on) < 0) {
+                fprintf(stderr, "Tuner cannot add arrival timestamps\n");
+                pipeline_fail(tdata, EIO);
+                goto done;
+            }
+            arrival_restart(tdata->arrival);
+        }
+    }
+    else {
+        /* SET_CHANNEL only */
+        const FREQUENCY freq = {
+          .frequencyno = table->set_freq,
+          .slot = table->add_freq,
+        };
+        if(ioctl(t->tfd, SET_CHANNEL, &freq) < 0) {
+            fprintf(stderr, "Cannot tune to the specified channel\n");
+            goto done;
+        }
+    }
+    /* restart recording */
+    if(ioctl(t->tfd, START_REC, 0) < 0) {
+        fprintf(stderr, "Tuner cannot start recording\n");
+        pipeline_fail(tdata, EIO);
+        goto done;
+    }
+    fprintf(stderr, "Channel switched in %.1f ms\n",
+            elapsed_ms(&switch_start));
+
+switched:
+    /* tune() has already set the table of a re-opened device */
+    if(table->type == current_type) {
+        if(table == &bs.table) {
+            t->bs = bs;
+            t->bs.table.parm_freq = t->bs.name;
+            table = &t->bs.table;
+        }
+        t->table = table;
+        calc_cn(t->tfd, table->type, FALSE);
+    }
+    tdata->filter_reset = TRUE;
+    pipeline_event(tdata, "channel %s", t->table->parm_freq);
+    rv = 0;
+done:
+    pthread_mutex_unlock(&tdata->switch_lock);
+    return rv;
+}
+
+void
+recpt1_pipeline_extend(recpt1_pipeline *tdata, int sec)
+{
+    tdata->recsec += sec;
+    fprintf(stderr, "Extended %d sec\n", sec);
+    pipeline_event(tdata, "recsec %d", tdata->recsec);
+}
+
+void
+recpt1_pipeline_set_recsec(recpt1_pipeline *tdata, int recsec)
+{
+    time_t cur_time;
+
+    time(&cur_time);
+    if(cur_time - tdata->start_time > recsec) {
+        recpt1_pipeline_stop(tdata);
+    }
+    else {
+        tdata->recsec = recsec;
+        fprintf(stderr, "Total recording time = %d sec\n", recsec);
+        pipeline_event(tdata, "recsec %d", recsec);
+    }
+}
+
+int
+recpt1_pipeline_error(const recpt1_pipeline *tdata)
+{
+    return tdata->error;
+}
+
+void
+recpt1_pipeline_report(const recpt1_pipeline *tdata, FILE *fp)
+{
+    pipestat_dump(fp, &tdata->stat, tdata->queue, tdata->dec_queue);
+    if(tdata->decoder)
+        bcas_report(fp);
+    if(tdata->arrival)
+        arrival_report(tdata->arrival);
+    if(tdata->pidstat)
+        pidstat_report(fp, tdata->pidstat);
+    if(tdata->udp)
+        udpout_report(fp, tdata->udp);
+}
+
+void
+recpt1_pipeline_stats_json(const recpt1_pipeline *tdata, int fd)
+{
+    pipestat_json(fd, &tdata->stat, tdata->queue, tdata->dec_queue);
+}
+
+int
+recpt1_pipeline_stats(const recpt1_pipeline *tdata, char *buf, size_t len)
+{
+    return pipestat_format(buf, len, &tdata->stat, tdata->queue,
+                           tdata->dec_queue);
+}
+
+int
+recpt1_pipeline_status(recpt1_pipeline *tdata, char *buf, size_t len)
+{
+    char sid[RECPT1_EVENT_MAX];
+    time_t cur_time;
+    int n;
+
+    pthread_mutex_lock(&tdata->sid_lock);
+    snprintf(sid, sizeof(sid), "%s", tdata->sid ? tdata->sid : "off");
+    pthread_mutex_unlock(&tdata->sid_lock);
+    time(&cur_time);
+    n = snprintf(buf, len,
+                 "{\"channel\":\"%s\",\"sid\":\"%s\",\"recsec\":%d,"
+                 "\"elapsed\":%ld,\"recording\":%s,\"error\":%d}",
+                 tdata->tuner->table->parm_freq, sid,
+                 tdata->indefinite ? -1 : tdata->recsec,
+                 tdata->started ? (long)(cur_time - tdata->start_time) : 0L,
+                 tdata->started && !tdata->f_exit ? "true" : "false",
+                 tdata->error);
+    return n < (int)len ? n : -1;
+}
+
+/* numbers and the names AnalyzePat knows, separated by commas */
+static boolean
+valid_sid(const char *sid)
+{
+    static const char *const names[] = {
+        "hd", "sd1", "sd2", "sd3", "1seg", "all", "epg", NULL
+    };
+    const char *p = sid, *end;
+    size_t len;
+    int i;
+
+    do {
+        end = strchr(p, ',');
+        len = end ? (size_t)(end - p) : strlen(p);
+        if(len == 0)
+            return FALSE;
+        if(strspn(p, "0123456789") < len) {
+            for(i = 0; names[i]; i++) {
+                if(strlen(names[i]) == len && !strncasecmp(p, names[i], len))
+                    break;
+            }
+            if(!names[i])
+                return FALSE;
+        }
+        p = end + 1;
+    } while(end);
+    return TRUE;
+}
+
+int
+recpt1_pipeline_set_sid(recpt1_pipeline *tdata, const char *sid)
+{
+    splitter *sp = NULL;
+    char *copy = NULL;
+
+    if(sid && !strcmp(sid, "off"))
+        sid = NULL;
+    if(sid) {
+        if(!valid_sid(sid)) {
+            fprintf(stderr, "Invalid SID: %s\n", sid);
+            errno = EINVAL;
+            return -1;
+        }
+        sp = split_startup((char *)sid);
+        copy = strdup(sid);
+        if(!sp || !copy) {
+            if(sp)
+                split_shutdown(sp);
+            free(copy);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&tdata->sid_lock);
+    if(tdata->spliced) {
+        pthread_mutex_unlock(&tdata->sid_lock);
+        if(sp)
+            split_shutdown(sp);
+        free(copy);
+        errno = EBUSY;
+        return -1;
+    }
+    if(!tdata->started) {
+        /* nothing reads yet: take it now */
+        if(tdata->splitter)
+            split_shutdown(tdata->splitter);
+        tdata->splitter = sp;
+    }
+    else {
+        /* the reader swaps splitters between two blocks */
+        if(tdata->sid_change && tdata->sid_next)
+            split_shutdown(tdata->sid_next);
+        tdata->sid_next = sp;
+        tdata->sid_change = TRUE;
+    }
+    free(tdata->sid);
+    tdata->sid = copy;
+    pthread_mutex_unlock(&tdata->sid_lock);
+
+    fprintf(stderr, "SID = %s\n", sid ? sid : "off");
+    return 0;
+}
+
+void
+recpt1_pipeline_set_event(recpt1_pipeline *tdata, recpt1_event_func func,
+                          void *arg)
+{
+    pthread_mutex_lock(&tdata->event_lock);
+    tdata->event = func;
+    tdata->event_arg = arg;
+    pthread_mutex_unlock(&tdata->event_lock);
+}
+
+void
+recpt1_pipeline_destroy(recpt1_pipeline *tdata)
+{
+    if(!tdata)
+        return;
+    if(tdata->started) {
+        recpt1_pipeline_stop(tdata);
+        recpt1_pipeline_wait(tdata);
+    }
+    httpd_stop(tdata->httpd);
+    shmring_close(tdata->shm);
+    arrival_destroy(tdata->arrival);
+    pidstat_destroy(tdata->pidstat);
+
+    /* release queue */
+    destroy_queue(tdata->queue);
+    destroy_queue(tdata->dec_queue);
+
+    /* close output file */
+    tsindex_close(tdata->tindex);
+    segment_close(tdata->segment);
+    timeshift_close(tdata->tshift);
+    if(!tdata->use_stdout && tdata->wfd >= 0)
+        close(tdata->wfd);
+    pipeout_close(tdata->pout);
+
+    /* close the udp socket */
+    udpout_close(tdata->udp);
+
+    /* release decoder */
+    if(tdata->decoder)
+        b25_shutdown(tdata->decoder);
+    if(tdata->splitter)
+        split_shutdown(tdata->splitter);
+    if(tdata->sid_next)
+        split_shutdown(tdata->sid_next);
+    free(tdata->sid);
+
+    pthread_mutex_destroy(&tdata->switch_lock);
+    pthread_mutex_destroy(&tdata->sid_lock);
+    pthread_mutex_destroy(&tdata->event_lock);
+    free(tdata);
+}
+
+int
+recpt1_bcas_hold(int on)
+{
+    return bcas_hold(on);
+}
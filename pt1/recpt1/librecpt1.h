@@ -0,0 +1,142 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _LIBRECPT1_H_
+#define _LIBRECPT1_H_
+
+#include <stdio.h>
+
+/*
+ * librecpt1: the recpt1 tuner and recording pipeline as a library.
+ * Everything a recording needs lives behind its handles, so a process
+ * can run any number of recordings, each with its own tuner, queues,
+ * b25 decoder, splitter and outputs.  The library installs no signal
+ * handlers and never exits; failures come back as return values and
+ * recpt1_pipeline_error().  Progress messages go to stderr as in
+ * recpt1.
+ *
+ *   recpt1_tuner *t = recpt1_tuner_create(0);
+ *   recpt1_options opt;
+ *
+ *   recpt1_tuner_tune(t, "27", NULL, 0);
+ *   recpt1_options_init(&opt);
+ *   opt.destfile = "out.ts";
+ *   opt.recsec = 60;
+ *   p = recpt1_pipeline_create(t, &opt);
+ *   recpt1_pipeline_start(p);
+ *   recpt1_pipeline_wait(p);
+ *   recpt1_pipeline_destroy(p);
+ *   recpt1_tuner_close(t);
+ */
+
+typedef struct recpt1_tuner recpt1_tuner;
+typedef struct recpt1_pipeline recpt1_pipeline;
+
+/* http GET /ch/NAME: 0 if the switch was taken, -1 to refuse it */
+typedef int (*recpt1_tune_func)(void *arg, const char *channel);
+
+/* pipeline events, one line each: "channel NAME", "sid LIST|off",
+   "recsec N", "error ERRNO", "end ERRNO".  called from whichever thread
+   caused them; must not block nor call back into the pipeline */
+#define RECPT1_EVENT_MAX    128
+typedef void (*recpt1_event_func)(void *arg, const char *event);
+
+typedef struct recpt1_options {
+    int recsec;                 /* -1: until recpt1_pipeline_stop() */
+    const char *destfile;       /* "-": stdout, NULL: no file output */
+    /* b25 */
+    int b25;
+    int round;
+    int strip;
+    int emm;
+    const char *decode_cpu;     /* NULL: any, "auto": by tuner, or N */
+    const char *sid;            /* splitter SID list, NULL: whole TS */
+    /* outputs besides destfile */
+    const char *udp_host;       /* NULL: off; IPv4/IPv6, may be multicast */
+    int udp_port;
+    int udp_rtp;                /* RTP headers */
+    int udp_ttl;                /* 0: system default */
+    const char *udp_iface;      /* multicast interface, NULL: default */
+    int udp_pace;               /* send by the stream clock, 0: as read */
+    int udp_txtime;             /* SO_TXTIME (etf/fq qdisc) */
+    int udp_delay_ms;           /* pacing latency, 0: default */
+    long timeshift_mb;          /* destfile is the ring, 0: off */
+    int timeshift_interval;     /* msec */
+    int index_interval;         /* msec, 0: no seek index */
+    int segment_sec;            /* destfile is the segment name */
+    int segment_mb;
+    int segment_rap;
+    const char *playlist;
+    int http_port;              /* 0: off */
+    int http_ring_mb;
+    recpt1_tune_func http_tune; /* NULL: switch right away */
+    void *http_tune_arg;
+    const char *shm_name;       /* NULL: off */
+    int shm_ring_mb;
+    int timestamp;              /* 0: off, 1: strip, 2: m2ts */
+    int analyze;                /* per-PID counters in the report */
+    int splice;                 /* let the kernel move raw data */
+    int pipe_mb;                /* stdout pipe size for vmsplice */
+} recpt1_options;
+
+/* tuner: lnb is 0, 1 (11V) or 2 (15V) */
+recpt1_tuner *recpt1_tuner_create(int lnb);
+/* device NULL: the first free tuner for the channel.  persistent: keep
+   trying until the signal locks or recpt1_tuner_cancel() */
+int recpt1_tuner_tune(recpt1_tuner *t, const char *channel,
+                      const char *device, int persistent);
+void recpt1_tuner_cancel(recpt1_tuner *t);
+int recpt1_tuner_fd(const recpt1_tuner *t);
+int recpt1_tuner_type(const recpt1_tuner *t);
+const char *recpt1_tuner_channel(const recpt1_tuner *t);
+double recpt1_tuner_cn(const recpt1_tuner *t);
+int recpt1_tuner_close(recpt1_tuner *t);
+/* 0 if channel is known */
+int recpt1_channel_valid(const char *channel);
+
+/* pipeline: reads the tuner, which must outlive it */
+void recpt1_options_init(recpt1_options *opt);
+recpt1_pipeline *recpt1_pipeline_create(recpt1_tuner *t,
+                                        const recpt1_options *opt);
+int recpt1_pipeline_start(recpt1_pipeline *p);
+void recpt1_pipeline_stop(recpt1_pipeline *p);
+/* 0, or the errno that ended the recording */
+int recpt1_pipeline_wait(recpt1_pipeline *p);
+int recpt1_pipeline_switch(recpt1_pipeline *p, const char *channel);
+void recpt1_pipeline_extend(recpt1_pipeline *p, int sec);
+void recpt1_pipeline_set_recsec(recpt1_pipeline *p, int recsec);
+/* sid NULL or "off": whole TS, unsplit.  taken between two blocks; -1 with EINVAL
+   for a bad list, EBUSY if a raw recording bypasses the splitter */
+int recpt1_pipeline_set_sid(recpt1_pipeline *p, const char *sid);
+int recpt1_pipeline_error(const recpt1_pipeline *p);
+void recpt1_pipeline_report(const recpt1_pipeline *p, FILE *fp);
+void recpt1_pipeline_stats_json(const recpt1_pipeline *p, int fd);
+/* one JSON object into buf: its length, or -1 if it does not fit */
+int recpt1_pipeline_stats(const recpt1_pipeline *p, char *buf, size_t len);
+int recpt1_pipeline_status(recpt1_pipeline *p, char *buf, size_t len);
+/* one listener per pipeline, NULL to remove it; once this returns the
+   old one is not running */
+void recpt1_pipeline_set_event(recpt1_pipeline *p, recpt1_event_func func,
+                               void *arg);
+void recpt1_pipeline_destroy(recpt1_pipeline *p);
+
+/*
+ * Control socket: a Unix seqpacket socket serving any number of
+ * pipelines under names, for recpt1ctl and the like (see ctlsock.h for
+ * the protocol).  path is a file, or "@name" in the abstract namespace.
+ * A pipeline must be removed before it is destroyed.
+ */
+typedef struct recpt1_ctl recpt1_ctl;
+
+recpt1_ctl *recpt1_ctl_start(const char *path);
+int recpt1_ctl_add(recpt1_ctl *c, const char *name, recpt1_pipeline *p);
+void recpt1_ctl_remove(recpt1_ctl *c, recpt1_pipeline *p);
+/* switch channel on the control worker; returns before the switch */
+int recpt1_ctl_switch(recpt1_ctl *c, recpt1_pipeline *p,
+                      const char *channel);
+void recpt1_ctl_stop(recpt1_ctl *c);
+
+/* b25: the B-CAS card is shared by all pipelines of the process.  on:
+   open it now and keep it open between recordings, so a daemon does
+   not wait for the card at every start.  0 or -1 */
+int recpt1_bcas_hold(int on);
+
+#endif
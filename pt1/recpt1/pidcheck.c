@@ -0,0 +1,249 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * pidcheck: the --analyze counters against a synthetic stream with
+ * known defects, fed in blocks that split packets at every awkward
+ * place (the SSE2 path and the carried packet both get used).
+ *
+ *   video  counter skips (drops), single duplicates (allowed), one
+ *          triple (a drop), signalled discontinuities and packets
+ *          without payload (neither counted)
+ *   audio  TEI packets, each also costing the next packet a drop, and
+ *          scrambled packets
+ *   null   random counters, never checked
+ *   junk   bytes without a sync byte in the middle of the stream
+ *
+ * Then the bitrate window: a steady feed must show about the rate
+ * measured here, with a peak at least as high, and an idle window 0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "pidstat.h"
+
+#define TS_PACKET_SIZE  188
+#define PACKETS         10000
+#define JUNK            50
+#define VIDEO_PID       0x100
+#define AUDIO_PID       0x110
+#define NULL_PID        0x1fff
+#define WINDOW_MS       200
+#define FEED_MS         10
+#define FEED_PACKETS    500
+#define FEEDS           60
+#define RATE_TOLERANCE  0.25
+
+/* every split of a packet against a block, cycled */
+static const size_t block_sizes[] = {
+    1, 187, 188, 189, 376, 95, 4093, 6000, 2, 65536, 188 * 7 + 1, 1000
+};
+
+typedef struct stream {
+    uint8_t *data;
+    size_t len;
+    uint64_t packets;
+    uint32_t cc_errors[PIDSTAT_MAX_PID];
+    uint64_t tei;
+    uint64_t scrambled;
+    uint64_t sync_errors;
+} stream;
+
+static uint8_t *
+put(stream *s, int pid, int cc)
+{
+    uint8_t *p = s->data + s->len;
+
+    memset(p, 0xff, TS_PACKET_SIZE);
+    p[0] = 0x47;
+    p[1] = pid >> 8;
+    p[2] = pid & 0xff;
+    p[3] = 0x10 | (cc & 0x0f);
+    s->len += TS_PACKET_SIZE;
+    s->packets++;
+    return p;
+}
+
+static int
+make_stream(stream *s)
+{
+    int i, v = 0, a = 0, tei = 0;
+    uint8_t *p;
+
+    memset(s, 0, sizeof(stream));
+    s->data = malloc((size_t)PACKETS * 2 * TS_PACKET_SIZE + JUNK);
+    if(!s->data)
+        return -1;
+    for(i = 0; i < PACKETS; i++) {
+        if(i == PACKETS / 2) {
+            memset(s->data + s->len, 0x00, JUNK);
+            s->len += JUNK;
+            s->sync_errors += JUNK;
+        }
+        switch(i % 1000) {
+        case 100:   /* no payload: the counter stays */
+            p = put(s, VIDEO_PID, v);
+            p[3] = 0x20 | (v & 0x0f);
+            p[4] = 183;
+            p[5] = 0x00;
+            break;
+        case 500:   /* a packet lost */
+            v += 2;
+            put(s, VIDEO_PID, v);
+            s->cc_errors[VIDEO_PID]++;
+            break;
+        case 700:   /* sent twice */
+            put(s, VIDEO_PID, ++v);
+            put(s, VIDEO_PID, v);
+            if(i == 3700) {
+                put(s, VIDEO_PID, v);
+                s->cc_errors[VIDEO_PID]++;
+            }
+            break;
+        case 900:   /* signalled discontinuity */
+            v += 5;
+            p = put(s, VIDEO_PID, v);
+            p[3] = 0x30 | (v & 0x0f);
+            p[4] = 1;
+            p[5] = 0x80;
+            break;
+        default:
+            put(s, VIDEO_PID, ++v);
+            break;
+        }
+
+        if(i % 4 == 0) {
+            p = put(s, AUDIO_PID, ++a);
+            if(i % 2500 == 4) {
+                p[1] |= 0x80;       /* transport_error_indicator */
+                s->tei++;
+                tei = 1;
+            }
+            else if(tei) {
+                s->cc_errors[AUDIO_PID]++;
+                tei = 0;
+            }
+            if(i % 2000 == 8) {
+                p[3] |= 0x80;       /* scrambled, even key */
+                s->scrambled++;
+            }
+        }
+        if(i % 10 == 0)
+            put(s, NULL_PID, rand());
+    }
+    return 0;
+}
+
+static int
+expect(const char *what, uint64_t got, uint64_t want)
+{
+    printf("%-20s %8llu (want %llu)\n", what, (unsigned long long)got,
+           (unsigned long long)want);
+    return got != want;
+}
+
+static int
+check_counters(const stream *s)
+{
+    pidstat *ps = pidstat_create(0);
+    size_t offset, len;
+    int n, errors = 0;
+
+    if(!ps)
+        return 1;
+    for(offset = 0, n = 0; offset < s->len; offset += len, n++) {
+        len = block_sizes[n % (sizeof(block_sizes) / sizeof(block_sizes[0]))];
+        if(len > s->len - offset)
+            len = s->len - offset;
+        pidstat_chunk(ps, s->data + offset, len);
+    }
+    pidstat_report(stdout, ps);
+    errors += expect("packets", ps->packets, s->packets);
+    errors += expect("video CC errors", ps->pid[VIDEO_PID].cc_errors,
+                     s->cc_errors[VIDEO_PID]);
+    errors += expect("audio CC errors", ps->pid[AUDIO_PID].cc_errors,
+                     s->cc_errors[AUDIO_PID]);
+    errors += expect("null CC errors", ps->pid[NULL_PID].cc_errors, 0);
+    errors += expect("CC errors", ps->cc_errors,
+                     s->cc_errors[VIDEO_PID] + s->cc_errors[AUDIO_PID]);
+    errors += expect("TEI", ps->tei, s->tei);
+    errors += expect("scrambled", ps->scrambled, s->scrambled);
+    errors += expect("sync bytes lost", ps->sync_errors, s->sync_errors);
+    pidstat_destroy(ps);
+    return errors;
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* FEED_PACKETS every FEED_MS for several windows, then nothing */
+static int
+check_rate(void)
+{
+    pidstat *ps = pidstat_create(WINDOW_MS);
+    stream s;
+    uint64_t start, ns;
+    uint32_t want, rate, peak;
+    int i, errors = 0;
+
+    if(!ps)
+        return 1;
+    memset(&s, 0, sizeof(s));
+    s.data = malloc(FEED_PACKETS * TS_PACKET_SIZE);
+    if(!s.data)
+        return 1;
+    for(i = 0; i < FEED_PACKETS; i++)
+        put(&s, VIDEO_PID, i);
+
+    start = now_ns();
+    for(i = 0; i < FEEDS; i++) {
+        pidstat_chunk(ps, s.data, s.len);
+        usleep(FEED_MS * 1000);
+    }
+    ns = now_ns() - start;
+    want = (uint64_t)FEEDS * FEED_PACKETS * TS_PACKET_SIZE * 8 * 1000000 / ns;
+    rate = ps->pid[VIDEO_PID].rate;
+    peak = ps->pid[VIDEO_PID].peak;
+    printf("rate %u kbit/s, peak %u (want about %u)\n", rate, peak, want);
+    if(rate < want * (1 - RATE_TOLERANCE) || rate > want * (1 + RATE_TOLERANCE) ||
+       peak < rate || ps->rate != rate)
+        errors++;
+
+    /* a whole window without packets */
+    for(i = 0; i < 2 * WINDOW_MS / FEED_MS; i++) {
+        pidstat_chunk(ps, s.data, 0);
+        usleep(FEED_MS * 1000);
+    }
+    printf("idle rate %u kbit/s, peak %u\n", ps->pid[VIDEO_PID].rate,
+           ps->pid[VIDEO_PID].peak);
+    if(ps->pid[VIDEO_PID].rate || ps->rate)
+        errors++;
+
+    free(s.data);
+    pidstat_destroy(ps);
+    return errors;
+}
+
+int
+main(void)
+{
+    stream s;
+    int errors = 0;
+
+    if(make_stream(&s) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    errors += check_counters(&s);
+    errors += check_rate();
+    printf("%s\n", errors ? "FAIL" : "ok");
+    return errors ? 1 : 0;
+}
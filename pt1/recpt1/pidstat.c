@@ -0,0 +1,288 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pidstat.h"
+
+#define TS_PACKET_SIZE  188
+#define NULL_PID        0x1fff
+
+/* header() value: sync byte, TEI and scrambling bits */
+#define HDR_CHECK_MASK  0xc00080ffU
+#define HDR_CLEAN       0x00000047U
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+pidstat *
+pidstat_create(int window_ms)
+{
+    pidstat *ps = calloc(1, sizeof(pidstat));
+    int pid;
+
+    if(!ps)
+        return NULL;
+    for(pid = 0; pid < PIDSTAT_MAX_PID; pid++)
+        ps->pid[pid].cc = PIDSTAT_CC_NONE;
+    ps->window_ms = window_ms > 0 ? window_ms : PIDSTAT_WINDOW_MS;
+    ps->start_ns = ps->slot_ns = now_ns();
+    return ps;
+}
+
+void
+pidstat_destroy(pidstat *ps)
+{
+    free(ps);
+}
+
+/* kbit/s of packets over ns */
+static uint32_t
+rate_kbps(uint64_t packets, uint64_t ns)
+{
+    return ns ? packets * TS_PACKET_SIZE * 8 * 1000000 / ns : 0;
+}
+
+/* move the slot's packets into the window, dropping the oldest slot.
+   returns the new rate; peaks only count once the window is full */
+static uint32_t
+slide(uint32_t *slot, uint32_t *sum, uint64_t *mark, uint64_t packets,
+      int head, uint64_t window_ns, int full, uint32_t *peak)
+{
+    uint32_t n = packets - *mark;
+    uint32_t rate;
+
+    *sum += n - slot[head];
+    slot[head] = n;
+    *mark = packets;
+    rate = rate_kbps(*sum, window_ns);
+    if(full && rate > *peak)
+        *peak = rate;
+    return rate;
+}
+
+static void
+roll_slot(pidstat *ps, uint64_t now)
+{
+    int head = ps->slot_head;
+    int full;
+    int i;
+
+    ps->window_ns += (now - ps->slot_ns) - ps->slot_len[head];
+    ps->slot_len[head] = now - ps->slot_ns;
+    if(ps->slots < PIDSTAT_SLOTS)
+        ps->slots++;
+    full = ps->slots == PIDSTAT_SLOTS;
+
+    for(i = 0; i < ps->num_active; i++) {
+        pidstat_pid *e = &ps->pid[ps->active[i]];
+
+        e->rate = slide(e->slot, &e->sum, &e->mark, e->packets, head,
+                        ps->window_ns, full, &e->peak);
+    }
+    ps->rate = slide(ps->slot, &ps->sum, &ps->mark, ps->packets, head,
+                     ps->window_ns, full, &ps->peak);
+    ps->slot_head = (head + 1) % PIDSTAT_SLOTS;
+    ps->slot_ns = now;
+}
+
+/* the counter did not advance by one: first packet, duplicate,
+   signalled discontinuity or a drop.  returns 1 for a duplicate,
+   which leaves the counter where it was. */
+static int
+check_cc(pidstat *ps, pidstat_pid *e, const uint8_t *p, int pid)
+{
+    int cc = p[3] & 0x0f;
+
+    if(e->cc & PIDSTAT_CC_NONE || pid == NULL_PID)
+        return 0;
+    /* adaptation field with discontinuity_indicator */
+    if((p[3] & 0x20) && p[4] > 0 && (p[5] & 0x80))
+        return 0;
+    if(cc == (e->cc & 0x0f) && !(e->cc & PIDSTAT_CC_DUP)) {
+        e->cc |= PIDSTAT_CC_DUP;
+        return 1;
+    }
+    e->cc_errors++;
+    ps->cc_errors++;
+    return 0;
+}
+
+static inline pidstat_pid *
+lookup(pidstat *ps, int pid)
+{
+    pidstat_pid *e = &ps->pid[pid];
+
+    if(!e->packets)
+        ps->active[ps->num_active++] = pid;
+    e->packets++;
+    return e;
+}
+
+/* a packet with a good sync byte and neither TEI nor scrambling */
+static inline void
+clean_packet(pidstat *ps, const uint8_t *p)
+{
+    int pid = ((p[1] & 0x1f) << 8) | p[2];
+    pidstat_pid *e = lookup(ps, pid);
+    int cc = p[3] & 0x0f;
+
+    /* without payload the counter stays */
+    if(!(p[3] & 0x10))
+        return;
+    if(cc != ((e->cc + 1) & 0x0f) && check_cc(ps, e, p, pid))
+        return;
+    e->cc = cc;
+}
+
+static void
+odd_packet(pidstat *ps, const uint8_t *p)
+{
+    int pid = ((p[1] & 0x1f) << 8) | p[2];
+    pidstat_pid *e;
+
+    /* the header itself may be corrupt: count it, do not trust its CC */
+    if(p[1] & 0x80) {
+        e = lookup(ps, pid);
+        e->tei++;
+        ps->tei++;
+        return;
+    }
+    if(p[3] & 0xc0) {
+        ps->pid[pid].scrambled++;
+        ps->scrambled++;
+    }
+    clean_packet(ps, p);
+}
+
+/* the 4 header bytes, first byte lowest whatever the host byte order;
+   a single load on little-endian */
+static inline uint32_t
+header(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+        (uint32_t)p[3] << 24;
+}
+
+/* whole packets at p; returns the bytes used */
+static size_t
+scan(pidstat *ps, const uint8_t *p, size_t len)
+{
+    const uint8_t *start = p;
+    const uint8_t *end = p + len;
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi32((int)HDR_CHECK_MASK);
+    const __m128i clean = _mm_set1_epi32((int)HDR_CLEAN);
+#endif
+
+    while(end - p >= TS_PACKET_SIZE) {
+        uint32_t h;
+
+#ifdef __SSE2__
+        /* four clean headers at a time */
+        while(end - p >= 4 * TS_PACKET_SIZE) {
+            __m128i v = _mm_set_epi32(header(p + 3 * TS_PACKET_SIZE),
+                                      header(p + 2 * TS_PACKET_SIZE),
+                                      header(p + TS_PACKET_SIZE),
+                                      header(p));
+
+            v = _mm_cmpeq_epi32(_mm_and_si128(v, mask), clean);
+            if(_mm_movemask_epi8(v) != 0xffff)
+                break;
+            clean_packet(ps, p);
+            clean_packet(ps, p + TS_PACKET_SIZE);
+            clean_packet(ps, p + 2 * TS_PACKET_SIZE);
+            clean_packet(ps, p + 3 * TS_PACKET_SIZE);
+            ps->packets += 4;
+            p += 4 * TS_PACKET_SIZE;
+        }
+        if(end - p < TS_PACKET_SIZE)
+            break;
+#endif
+        h = header(p);
+        if((h & HDR_CHECK_MASK) == HDR_CLEAN)
+            clean_packet(ps, p);
+        else if(p[0] == 0x47)
+            odd_packet(ps, p);
+        else {
+            /* lost sync: skip to the next sync byte */
+            const uint8_t *q = memchr(p + 1, 0x47, end - p - 1);
+
+            q = q ? q : end;
+            ps->sync_errors += q - p;
+            p = q;
+            continue;
+        }
+        ps->packets++;
+        p += TS_PACKET_SIZE;
+    }
+    return p - start;
+}
+
+void
+pidstat_chunk(pidstat *ps, const uint8_t *data, size_t len)
+{
+    uint64_t now;
+    size_t used;
+
+    /* complete a packet split across blocks */
+    if(ps->carry_len) {
+        size_t need = TS_PACKET_SIZE - ps->carry_len;
+
+        if(len < need) {
+            memcpy(ps->carry + ps->carry_len, data, len);
+            ps->carry_len += len;
+            return;
+        }
+        memcpy(ps->carry + ps->carry_len, data, need);
+        ps->carry_len = 0;
+        scan(ps, ps->carry, TS_PACKET_SIZE);
+        data += need;
+        len -= need;
+    }
+
+    used = scan(ps, data, len);
+    if(len - used > 0 && data[used] == 0x47) {
+        memcpy(ps->carry, data + used, len - used);
+        ps->carry_len = len - used;
+    }
+
+    now = now_ns();
+    if(now - ps->slot_ns >= (uint64_t)ps->window_ms * 1000000 / PIDSTAT_SLOTS)
+        roll_slot(ps, now);
+}
+
+void
+pidstat_report(FILE *fp, const pidstat *ps)
+{
+    uint64_t ns = now_ns() - ps->start_ns;
+    int pid;
+
+    fprintf(fp, "analyze       %llu packets, %llu CC errors, %llu TEI, "
+            "%llu scrambled, %llu sync bytes lost, %.1f Mbit/s (peak %.1f)\n",
+            (unsigned long long)ps->packets,
+            (unsigned long long)ps->cc_errors, (unsigned long long)ps->tei,
+            (unsigned long long)ps->scrambled,
+            (unsigned long long)ps->sync_errors,
+            rate_kbps(ps->packets, ns) / 1000.0, ps->peak / 1000.0);
+    for(pid = 0; pid < PIDSTAT_MAX_PID; pid++) {
+        const pidstat_pid *e = &ps->pid[pid];
+
+        if(!e->packets)
+            continue;
+        fprintf(fp, "  pid 0x%04x  %10llu packets %8u kbit/s (last %u, peak %u)"
+                "  cc %u  tei %u  scrambled %u\n", pid,
+                (unsigned long long)e->packets, rate_kbps(e->packets, ns),
+                e->rate, e->peak, e->cc_errors, e->tei, e->scrambled);
+    }
+}
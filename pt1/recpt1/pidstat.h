@@ -0,0 +1,77 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _PIDSTAT_H_
+#define _PIDSTAT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Per-PID stream analyzer (recpt1 --analyze).  Runs over each block
+ * recpt1 writes and counts, for every PID, packets, continuity counter
+ * discontinuities, transport_error_indicator and scrambled packets,
+ * and the bitrate over a sliding window, so drops show up at the end of
+ * the recording instead of in a second pass over the file.
+ *
+ * A clean packet costs a header check, a counter increment and a
+ * continuity compare.  With SSE2 the headers of four packets are
+ * checked at once and anything unusual (lost sync, TEI, scrambling)
+ * falls back to the per-packet path.  One duplicate packet is allowed
+ * as the standard does; the null PID and packets flagged
+ * discontinuous are not checked.  A TEI packet is not trusted for its
+ * counter, so the next packet of the PID usually counts as a drop.
+ */
+
+#define PIDSTAT_MAX_PID     8192
+#define PIDSTAT_WINDOW_MS   1000
+#define PIDSTAT_SLOTS       10      /* the window slides a tenth at a time */
+
+/* cc: low 4 bits the last counter, plus */
+#define PIDSTAT_CC_DUP      0x10    /* the last packet was a duplicate */
+#define PIDSTAT_CC_NONE     0x20    /* no packet with payload yet */
+
+typedef struct pidstat_pid {
+    uint64_t packets;
+    uint8_t cc;
+    uint32_t cc_errors;
+    uint32_t tei;
+    uint32_t scrambled;
+    uint32_t rate;          /* kbit/s over the last window */
+    uint32_t peak;          /* highest window rate, kbit/s */
+    uint64_t mark;          /* packets when the slot started */
+    uint32_t slot[PIDSTAT_SLOTS];   /* packets per finished slot */
+    uint32_t sum;           /* packets in the window */
+} pidstat_pid;
+
+typedef struct pidstat {
+    pidstat_pid pid[PIDSTAT_MAX_PID];
+    uint16_t active[PIDSTAT_MAX_PID];   /* PIDs seen, in order */
+    int num_active;
+    uint64_t packets;
+    uint64_t sync_errors;   /* bytes skipped to find a sync byte */
+    uint64_t cc_errors;
+    uint64_t tei;
+    uint64_t scrambled;
+    uint8_t carry[188];     /* packet split across blocks */
+    int carry_len;
+    int window_ms;
+    uint64_t start_ns;
+    uint64_t slot_ns;       /* when the slot started */
+    uint64_t slot_len[PIDSTAT_SLOTS];   /* ns each finished slot took */
+    uint64_t window_ns;     /* their sum */
+    int slot_head;          /* the slot to replace next */
+    int slots;              /* finished slots, up to PIDSTAT_SLOTS */
+    uint64_t mark;
+    uint32_t slot[PIDSTAT_SLOTS];
+    uint32_t sum;
+    uint32_t rate;          /* whole stream, kbit/s */
+    uint32_t peak;
+} pidstat;
+
+/* window_ms: bitrate window, 0 for the default */
+pidstat *pidstat_create(int window_ms);
+void pidstat_chunk(pidstat *ps, const uint8_t *data, size_t len);
+void pidstat_report(FILE *fp, const pidstat *ps);
+void pidstat_destroy(pidstat *ps);
+
+#endif
@@ -0,0 +1,192 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* vmsplice, F_SETPIPE_SZ */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "pipeout.h"
+
+#define WAIT_MS     100
+
+pipeout *
+pipeout_open(int fd, size_t pipe_size)
+{
+    pipeout *po;
+    struct stat st;
+    int size;
+
+    if(fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode))
+        return NULL;
+    po = calloc(1, sizeof(pipeout));
+    if(!po)
+        return NULL;
+    po->fd = fd;
+    po->page_size = sysconf(_SC_PAGESIZE);
+
+    /* a deeper pipe absorbs consumer jitter */
+    if(pipe_size && fcntl(fd, F_SETPIPE_SZ, (int)pipe_size) < 0)
+        fprintf(stderr, "Cannot resize stdout pipe to %zu bytes: %s\n",
+                pipe_size, strerror(errno));
+    size = fcntl(fd, F_GETPIPE_SZ);
+    po->pipe_size = size > 0 ? size : 65536;
+
+    /* the pipe's worth in flight, and as much again being filled */
+    po->pool_size = 4 * po->pipe_size;
+    if(posix_memalign((void **)&po->pool, po->page_size, po->pool_size)) {
+        free(po);
+        return NULL;
+    }
+    return po;
+}
+
+/* release what the consumer has read */
+static void
+reap(pipeout *po)
+{
+    int unread;
+    uint64_t consumed;
+
+    if(ioctl(po->fd, FIONREAD, &unread) < 0)
+        return;
+    consumed = po->pushed - unread;
+    while(po->num_held) {
+        pipeout_held *h = &po->held[po->held_first];
+
+        if(h->end > consumed)
+            break;
+        if(h->owner)
+            free(h->owner);
+        else
+            po->pool_tail = h->pool_to;
+        po->held_first = (po->held_first + 1) % PIPEOUT_MAX_HELD;
+        po->num_held--;
+    }
+}
+
+/* wait until the consumer makes progress */
+static int
+wait_consumer(pipeout *po)
+{
+    struct pollfd pfd;
+
+    pfd.fd = po->fd;
+    pfd.events = POLLOUT;
+    if(poll(&pfd, 1, WAIT_MS) > 0 && (pfd.revents & (POLLERR | POLLHUP))) {
+        errno = EPIPE;
+        return -1;
+    }
+    reap(po);
+    return 0;
+}
+
+static int
+push(pipeout *po, const uint8_t *data, size_t len, unsigned int flags)
+{
+    struct iovec iov;
+    ssize_t n;
+
+    while(len > 0) {
+        iov.iov_base = (void *)data;
+        iov.iov_len = len;
+        n = vmsplice(po->fd, &iov, 1, flags);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            /* stdout may have been left non-blocking */
+            if(errno == EAGAIN) {
+                if(wait_consumer(po) < 0)
+                    return -1;
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+        po->pushed += n;
+    }
+    return 0;
+}
+
+static void
+record(pipeout *po, void *owner)
+{
+    pipeout_held *h;
+
+    h = &po->held[(po->held_first + po->num_held) % PIPEOUT_MAX_HELD];
+    h->end = po->pushed;
+    h->owner = owner;
+    h->pool_to = po->pool_head;
+    po->num_held++;
+}
+
+/* copy into the pool and gift its pages to the pipe */
+int
+pipeout_write(pipeout *po, const uint8_t *data, size_t len)
+{
+    size_t page_mask = po->page_size - 1;
+
+    reap(po);
+    while(len > 0) {
+        size_t n = len < po->pool_size / 2 ? len : po->pool_size / 2;
+        size_t need = (n + page_mask) & ~page_mask;
+        size_t pos = po->pool_head % po->pool_size;
+        size_t skip = pos + need > po->pool_size ? po->pool_size - pos : 0;
+        uint8_t *p;
+
+        /* blocks are contiguous: skip the end of the pool if it is short */
+        while(po->pool_head + skip + need - po->pool_tail > po->pool_size ||
+              po->num_held == PIPEOUT_MAX_HELD) {
+            if(wait_consumer(po) < 0)
+                return -1;
+        }
+        po->pool_head += skip;
+        p = po->pool + po->pool_head % po->pool_size;
+        memcpy(p, data, n);
+        po->pool_head += need;
+        /* whole pages can be gifted; older kernels refuse partial ones */
+        if(push(po, p, n, (n & page_mask) ? 0 : SPLICE_F_GIFT) < 0)
+            return -1;
+        record(po, NULL);
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* hand a malloc'd buffer to the pipe; it is freed once consumed */
+int
+pipeout_give(pipeout *po, const uint8_t *data, size_t len, void *owner)
+{
+    reap(po);
+    while(po->num_held == PIPEOUT_MAX_HELD) {
+        if(wait_consumer(po) < 0)
+            return -1;
+    }
+    if(push(po, data, len, 0) < 0)
+        return -1;
+    record(po, owner);
+    return 0;
+}
+
+void
+pipeout_close(pipeout *po)
+{
+    if(!po)
+        return;
+    reap(po);
+    /* memory still in the pipe would be reused before the consumer
+       reads it, so leave it allocated */
+    if(po->num_held)
+        return;
+    free(po->pool);
+    free(po);
+}
@@ -0,0 +1,51 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _PIPEOUT_H_
+#define _PIPEOUT_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * stdout output for pipeline consumers (destfile "-" on a pipe).
+ * Blocks are handed to the pipe with vmsplice(), so the consumer's
+ * read() copies straight out of recpt1's memory instead of every
+ * write() being copied into pipe pages first.
+ *
+ * Memory handed over must stay untouched until the consumer has read
+ * it.  The bytes still in the pipe (FIONREAD) tell how far it got:
+ * capture buffers given with pipeout_give() are freed once consumed,
+ * other data is copied into a page-aligned pool whose pages are gifted
+ * and reused only behind the consumer.  This relies on the consumer
+ * read()ing the pipe; one that splices the pages onwards could see them
+ * after reuse, so --no-splice falls back to write().
+ */
+
+#define PIPEOUT_MAX_HELD    1024    /* blocks in flight */
+
+typedef struct pipeout_held {
+    uint64_t end;           /* stream offset just past the block */
+    void *owner;            /* freed once consumed, NULL: pool data */
+    uint64_t pool_to;       /* pool_head after the block */
+} pipeout_held;
+
+typedef struct pipeout {
+    int fd;
+    size_t pipe_size;
+    size_t page_size;
+    uint64_t pushed;        /* bytes handed to the pipe */
+    uint8_t *pool;
+    size_t pool_size;
+    uint64_t pool_head;     /* pool bytes used, page aligned */
+    uint64_t pool_tail;     /* pool bytes released */
+    pipeout_held held[PIPEOUT_MAX_HELD];
+    int held_first;
+    int num_held;
+} pipeout;
+
+/* NULL if fd is not a pipe */
+pipeout *pipeout_open(int fd, size_t pipe_size);
+int pipeout_write(pipeout *po, const uint8_t *data, size_t len);
+int pipeout_give(pipeout *po, const uint8_t *data, size_t len, void *owner);
+void pipeout_close(pipeout *po);
+
+#endif
@@ -0,0 +1,155 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pipestat.h"
+
+static const char *stage_name[NUM_STAGE] = {
+    "read", "decode", "split", "scan", "write", "udp", "http", "shm",
+    "analyze"
+};
+
+/* vDSO clock; a few tens of ns per call */
+uint64_t
+pipestat_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+pipestat_add(pipestat *ps, int stage, uint64_t start, size_t in, size_t out)
+{
+    stage_stat *st = &ps->stage[stage];
+    uint64_t ns = pipestat_now() - start;
+    uint64_t us = ns / 1000;
+    int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+    if(bucket >= PIPESTAT_HIST)
+        bucket = PIPESTAT_HIST - 1;
+
+    st->count++;
+    st->total_ns += ns;
+    if(ns > st->max_ns)
+        st->max_ns = ns;
+    st->bytes_in += in;
+    st->bytes_out += out;
+    st->hist[bucket]++;
+}
+
+void
+pipestat_error(pipestat *ps, int stage)
+{
+    ps->stage[stage].errors++;
+}
+
+static void
+dump_queue(FILE *fp, const char *name, const QUEUE_T *q)
+{
+    if(!q)
+        return;
+    fprintf(fp, "queue %-8s used=%u/%u hwm=%u stalls=%lu\n",
+            name, q->num_used, q->size, q->hwm, q->stalls);
+}
+
+void
+pipestat_dump(FILE *fp, const pipestat *ps, const QUEUE_T *capture,
+              const QUEUE_T *decoded)
+{
+    int i, b;
+    const stage_stat *st;
+
+    for(i = 0; i < NUM_STAGE; i++) {
+        st = &ps->stage[i];
+        if(!st->count && !st->errors)
+            continue;
+        fprintf(fp, "stage %-7s %lu calls, %lu errors, in %llu B, out %llu B, "
+                "avg %.1fus, max %.1fus\n",
+                stage_name[i], st->count, st->errors,
+                (unsigned long long)st->bytes_in,
+                (unsigned long long)st->bytes_out,
+                st->count ? st->total_ns / 1000.0 / st->count : 0.0,
+                st->max_ns / 1000.0);
+        fprintf(fp, "             ");
+        for(b = 0; b < PIPESTAT_HIST; b++) {
+            if(!st->hist[b])
+                continue;
+            if(b < PIPESTAT_HIST - 1)
+                fprintf(fp, " <%dus:%lu", 1 << b, st->hist[b]);
+            else
+                fprintf(fp, " >=%dus:%lu", 1 << (b - 1), st->hist[b]);
+        }
+        fprintf(fp, "\n");
+    }
+    dump_queue(fp, "capture", capture);
+    dump_queue(fp, "decoded", decoded);
+}
+
+static int
+json_queue(char *p, size_t len, const char *sep, const char *name,
+           const QUEUE_T *q)
+{
+    return snprintf(p, len, "%s\"%s\":{\"used\":%u,\"size\":%u,\"hwm\":%u,"
+                    "\"stalls\":%lu}",
+                    sep, name, q->num_used, q->size, q->hwm, q->stalls);
+}
+
+/* one JSON object and a newline into line; its length, or -1 if it
+   does not fit */
+int
+pipestat_format(char *line, size_t len, const pipestat *ps,
+                const QUEUE_T *capture, const QUEUE_T *decoded)
+{
+    size_t n = 0;
+    const stage_stat *st;
+    struct timespec ts;
+    int i, b;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    n += snprintf(line + n, len - n, "{\"time\":%ld.%03ld,\"stages\":{",
+                  (long)ts.tv_sec, ts.tv_nsec / 1000000);
+    for(i = 0; i < NUM_STAGE && n < len; i++) {
+        st = &ps->stage[i];
+        n += snprintf(line + n, len - n,
+                      "%s\"%s\":{\"count\":%lu,\"errors\":%lu,"
+                      "\"bytes_in\":%llu,\"bytes_out\":%llu,"
+                      "\"total_us\":%llu,\"max_us\":%llu,\"hist\":[",
+                      i ? "," : "", stage_name[i], st->count, st->errors,
+                      (unsigned long long)st->bytes_in,
+                      (unsigned long long)st->bytes_out,
+                      (unsigned long long)(st->total_ns / 1000),
+                      (unsigned long long)(st->max_ns / 1000));
+        for(b = 0; b < PIPESTAT_HIST && n < len; b++)
+            n += snprintf(line + n, len - n, "%s%lu", b ? "," : "",
+                          st->hist[b]);
+        if(n < len)
+            n += snprintf(line + n, len - n, "]}");
+    }
+    if(n < len)
+        n += snprintf(line + n, len - n, "},\"queues\":{");
+    if(capture && n < len)
+        n += json_queue(line + n, len - n, "", "capture", capture);
+    if(decoded && n < len)
+        n += json_queue(line + n, len - n, capture ? "," : "", "decoded",
+                        decoded);
+    if(n < len)
+        n += snprintf(line + n, len - n, "}}\n");
+    if(n >= len)
+        return -1;  /* truncated; never emit a broken line */
+    return n;
+}
+
+/* one JSON object per line, written with a single write() */
+void
+pipestat_json(int fd, const pipestat *ps, const QUEUE_T *capture,
+              const QUEUE_T *decoded)
+{
+    char line[PIPESTAT_JSON_MAX];
+    int n = pipestat_format(line, sizeof(line), ps, capture, decoded);
+
+    if(n > 0 && write(fd, line, n) < 0)
+        ;   /* monitoring must not disturb recording */
+}
@@ -0,0 +1,61 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _PIPESTAT_H_
+#define _PIPESTAT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "recpt1.h"
+
+/*
+ * Pipeline instrumentation for recpt1, one set per pipeline.  Each
+ * stage is updated by a single thread only, so counters are plain
+ * integers; readers (dumps) may see a slightly torn snapshot, which is
+ * fine for statistics.
+ * Latency is bucketed by log2 of microseconds.
+ */
+
+#define PIPESTAT_HIST 20    /* <1us, <2us, ..., >=2^18us */
+#define PIPESTAT_JSON_MAX 4096
+
+enum {
+    STAGE_READ,     /* read() from tuner */
+    STAGE_DECODE,   /* b25_decode */
+    STAGE_SPLIT,    /* split_select / split_ts */
+    STAGE_SCAN,     /* random access point scan */
+    STAGE_WRITE,    /* write to output file */
+    STAGE_UDP,      /* write to udp socket */
+    STAGE_HTTP,     /* copy to the http ring */
+    STAGE_SHM,      /* copy to the shared-memory ring */
+    STAGE_ANALYZE,  /* per-PID counters */
+    NUM_STAGE
+};
+
+typedef struct stage_stat {
+    unsigned long count;
+    unsigned long errors;   /* failed, empty or dropped calls */
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    unsigned long hist[PIPESTAT_HIST];
+} stage_stat;
+
+typedef struct pipestat {
+    stage_stat stage[NUM_STAGE];
+} pipestat;
+
+uint64_t pipestat_now(void);
+void pipestat_add(pipestat *ps, int stage, uint64_t start, size_t in,
+                  size_t out);
+void pipestat_error(pipestat *ps, int stage);
+void pipestat_dump(FILE *fp, const pipestat *ps, const QUEUE_T *capture,
+                   const QUEUE_T *decoded);
+int pipestat_format(char *line, size_t len, const pipestat *ps,
+                    const QUEUE_T *capture, const QUEUE_T *decoded);
+void pipestat_json(int fd, const pipestat *ps, const QUEUE_T *capture,
+                   const QUEUE_T *decoded);
+
+#endif
@@ -0,0 +1,308 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * pt1bench: run recpt1 against the pt1emu tuner emulator and report
+ * throughput, CPU per stream and per-stage costs.  Every stream is a
+ * separate recpt1 process, exactly as in production; the per-stage
+ * numbers come from recpt1's --stat-fd JSON line written at exit.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_STREAM  16
+#define STAT_FD     3
+#define STAT_BUFSZ  (64 * 1024)
+
+static const char *stage_name[] = { "read", "decode", "split", "scan", "write", "udp", "http", "shm",
+                                     "analyze" };
+#define NUM_STAGE (int)(sizeof(stage_name) / sizeof(stage_name[0]))
+
+typedef struct stream {
+    pid_t pid;
+    int stat_pipe;
+    struct timespec start;
+    double wall;
+    struct rusage ru;
+    int status;
+    char stat[STAT_BUFSZ];
+    int stat_len;
+} stream;
+
+typedef struct options {
+    const char *recpt1;
+    const char *emu;
+    const char *file;
+    const char *pids;
+    const char *rate;
+    const char *channel;
+    const char *sid;
+    const char *output;
+    int seconds;
+    int streams;
+    int b25;
+    int verbose;
+} options;
+
+static double
+elapsed(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int
+spawn(const options *opt, int index, stream *st)
+{
+    int fds[2];
+    char device[32], secs[16], fd[8];
+    char *argv[16];
+    int argc = 0;
+
+    if(pipe(fds) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &st->start);
+    st->pid = fork();
+    if(st->pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if(st->pid == 0) {
+        close(fds[0]);
+        if(dup2(fds[1], STAT_FD) < 0)
+            _exit(127);
+        if(!opt->verbose) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, 2);
+        }
+        setenv("LD_PRELOAD", opt->emu, 1);
+        if(opt->file)
+            setenv("PT1EMU_FILE", opt->file, 1);
+        if(opt->pids)
+            setenv("PT1EMU_PIDS", opt->pids, 1);
+        if(opt->rate)
+            setenv("PT1EMU_RATE", opt->rate, 1);
+        if(opt->sid)
+            setenv("PT1EMU_SID", opt->sid, 1);
+
+        snprintf(device, sizeof(device), "/dev/pt1video%d", index);
+        snprintf(secs, sizeof(secs), "%d", opt->seconds);
+        snprintf(fd, sizeof(fd), "%d", STAT_FD);
+        argv[argc++] = (char *)opt->recpt1;
+        if(opt->b25)
+            argv[argc++] = "--b25";
+        if(opt->sid) {
+            argv[argc++] = "--sid";
+            argv[argc++] = (char *)opt->sid;
+        }
+        argv[argc++] = "--device";
+        argv[argc++] = device;
+        argv[argc++] = "--stat-fd";
+        argv[argc++] = fd;
+        argv[argc++] = "--stat-interval";
+        argv[argc++] = "86400";
+        argv[argc++] = (char *)opt->channel;
+        argv[argc++] = secs;
+        argv[argc++] = (char *)opt->output;
+        argv[argc] = NULL;
+        execv(opt->recpt1, argv);
+        perror("execv");
+        _exit(127);
+    }
+    close(fds[1]);
+    st->stat_pipe = fds[0];
+    return 0;
+}
+
+/* take the last JSON line written to the stat pipe */
+static const char *
+last_line(stream *st)
+{
+    char *p;
+
+    if(st->stat_len <= 0)
+        return NULL;
+    st->stat[st->stat_len] = '\0';
+    if(st->stat[st->stat_len - 1] == '\n')
+        st->stat[--st->stat_len] = '\0';
+    p = strrchr(st->stat, '\n');
+    return p ? p + 1 : st->stat;
+}
+
+static int
+stage_field(const char *json, const char *stage, unsigned long *count,
+            unsigned long long *bytes_out, unsigned long long *total_us,
+            unsigned long long *max_us)
+{
+    char key[32];
+    const char *p;
+    unsigned long errors;
+    unsigned long long bytes_in;
+
+    snprintf(key, sizeof(key), "\"%s\":{", stage);
+    p = json ? strstr(json, key) : NULL;
+    if(!p)
+        return -1;
+    p += strlen(key);
+    if(sscanf(p, "\"count\":%lu,\"errors\":%lu,\"bytes_in\":%llu,"
+              "\"bytes_out\":%llu,\"total_us\":%llu,\"max_us\":%llu",
+              count, &errors, &bytes_in, bytes_out, total_us, max_us) != 6)
+        return -1;
+    return 0;
+}
+
+static void
+report(const options *opt, stream *st, int nstream)
+{
+    int i, s;
+    double total_mb = 0, total_cpu = 0, wall = 0;
+
+    for(i = 0; i < nstream; i++) {
+        const char *json = last_line(&st[i]);
+        unsigned long count;
+        unsigned long long bytes = 0, total_us, max_us;
+        double cpu = st[i].ru.ru_utime.tv_sec + st[i].ru.ru_utime.tv_usec / 1e6 +
+            st[i].ru.ru_stime.tv_sec + st[i].ru.ru_stime.tv_usec / 1e6;
+
+        stage_field(json, "read", &count, &bytes, &total_us, &max_us);
+        printf("stream %d: %.2fs wall, %.1f MB/s, cpu %.2fs (%.1f%%)%s\n",
+               i, st[i].wall, bytes / 1e6 / st[i].wall, cpu,
+               cpu * 100 / st[i].wall,
+               WIFEXITED(st[i].status) && !WEXITSTATUS(st[i].status) ?
+               "" : " [recpt1 failed]");
+        for(s = 0; s < NUM_STAGE; s++) {
+            if(stage_field(json, stage_name[s], &count, &bytes, &total_us,
+                           &max_us) < 0 || !count)
+                continue;
+            printf("  %-7s %9lu calls  avg %8.1fus  max %8lluus  %6.1f%% of wall\n",
+                   stage_name[s], count, (double)total_us / count, max_us,
+                   total_us / 1e4 / st[i].wall);
+        }
+        stage_field(json, "read", &count, &bytes, &total_us, &max_us);
+        total_mb += bytes / 1e6;
+        total_cpu += cpu;
+        if(st[i].wall > wall)
+            wall = st[i].wall;
+    }
+    printf("total: %d stream(s), %.1f MB/s, cpu %.2fs (%s)\n",
+           nstream, wall > 0 ? total_mb / wall : 0, total_cpu,
+           opt->file ? opt->file : "synthetic");
+}
+
+static void
+show_usage(char *cmd)
+{
+    fprintf(stderr, "Usage: \n%s [options]\n\n", cmd);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "--recpt1 path:       recpt1 binary (default ./recpt1)\n");
+    fprintf(stderr, "--emu path:          emulator library (default ./pt1emu.so)\n");
+    fprintf(stderr, "--file ts:           replay a recorded TS file\n");
+    fprintf(stderr, "--pids pid:weight,.. synthetic PID mix\n");
+    fprintf(stderr, "--rate mbps:         pace each stream (default unpaced)\n");
+    fprintf(stderr, "--streams n:         concurrent streams (default 1)\n");
+    fprintf(stderr, "--time sec:          duration (default 5)\n");
+    fprintf(stderr, "--channel ch:        channel passed to recpt1 (default 27)\n");
+    fprintf(stderr, "--sid sid:           enable the splitter for this service\n");
+    fprintf(stderr, "--b25:               enable b25 decoding\n");
+    fprintf(stderr, "--output file:       recpt1 destination (default /dev/null)\n");
+    fprintf(stderr, "--verbose:           show recpt1 messages\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    static stream st[MAX_STREAM];
+    options opt = {
+        "./recpt1", "./pt1emu.so", NULL, NULL, NULL, "27", NULL,
+        "/dev/null", 5, 1, 0, 0
+    };
+    struct option long_options[] = {
+        { "recpt1",  1, NULL, 'R'},
+        { "emu",     1, NULL, 'E'},
+        { "file",    1, NULL, 'f'},
+        { "pids",    1, NULL, 'p'},
+        { "rate",    1, NULL, 'r'},
+        { "streams", 1, NULL, 'n'},
+        { "time",    1, NULL, 't'},
+        { "channel", 1, NULL, 'c'},
+        { "sid",     1, NULL, 'i'},
+        { "b25",     0, NULL, 'b'},
+        { "output",  1, NULL, 'o'},
+        { "verbose", 0, NULL, 'v'},
+        { "help",    0, NULL, 'h'},
+        {0, 0, NULL, 0} /* terminate */
+    };
+    int result, option_index, i, done;
+
+    while((result = getopt_long(argc, argv, "R:E:f:p:r:n:t:c:i:bo:vh",
+                                long_options, &option_index)) != -1) {
+        switch(result) {
+        case 'R': opt.recpt1 = optarg; break;
+        case 'E': opt.emu = optarg; break;
+        case 'f': opt.file = optarg; break;
+        case 'p': opt.pids = optarg; break;
+        case 'r': opt.rate = optarg; break;
+        case 'n': opt.streams = atoi(optarg); break;
+        case 't': opt.seconds = atoi(optarg); break;
+        case 'c': opt.channel = optarg; break;
+        case 'i': opt.sid = optarg; break;
+        case 'b': opt.b25 = 1; break;
+        case 'o': opt.output = optarg; break;
+        case 'v': opt.verbose = 1; break;
+        default:
+            show_usage(argv[0]);
+            return result == 'h' ? 0 : 1;
+        }
+    }
+    if(opt.streams < 1 || opt.streams > MAX_STREAM || opt.seconds < 1) {
+        fprintf(stderr, "streams must be 1-%d and time >= 1\n", MAX_STREAM);
+        return 1;
+    }
+
+    for(i = 0; i < opt.streams; i++) {
+        if(spawn(&opt, i, &st[i]) < 0)
+            return 1;
+    }
+
+    /* drain the stat pipes while waiting so a child never blocks on them */
+    for(done = 0; done < opt.streams; ) {
+        for(i = 0; i < opt.streams; i++) {
+            ssize_t n;
+
+            if(st[i].pid <= 0)
+                continue;
+            fcntl(st[i].stat_pipe, F_SETFL, O_NONBLOCK);
+            while((n = read(st[i].stat_pipe, st[i].stat + st[i].stat_len,
+                            STAT_BUFSZ - 1 - st[i].stat_len)) > 0)
+                st[i].stat_len += n;
+            if(st[i].stat_len >= STAT_BUFSZ - 1)
+                st[i].stat_len = 0;     /* keep only recent output */
+            if(wait4(st[i].pid, &st[i].status, WNOHANG, &st[i].ru) == st[i].pid) {
+                st[i].wall = elapsed(&st[i].start);
+                fcntl(st[i].stat_pipe, F_SETFL, 0);
+                while((n = read(st[i].stat_pipe, st[i].stat + st[i].stat_len,
+                                STAT_BUFSZ - 1 - st[i].stat_len)) > 0)
+                    st[i].stat_len += n;
+                close(st[i].stat_pipe);
+                st[i].pid = 0;
+                done++;
+            }
+        }
+        usleep(50000);
+    }
+
+    report(&opt, st, opt.streams);
+    return 0;
+}
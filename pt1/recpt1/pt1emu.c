@@ -0,0 +1,614 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * pt1emu: file-backed PT1/PT2 tuner emulator, loaded with LD_PRELOAD.
+ *
+ * open() of /dev/pt1video* returns a descriptor whose read() delivers a
+ * transport stream and whose ioctl() answers the pt1_ioctl.h requests,
+ * so recpt1 and friends run unmodified without hardware.
+ *
+ * Environment:
+ *   PT1EMU_FILE   replay this TS file (looped).  Otherwise synthetic TS.
+ *   PT1EMU_PIDS   synthetic PID mix "pid:weight,..."
+ *                 (default "0x111:90,0x112:8,0x1fff:2")
+ *   PT1EMU_SID    service id of the synthetic PAT/PMT (default 1024)
+ *   PT1EMU_RATE   pacing in Mbit/s; 0 or unset delivers as fast as read.
+ *
+ * The synthetic PCR_PID (the first PID besides null) carries a PCR every
+ * PCR_INTERVAL packets, counting the mux at PT1EMU_RATE (32 Mbit/s when
+ * unpaced).
+ * SET_PID_FILTER is honoured like the driver: filtered packets are taken
+ * out of what read() returns while pacing still follows the full mux.
+ * SET_TIMESTAMP prefixes packets with the time they were due at the
+ * configured rate (or the time of the read when unpaced); a read shorter
+ * than one stamped packet fails with EINVAL.
+ *
+ * splice() from the device moves up to one driver wakeup (64KB) into
+ * the pipe: replayed files are spliced from the page cache, synthetic
+ * packets are copied in as the driver copies its ring.  Like read()
+ * it is paced; the PID filter and timestamps are not supported there.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* RTLD_NEXT */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "pt1_ioctl.h"
+
+#define EMU_PREFIX      "/dev/pt1video"
+#define EMU_MAX_FD      1024
+#define EMU_MAX_PID     16
+#define TS_SIZE         188
+#define READ_CHUNK      (TS_SIZE * 87)
+#define SPLICE_CHUNK    (16 * 4096 / TS_SIZE * TS_SIZE)    /* READ_SIZE */
+#define PSI_INTERVAL    1000    /* packets between PAT/PMT */
+#define PMT_PID         0x1f0
+#define PCR_INTERVAL    500     /* packets, ~25ms at 30Mbit/s */
+#define PCR_RATE        4000000 /* bytes per second when unpaced */
+
+typedef struct emu_pid {
+    int pid;
+    int weight;
+    int credit;
+    uint8_t cc;
+} emu_pid;
+
+typedef struct emu_dev {
+    pthread_mutex_t lock;
+    int streaming;
+    int file;                   /* replay fd, -1: synthetic */
+    emu_pid pids[EMU_MAX_PID];
+    int num_pids;
+    int sid;
+    uint8_t pat_cc, pmt_cc;
+    unsigned long packets;
+    unsigned long pcr_packet;   /* packet of the last PCR */
+    uint32_t rnd;
+    double rate;                /* bytes per second, 0: unpaced */
+    struct timespec start;
+    uint64_t delivered;         /* mux bytes, before the PID filter */
+    PID_FILTER filter;
+    int timestamp;
+    uint8_t *scratch;           /* synthetic packets for splice() */
+} emu_dev;
+
+static emu_dev *devs[EMU_MAX_FD];
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_splice)(int, loff_t *, int, loff_t *, size_t,
+                              unsigned int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_close)(int);
+
+static void
+resolve(void)
+{
+    if(real_read)
+        return;
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_open64 = dlsym(RTLD_NEXT, "open64");
+    real_read = dlsym(RTLD_NEXT, "read");
+    real_splice = dlsym(RTLD_NEXT, "splice");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+    real_close = dlsym(RTLD_NEXT, "close");
+}
+
+static uint32_t
+crc32_mpeg(const uint8_t *p, int len)
+{
+    uint32_t crc = 0xffffffff;
+    int i;
+
+    while(len--) {
+        crc ^= (uint32_t)*p++ << 24;
+        for(i = 0; i < 8; i++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+    return crc;
+}
+
+static void
+parse_pids(emu_dev *dev, const char *spec)
+{
+    char *copy = strdup(spec), *tok, *save = NULL;
+
+    dev->num_pids = 0;
+    for(tok = strtok_r(copy, ",", &save); tok && dev->num_pids < EMU_MAX_PID;
+        tok = strtok_r(NULL, ",", &save)) {
+        emu_pid *p = &dev->pids[dev->num_pids];
+        char *colon = strchr(tok, ':');
+
+        p->pid = strtol(tok, NULL, 0) & 0x1fff;
+        p->weight = colon ? atoi(colon + 1) : 1;
+        if(p->weight <= 0)
+            continue;
+        dev->num_pids++;
+    }
+    free(copy);
+}
+
+static void
+put_header(uint8_t *pkt, int pid, int pusi, uint8_t *cc)
+{
+    pkt[0] = 0x47;
+    pkt[1] = (pusi ? 0x40 : 0) | ((pid >> 8) & 0x1f);
+    pkt[2] = pid & 0xff;
+    pkt[3] = 0x10 | (*cc & 0x0f);
+    *cc = (*cc + 1) & 0x0f;
+}
+
+/* PSI section in one packet: pointer field, section, CRC, 0xff stuffing */
+static void
+put_section(uint8_t *pkt, const uint8_t *sec, int len)
+{
+    uint32_t crc = crc32_mpeg(sec, len);
+
+    memset(pkt + 4, 0xff, TS_SIZE - 4);
+    pkt[4] = 0;
+    memcpy(pkt + 5, sec, len);
+    pkt[5 + len] = crc >> 24;
+    pkt[6 + len] = crc >> 16;
+    pkt[7 + len] = crc >> 8;
+    pkt[8 + len] = crc;
+}
+
+static int
+pcr_pid(const emu_dev *dev)
+{
+    int i;
+
+    for(i = 0; i < dev->num_pids; i++) {
+        if(dev->pids[i].pid != 0x1fff)
+            return dev->pids[i].pid;
+    }
+    return 0x1fff;
+}
+
+static void
+make_pat(emu_dev *dev, uint8_t *pkt)
+{
+    uint8_t sec[16];
+    int len = 0;
+
+    put_header(pkt, 0x0000, 1, &dev->pat_cc);
+    sec[len++] = 0x00;                      /* table_id */
+    sec[len++] = 0xb0;
+    sec[len++] = 13;                        /* section_length */
+    sec[len++] = 0x00; sec[len++] = 0x01;   /* transport_stream_id */
+    sec[len++] = 0xc1;                      /* version 0, current */
+    sec[len++] = 0; sec[len++] = 0;
+    sec[len++] = dev->sid >> 8; sec[len++] = dev->sid;
+    sec[len++] = 0xe0 | (PMT_PID >> 8); sec[len++] = PMT_PID & 0xff;
+    put_section(pkt, sec, len);
+}
+
+static void
+make_pmt(emu_dev *dev, uint8_t *pkt)
+{
+    uint8_t sec[TS_SIZE];
+    int len = 0, i, first = 1, pcr = pcr_pid(dev);
+
+    put_header(pkt, PMT_PID, 1, &dev->pmt_cc);
+    sec[len++] = 0x02;
+    sec[len++] = 0xb0;
+    sec[len++] = 0;                         /* section_length, below */
+    sec[len++] = dev->sid >> 8; sec[len++] = dev->sid;
+    sec[len++] = 0xc1;
+    sec[len++] = 0; sec[len++] = 0;
+    sec[len++] = 0xe0 | (pcr >> 8); sec[len++] = pcr & 0xff;
+    sec[len++] = 0xf0; sec[len++] = 0;      /* program_info_length */
+    for(i = 0; i < dev->num_pids && len < TS_SIZE - 16; i++) {
+        int pid = dev->pids[i].pid;
+        if(pid == 0x1fff)
+            continue;
+        sec[len++] = first ? 0x02 : 0x0f;   /* MPEG2 video / AAC */
+        sec[len++] = 0xe0 | (pid >> 8); sec[len++] = pid & 0xff;
+        sec[len++] = 0xf0; sec[len++] = 0;
+        first = 0;
+    }
+    sec[2] = len - 3 + 4;
+    put_section(pkt, sec, len);
+}
+
+/* adaptation field with the PCR of the packet's mux position */
+static void
+put_pcr(emu_dev *dev, uint8_t *pkt)
+{
+    double rate = dev->rate > 0 ? dev->rate : PCR_RATE;
+    uint64_t pcr = (uint64_t)(dev->packets * TS_SIZE / rate * 27e6);
+    uint64_t base = pcr / 300;
+    int ext = pcr % 300;
+
+    pkt[3] |= 0x20;
+    pkt[4] = 7;
+    pkt[5] = 0x10;
+    pkt[6] = base >> 25;
+    pkt[7] = base >> 17;
+    pkt[8] = base >> 9;
+    pkt[9] = base >> 1;
+    pkt[10] = (base & 1) << 7 | 0x7e | ext >> 8;
+    pkt[11] = ext;
+    dev->pcr_packet = dev->packets;
+}
+
+static void
+make_packet(emu_dev *dev, uint8_t *pkt)
+{
+    emu_pid *best = NULL;
+    int i, total = 0;
+
+    if(dev->packets % PSI_INTERVAL == 0) {
+        make_pat(dev, pkt);
+    }
+    else if(dev->packets % PSI_INTERVAL == 1) {
+        make_pmt(dev, pkt);
+    }
+    else {
+        /* smooth weighted round robin keeps the mix deterministic */
+        for(i = 0; i < dev->num_pids; i++) {
+            dev->pids[i].credit += dev->pids[i].weight;
+            total += dev->pids[i].weight;
+            if(!best || dev->pids[i].credit > best->credit)
+                best = &dev->pids[i];
+        }
+        best->credit -= total;
+        put_header(pkt, best->pid, 0, &best->cc);
+        for(i = 4; i < TS_SIZE; i += 4) {
+            dev->rnd ^= dev->rnd << 13;
+            dev->rnd ^= dev->rnd >> 17;
+            dev->rnd ^= dev->rnd << 5;
+            memcpy(pkt + i, &dev->rnd, 4);
+        }
+        if(best->pid != 0x1fff && best->pid == pcr_pid(dev) &&
+           dev->packets - dev->pcr_packet >= PCR_INTERVAL)
+            put_pcr(dev, pkt);
+    }
+    dev->packets++;
+}
+
+static ssize_t
+fill_file(emu_dev *dev, uint8_t *buf, size_t len)
+{
+    ssize_t n = real_read(dev->file, buf, len);
+
+    if(n == 0) {
+        lseek(dev->file, 0, SEEK_SET);
+        n = real_read(dev->file, buf, len);
+    }
+    if(n > 0)
+        n -= n % TS_SIZE;
+    return n;
+}
+
+/* drop the packets SET_PID_FILTER excludes, as the driver thread does */
+static ssize_t
+apply_filter(emu_dev *dev, uint8_t *buf, ssize_t len, int unit)
+{
+    PID_FILTER *f = &dev->filter;
+    ssize_t in, out = 0;
+    int pid;
+
+    if(!f->flags)
+        return len;
+    for(in = 0; in + unit <= len; in += unit) {
+        const uint8_t *p = buf + in + unit - TS_SIZE;
+
+        pid = ((p[1] & 0x1f) << 8) | p[2];
+        if((f->flags & PID_FILTER_DROP_NULL) && pid == 0x1fff)
+            continue;
+        if((f->flags & PID_FILTER_ENABLE) && !PID_FILTER_ISSET(f, pid))
+            continue;
+        if(out != in)
+            memmove(buf + out, buf + in, unit);
+        out += unit;
+    }
+    return out;
+}
+
+/* spread n packets out to 192 bytes and prefix their arrival times */
+static void
+add_stamps(emu_dev *dev, uint8_t *buf, int n, uint64_t mux_offset)
+{
+    struct timespec now;
+    double sec;
+    uint32_t stamp;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for(i = n - 1; i >= 0; i--) {
+        uint8_t *p = buf + i * (TIMESTAMP_SIZE + TS_SIZE);
+
+        memmove(p + TIMESTAMP_SIZE, buf + i * TS_SIZE, TS_SIZE);
+        if(dev->rate > 0)
+            sec = dev->start.tv_sec + dev->start.tv_nsec / 1e9 +
+                (mux_offset + (i + 1) * TS_SIZE) / dev->rate;
+        else
+            sec = now.tv_sec + now.tv_nsec / 1e9;
+        stamp = (uint32_t)(uint64_t)(sec * 27e6) & TIMESTAMP_MASK;
+        p[0] = stamp >> 24;
+        p[1] = stamp >> 16;
+        p[2] = stamp >> 8;
+        p[3] = stamp;
+    }
+}
+
+/* sleep until the stream position is due at the configured rate */
+static void
+pace(emu_dev *dev, size_t len)
+{
+    struct timespec now, wait;
+    double due, elapsed;
+
+    if(dev->rate <= 0)
+        return;
+    due = (dev->delivered + len) / dev->rate;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - dev->start.tv_sec) +
+        (now.tv_nsec - dev->start.tv_nsec) / 1e9;
+    if(due <= elapsed)
+        return;
+    wait.tv_sec = (time_t)(due - elapsed);
+    wait.tv_nsec = (long)((due - elapsed - wait.tv_sec) * 1e9);
+    nanosleep(&wait, NULL);
+}
+
+static int
+emu_open(const char *path)
+{
+    emu_dev *dev;
+    const char *env;
+    int fd;
+
+    fd = real_open("/dev/null", O_RDONLY);
+    if(fd < 0 || fd >= EMU_MAX_FD) {
+        if(fd >= 0)
+            real_close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+
+    dev = calloc(1, sizeof(emu_dev));
+    pthread_mutex_init(&dev->lock, NULL);
+    dev->file = -1;
+    dev->rnd = 0x2545f491;
+    dev->sid = (env = getenv("PT1EMU_SID")) ? atoi(env) : 1024;
+    parse_pids(dev, (env = getenv("PT1EMU_PIDS")) ? env :
+               "0x111:90,0x112:8,0x1fff:2");
+    if(dev->num_pids == 0)
+        parse_pids(dev, "0x1fff:1");
+    dev->rate = (env = getenv("PT1EMU_RATE")) ? atof(env) * 1000000 / 8 : 0;
+    if((env = getenv("PT1EMU_FILE"))) {
+        dev->file = real_open(env, O_RDONLY);
+        if(dev->file < 0)
+            fprintf(stderr, "pt1emu: cannot open %s\n", env);
+    }
+    devs[fd] = dev;
+    fprintf(stderr, "pt1emu: %s -> %s\n", path,
+            dev->file >= 0 ? env : "synthetic TS");
+    return fd;
+}
+
+static int
+is_emu_path(const char *path)
+{
+    return path && !strncmp(path, EMU_PREFIX, strlen(EMU_PREFIX));
+}
+
+int
+open(const char *path, int flags, ...)
+{
+    va_list ap;
+    int mode;
+
+    resolve();
+    if(is_emu_path(path))
+        return emu_open(path);
+    va_start(ap, flags);
+    mode = va_arg(ap, int);
+    va_end(ap);
+    return real_open(path, flags, mode);
+}
+
+int
+open64(const char *path, int flags, ...)
+{
+    va_list ap;
+    int mode;
+
+    resolve();
+    if(is_emu_path(path))
+        return emu_open(path);
+    va_start(ap, flags);
+    mode = va_arg(ap, int);
+    va_end(ap);
+    return real_open64 ? real_open64(path, flags, mode) :
+        real_open(path, flags, mode);
+}
+
+ssize_t
+read(int fd, void *buf, size_t count)
+{
+    emu_dev *dev;
+    ssize_t n = 0, mux = 0;
+    int unit;
+
+    resolve();
+    if(fd < 0 || fd >= EMU_MAX_FD || !(dev = devs[fd]))
+        return real_read(fd, buf, count);
+
+    if(count > READ_CHUNK)
+        count = READ_CHUNK;
+
+    pthread_mutex_lock(&dev->lock);
+    unit = dev->timestamp ? TIMESTAMP_SIZE + TS_SIZE : TS_SIZE;
+    /* the driver refuses a stamped read shorter than one record */
+    if(dev->timestamp && count < (size_t)unit) {
+        pthread_mutex_unlock(&dev->lock);
+        errno = EINVAL;
+        return -1;
+    }
+    /* generate 188 byte packets, spread out below if stamped */
+    count = count / unit * TS_SIZE;
+    if(dev->streaming) {
+        pace(dev, count);
+        if(dev->file >= 0) {
+            n = fill_file(dev, buf, count);
+        }
+        else {
+            for(n = 0; n < (ssize_t)count; n += TS_SIZE)
+                make_packet(dev, (uint8_t *)buf + n);
+        }
+        if(n > 0) {
+            if(dev->timestamp)
+                add_stamps(dev, buf, n / TS_SIZE, dev->delivered);
+            dev->delivered += n;
+            mux = n;
+            n = n / TS_SIZE * unit;
+            n = apply_filter(dev, buf, n, unit);
+        }
+    }
+    pthread_mutex_unlock(&dev->lock);
+
+    /* like the driver: nothing to read while stopped */
+    if(mux == 0)
+        usleep(10000);
+    return n;
+}
+
+ssize_t
+splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len,
+       unsigned int flags)
+{
+    emu_dev *dev;
+    ssize_t n = 0;
+    int i;
+
+    resolve();
+    if(fd_in < 0 || fd_in >= EMU_MAX_FD || !(dev = devs[fd_in]))
+        return real_splice(fd_in, off_in, fd_out, off_out, len, flags);
+
+    if(len > SPLICE_CHUNK)
+        len = SPLICE_CHUNK;
+    len -= len % TS_SIZE;
+
+    pthread_mutex_lock(&dev->lock);
+    if(dev->filter.flags || dev->timestamp) {
+        pthread_mutex_unlock(&dev->lock);
+        errno = EINVAL;
+        return -1;
+    }
+    if(dev->streaming) {
+        pace(dev, len);
+        if(dev->file >= 0) {
+            n = real_splice(dev->file, NULL, fd_out, NULL, len, flags);
+            if(n == 0) {
+                lseek(dev->file, 0, SEEK_SET);
+                n = real_splice(dev->file, NULL, fd_out, NULL, len, flags);
+            }
+        }
+        else {
+            if(!dev->scratch)
+                dev->scratch = malloc(SPLICE_CHUNK);
+            if(dev->scratch) {
+                for(i = 0; i < (int)len; i += TS_SIZE)
+                    make_packet(dev, dev->scratch + i);
+                n = write(fd_out, dev->scratch, len);
+            }
+        }
+        if(n > 0)
+            dev->delivered += n;
+    }
+    pthread_mutex_unlock(&dev->lock);
+
+    if(n == 0)
+        usleep(10000);
+    return n;
+}
+
+int
+ioctl(int fd, unsigned long request, ...)
+{
+    emu_dev *dev;
+    va_list ap;
+    void *arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    resolve();
+    if(fd < 0 || fd >= EMU_MAX_FD || !(dev = devs[fd]))
+        return real_ioctl(fd, request, arg);
+
+    pthread_mutex_lock(&dev->lock);
+    switch(request) {
+    case SWITCH_CHANNEL:
+        /* a retune clears the filter */
+        memset(&dev->filter, 0, sizeof(PID_FILTER));
+        /* FALLTHROUGH */
+    case START_REC:
+        if(!dev->streaming) {
+            dev->streaming = 1;
+            dev->delivered = 0;
+            clock_gettime(CLOCK_MONOTONIC, &dev->start);
+        }
+        break;
+    case STOP_REC:
+        dev->streaming = 0;
+        break;
+    case GET_SIGNAL_STRENGTH:
+        *(int *)arg = 0x3000;
+        break;
+    case GET_TUNE_STAT:
+        memset(arg, 0, sizeof(TUNE_STAT));
+        break;
+    case SET_TIMESTAMP:
+        dev->timestamp = *(int *)arg != 0;
+        break;
+    case SET_PID_FILTER:
+        memcpy(&dev->filter, arg, sizeof(PID_FILTER));
+        break;
+    case SET_CHANNEL:
+        /* a retune clears the filter */
+        memset(&dev->filter, 0, sizeof(PID_FILTER));
+        break;
+    case LNB_ENABLE:
+    case LNB_DISABLE:
+        break;
+    default:
+        pthread_mutex_unlock(&dev->lock);
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+int
+close(int fd)
+{
+    emu_dev *dev;
+
+    resolve();
+    if(fd >= 0 && fd < EMU_MAX_FD && (dev = devs[fd])) {
+        devs[fd] = NULL;
+        if(dev->file >= 0)
+            real_close(dev->file);
+        pthread_mutex_destroy(&dev->lock);
+        free(dev->scratch);
+        free(dev);
+    }
+    return real_close(fd);
+}
@@ -0,0 +1,260 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * pt1mon: sample the state of every PT1/PT2 tuner from /proc/driver/pt1
+ * and publish it in a shared-memory ring.  Tuners are never opened, so
+ * monitoring does not take a tuner away from recpt1.
+ */
+#include <sys/mman.h>
+
+#include "recpt1core.h"
+#include "pt1mon.h"
+#include "cnlut.h"
+
+#define PROC_PATH "/proc/driver/pt1"
+#define PROC_BUFSZ 8192
+
+static volatile sig_atomic_t mon_exit = 0;
+
+static void
+handle_signal(int sig)
+{
+    mon_exit = 1;
+}
+
+static pt1mon_shm *
+open_shm(const char *name, int interval_ms)
+{
+    pt1mon_shm *shm;
+    int fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    if(ftruncate(fd, sizeof(pt1mon_shm)) < 0) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(pt1mon_shm), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    close(fd);
+    if(shm == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    memset(shm, 0, sizeof(pt1mon_shm));
+    shm->version = PT1MON_VERSION;
+    shm->ring_size = PT1MON_RING_SIZE;
+    shm->interval_ms = interval_ms;
+    __sync_synchronize();
+    shm->magic = PT1MON_MAGIC;
+
+    return shm;
+}
+
+/* read and parse one snapshot of the driver state */
+static int
+take_sample(int pfd, pt1mon_sample *sample)
+{
+    static char buf[PROC_BUFSZ];
+    char *line, *next;
+    ssize_t len;
+    pt1mon_tuner *t;
+    char type;
+
+    len = pread(pfd, buf, sizeof(buf) - 1, 0);
+    if(len < 0)
+        return -1;
+    buf[len] = '\0';
+
+    sample->num_tuner = 0;
+    for(line = buf; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if(next)
+            *next++ = '\0';
+        if(*line == '#')
+            continue;
+        if(sample->num_tuner >= PT1MON_MAX_TUNER)
+            break;
+
+        t = &sample->tuner[sample->num_tuner];
+        if(sscanf(line, "%d %u %c %d %d %u %u %u %u %u %u %u",
+                  &t->card, &t->minor, &type, &t->valid, &t->locked,
+                  &t->signal, &t->drop, &t->overflow, &t->counter_err,
+                  &t->trans_err, &t->size, &t->switch_us) != 12)
+            continue;
+        t->type = (type == 'S') ? CHTYPE_SATELLITE : CHTYPE_GROUND;
+        t->cn = t->valid ? cnlut_lookup(t->type, t->signal) : 0.0;
+        sample->num_tuner++;
+    }
+
+    return 0;
+}
+
+static void
+publish(pt1mon_shm *shm, const pt1mon_sample *sample)
+{
+    uint64_t n = shm->head;
+    pt1mon_sample *slot = &shm->ring[n % PT1MON_RING_SIZE];
+
+    slot->seq = PT1MON_SEQ_BUSY;
+    __sync_synchronize();
+    slot->tv_sec = sample->tv_sec;
+    slot->tv_nsec = sample->tv_nsec;
+    slot->sample_ns = sample->sample_ns;
+    slot->num_tuner = sample->num_tuner;
+    memcpy(slot->tuner, sample->tuner,
+           sample->num_tuner * sizeof(pt1mon_tuner));
+    __sync_synchronize();
+    slot->seq = n;
+    __sync_synchronize();
+    shm->head = n + 1;
+}
+
+static void
+print_sample(const pt1mon_sample *sample)
+{
+    int i;
+    const pt1mon_tuner *t;
+
+    for(i = 0; i < sample->num_tuner; i++) {
+        t = &sample->tuner[i];
+        if(!t->valid)
+            continue;
+        fprintf(stderr, "card%d/%u %s C/N=%.2fdB lock=%d drop=%u ovf=%u "
+                "cnt=%u trans=%u\n", t->card, t->minor,
+                t->type == CHTYPE_SATELLITE ? "BS/CS" : "UHF",
+                t->cn, t->locked, t->drop, t->overflow,
+                t->counter_err, t->trans_err);
+    }
+    fprintf(stderr, "sample took %uus\n", sample->sample_ns / 1000);
+}
+
+void
+show_usage(char *cmd)
+{
+    fprintf(stderr, "Usage: \n%s [--interval msec] [--name shmname] [--count n] [--print]\n", cmd);
+    fprintf(stderr, "\n");
+}
+
+void
+show_options(void)
+{
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "--interval msec:     Sampling interval (default 1000)\n");
+    fprintf(stderr, "--name shmname:      Shared memory name (default %s)\n", PT1MON_SHM_NAME);
+    fprintf(stderr, "--count n:           Exit after n samples\n");
+    fprintf(stderr, "--print:             Also print each sample\n");
+    fprintf(stderr, "--help:              Show this help\n");
+    fprintf(stderr, "--version:           Show version\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int result;
+    int option_index;
+    struct option long_options[] = {
+        { "interval",  1, NULL, 'i'},
+        { "name",      1, NULL, 'n'},
+        { "count",     1, NULL, 'c'},
+        { "print",     0, NULL, 'p'},
+        { "help",      0, NULL, 'h'},
+        { "version",   0, NULL, 'v'},
+        {0, 0, NULL, 0} /* terminate */
+    };
+
+    int interval_ms = 1000;
+    char *name = PT1MON_SHM_NAME;
+    long count = -1;
+    boolean use_print = FALSE;
+    static pt1mon_sample sample;
+    pt1mon_shm *shm;
+    struct timespec t0, t1, wait;
+    int pfd;
+
+    while((result = getopt_long(argc, argv, "i:n:c:phv",
+                                long_options, &option_index)) != -1) {
+        switch(result) {
+        case 'i':
+            interval_ms = atoi(optarg);
+            if(interval_ms <= 0)
+                interval_ms = 1000;
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        case 'c':
+            count = atol(optarg);
+            break;
+        case 'p':
+            use_print = TRUE;
+            break;
+        case 'h':
+            fprintf(stderr, "\n");
+            show_usage(argv[0]);
+            fprintf(stderr, "\n");
+            show_options();
+            fprintf(stderr, "\n");
+            exit(0);
+            break;
+        case 'v':
+            fprintf(stderr, "%s %s\n", argv[0], version);
+            fprintf(stderr, "signal monitor for PT1/2 digital tuner.\n");
+            exit(0);
+            break;
+        }
+    }
+
+    pfd = open(PROC_PATH, O_RDONLY);
+    if(pfd < 0) {
+        fprintf(stderr, "Cannot open %s\n", PROC_PATH);
+        return 1;
+    }
+
+    shm = open_shm(name, interval_ms);
+    if(shm == NULL) {
+        close(pfd);
+        return 1;
+    }
+
+    /* build C/N tables before any thread polls signal */
+    cnlut_init();
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    wait.tv_sec = interval_ms / 1000;
+    wait.tv_nsec = (interval_ms % 1000) * 1000000L;
+
+    while(!mon_exit && count != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if(take_sample(pfd, &sample) < 0) {
+            fprintf(stderr, "Cannot read %s\n", PROC_PATH);
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        sample.sample_ns = (t1.tv_sec - t0.tv_sec) * 1000000000L +
+            (t1.tv_nsec - t0.tv_nsec);
+        clock_gettime(CLOCK_REALTIME, &t1);
+        sample.tv_sec = t1.tv_sec;
+        sample.tv_nsec = t1.tv_nsec;
+
+        publish(shm, &sample);
+        if(use_print)
+            print_sample(&sample);
+        if(count > 0)
+            count--;
+
+        nanosleep(&wait, NULL);
+    }
+
+    munmap(shm, sizeof(pt1mon_shm));
+    shm_unlink(name);
+    close(pfd);
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _PT1MON_H_
+#define _PT1MON_H_
+
+#include <stdint.h>
+
+/*
+ * Shared-memory layout published by pt1mon.
+ *
+ * The segment is created with shm_open(PT1MON_SHM_NAME) and holds a
+ * ring of PT1MON_RING_SIZE samples.  Sample n lives in
+ * ring[n % ring_size]; head is the number of samples published so far.
+ *
+ * Readers take the latest sample as follows: read head (h), copy
+ * ring[(h - 1) % ring_size], then accept the copy only if its seq is
+ * h - 1 and head has not advanced by ring_size or more meanwhile.
+ * The writer sets seq to PT1MON_SEQ_BUSY while a slot is being filled.
+ */
+
+#define PT1MON_SHM_NAME     "/pt1mon"
+#define PT1MON_MAGIC        0x4d315450  /* "PT1M" */
+#define PT1MON_VERSION      1
+#define PT1MON_MAX_TUNER    32
+#define PT1MON_RING_SIZE    64
+#define PT1MON_SEQ_BUSY     UINT64_MAX
+
+typedef struct pt1mon_tuner {
+    int32_t  card;
+    uint32_t minor;
+    int32_t  type;          /* CHTYPE_SATELLITE or CHTYPE_GROUND */
+    int32_t  valid;         /* opened by a client */
+    int32_t  locked;        /* last tune succeeded */
+    uint32_t signal;        /* raw GET_SIGNAL_STRENGTH value */
+    double   cn;            /* C/N in dB */
+    uint32_t drop;
+    uint32_t overflow;
+    uint32_t counter_err;
+    uint32_t trans_err;
+    uint32_t size;          /* bytes pending in the driver ring */
+    uint32_t switch_us;     /* downtime of last SWITCH_CHANNEL */
+} pt1mon_tuner;
+
+typedef struct pt1mon_sample {
+    volatile uint64_t seq;
+    int64_t  tv_sec;        /* CLOCK_REALTIME of the sample */
+    int64_t  tv_nsec;
+    uint32_t sample_ns;     /* time spent taking the sample */
+    int32_t  num_tuner;
+    pt1mon_tuner tuner[PT1MON_MAX_TUNER];
+} pt1mon_sample;
+
+typedef struct pt1mon_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+    uint32_t interval_ms;
+    volatile uint64_t head;
+    pt1mon_sample ring[PT1MON_RING_SIZE];
+} pt1mon_shm;
+
+#endif
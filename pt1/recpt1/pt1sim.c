@@ -0,0 +1,718 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * pt1sim: drive the driver's DMA demultiplexer (driver/pt1_demux.c) from
+ * userspace.  For every simulated card a "hardware" thread fills DMA
+ * pages with micro-packets for all four channels at the configured
+ * rates, a card thread replays pt1_thread() over those pages and one
+ * reader per channel replays pt1_read().  Readers check every TS packet
+ * for order and integrity, so regressions in the demux logic and its
+ * locking show up without a PT1/PT2 installed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "pt1_demux.h"
+#include "pt1_pci.h"
+
+#define MAX_CARD        32
+#define READ_SIZE       (16 * DMA_SIZE)         /* same as the driver */
+#define READ_CNT        (PACKET_SIZE * 512)     /* recpt1 reads whole packets */
+#define T_BUF_SIZE      (2 * 1024 * 1024)       /* CHANNEL_DMA_SIZE */
+#define S_BUF_SIZE      (4 * 1024 * 1024)       /* BS_CHANNEL_DMA_SIZE */
+#define SIM_PID_BASE    0x100
+#define DMA_WAIT_MS     500
+#define READ_WAIT_MS    500
+
+/* DMA channel -> tuner, as real_channel[] in the driver */
+static const int real_channel[MAX_CHANNEL] = {0, 2, 1, 3};
+
+typedef struct sim_channel {
+    /* state shared with the card thread, as in PT1_CHANNEL */
+    pthread_mutex_t lock;
+    pthread_cond_t wait_q;          /* reader waits for READ_SIZE */
+    pthread_cond_t dma_wait_q;      /* card thread waits for room */
+    uint8_t *buf;
+    uint32_t maxsize;
+    uint32_t pointer;
+    uint32_t size;
+    uint32_t packet_size;
+    uint8_t packet_buf[TIMESTAMP_SIZE + PACKET_SIZE];
+    int timestamp;
+    int req_dma;
+    uint32_t drop;
+    uint32_t overflow;
+    uint32_t counter_err;
+    uint32_t trans_err;
+    PID_FILTER filter;
+    uint32_t filtered;
+
+    /* generator side */
+    double rate;                    /* Mbps, 0 = share of unpaced output */
+    double credit;
+    uint32_t gen_seq;
+    uint64_t gen_count;             /* packets generated, nulls included */
+    int gen_pos;                    /* next micro-packet of the packet */
+    uint8_t gen_packet[PACKET_SIZE + 2];
+
+    /* reader side */
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t corrupt;
+    uint32_t next_seq;
+    int synced;
+    uint32_t last_stamp;
+    uint64_t stamp_back;            /* arrival stamps going backwards */
+} sim_channel;
+
+typedef struct sim_card {
+    int index;
+    int npage;
+    uint32_t **pages;
+    pthread_mutex_t reset_lock;     /* a DMA page write or reset_dma() */
+    unsigned int reset_gen;
+    volatile uint32_t regs;         /* error bits read by the card thread */
+    sim_channel ch[MAX_CHANNEL];    /* indexed by tuner number */
+    uint64_t pages_done;
+    uint64_t hw_stall;
+    uint64_t bad_channel;
+    uint64_t resets;
+    double demux_cpu;
+    ARRIVAL_CLOCK clock;
+    pthread_t hw_thread;
+    pthread_t card_thread;
+    pthread_t reader[MAX_CHANNEL];
+} sim_card;
+
+typedef struct sim_reader {
+    sim_card *card;
+    int tuner;
+} sim_reader;
+
+typedef struct options {
+    int cards;
+    int seconds;
+    int npage;
+    int poll_ms;
+    int read_delay_ms;
+    long error_every;
+    long bad_every;
+    long null_every;
+    int timestamp;
+    double rate[MAX_CHANNEL];
+} options;
+
+static options opt = {
+    1, 5, 2048, 100, 0, 0, 0, 0, 0, { 29.0, 29.0, 17.0, 17.0 }
+};
+static volatile int sim_stop = 0;
+
+static void
+add_ms(struct timespec *ts, long ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if(ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static void
+timed_wait(pthread_cond_t *cond, pthread_mutex_t *lock, long ms)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    add_ms(&ts, ms);
+    pthread_cond_timedwait(cond, lock, &ts);
+}
+
+/*
+ * "hardware": build micro-packets for a tuner.  Each TS packet carries
+ * its card, tuner and sequence number so readers can verify it.
+ */
+static uint32_t
+next_micro(sim_card *card, int dma_channel)
+{
+    sim_channel *ch = &card->ch[real_channel[dma_channel]];
+    MICRO_PACKET micro;
+    uint8_t *p;
+    uint32_t val;
+
+    if(ch->gen_pos == 0 && opt.null_every &&
+       ++ch->gen_count % opt.null_every == 0) {
+        /* stuffing for the driver's PID filter to drop */
+        memset(ch->gen_packet, 0xff, sizeof(ch->gen_packet));
+        ch->gen_packet[0] = 0x47;
+        ch->gen_packet[1] = 0x1f;
+        ch->gen_packet[2] = 0xff;
+        ch->gen_packet[3] = 0x10;
+    }
+    else if(ch->gen_pos == 0) {
+        uint16_t pid = SIM_PID_BASE + real_channel[dma_channel];
+
+        memset(ch->gen_packet, 0xff, sizeof(ch->gen_packet));
+        ch->gen_packet[0] = 0x47;
+        ch->gen_packet[1] = (pid >> 8) & 0x1f;
+        ch->gen_packet[2] = pid & 0xff;
+        ch->gen_packet[3] = 0x10 | (ch->gen_seq & 0x0f);
+        ch->gen_packet[4] = card->index;
+        ch->gen_packet[5] = real_channel[dma_channel];
+        memcpy(&ch->gen_packet[8], &ch->gen_seq, sizeof(ch->gen_seq));
+        ch->gen_seq++;
+    }
+    p = &ch->gen_packet[ch->gen_pos * MICRO_DATA_SIZE];
+    micro.data[2] = p[0];
+    micro.data[1] = p[1];
+    micro.data[0] = p[2];
+    micro.head = ((dma_channel + 1) << 5) | ((ch->gen_pos & 0x07) << 2) |
+        (ch->gen_pos == 0 ? MICRO_START : 0);
+    if(++ch->gen_pos * MICRO_DATA_SIZE >= PACKET_SIZE)
+        ch->gen_pos = 0;
+
+    memcpy(&val, &micro, sizeof(val));
+    return val;
+}
+
+/* weighted round robin over the four DMA channels */
+static int
+pick_channel(sim_card *card)
+{
+    int i, best = 0;
+    double total = 0;
+
+    for(i = 0; i < MAX_CHANNEL; i++) {
+        sim_channel *ch = &card->ch[real_channel[i]];
+
+        ch->credit += ch->rate;
+        total += ch->rate;
+        if(ch->credit > card->ch[real_channel[best]].credit)
+            best = i;
+    }
+    card->ch[real_channel[best]].credit -= total;
+    return best;
+}
+
+static void
+fill_page(sim_card *card, uint32_t *page)
+{
+    /* a micro-packet on DMA channel 0 must be skipped */
+    static const MICRO_PACKET bad = { { 0, 0, 0 }, MICRO_START };
+    int inject_bad = opt.bad_every &&
+        card->pages_done % opt.bad_every == opt.bad_every - 1;
+    int i;
+
+    for(i = 0; i < (int)DMA_PAGE_WORDS; i++) {
+        if(i == (int)DMA_PAGE_FLAG)
+            continue;
+        if(inject_bad && i == (int)DMA_PAGE_WORDS / 2)
+            memcpy(&page[i], &bad, sizeof(bad));
+        else
+            page[i] = next_micro(card, pick_channel(card));
+    }
+    if(opt.error_every &&
+       card->pages_done % opt.error_every == opt.error_every - 1) {
+        static const uint32_t bits[] = {
+            BIT_RAM_OVERFLOW, BIT_INITIATOR_ERROR, BIT_INITIATOR_WARNING
+        };
+        MICRO_PACKET *m = (MICRO_PACKET *)&page[DMA_PAGE_WORDS / 4];
+
+        card->regs = bits[(card->pages_done / opt.error_every) % 3];
+        m->head |= MICRO_ERROR;
+    }
+    __atomic_store_n(&page[DMA_PAGE_FLAG],
+                     next_micro(card, pick_channel(card)), __ATOMIC_RELEASE);
+}
+
+static void *
+hw_func(void *arg)
+{
+    sim_card *card = arg;
+    int pos = 0;
+    unsigned int gen = 0;
+    double total_rate = 0, page_ns;
+    struct timespec next;
+    int i;
+
+    for(i = 0; i < MAX_CHANNEL; i++)
+        total_rate += card->ch[i].rate;
+    /* only paced when every tuner has a rate */
+    for(i = 0; i < MAX_CHANNEL; i++)
+        if(opt.rate[i] <= 0)
+            total_rate = 0;
+    page_ns = total_rate > 0 ?
+        (DMA_PAGE_WORDS * MICRO_DATA_SIZE * 8 * 1000.0) / total_rate : 0;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while(!sim_stop) {
+        uint32_t *page = card->pages[pos];
+
+        if(__atomic_load_n(&page[DMA_PAGE_FLAG], __ATOMIC_ACQUIRE) != 0) {
+            /* card thread is behind: real hardware would overflow */
+            card->hw_stall++;
+            usleep(100);
+            continue;
+        }
+        pthread_mutex_lock(&card->reset_lock);
+        if(gen != card->reset_gen) {
+            /* reset_dma(): start again from the first page */
+            gen = card->reset_gen;
+            pos = 0;
+            page = card->pages[0];
+        }
+        fill_page(card, page);
+        card->pages_done++;
+        pthread_mutex_unlock(&card->reset_lock);
+        if(++pos >= card->npage)
+            pos = 0;
+
+        if(page_ns > 0) {
+            next.tv_nsec += (long)page_ns;
+            while(next.tv_nsec >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void
+reset_dma(sim_card *card)
+{
+    int i;
+
+    pthread_mutex_lock(&card->reset_lock);
+    for(i = 0; i < card->npage; i++)
+        card->pages[i][DMA_PAGE_FLAG] = 0;
+    card->reset_gen++;
+    card->resets++;
+    pthread_mutex_unlock(&card->reset_lock);
+}
+
+/* count_ready_pages() */
+static uint32_t
+count_ready_pages(sim_card *card, int pos)
+{
+    uint32_t count = 0;
+
+    while(count < (uint32_t)card->npage &&
+          __atomic_load_n(&card->pages[pos][DMA_PAGE_FLAG], __ATOMIC_ACQUIRE)) {
+        count++;
+        if(++pos >= card->npage)
+            pos = 0;
+    }
+    return count;
+}
+
+/* pt1_thread() without the register and kthread plumbing */
+static void *
+card_func(void *arg)
+{
+    sim_card *card = arg;
+    sim_channel *channel;
+    int pos = 0;
+    uint32_t pass_left = 0, pass_page = 0;
+    struct timespec now;
+    int lp, dma_channel, status, fault;
+    uint32_t *dataptr, val;
+    union {
+        uint32_t val;
+        MICRO_PACKET packet;
+    } micro;
+    struct timespec cpu;
+
+    while(!sim_stop) {
+        for(;;) {
+            dataptr = card->pages[pos];
+            if(__atomic_load_n(&dataptr[DMA_PAGE_FLAG], __ATOMIC_ACQUIRE) == 0)
+                break;
+            if(pass_left == 0) {
+                pass_left = count_ready_pages(card, pos);
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                pt1_clock_pass(&card->clock,
+                               now.tv_sec * 1000000000ULL + now.tv_nsec,
+                               pass_left);
+                pass_page = 0;
+            }
+            fault = FALSE;
+            for(lp = 0; lp < (int)DMA_PAGE_WORDS; lp++) {
+                micro.val = dataptr[lp];
+                status = pt1_micro_decode(&micro.packet, &dma_channel);
+                if(status == MICRO_BAD_CHANNEL) {
+                    card->bad_channel++;
+                    continue;
+                }
+                channel = &card->ch[real_channel[dma_channel]];
+                if(status == MICRO_FAULT) {
+                    val = __atomic_exchange_n(&card->regs, 0, __ATOMIC_ACQ_REL);
+                    if(val & BIT_RAM_OVERFLOW)
+                        channel->overflow++;
+                    if(val & BIT_INITIATOR_ERROR)
+                        channel->counter_err++;
+                    if(val & BIT_INITIATOR_WARNING)
+                        channel->trans_err++;
+                    reset_dma(card);
+                    fault = TRUE;
+                    break;
+                }
+                pthread_mutex_lock(&channel->lock);
+                while(RING_FULL(channel->maxsize, channel->size) && !sim_stop) {
+                    pthread_cond_signal(&channel->wait_q);
+                    channel->req_dma = TRUE;
+                    timed_wait(&channel->dma_wait_q, &channel->lock, DMA_WAIT_MS);
+                    channel->drop++;
+                }
+                if(RING_FULL(channel->maxsize, channel->size)) {
+                    /* stopping with a full ring */
+                    pthread_mutex_unlock(&channel->lock);
+                    continue;
+                }
+                if(pt1_micro_append(&channel->packet_buf[TIMESTAMP_SIZE],
+                                    &channel->packet_size, &micro.packet)) {
+                    if(!pt1_pid_pass(&channel->filter,
+                                     &channel->packet_buf[TIMESTAMP_SIZE])) {
+                        channel->filtered++;
+                    }
+                    else if(channel->timestamp) {
+                        pt1_clock_stamp(&card->clock,
+                                        pass_page * DMA_PAGE_WORDS + lp,
+                                        channel->packet_buf);
+                        pt1_ring_put(channel->buf, channel->maxsize,
+                                     channel->pointer, channel->size,
+                                     channel->packet_buf,
+                                     TIMESTAMP_SIZE + PACKET_SIZE);
+                        channel->size += TIMESTAMP_SIZE + PACKET_SIZE;
+                    }
+                    else {
+                        pt1_ring_put(channel->buf, channel->maxsize,
+                                     channel->pointer, channel->size,
+                                     &channel->packet_buf[TIMESTAMP_SIZE],
+                                     PACKET_SIZE);
+                        channel->size += PACKET_SIZE;
+                    }
+                }
+                pthread_mutex_unlock(&channel->lock);
+            }
+            if(fault) {
+                /* reset_dma() already cleared every page */
+                pos = 0;
+                pass_left = 0;
+                continue;
+            }
+            __atomic_store_n(&dataptr[DMA_PAGE_FLAG], 0, __ATOMIC_RELEASE);
+            if(pass_left > 0) {
+                pass_left--;
+                pass_page++;
+            }
+            if(++pos >= card->npage)
+                pos = 0;
+
+            for(lp = 0; lp < MAX_CHANNEL; lp++) {
+                channel = &card->ch[lp];
+                if(channel->size >= READ_SIZE)
+                    pthread_cond_signal(&channel->wait_q);
+            }
+            if(sim_stop)
+                break;
+        }
+        usleep(opt.poll_ms * 1000);
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    card->demux_cpu = cpu.tv_sec + cpu.tv_nsec / 1e9;
+    return NULL;
+}
+
+/* pt1_read() */
+static uint32_t
+sim_read(sim_channel *channel, uint8_t *buf, size_t cnt)
+{
+    uint32_t size, pos, first;
+
+    pthread_mutex_lock(&channel->lock);
+    if(channel->size < READ_SIZE)
+        timed_wait(&channel->wait_q, &channel->lock, READ_WAIT_MS);
+    if(!channel->size) {
+        size = 0;
+    }
+    else {
+        if(channel->timestamp)
+            cnt -= cnt % (TIMESTAMP_SIZE + PACKET_SIZE);
+        pos = channel->pointer;
+        size = pt1_ring_get(channel->maxsize, &channel->pointer, &channel->size,
+                            cnt, &first);
+        memcpy(buf, &channel->buf[pos], first);
+        if(first < size)
+            memcpy(&buf[first], channel->buf, size - first);
+    }
+    if(channel->req_dma) {
+        channel->req_dma = FALSE;
+        pthread_cond_signal(&channel->dma_wait_q);
+    }
+    pthread_mutex_unlock(&channel->lock);
+    return size;
+}
+
+static void
+check_packet(sim_card *card, int tuner, sim_channel *ch, const uint8_t *p)
+{
+    uint16_t pid = ((p[1] & 0x1f) << 8) | p[2];
+    uint32_t seq;
+
+    ch->packets++;
+    if(p[0] != 0x47 || pid != SIM_PID_BASE + tuner ||
+       p[4] != card->index || p[5] != tuner || p[PACKET_SIZE - 1] != 0xff) {
+        ch->corrupt++;
+        return;
+    }
+    memcpy(&seq, &p[8], sizeof(seq));
+    if(ch->synced) {
+        if(seq > ch->next_seq)
+            ch->lost += seq - ch->next_seq;
+        else if(seq < ch->next_seq)
+            ch->reordered++;
+    }
+    ch->synced = TRUE;
+    ch->next_seq = seq + 1;
+}
+
+/* arrival stamps wrap at 30 bits but must never step back */
+static void
+check_stamp(sim_channel *ch, const uint8_t *p)
+{
+    uint32_t stamp = ((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]) &
+        TIMESTAMP_MASK;
+
+    if(ch->packets && ((stamp - ch->last_stamp) & TIMESTAMP_MASK) >
+       TIMESTAMP_MASK / 2)
+        ch->stamp_back++;
+    ch->last_stamp = stamp;
+}
+
+static void *
+reader_func(void *arg)
+{
+    sim_reader *r = arg;
+    sim_channel *ch = &r->card->ch[r->tuner];
+    uint8_t *buf = malloc(READ_CNT);
+    uint32_t len, i, unit = PACKET_SIZE;
+
+    if(!buf)
+        return NULL;
+    if(ch->timestamp)
+        unit += TIMESTAMP_SIZE;
+    while(!sim_stop) {
+        len = sim_read(ch, buf, READ_CNT);
+        /* the ring only ever holds whole packets */
+        for(i = 0; i + unit <= len; i += unit) {
+            if(ch->timestamp)
+                check_stamp(ch, &buf[i]);
+            check_packet(r->card, r->tuner, ch, &buf[i + unit - PACKET_SIZE]);
+        }
+        if(len % unit)
+            ch->corrupt++;
+        ch->bytes += len;
+        if(opt.read_delay_ms)
+            usleep(opt.read_delay_ms * 1000);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int
+init_card(sim_card *card, int index)
+{
+    int i;
+
+    memset(card, 0, sizeof(*card));
+    card->index = index;
+    card->npage = opt.npage;
+    pthread_mutex_init(&card->reset_lock, NULL);
+    card->pages = calloc(card->npage, sizeof(uint32_t *));
+    if(!card->pages)
+        return -1;
+    for(i = 0; i < card->npage; i++) {
+        card->pages[i] = calloc(1, DMA_SIZE);
+        if(!card->pages[i])
+            return -1;
+    }
+    for(i = 0; i < MAX_CHANNEL; i++) {
+        sim_channel *ch = &card->ch[i];
+
+        pthread_mutex_init(&ch->lock, NULL);
+        pthread_cond_init(&ch->wait_q, NULL);
+        pthread_cond_init(&ch->dma_wait_q, NULL);
+        /* tuners 0 and 1 are ISDB-S */
+        ch->maxsize = i < 2 ? S_BUF_SIZE : T_BUF_SIZE;
+        ch->buf = malloc(ch->maxsize);
+        if(!ch->buf)
+            return -1;
+        ch->rate = opt.rate[i] > 0 ? opt.rate[i] : 1.0;
+        if(opt.null_every)
+            ch->filter.flags = PID_FILTER_DROP_NULL;
+        ch->timestamp = opt.timestamp;
+    }
+    return 0;
+}
+
+static int
+report(sim_card *card, int ncard, double wall)
+{
+    int c, i, failed = 0;
+    uint64_t total = 0, resets = 0, bad = 0, stall = 0;
+    double cpu = 0;
+
+    for(c = 0; c < ncard; c++) {
+        for(i = 0; i < MAX_CHANNEL; i++) {
+            sim_channel *ch = &card[c].ch[i];
+
+            printf("card%d/%d %c %7.2f MB/s pkts=%llu lost=%llu reorder=%llu "
+                   "corrupt=%llu drop=%u ovf=%u cnt=%u trans=%u filt=%u tsback=%llu\n",
+                   c, i, i < 2 ? 'S' : 'T', ch->bytes / 1e6 / wall,
+                   (unsigned long long)ch->packets,
+                   (unsigned long long)ch->lost,
+                   (unsigned long long)ch->reordered,
+                   (unsigned long long)ch->corrupt, ch->drop, ch->overflow,
+                   ch->counter_err, ch->trans_err, ch->filtered,
+                   (unsigned long long)ch->stamp_back);
+            total += ch->bytes;
+            /* without injected faults the stream must be intact */
+            if(!opt.error_every && (ch->lost || ch->reordered || ch->corrupt))
+                failed = 1;
+            if(ch->stamp_back)
+                failed = 1;
+        }
+        resets += card[c].resets;
+        bad += card[c].bad_channel;
+        stall += card[c].hw_stall;
+        cpu += card[c].demux_cpu;
+    }
+    printf("total: %d card(s), %.1f MB/s, demux cpu %.2fs (%.1f%% of one core), "
+           "resets=%llu bad_channel=%llu hw_stall=%llu%s\n",
+           ncard, total / 1e6 / wall, cpu, cpu * 100 / wall,
+           (unsigned long long)resets, (unsigned long long)bad,
+           (unsigned long long)stall, failed ? " FAILED" : "");
+    return failed;
+}
+
+static void
+show_usage(char *cmd)
+{
+    fprintf(stderr, "Usage: \n%s [options]\n\n", cmd);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "--cards n:           simulated cards (default 1, max %d)\n", MAX_CARD);
+    fprintf(stderr, "--time sec:          duration (default 5)\n");
+    fprintf(stderr, "--rate s0,s1,t0,t1:  Mbps per tuner, 0 = unpaced (default 29,29,17,17)\n");
+    fprintf(stderr, "--pages n:           DMA pages per card (default 2048)\n");
+    fprintf(stderr, "--poll msec:         card thread idle sleep (default 100)\n");
+    fprintf(stderr, "--read-delay msec:   slow readers down to fill the rings\n");
+    fprintf(stderr, "--error-every n:     error micro-packet every n pages\n");
+    fprintf(stderr, "--bad-every n:       channel 0 micro-packet every n pages\n");
+    fprintf(stderr, "--null-every n:      null packet every n packets, dropped by the PID filter\n");
+    fprintf(stderr, "--timestamp:         192-byte packets with arrival stamps\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    static sim_card card[MAX_CARD];
+    static sim_reader reader[MAX_CARD][MAX_CHANNEL];
+    struct option long_options[] = {
+        { "cards",       1, NULL, 'n'},
+        { "time",        1, NULL, 't'},
+        { "rate",        1, NULL, 'r'},
+        { "pages",       1, NULL, 'p'},
+        { "poll",        1, NULL, 'P'},
+        { "read-delay",  1, NULL, 'd'},
+        { "error-every", 1, NULL, 'e'},
+        { "bad-every",   1, NULL, 'b'},
+        { "null-every",  1, NULL, 'N'},
+        { "timestamp",   0, NULL, 's'},
+        { "help",        0, NULL, 'h'},
+        {0, 0, NULL, 0} /* terminate */
+    };
+    int result, option_index, c, i;
+    struct timespec start, now;
+    char *p;
+
+    while((result = getopt_long(argc, argv, "n:t:r:p:P:d:e:b:N:sh",
+                                long_options, &option_index)) != -1) {
+        switch(result) {
+        case 'n': opt.cards = atoi(optarg); break;
+        case 't': opt.seconds = atoi(optarg); break;
+        case 'r':
+            for(i = 0, p = optarg; i < MAX_CHANNEL && p; i++) {
+                opt.rate[i] = atof(p);
+                p = strchr(p, ',');
+                if(p)
+                    p++;
+            }
+            /* a single value applies to every tuner */
+            for(; i < MAX_CHANNEL; i++)
+                opt.rate[i] = opt.rate[0];
+            break;
+        case 'p': opt.npage = atoi(optarg); break;
+        case 'P': opt.poll_ms = atoi(optarg); break;
+        case 'd': opt.read_delay_ms = atoi(optarg); break;
+        case 'e': opt.error_every = atol(optarg); break;
+        case 'b': opt.bad_every = atol(optarg); break;
+        case 'N': opt.null_every = atol(optarg); break;
+        case 's': opt.timestamp = 1; break;
+        default:
+            show_usage(argv[0]);
+            return result == 'h' ? 0 : 1;
+        }
+    }
+    if(opt.cards < 1 || opt.cards > MAX_CARD || opt.seconds < 1 ||
+       opt.npage < 2 || opt.poll_ms < 1) {
+        show_usage(argv[0]);
+        return 1;
+    }
+
+    for(c = 0; c < opt.cards; c++) {
+        if(init_card(&card[c], c) < 0) {
+            fprintf(stderr, "Cannot allocate card %d\n", c);
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(c = 0; c < opt.cards; c++) {
+        for(i = 0; i < MAX_CHANNEL; i++) {
+            reader[c][i].card = &card[c];
+            reader[c][i].tuner = i;
+            pthread_create(&card[c].reader[i], NULL, reader_func, &reader[c][i]);
+        }
+        pthread_create(&card[c].card_thread, NULL, card_func, &card[c]);
+        pthread_create(&card[c].hw_thread, NULL, hw_func, &card[c]);
+    }
+
+    sleep(opt.seconds);
+    sim_stop = 1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for(c = 0; c < opt.cards; c++) {
+        pthread_join(card[c].hw_thread, NULL);
+        pthread_join(card[c].card_thread, NULL);
+        for(i = 0; i < MAX_CHANNEL; i++) {
+            pthread_mutex_lock(&card[c].ch[i].lock);
+            pthread_cond_broadcast(&card[c].ch[i].wait_q);
+            pthread_mutex_unlock(&card[c].ch[i].lock);
+            pthread_join(card[c].reader[i], NULL);
+        }
+    }
+
+    return report(card, opt.cards,
+                  (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9);
+}
@@ -0,0 +1,199 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rapscan.h"
+#include "tsindex.h"
+
+#define TS_PACKET_SIZE  188
+#define TS_SYNC         0x47
+
+/* stream_type of the PMT */
+#define ST_MPEG1_VIDEO  0x01
+#define ST_MPEG2_VIDEO  0x02
+#define ST_H264         0x1b
+#define ST_HEVC         0x24
+
+rapscan *
+rapscan_create(const uint8_t *stream_type)
+{
+    rapscan *rs = calloc(1, sizeof(rapscan));
+
+    if(!rs)
+        return NULL;
+    rs->stream_type = stream_type ? stream_type : rs->own_type;
+    return rs;
+}
+
+void
+rapscan_destroy(rapscan *rs)
+{
+    free(rs);
+}
+
+/* learn PMT PIDs and ES stream types from single-packet sections */
+static void
+parse_psi(rapscan *rs, int pid, const uint8_t *p)
+{
+    int pos, len, end, i;
+
+    if(!(p[1] & 0x40) || !(p[3] & 0x10))
+        return;
+    pos = (p[3] & 0x20) ? 5 + p[4] : 4;
+    if(pos >= TS_PACKET_SIZE - 4)
+        return;
+    pos += 1 + p[pos];      /* pointer_field */
+    if(pos + 12 > TS_PACKET_SIZE)
+        return;
+    len = ((p[pos + 1] & 0x0f) << 8) | p[pos + 2];
+    end = pos + 3 + len - 4;    /* CRC excluded */
+    if(end > TS_PACKET_SIZE)
+        end = TS_PACKET_SIZE;
+
+    if(pid == 0 && p[pos] == 0x00) {
+        for(i = pos + 8; i + 4 <= end; i += 4) {
+            if(p[i] | p[i + 1])
+                rs->is_pmt[((p[i + 2] & 0x1f) << 8) | p[i + 3]] = 1;
+        }
+    }
+    else if(rs->is_pmt[pid] && p[pos] == 0x02) {
+        i = pos + 12 + (((p[pos + 10] & 0x0f) << 8) | p[pos + 11]);
+        while(i + 5 <= end) {
+            rs->own_type[((p[i + 1] & 0x1f) << 8) | p[i + 2]] = p[i];
+            i += 5 + (((p[i + 3] & 0x0f) << 8) | p[i + 4]);
+        }
+    }
+}
+
+/* next 00 00 01 prefix at or after p, returns the byte after it */
+static const uint8_t *
+start_code(const uint8_t *p, const uint8_t *end)
+{
+    /* memchr is vectorised in libc; check the two zeros behind each hit */
+    for(p += 2; p < end; p++) {
+        p = memchr(p, 0x01, end - p);
+        if(!p)
+            return NULL;
+        if(!p[-1] && !p[-2])
+            return p + 1 < end ? p + 1 : NULL;
+    }
+    return NULL;
+}
+
+/* does the elementary stream data starting a PES begin a key frame */
+static int
+es_keyframe(int type, const uint8_t *p, const uint8_t *end)
+{
+    while((p = start_code(p, end)) != NULL) {
+        switch(type) {
+        case ST_MPEG1_VIDEO:
+        case ST_MPEG2_VIDEO:
+            if(p[0] == 0xb3 || p[0] == 0xb8)    /* sequence, GOP */
+                return 1;
+            if(p[0] == 0x00)                    /* picture */
+                return p + 2 < end && ((p[2] >> 3) & 7) == 1;
+            break;
+        case ST_H264:
+            switch(p[0] & 0x1f) {
+            case 5:                             /* IDR slice */
+            case 7:                             /* SPS */
+                return 1;
+            case 9:                             /* AUD: primary_pic_type I */
+                if(p + 1 < end && (p[1] >> 5) == 0)
+                    return 1;
+                break;
+            case 1:                             /* non-IDR slice */
+                return 0;
+            }
+            break;
+        case ST_HEVC: {
+            int nal = (p[0] >> 1) & 0x3f;
+
+            if((nal >= 16 && nal <= 23) || nal == 32 || nal == 33)
+                return 1;                       /* IRAP, VPS, SPS */
+            if(nal == 35 && p + 2 < end && (p[2] >> 5) == 0)
+                return 1;                       /* AUD: pic_type I */
+            if(nal <= 9)                        /* other slices */
+                return 0;
+            break;
+        }
+        default:
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static int
+is_video(int type)
+{
+    return type == ST_MPEG1_VIDEO || type == ST_MPEG2_VIDEO ||
+        type == ST_H264 || type == ST_HEVC;
+}
+
+static int
+packet_rap(rapscan *rs, const uint8_t *p)
+{
+    int pid = ((p[1] & 0x1f) << 8) | p[2];
+    int type = rs->stream_type[pid];
+    int pos;
+
+    if(rs->stream_type == rs->own_type && (pid == 0 || rs->is_pmt[pid])) {
+        parse_psi(rs, pid, p);
+        return 0;
+    }
+    if(!is_video(type))
+        return 0;
+
+    /* adaptation field random_access_indicator */
+    if((p[3] & 0x20) && p[4] > 0 && (p[5] & 0x40))
+        return 1;
+    if(!(p[1] & 0x40) || !(p[3] & 0x10))
+        return 0;
+
+    /* PES header, then the first bytes of the access unit */
+    pos = (p[3] & 0x20) ? 5 + p[4] : 4;
+    if(pos + 9 > TS_PACKET_SIZE || p[pos] || p[pos + 1] || p[pos + 2] != 1)
+        return 0;
+    pos += 9 + p[pos + 8];
+    if(pos >= TS_PACKET_SIZE)
+        return 0;
+    return es_keyframe(type, p + pos, p + TS_PACKET_SIZE);
+}
+
+int
+rapscan_chunk(rapscan *rs, const uint8_t *data, size_t len)
+{
+    size_t p;
+
+    rs->count = 0;
+    p = rs->sync_offset > rs->offset ? rs->sync_offset - rs->offset : 0;
+    while(p + TS_PACKET_SIZE <= len) {
+        if(data[p] != TS_SYNC) {
+            /* lost alignment: resume at the next confirmed sync byte */
+            ssize_t s = tsindex_find_sync(data, len, p + 1);
+
+            p = s < 0 ? len : (size_t)s;
+            continue;
+        }
+        if(packet_rap(rs, data + p)) {
+            if(rs->count < RAPSCAN_MAX_RAP)
+                rs->rap[rs->count++] = p;
+            rs->total++;
+        }
+        p += TS_PACKET_SIZE;
+    }
+    /* past a packet running into the next block, as in segment_write */
+    if(p < len) {
+        ssize_t s = data[p] == TS_SYNC ? (ssize_t)p :
+            tsindex_find_sync(data, len, p);
+
+        rs->sync_offset = s < 0 ? rs->offset + len :
+            tsindex_next_sync(rs->offset, len, s);
+    }
+    else
+        rs->sync_offset = rs->offset + p;
+    rs->offset += len;
+    return rs->count;
+}
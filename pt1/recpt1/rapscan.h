@@ -0,0 +1,51 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _RAPSCAN_H_
+#define _RAPSCAN_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Random access point scanner.  Runs over each block written by recpt1
+ * and lists the packets a decoder can start from: packets of a video
+ * PID with random_access_indicator set, or whose PES starts with an
+ * MPEG-2 sequence header/GOP/I picture, an H.264 IDR/SPS/I access unit
+ * or an HEVC IRAP/VPS/SPS/I access unit.
+ *
+ * Video PIDs come from the stream types the splitter collected in
+ * AnalyzePmt; without a splitter the scanner reads single-packet PMTs
+ * itself.  Only the first packet of each PES is searched, so the cost
+ * stays at a few header checks per packet.  A packet split across two
+ * blocks is not inspected; a cut could not fall inside it anyway.
+ */
+
+#define RAPSCAN_MAX_PID     8192
+#define RAPSCAN_MAX_RAP     64      /* per block, later ones are dropped */
+
+typedef struct rapscan {
+    const uint8_t *stream_type;     /* by PID, 0: not a known ES */
+    uint8_t own_type[RAPSCAN_MAX_PID];
+    uint8_t is_pmt[RAPSCAN_MAX_PID];
+    uint64_t offset;                /* bytes of stream seen */
+    uint64_t sync_offset;           /* next expected packet boundary */
+    uint64_t total;                 /* RAPs found so far */
+    int count;                      /* RAPs in the last block */
+    uint32_t rap[RAPSCAN_MAX_RAP];  /* their offsets in the block */
+} rapscan;
+
+/* stream_type: the splitter's table, or NULL to parse PMTs here */
+rapscan *rapscan_create(const uint8_t *stream_type);
+int rapscan_chunk(rapscan *rs, const uint8_t *data, size_t len);
+
+/* the latest packet boundary at or before rs->offset, for a reader to
+   start at; sync_offset is past a packet running into the next block */
+static inline uint64_t
+rapscan_sync(const rapscan *rs)
+{
+    if(rs->sync_offset > rs->offset)
+        return rs->sync_offset - 188;
+    return rs->sync_offset;
+}
+void rapscan_destroy(rapscan *rs);
+
+#endif
@@ -1,492 +1,58 @@
 /* -*- tab-width: 4; indent-tabs-mode: nil -*- */
 #include <stdio.h>
-#include <fcntl.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
-#include <math.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <signal.h>
 #include <errno.h>
-#include <sys/time.h>
-#include <ctype.h>
-#include <libgen.h>
-
-#include <netdb.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-
-#include <sys/ipc.h>
-#include <sys/msg.h>
-
-#include <sys/ioctl.h>
-#include "pt1_ioctl.h"
 
 #include "config.h"
-#include "decoder.h"
 #include "recpt1core.h"
-#include "recpt1.h"
-#include "mkpath.h"
-
-#include "tssplitter_lite.h"
-
-/* maximum write length at once */
-#define SIZE_CHANK 1316
-
-/* ipc message size */
-#define MSGSZ     255
-
-/* globals */
-extern boolean f_exit;
-
-
-/* will be ipc message receive thread */
-void *
-mq_recv(void *t)
-{
-    thread_data *tdata = (thread_data *)t;
-    message_buf rbuf;
-    char channel[16];
-    int recsec = 0, time_to_add = 0;
-
-    while(1) {
-        if(msgrcv(tdata->msqid, &rbuf, MSGSZ, 1, 0) < 0) {
-            return NULL;
-        }
-
-        sscanf(rbuf.mtext, "ch=%s t=%d e=%d", channel, &recsec, &time_to_add);
-
-        if(strcmp(channel, tdata->table->parm_freq)) {
-            int current_type = tdata->table->type;
-            ISDB_T_FREQ_CONV_TABLE *table = searchrecoff(channel);
-            if (table == NULL) {
-                fprintf(stderr, "Invalid Channel: %s\n", channel);
-                goto CHECK_TIME_TO_ADD;
-            }
-            tdata->table = table;
-
-            /* stop stream */
-            ioctl(tdata->tfd, STOP_REC, 0);
-
-            /* wait for remainder */
-            while(tdata->queue->num_used > 0) {
-                usleep(10000);
-            }
-
-            if (tdata->table->type != current_type) {
-                /* re-open device */
-                if(close_tuner(tdata) != 0)
-                    return NULL;
-
-                tune(channel, tdata, NULL);
-            } else {
-                /* SET_CHANNEL only */
-                const FREQUENCY freq = {
-                  .frequencyno = tdata->table->set_freq,
-                  .slot = tdata->table->add_freq,
-                };
-                if(ioctl(tdata->tfd, SET_CHANNEL, &freq) < 0) {
-                    fprintf(stderr, "Cannot tune to the specified channel\n");
-                    goto CHECK_TIME_TO_ADD;
-                }
-                calc_cn(tdata->tfd, tdata->table->type, FALSE);
-            }
-            /* restart recording */
-            if(ioctl(tdata->tfd, START_REC, 0) < 0) {
-                fprintf(stderr, "Tuner cannot start recording\n");
-                return NULL;
-            }
-        }
-
-CHECK_TIME_TO_ADD:
-        if(time_to_add) {
-            tdata->recsec += time_to_add;
-            fprintf(stderr, "Extended %d sec\n", time_to_add);
-        }
-
-        if(recsec) {
-            time_t cur_time;
-            time(&cur_time);
-            if(cur_time - tdata->start_time > recsec) {
-                f_exit = TRUE;
-            }
-            else {
-                tdata->recsec = recsec;
-                fprintf(stderr, "Total recording time = %d sec\n", recsec);
-            }
-        }
-
-        if(f_exit)
-            return NULL;
-    }
-}
-
-
-QUEUE_T *
-create_queue(size_t size)
+#include "librecpt1.h"
+
+/* control socket of recpt1ctl --pid */
+#define CTL_PATH    "@recpt1.%d"
+
+/* what the signal thread and the control socket act on */
+typedef struct client {
+    recpt1_tuner *tuner;
+    recpt1_pipeline *pipeline;
+    recpt1_ctl *ctl;
+    int stat_fd;        /* JSON statistics, -1: off */
+    int stat_interval;
+    volatile boolean done;  /* recording is over */
+} client;
+
+/* http /ch/NAME: hand the switch to the control worker like recpt1ctl
+   does, so the http server keeps serving meanwhile */
+static int
+http_tune(void *arg, const char *channel)
 {
-    QUEUE_T *p_queue;
-    int memsize = sizeof(QUEUE_T) + size * sizeof(BUFSZ*);
-
-    p_queue = (QUEUE_T*)calloc(memsize, sizeof(char));
-
-    if(p_queue != NULL) {
-        p_queue->size = size;
-        p_queue->num_avail = size;
-        p_queue->num_used = 0;
-        pthread_mutex_init(&p_queue->mutex, NULL);
-        pthread_cond_init(&p_queue->cond_avail, NULL);
-        pthread_cond_init(&p_queue->cond_used, NULL);
-    }
+    client *c = (client *)arg;
 
-    return p_queue;
-}
-
-void
-destroy_queue(QUEUE_T *p_queue)
-{
-    if(!p_queue)
-        return;
-
-    pthread_mutex_destroy(&p_queue->mutex);
-    pthread_cond_destroy(&p_queue->cond_avail);
-    pthread_cond_destroy(&p_queue->cond_used);
-    free(p_queue);
-}
-
-/* enqueue data. this function will block if queue is full. */
-void
-enqueue(QUEUE_T *p_queue, BUFSZ *data)
-{
-    struct timeval now;
-    struct timespec spec;
-    int retry_count = 0;
-
-    pthread_mutex_lock(&p_queue->mutex);
-    /* entered critical section */
-
-    /* wait while queue is full */
-    while(p_queue->num_avail == 0) {
-
-        gettimeofday(&now, NULL);
-        spec.tv_sec = now.tv_sec + 1;
-        spec.tv_nsec = now.tv_usec * 1000;
-
-        pthread_cond_timedwait(&p_queue->cond_avail,
-                               &p_queue->mutex, &spec);
-        retry_count++;
-        if(retry_count > 60) {
-            f_exit = TRUE;
-        }
-        if(f_exit) {
-            pthread_mutex_unlock(&p_queue->mutex);
-            return;
-        }
-    }
-
-    p_queue->buffer[p_queue->in] = data;
-
-    /* move position marker for input to next position */
-    p_queue->in++;
-    p_queue->in %= p_queue->size;
-
-    /* update counters */
-    p_queue->num_avail--;
-    p_queue->num_used++;
-
-    /* leaving critical section */
-    pthread_mutex_unlock(&p_queue->mutex);
-    pthread_cond_signal(&p_queue->cond_used);
-}
-
-/* dequeue data. this function will block if queue is empty. */
-BUFSZ *
-dequeue(QUEUE_T *p_queue)
-{
-    struct timeval now;
-    struct timespec spec;
-    BUFSZ *buffer;
-    int retry_count = 0;
-
-    pthread_mutex_lock(&p_queue->mutex);
-    /* entered the critical section*/
-
-    /* wait while queue is empty */
-    while(p_queue->num_used == 0) {
-
-        gettimeofday(&now, NULL);
-        spec.tv_sec = now.tv_sec + 1;
-        spec.tv_nsec = now.tv_usec * 1000;
-
-        pthread_cond_timedwait(&p_queue->cond_used,
-                               &p_queue->mutex, &spec);
-        retry_count++;
-        if(retry_count > 60) {
-            f_exit = TRUE;
-        }
-        if(f_exit) {
-            pthread_mutex_unlock(&p_queue->mutex);
-            return NULL;
-        }
-    }
-
-    /* take buffer address */
-    buffer = p_queue->buffer[p_queue->out];
-
-    /* move position marker for output to next position */
-    p_queue->out++;
-    p_queue->out %= p_queue->size;
-
-    /* update counters */
-    p_queue->num_avail++;
-    p_queue->num_used--;
-
-    /* leaving the critical section */
-    pthread_mutex_unlock(&p_queue->mutex);
-    pthread_cond_signal(&p_queue->cond_avail);
-
-    return buffer;
-}
-
-/* this function will be reader thread */
-void *
-reader_func(void *p)
-{
-    thread_data *tdata = (thread_data *)p;
-    QUEUE_T *p_queue = tdata->queue;
-    decoder *dec = tdata->decoder;
-    splitter *splitter = tdata->splitter;
-    int wfd = tdata->wfd;
-    boolean use_b25 = dec ? TRUE : FALSE;
-    boolean use_udp = tdata->sock_data ? TRUE : FALSE;
-    boolean fileless = FALSE;
-    boolean use_splitter = splitter ? TRUE : FALSE;
-    int sfd = -1;
-    pthread_t signal_thread = tdata->signal_thread;
-    struct sockaddr_in *addr = NULL;
-    BUFSZ *qbuf;
-    static splitbuf_t splitbuf;
-    ARIB_STD_B25_BUFFER sbuf, dbuf, buf;
-    int code;
-    int split_select_finish = TSS_ERROR;
-
-    buf.size = 0;
-    buf.data = NULL;
-    splitbuf.buffer_size = 0;
-    splitbuf.buffer = NULL;
-
-    if(wfd == -1)
-        fileless = TRUE;
-
-    if(use_udp) {
-        sfd = tdata->sock_data->sfd;
-        addr = &tdata->sock_data->addr;
-    }
-
-    while(1) {
-        ssize_t wc = 0;
-        int file_err = 0;
-        qbuf = dequeue(p_queue);
-        /* no entry in the queue */
-        if(qbuf == NULL) {
-            break;
-        }
-
-        sbuf.data = qbuf->buffer;
-        sbuf.size = qbuf->size;
-
-        buf = sbuf; /* default */
-
-        if(use_b25) {
-            code = b25_decode(dec, &sbuf, &dbuf);
-            if(code < 0) {
-                fprintf(stderr, "b25_decode failed (code=%d). fall back to encrypted recording.\n", code);
-                use_b25 = FALSE;
-            }
-            else
-                buf = dbuf;
-        }
-
-
-        if(use_splitter) {
-            splitbuf.buffer_filled = 0;
-
-            /* allocate split buffer */
-            if(splitbuf.buffer_size < buf.size && buf.size > 0) {
-                splitbuf.buffer = realloc(splitbuf.buffer, buf.size);
-                if(splitbuf.buffer == NULL) {
-                    fprintf(stderr, "split buffer allocation failed\n");
-                    use_splitter = FALSE;
-                    goto fin;
-                }
-            }
-
-            while(buf.size) {
-                /* 分離対象PIDの抽出 */
-                if(split_select_finish != TSS_SUCCESS) {
-                    split_select_finish = split_select(splitter, &buf);
-                    if(split_select_finish == TSS_NULL) {
-                        /* mallocエラー発生 */
-                        fprintf(stderr, "split_select malloc failed\n");
-                        use_splitter = FALSE;
-                        goto fin;
-                    }
-                    else if(split_select_finish != TSS_SUCCESS) {
-                        /* 分離対象PIDが完全に抽出できるまで出力しない
-                         * 1秒程度余裕を見るといいかも
-                         */
-                        time_t cur_time;
-                        time(&cur_time);
-                        if(cur_time - tdata->start_time > 4) {
-                            use_splitter = FALSE;
-                            goto fin;
-                        }
-                        break;
-                    }
-                }
-
-                /* 分離対象以外をふるい落とす */
-                code = split_ts(splitter, &buf, &splitbuf);
-                if(code == TSS_NULL) {
-                    fprintf(stderr, "PMT reading..\n");
-                }
-                else if(code != TSS_SUCCESS) {
-                    fprintf(stderr, "split_ts failed\n");
-                    break;
-                }
-
-                break;
-            } /* while */
-
-            buf.size = splitbuf.buffer_filled;
-            buf.data = splitbuf.buffer;
-        fin:
-            ;
-        } /* if */
-
-
-        if(!fileless) {
-            /* write data to output file */
-            int size_remain = buf.size;
-            int offset = 0;
-
-            while(size_remain > 0) {
-                int ws = size_remain < SIZE_CHANK ? size_remain : SIZE_CHANK;
-
-                wc = write(wfd, buf.data + offset, ws);
-                if(wc < 0) {
-                    perror("write");
-                    file_err = 1;
-                    pthread_kill(signal_thread,
-                                 errno == EPIPE ? SIGPIPE : SIGUSR2);
-                    break;
-                }
-                size_remain -= wc;
-                offset += wc;
-            }
-        }
-
-        if(use_udp && sfd != -1) {
-            /* write data to socket */
-            int size_remain = buf.size;
-            int offset = 0;
-            while(size_remain > 0) {
-                int ws = size_remain < SIZE_CHANK ? size_remain : SIZE_CHANK;
-                wc = write(sfd, buf.data + offset, ws);
-                if(wc < 0) {
-                    if(errno == EPIPE)
-                        pthread_kill(signal_thread, SIGPIPE);
-                    break;
-                }
-                size_remain -= wc;
-                offset += wc;
-            }
-        }
-
-        free(qbuf);
-        qbuf = NULL;
-
-        /* normal exit */
-        if((f_exit && !p_queue->num_used) || file_err) {
-
-            buf = sbuf; /* default */
-
-            if(use_b25) {
-                code = b25_finish(dec, &sbuf, &dbuf);
-                if(code < 0)
-                    fprintf(stderr, "b25_finish failed\n");
-                else
-                    buf = dbuf;
-            }
-
-            if(use_splitter) {
-                /* 分離対象以外をふるい落とす */
-                code = split_ts(splitter, &buf, &splitbuf);
-                if(code == TSS_NULL) {
-                    split_select_finish = TSS_ERROR;
-                    fprintf(stderr, "PMT reading..\n");
-                }
-                else if(code != TSS_SUCCESS) {
-                    fprintf(stderr, "split_ts failed\n");
-                    break;
-                }
-
-                buf.data = splitbuf.buffer;
-                buf.size = splitbuf.buffer_size;
-            }
-
-            if(!fileless && !file_err) {
-                wc = write(wfd, buf.data, buf.size);
-                if(wc < 0) {
-                    perror("write");
-                    file_err = 1;
-                    pthread_kill(signal_thread,
-                                 errno == EPIPE ? SIGPIPE : SIGUSR2);
-                }
-            }
-
-            if(use_udp && sfd != -1) {
-                wc = write(sfd, buf.data, buf.size);
-                if(wc < 0) {
-                    if(errno == EPIPE)
-                        pthread_kill(signal_thread, SIGPIPE);
-                }
-            }
-
-            if(use_splitter) {
-                free(splitbuf.buffer);
-                splitbuf.buffer = NULL;
-                splitbuf.buffer_size = 0;
-            }
-
-            break;
-        }
-    }
-
-    time_t cur_time;
-    time(&cur_time);
-    fprintf(stderr, "Recorded %dsec\n",
-            (int)(cur_time - tdata->start_time));
-
-    return NULL;
+    if(!c->ctl)
+        return recpt1_pipeline_switch(c->pipeline, channel);
+    return recpt1_ctl_switch(c->ctl, c->pipeline, channel);
 }
 
 void
 show_usage(char *cmd)
 {
 #ifdef HAVE_LIBARIB25
-    fprintf(stderr, "Usage: \n%s [--b25 [--round N] [--strip] [--EMM]] [--udp [--addr hostname --port portnumber]] [--device devicefile] [--lnb voltage] [--sid SID1,SID2] channel rectime destfile\n", cmd);
+    fprintf(stderr, "Usage: \n%s [--b25 [--round N] [--strip] [--EMM] [--decode-cpu N]] [--udp [--addr hostname --port portnumber] [--rtp] [--ttl N] [--mcast-if name] [--udp-delay msec] [--udp-txtime] [--udp-burst]] [--device devicefile] [--lnb voltage] [--sid SID1,SID2] [--stat-fd fd [--stat-interval N]] [--timeshift MB [--timeshift-interval msec]] [--index msec] [--segment-time sec] [--segment-size MB] [--segment-rap] [--playlist file] [--http port [--http-ring MB]] [--timestamp m2ts|strip] [--no-splice] [--pipe-size MB] [--shm name [--shm-ring MB]] [--analyze] [--ctl path] channel rectime destfile\n", cmd);
 #else
-    fprintf(stderr, "Usage: \n%s [--strip] [--EMM]] [--udp [--addr hostname --port portnumber]] [--device devicefile] [--lnb voltage] [--sid SID1,SID2] channel rectime destfile\n", cmd);
+    fprintf(stderr, "Usage: \n%s [--strip] [--EMM]] [--udp [--addr hostname --port portnumber] [--rtp] [--ttl N] [--mcast-if name] [--udp-delay msec] [--udp-txtime] [--udp-burst]] [--device devicefile] [--lnb voltage] [--sid SID1,SID2] [--stat-fd fd [--stat-interval N]] [--timeshift MB [--timeshift-interval msec]] [--index msec] [--segment-time sec] [--segment-size MB] [--segment-rap] [--playlist file] [--http port [--http-ring MB]] [--timestamp m2ts|strip] [--no-splice] [--pipe-size MB] [--shm name [--shm-ring MB]] [--analyze] [--ctl path] channel rectime destfile\n", cmd);
 #endif
     fprintf(stderr, "\n");
     fprintf(stderr, "Remarks:\n");
     fprintf(stderr, "if rectime  is '-', records indefinitely.\n");
     fprintf(stderr, "if destfile is '-', stdout is used for output.\n");
+    fprintf(stderr, "with --timeshift, destfile is a ring of the last MB megabytes.\n");
+    fprintf(stderr, "with --segment-*, destfile is name.ts (name-00000.ts, ...) or a pattern with %%d.\n");
 }
 
 void
@@ -498,74 +64,105 @@ show_options(void)
     fprintf(stderr, "  --round N:         Specify round number\n");
     fprintf(stderr, "  --strip:           Strip null stream\n");
     fprintf(stderr, "  --EMM:             Instruct EMM operation\n");
+    fprintf(stderr, "  --decode-cpu N:    Bind decoder thread to cpu N ('auto': by tuner)\n");
 #endif
     fprintf(stderr, "--udp:               Turn on udp broadcasting\n");
     fprintf(stderr, "  --addr hostname:   Hostname or address to connect\n");
     fprintf(stderr, "  --port portnumber: Port number to connect\n");
+    fprintf(stderr, "  --rtp:             Send RTP (MP2T) instead of plain UDP\n");
+    fprintf(stderr, "  --ttl N:           TTL / hop limit of the datagrams\n");
+    fprintf(stderr, "  --mcast-if name:   Send multicast on interface name\n");
+    fprintf(stderr, "  --udp-delay msec:  Pacing latency (default %d)\n", UDPOUT_DELAY_MS);
+    fprintf(stderr, "  --udp-txtime:      Let an etf/fq qdisc release datagrams (SO_TXTIME)\n");
+    fprintf(stderr, "  --udp-burst:       Send each block as it comes, unpaced\n");
     fprintf(stderr, "--device devicefile: Specify devicefile to use\n");
     fprintf(stderr, "--lnb voltage:       Specify LNB voltage (0, 11, 15)\n");
     fprintf(stderr, "--sid SID1,SID2,...: Specify SID number in CSV format (101,102,...)\n");
+    fprintf(stderr, "--stat-fd fd:        Write pipeline statistics as JSON lines to fd\n");
+    fprintf(stderr, "  --stat-interval N: Interval of the JSON lines in seconds (default 1)\n");
+    fprintf(stderr, "--timeshift MB:      Keep the last MB megabytes in a ring (see tshiftctl)\n");
+    fprintf(stderr, "  --timeshift-interval msec: Ring index granularity (default 500)\n");
+    fprintf(stderr, "--index msec:        Write a seek index to destfile%s every msec\n", TSINDEX_EXT);
+    fprintf(stderr, "--segment-time sec:  Start a new file every sec seconds\n");
+    fprintf(stderr, "--segment-size MB:   Start a new file every MB megabytes\n");
+    fprintf(stderr, "  --segment-rap:     Cut at random access points\n");
+    fprintf(stderr, "  --playlist file:   Append each finished segment to an M3U8 playlist\n");
+    fprintf(stderr, "--http port:         Serve the stream over HTTP (GET /, /ch/NAME, /status)\n");
+    fprintf(stderr, "  --http-ring MB:    Size of the shared client ring (default 32)\n");
+    fprintf(stderr, "--timestamp m2ts:    Write 192 byte packets with driver arrival times\n");
+    fprintf(stderr, "--timestamp strip:   Take arrival times but write 188 byte packets\n");
+    fprintf(stderr, "--no-splice:         Read raw recordings through userspace buffers\n");
+    fprintf(stderr, "--pipe-size MB:      Size of the stdout pipe for vmsplice output (default 1)\n");
+    fprintf(stderr, "--shm name:          Publish the stream in shared memory /dev/shm/name\n");
+    fprintf(stderr, "  --shm-ring MB:     Size of the shared-memory ring (default 16)\n");
+    fprintf(stderr, "--analyze:           Count packets, CC errors, TEI and scrambling per PID\n");
+    fprintf(stderr, "--ctl path:          Control socket for recpt1ctl (default @recpt1.PID)\n");
     fprintf(stderr, "--help:              Show this help\n");
     fprintf(stderr, "--version:           Show version\n");
     fprintf(stderr, "--list:              Show channel list\n");
 }
 
-void
-cleanup(thread_data *tdata)
-{
-    /* stop recording */
-    ioctl(tdata->tfd, STOP_REC, 0);
-
-    f_exit = TRUE;
-
-    pthread_cond_signal(&tdata->queue->cond_avail);
-    pthread_cond_signal(&tdata->queue->cond_used);
-}
-
 /* will be signal handler thread */
 void *
 process_signals(void *t)
 {
     sigset_t waitset;
     int sig;
-    thread_data *tdata = (thread_data *)t;
+    client *c = (client *)t;
 
     sigemptyset(&waitset);
     sigaddset(&waitset, SIGPIPE);
     sigaddset(&waitset, SIGINT);
     sigaddset(&waitset, SIGTERM);
     sigaddset(&waitset, SIGUSR1);
-    sigaddset(&waitset, SIGUSR2);
 
-    sigwait(&waitset, &sig);
+    while(1) {
+        if(c->stat_fd >= 0) {
+            struct timespec timeout = { c->stat_interval, 0 };
+
+            sig = sigtimedwait(&waitset, NULL, &timeout);
+            if(sig < 0) {
+                if(errno == EAGAIN && c->pipeline)
+                    recpt1_pipeline_stats_json(c->pipeline, c->stat_fd);
+                continue;
+            }
+        }
+        else if(sigwait(&waitset, &sig) != 0)
+            continue;
+
+        /* SIGUSR1 from outside while recording: dump statistics.
+           main() sends SIGUSR1 only after setting done. */
+        if(sig == SIGUSR1 && !c->done) {
+            if(c->pipeline)
+                recpt1_pipeline_report(c->pipeline, stderr);
+            continue;
+        }
+        break;
+    }
 
     switch(sig) {
     case SIGPIPE:
         fprintf(stderr, "\nSIGPIPE received. cleaning up...\n");
-        cleanup(tdata);
         break;
     case SIGINT:
         fprintf(stderr, "\nSIGINT received. cleaning up...\n");
-        cleanup(tdata);
         break;
     case SIGTERM:
         fprintf(stderr, "\nSIGTERM received. cleaning up...\n");
-        cleanup(tdata);
         break;
     case SIGUSR1: /* normal exit*/
-        cleanup(tdata);
-        break;
-    case SIGUSR2: /* error */
-        fprintf(stderr, "Detected an error. cleaning up...\n");
-        cleanup(tdata);
-        break;
+        return NULL;
     }
+    /* still tuning, or recording */
+    recpt1_tuner_cancel(c->tuner);
+    if(c->pipeline)
+        recpt1_pipeline_stop(c->pipeline);
 
     return NULL; /* dummy */
 }
 
 void
-init_signal_handlers(pthread_t *signal_thread, thread_data *tdata)
+init_signal_handlers(pthread_t *signal_thread, client *c)
 {
     sigset_t blockset;
 
@@ -574,33 +171,22 @@ init_signal_handlers(pthread_t *signal_thread, thread_data *tdata)
     sigaddset(&blockset, SIGINT);
     sigaddset(&blockset, SIGTERM);
     sigaddset(&blockset, SIGUSR1);
-    sigaddset(&blockset, SIGUSR2);
 
     if(pthread_sigmask(SIG_BLOCK, &blockset, NULL))
         fprintf(stderr, "pthread_sigmask() failed.\n");
 
-    pthread_create(signal_thread, NULL, process_signals, tdata);
+    pthread_create(signal_thread, NULL, process_signals, c);
 }
 
 int
 main(int argc, char **argv)
 {
-    time_t cur_time;
     pthread_t signal_thread;
-    pthread_t reader_thread;
-    pthread_t ipc_thread;
-    QUEUE_T *p_queue = create_queue(MAX_QUEUE);
-    BUFSZ   *bufptr;
-    decoder *decoder = NULL;
-    splitter *splitter = NULL;
-    static thread_data tdata;
-    decoder_options dopt = {
-        4,  /* round */
-        0,  /* strip */
-        0   /* emm */
-    };
-    tdata.dopt = &dopt;
-    tdata.lnb = 0;
+    static client c;
+    recpt1_options opt;
+    int lnb = 0;
+    char ctl_path[32];
+    const char *ctl = NULL;
 
     int result;
     int option_index;
@@ -612,12 +198,37 @@ main(int argc, char **argv)
         { "strip",     0, NULL, 's'},
         { "emm",       0, NULL, 'm'},
         { "EMM",       0, NULL, 'm'},
+        { "decode-cpu", 1, NULL, 'c'},
 #endif
+        { "stat-fd",   1, NULL, 'F'},
+        { "stat-interval", 1, NULL, 'T'},
+        { "timeshift", 1, NULL, 'R'},
+        { "timeshift-interval", 1, NULL, 'N'},
+        { "index",     1, NULL, 'x'},
+        { "segment-time", 1, NULL, 'g'},
+        { "segment-size", 1, NULL, 'G'},
+        { "segment-rap", 0, NULL, 'k'},
+        { "playlist",  1, NULL, 'P'},
+        { "http",      1, NULL, 'H'},
+        { "http-ring", 1, NULL, 'W'},
+        { "timestamp", 1, NULL, 'M'},
+        { "no-splice", 0, NULL, 'z'},
+        { "pipe-size", 1, NULL, 'S'},
+        { "shm",       1, NULL, 'Y'},
+        { "shm-ring",  1, NULL, 'y'},
+        { "analyze",   0, NULL, 'A'},
+        { "ctl",       1, NULL, 'C'},
         { "LNB",       1, NULL, 'n'},
         { "lnb",       1, NULL, 'n'},
         { "udp",       0, NULL, 'u'},
         { "addr",      1, NULL, 'a'},
         { "port",      1, NULL, 'p'},
+        { "rtp",       0, NULL, 'Q'},
+        { "ttl",       1, NULL, 't'},
+        { "mcast-if",  1, NULL, 'I'},
+        { "udp-delay", 1, NULL, 'D'},
+        { "udp-txtime", 0, NULL, 'X'},
+        { "udp-burst", 0, NULL, 'B'},
         { "device",    1, NULL, 'd'},
         { "help",      0, NULL, 'h'},
         { "version",   0, NULL, 'v'},
@@ -626,37 +237,31 @@ main(int argc, char **argv)
         {0, 0, NULL, 0} /* terminate */
     };
 
-    boolean use_b25 = FALSE;
-    boolean use_udp = FALSE;
-    boolean fileless = FALSE;
-    boolean use_stdout = FALSE;
-    boolean use_splitter = FALSE;
-    char *host_to = NULL;
-    int port_to = 1234;
-    sock_data *sockdata = NULL;
     char *device = NULL;
     int val;
     char *voltage[] = {"0V", "11V", "15V"};
-    char *sid_list = NULL;
 
-    while((result = getopt_long(argc, argv, "br:smn:ua:p:d:hvli:",
+    recpt1_options_init(&opt);
+    c.stat_fd = -1;
+    c.stat_interval = 1;
+
+    while((result = getopt_long(argc, argv, "br:smc:n:ua:p:d:hvli:F:T:R:N:x:g:G:kP:H:W:M:zS:Y:y:AQt:I:D:XBC:",
                                 long_options, &option_index)) != -1) {
         switch(result) {
         case 'b':
-            use_b25 = TRUE;
+            opt.b25 = TRUE;
             fprintf(stderr, "using B25...\n");
             break;
         case 's':
-            dopt.strip = TRUE;
+            opt.strip = TRUE;
             fprintf(stderr, "enable B25 strip\n");
             break;
         case 'm':
-            dopt.emm = TRUE;
+            opt.emm = TRUE;
             fprintf(stderr, "enable B25 emm processing\n");
             break;
         case 'u':
-            use_udp = TRUE;
-            host_to = "localhost";
+            opt.udp_host = "localhost";
             fprintf(stderr, "enable UDP broadcasting\n");
             break;
         case 'h':
@@ -683,46 +288,136 @@ main(int argc, char **argv)
             val = atoi(optarg);
             switch(val) {
             case 11:
-                tdata.lnb = 1;
+                lnb = 1;
                 break;
             case 15:
-                tdata.lnb = 2;
+                lnb = 2;
                 break;
             default:
-                tdata.lnb = 0;
+                lnb = 0;
                 break;
             }
-            fprintf(stderr, "LNB = %s\n", voltage[tdata.lnb]);
+            fprintf(stderr, "LNB = %s\n", voltage[lnb]);
+            break;
+        case 'c':
+            opt.decode_cpu = optarg;
+            break;
+        case 'F':
+            c.stat_fd = atoi(optarg);
+            break;
+        case 'T':
+            c.stat_interval = atoi(optarg);
+            if(c.stat_interval <= 0)
+                c.stat_interval = 1;
+            break;
+        case 'R':
+            opt.timeshift_mb = atol(optarg);
+            break;
+        case 'N':
+            opt.timeshift_interval = atoi(optarg);
+            break;
+        case 'x':
+            opt.index_interval = atoi(optarg);
+            if(opt.index_interval <= 0)
+                opt.index_interval = 500;
+            break;
+        case 'g':
+            opt.segment_sec = atoi(optarg);
+            break;
+        case 'G':
+            opt.segment_mb = atoi(optarg);
+            break;
+        case 'k':
+            opt.segment_rap = 1;
+            break;
+        case 'P':
+            opt.playlist = optarg;
+            break;
+        case 'H':
+            opt.http_port = atoi(optarg);
+            break;
+        case 'W':
+            opt.http_ring_mb = atoi(optarg);
+            if(opt.http_ring_mb < 1)
+                opt.http_ring_mb = 1;
+            break;
+        case 'z':
+            opt.splice = FALSE;
+            break;
+        case 'S':
+            opt.pipe_mb = atoi(optarg);
+            if(opt.pipe_mb < 1)
+                opt.pipe_mb = 1;
+            break;
+        case 'Y':
+            opt.shm_name = optarg;
+            break;
+        case 'y':
+            opt.shm_ring_mb = atoi(optarg);
+            if(opt.shm_ring_mb < 1)
+                opt.shm_ring_mb = 1;
+            break;
+        case 'A':
+            opt.analyze = TRUE;
+            break;
+        case 'C':
+            ctl = optarg;
+            break;
+        case 'Q':
+            opt.udp_rtp = TRUE;
+            break;
+        case 'X':
+            opt.udp_txtime = TRUE;
+            break;
+        case 'B':
+            opt.udp_pace = FALSE;
+            break;
+        case 't':
+            opt.udp_ttl = atoi(optarg);
+            break;
+        case 'I':
+            opt.udp_iface = optarg;
+            break;
+        case 'D':
+            opt.udp_delay_ms = atoi(optarg);
+            break;
+        case 'M':
+            if(!strcmp(optarg, "m2ts"))
+                opt.timestamp = 2;
+            else if(!strcmp(optarg, "strip"))
+                opt.timestamp = 1;
+            else {
+                fprintf(stderr, "--timestamp takes m2ts or strip\n");
+                exit(1);
+            }
             break;
         case 'r':
-            dopt.round = atoi(optarg);
-            fprintf(stderr, "set round %d\n", dopt.round);
+            opt.round = atoi(optarg);
+            fprintf(stderr, "set round %d\n", opt.round);
             break;
         case 'a':
-            use_udp = TRUE;
-            host_to = optarg;
-            fprintf(stderr, "UDP destination address: %s\n", host_to);
+            opt.udp_host = optarg;
+            fprintf(stderr, "UDP destination address: %s\n", opt.udp_host);
             break;
         case 'p':
-            port_to = atoi(optarg);
-            fprintf(stderr, "UDP port: %d\n", port_to);
+            opt.udp_port = atoi(optarg);
+            fprintf(stderr, "UDP port: %d\n", opt.udp_port);
             break;
         case 'd':
             device = optarg;
             fprintf(stderr, "using device: %s\n", device);
             break;
         case 'i':
-            use_splitter = TRUE;
-            sid_list = optarg;
+            opt.sid = optarg;
             break;
         }
     }
 
     if(argc - optind < 3) {
-        if(argc - optind == 2 && use_udp) {
-            fprintf(stderr, "Fileless UDP broadcasting\n");
-            fileless = TRUE;
-            tdata.wfd = -1;
+        if(argc - optind == 2 && (opt.udp_host || opt.http_port || opt.shm_name)) {
+            fprintf(stderr, opt.udp_host ? "Fileless UDP broadcasting\n"
+                    : opt.http_port ? "Fileless HTTP streaming\n"
+                    : "Fileless shared-memory publishing\n");
         }
         else {
             fprintf(stderr, "Arguments are necessary!\n");
@@ -730,207 +425,66 @@ main(int argc, char **argv)
             return 1;
         }
     }
+    else
+        opt.destfile = argv[optind + 2];
 
     fprintf(stderr, "pid = %d\n", getpid());
 
     /* tune */
-    if(tune(argv[optind], &tdata, device) != 0)
+    c.tuner = recpt1_tuner_create(lnb);
+    if(!c.tuner || recpt1_tuner_tune(c.tuner, argv[optind], device, FALSE) != 0)
         return 1;
 
     /* set recsec */
-    if(parse_time(argv[optind + 1], &tdata.recsec) != 0) // no other thread --yaz
+    if(parse_time(argv[optind + 1], &opt.recsec) != 0) // no other thread --yaz
         return 1;
 
-    if(tdata.recsec == -1)
-        tdata.indefinite = TRUE;
-
-    /* open output file */
-    char *destfile = argv[optind + 2];
-    if(destfile && !strcmp("-", destfile)) {
-        use_stdout = TRUE;
-        tdata.wfd = 1; /* stdout */
-    }
-    else {
-        if(!fileless) {
-            int status;
-            char *path = strdup(argv[optind + 2]);
-            char *dir = dirname(path);
-            status = mkpath(dir, 0777);
-            if(status == -1)
-                perror("mkpath");
-            free(path);
-
-            tdata.wfd = open(argv[optind + 2], (O_RDWR | O_CREAT | O_TRUNC), 0666);
-            if(tdata.wfd < 0) {
-                fprintf(stderr, "Cannot open output file: %s\n",
-                        argv[optind + 2]);
-                return 1;
-            }
-        }
-    }
-
-    /* initialize decoder */
-    if(use_b25) {
-        decoder = b25_startup(&dopt);
-        if(!decoder) {
-            fprintf(stderr, "Cannot start b25 decoder\n");
-            fprintf(stderr, "Fall back to encrypted recording\n");
-            use_b25 = FALSE;
-        }
-    }
-    /* initialize splitter */
-    if(use_splitter) {
-        splitter = split_startup(sid_list);
-        if(splitter->sid_list == NULL) {
-            fprintf(stderr, "Cannot start TS splitter\n");
-            return 1;
-        }
-    }
-
-    /* initialize udp connection */
-    if(use_udp) {
-      sockdata = calloc(1, sizeof(sock_data));
-      struct in_addr ia;
-      ia.s_addr = inet_addr(host_to);
-      if(ia.s_addr == INADDR_NONE) {
-            struct hostent *hoste = gethostbyname(host_to);
-            if(!hoste) {
-                perror("gethostbyname");
-                return 1;
-            }
-            ia.s_addr = *(in_addr_t*) (hoste->h_addr_list[0]);
-        }
-        if((sockdata->sfd = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
-            perror("socket");
-            return 1;
-        }
-
-        sockdata->addr.sin_family = AF_INET;
-        sockdata->addr.sin_port = htons (port_to);
-        sockdata->addr.sin_addr.s_addr = ia.s_addr;
-
-        if(connect(sockdata->sfd, (struct sockaddr *)&sockdata->addr,
-                   sizeof(sockdata->addr)) < 0) {
-            perror("connect");
-            return 1;
-        }
-    }
-
-    /* prepare thread data */
-    tdata.queue = p_queue;
-    tdata.decoder = decoder;
-    tdata.splitter = splitter;
-    tdata.sock_data = sockdata;
-    tdata.tune_persistent = FALSE;
+    /* build the pipeline; /ch/NAME goes through the control worker */
+    opt.http_tune = http_tune;
+    opt.http_tune_arg = &c;
+    c.pipeline = recpt1_pipeline_create(c.tuner, &opt);
+    if(!c.pipeline)
+        return 1;
 
     /* spawn signal handler thread */
-    init_signal_handlers(&signal_thread, &tdata);
+    init_signal_handlers(&signal_thread, &c);
 
-    /* spawn reader thread */
-    tdata.signal_thread = signal_thread;
-    pthread_create(&reader_thread, NULL, reader_func, &tdata);
-
-    /* spawn ipc thread */
-    key_t key;
-    key = (key_t)getpid();
-
-    if ((tdata.msqid = msgget(key, IPC_CREAT | 0666)) < 0) {
-        perror("msgget");
+    /* open the control socket */
+    if(!ctl) {
+        snprintf(ctl_path, sizeof(ctl_path), CTL_PATH, (int)getpid());
+        ctl = ctl_path;
     }
-    pthread_create(&ipc_thread, NULL, mq_recv, &tdata);
-
-    /* start recording */
-    if(ioctl(tdata.tfd, START_REC, 0) < 0) {
-        fprintf(stderr, "Tuner cannot start recording\n");
-        return 1;
+    c.ctl = recpt1_ctl_start(ctl);
+    if(c.ctl)
+        recpt1_ctl_add(c.ctl, "recpt1", c.pipeline);
+    else
+        fprintf(stderr, "Cannot open control socket %s\n", ctl);
+
+    /* record until recsec, a signal or an error */
+    if(recpt1_pipeline_start(c.pipeline) == 0)
+        recpt1_pipeline_wait(c.pipeline);
+    c.done = TRUE;
+
+    /* no more requests: a pending switch is finished or dropped */
+    if(c.ctl) {
+        recpt1_ctl_remove(c.ctl, c.pipeline);
+        recpt1_ctl_stop(c.ctl);
     }
 
-    fprintf(stderr, "\nRecording...\n");
-
-    time(&tdata.start_time);
-
-    /* read from tuner */
-    while(1) {
-        if(f_exit)
-            break;
-
-        time(&cur_time);
-        bufptr = malloc(sizeof(BUFSZ));
-        if(!bufptr) {
-            f_exit = TRUE;
-            break;
-        }
-        bufptr->size = read(tdata.tfd, bufptr->buffer, MAX_READ_SIZE);
-        if(bufptr->size <= 0) {
-            if((cur_time - tdata.start_time) >= tdata.recsec && !tdata.indefinite) {
-                f_exit = TRUE;
-                enqueue(p_queue, NULL);
-                break;
-            }
-            else {
-                free(bufptr);
-                continue;
-            }
-        }
-        enqueue(p_queue, bufptr);
-
-        /* stop recording */
-        time(&cur_time);
-        if((cur_time - tdata.start_time) >= tdata.recsec && !tdata.indefinite) {
-            ioctl(tdata.tfd, STOP_REC, 0);
-            /* read remaining data */
-            while(1) {
-                bufptr = malloc(sizeof(BUFSZ));
-                if(!bufptr) {
-                    f_exit = TRUE;
-                    break;
-                }
-                bufptr->size = read(tdata.tfd, bufptr->buffer, MAX_READ_SIZE);
-                if(bufptr->size <= 0) {
-                    f_exit = TRUE;
-                    enqueue(p_queue, NULL);
-                    break;
-                }
-                enqueue(p_queue, bufptr);
-            }
-            break;
-        }
-    }
-
-    /* delete message queue*/
-    msgctl(tdata.msqid, IPC_RMID, NULL);
-
     pthread_kill(signal_thread, SIGUSR1);
 
     /* wait for threads */
-    pthread_join(reader_thread, NULL);
     pthread_join(signal_thread, NULL);
-    pthread_join(ipc_thread, NULL);
-
-    /* close tuner */
-    if(close_tuner(&tdata) != 0)
-        return 1;
 
-    /* release queue */
-    destroy_queue(p_queue);
+    recpt1_pipeline_report(c.pipeline, stderr);
+    if(c.stat_fd >= 0)
+        recpt1_pipeline_stats_json(c.pipeline, c.stat_fd);
 
-    /* close output file */
-    if(!use_stdout)
-        close(tdata.wfd);
+    recpt1_pipeline_destroy(c.pipeline);
 
-    /* free socket data */
-    if(use_udp) {
-        close(sockdata->sfd);
-        free(sockdata);
-    }
-
-    /* release decoder */
-    if(use_b25) {
-        b25_shutdown(decoder);
-    }
-    if(use_splitter) {
-        split_shutdown(splitter);
-    }
+    /* close tuner */
+    if(recpt1_tuner_close(c.tuner) != 0)
+        return 1;
 
     return 0;
 }
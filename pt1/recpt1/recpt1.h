@@ -7,8 +7,10 @@
 #define CHTYPE_SATELLITE    0        /* satellite digital */
 #define CHTYPE_GROUND       1        /* terrestrial digital */
 #define MAX_QUEUE           8192
+#define MAX_DEC_QUEUE       512      /* decoder -> writer hand-off */
 #define MAX_READ_SIZE       (188 * 87) /* 188*87=16356 splitterが188アライメントを期待しているのでこの数字とする*/
 #define WRITE_SIZE          (1024 * 1024 * 2)
+#define SPLICE_PIPE_SIZE    (1024 * 1024) /* raw recording: tuner -> pipe -> file */
 #define TRUE                1
 #define FALSE               0
 
@@ -23,6 +25,9 @@ typedef struct _QUEUE_T {
     unsigned int size;        // キューのサイズ
     unsigned int num_avail;    // 満タンになると 0 になる
     unsigned int num_used;    // 空っぽになると 0 になる
+    unsigned int hwm;        // num_used の最大値
+    unsigned long stalls;    // 満タンで enqueue が待たされた回数
+    volatile int *f_exit;    // TRUE になったら待つのをやめる
     pthread_mutex_t mutex;
     pthread_cond_t cond_avail;    // データが満タンのときに待つための cond
     pthread_cond_t cond_used;    // データが空のときに待つための cond
@@ -3,16 +3,11 @@
 #include "recpt1core.h"
 #include "version.h"
 #include "pt1_dev.h"
+#include "cnlut.h"
 
 #define ISDB_T_NODE_LIMIT 24        // 32:ARIB limit 24:program maximum
 #define ISDB_T_SLOT_LIMIT 8
 
-/* globals */
-boolean f_exit = FALSE;
-char  bs_channel_buf[20];
-ISDB_T_FREQ_CONV_TABLE isdb_t_conv_set = { 0, CHTYPE_SATELLITE, 0, bs_channel_buf };
-
-
 #if 0
 /* lookup frequency conversion table */
 ISDB_T_FREQ_CONV_TABLE *
@@ -32,9 +27,9 @@ searchrecoff(char *channel)
     return NULL;
 }
 #else
-/* lookup frequency conversion table */
+/* lookup frequency conversion table; BSnn_m channels are built in *bs */
 ISDB_T_FREQ_CONV_TABLE *
-searchrecoff(char *channel)
+searchrecoff(char *channel, bs_channel *bs)
 {
     int lp;
     //printf("channel = %s\n", channel);
@@ -52,10 +47,12 @@ searchrecoff(char *channel)
             if(isdigit(*++bs_ch)) {
                 slot = *bs_ch - '0';
                 if(*++bs_ch == '\0' && slot < ISDB_T_SLOT_LIMIT) {
-                    isdb_t_conv_set.set_freq = node / 2;
-                    isdb_t_conv_set.add_freq = slot;
-                    sprintf(bs_channel_buf, "BS%d_%d", node, slot);
-                    return &isdb_t_conv_set;
+                    bs->table.set_freq = node / 2;
+                    bs->table.type = CHTYPE_SATELLITE;
+                    bs->table.add_freq = slot;
+                    bs->table.parm_freq = bs->name;
+                    sprintf(bs->name, "BS%d_%d", node, slot);
+                    return &bs->table;
                 }
             }
         }
@@ -75,74 +72,28 @@ searchrecoff(char *channel)
 #endif
 
 int
-close_tuner(thread_data *tdata)
+close_tuner(recpt1_tuner *t)
 {
     int rv = 0;
 
-    if(tdata->tfd == -1)
+    if(t->tfd == -1)
         return rv;
 
-    if(tdata->table->type == CHTYPE_SATELLITE) {
-        if(ioctl(tdata->tfd, LNB_DISABLE, 0) < 0) {
+    if(t->table->type == CHTYPE_SATELLITE) {
+        if(ioctl(t->tfd, LNB_DISABLE, 0) < 0) {
             rv = 1;
         }
     }
-    close(tdata->tfd);
-    tdata->tfd = -1;
+    close(t->tfd);
+    t->tfd = -1;
 
     return rv;
 }
 
-float
-getsignal_isdb_s(int signal)
-{
-    /* apply linear interpolation */
-    static const float afLevelTable[] = {
-        24.07f,    // 00    00    0        24.07dB
-        24.07f,    // 10    00    4096     24.07dB
-        18.61f,    // 20    00    8192     18.61dB
-        15.21f,    // 30    00    12288    15.21dB
-        12.50f,    // 40    00    16384    12.50dB
-        10.19f,    // 50    00    20480    10.19dB
-        8.140f,    // 60    00    24576    8.140dB
-        6.270f,    // 70    00    28672    6.270dB
-        4.550f,    // 80    00    32768    4.550dB
-        3.730f,    // 88    00    34816    3.730dB
-        3.630f,    // 88    FF    35071    3.630dB
-        2.940f,    // 90    00    36864    2.940dB
-        1.420f,    // A0    00    40960    1.420dB
-        0.000f     // B0    00    45056    -0.01dB
-    };
-
-    unsigned char sigbuf[4];
-    memset(sigbuf, '\0', sizeof(sigbuf));
-    sigbuf[0] =  (((signal & 0xFF00) >> 8) & 0XFF);
-    sigbuf[1] =  (signal & 0xFF);
-
-    /* calculate signal level */
-    if(sigbuf[0] <= 0x10U) {
-        /* clipped maximum */
-        return 24.07f;
-    }
-    else if (sigbuf[0] >= 0xB0U) {
-        /* clipped minimum */
-        return 0.0f;
-    }
-    else {
-        /* linear interpolation */
-        const float fMixRate =
-            (float)(((unsigned short)(sigbuf[0] & 0x0FU) << 8) |
-                    (unsigned short)sigbuf[0]) / 4096.0f;
-        return afLevelTable[sigbuf[0] >> 4] * (1.0f - fMixRate) +
-            afLevelTable[(sigbuf[0] >> 4) + 0x01U] * fMixRate;
-    }
-}
-
 void
 calc_cn(int fd, int type, boolean use_bell)
 {
     int     rc;
-    double  P;
     double  CNR;
     int bell = 0;
 
@@ -151,14 +102,7 @@ calc_cn(int fd, int type, boolean use_bell)
         return ;
     }
 
-    if(type == CHTYPE_GROUND) {
-        P = log10(5505024/(double)rc) * 10;
-        CNR = (0.000024 * P * P * P * P) - (0.0016 * P * P * P) +
-                    (0.0398 * P * P) + (0.5491 * P)+3.0965;
-    }
-    else {
-        CNR = getsignal_isdb_s(rc);
-    }
+    CNR = cnlut_lookup(type, rc);
 
     if(use_bell) {
         if(CNR >= 30.0)
@@ -175,6 +119,38 @@ calc_cn(int fd, int type, boolean use_bell)
     }
 }
 
+int
+show_tune_stat(int fd)
+{
+    static const char *phase_name[MAX_TUNE_PHASE] = { "PLL", "TMCC", "TS-lock",
+                                                    "TS-ID" };
+    TUNE_STAT stat;
+    int phase, i;
+
+    if(ioctl(fd, GET_TUNE_STAT, &stat) < 0) {
+        fprintf(stderr, "Cannot get tuning statistics\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Tuning statistics (last: ch=%d slot=%d)\n",
+            stat.frequencyno, stat.slot);
+    for(phase = 0; phase < MAX_TUNE_PHASE; phase++) {
+        fprintf(stderr, "%-8s locked=%u timeout=%u last=%uus max=%uus\n",
+                phase_name[phase], stat.count[phase], stat.timeout[phase],
+                stat.last_us[phase], stat.max_us[phase]);
+        fprintf(stderr, "        ");
+        for(i = 0; i < TUNE_HIST_SIZE; i++) {
+            if(i < TUNE_HIST_SIZE - 1)
+                fprintf(stderr, " <%dms:%u", 1 << i, stat.hist[phase][i]);
+            else
+                fprintf(stderr, " >=%dms:%u", 1 << (i - 1), stat.hist[phase][i]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    return 0;
+}
+
 void
 show_channels(void)
 {
@@ -362,7 +338,7 @@ do_bell(int bell)
 
 /* from checksignal.c */
 int
-tune(char *channel, thread_data *tdata, char *device)
+tune(char *channel, recpt1_tuner *t, char *device)
 {
     char **tuner;
     int num_devs;
@@ -370,42 +346,43 @@ tune(char *channel, thread_data *tdata, char *device)
     FREQUENCY freq;
 
     /* get channel */
-    tdata->table = searchrecoff(channel);
-    if(tdata->table == NULL) {
+    t->table = searchrecoff(channel, &t->bs);
+    if(t->table == NULL) {
         fprintf(stderr, "Invalid Channel: %s\n", channel);
         return 1;
     }
 
-    freq.frequencyno = tdata->table->set_freq;
-    freq.slot = tdata->table->add_freq;
+    freq.frequencyno = t->table->set_freq;
+    freq.slot = t->table->add_freq;
 
     /* open tuner */
     /* case 1: specified tuner device */
     if(device) {
-        tdata->tfd = open(device, O_RDONLY);
-        if(tdata->tfd < 0) {
+        t->tfd = open(device, O_RDONLY);
+        if(t->tfd < 0) {
             fprintf(stderr, "Cannot open tuner device: %s\n", device);
             return 1;
         }
 
         /* power on LNB */
-        if(tdata->table->type == CHTYPE_SATELLITE) {
-            if(ioctl(tdata->tfd, LNB_ENABLE, tdata->lnb) < 0) {
+        if(t->table->type == CHTYPE_SATELLITE) {
+            if(ioctl(t->tfd, LNB_ENABLE, t->lnb) < 0) {
                 fprintf(stderr, "Power on LNB failed: %s\n", device);
             }
         }
 
         /* tune to specified channel */
-        while(ioctl(tdata->tfd, SET_CHANNEL, &freq) < 0) {
-            if(tdata->tune_persistent) {
-                if(f_exit) {
-                    close_tuner(tdata);
+        while(ioctl(t->tfd, SET_CHANNEL, &freq) < 0) {
+            if(t->tune_persistent) {
+                if(t->cancel) {
+                    close_tuner(t);
                     return 1;
                 }
                 fprintf(stderr, "No signal. Still trying: %s\n", device);
             }
             else {
-                close(tdata->tfd);
+                close(t->tfd);
+                t->tfd = -1;
                 fprintf(stderr, "Cannot tune to the specified channel: %s\n", device);
                 return 1;
             }
@@ -415,7 +392,7 @@ tune(char *channel, thread_data *tdata, char *device)
     }
     else {
         /* case 2: loop around available devices */
-        if(tdata->table->type == CHTYPE_SATELLITE) {
+        if(t->table->type == CHTYPE_SATELLITE) {
             tuner = bsdev;
             num_devs = NUM_BSDEV;
         }
@@ -427,21 +404,21 @@ tune(char *channel, thread_data *tdata, char *device)
         for(lp = 0; lp < num_devs; lp++) {
             int count = 0;
 
-            tdata->tfd = open(tuner[lp], O_RDONLY);
-            if(tdata->tfd >= 0) {
+            t->tfd = open(tuner[lp], O_RDONLY);
+            if(t->tfd >= 0) {
                 /* power on LNB */
-                if(tdata->table->type == CHTYPE_SATELLITE) {
-                    if(ioctl(tdata->tfd, LNB_ENABLE, tdata->lnb) < 0) {
+                if(t->table->type == CHTYPE_SATELLITE) {
+                    if(ioctl(t->tfd, LNB_ENABLE, t->lnb) < 0) {
                         fprintf(stderr, "Warning: Power on LNB failed: %s\n", tuner[lp]);
                     }
                 }
 
                 /* tune to specified channel */
-                if(tdata->tune_persistent) {
-                    while(ioctl(tdata->tfd, SET_CHANNEL, &freq) < 0 &&
+                if(t->tune_persistent) {
+                    while(ioctl(t->tfd, SET_CHANNEL, &freq) < 0 &&
                           count < MAX_RETRY) {
-                        if(f_exit) {
-                            close_tuner(tdata);
+                        if(t->cancel) {
+                            close_tuner(t);
                             return 1;
                         }
                         fprintf(stderr, "No signal. Still trying: %s\n", tuner[lp]);
@@ -449,35 +426,35 @@ tune(char *channel, thread_data *tdata, char *device)
                     }
 
                     if(count >= MAX_RETRY) {
-                        close_tuner(tdata);
+                        close_tuner(t);
                         count = 0;
                         continue;
                     }
                 } /* tune_persistent */
                 else {
-                    if(ioctl(tdata->tfd, SET_CHANNEL, &freq) < 0) {
-                        close(tdata->tfd);
-                        tdata->tfd = -1;
+                    if(ioctl(t->tfd, SET_CHANNEL, &freq) < 0) {
+                        close(t->tfd);
+                        t->tfd = -1;
                         continue;
                     }
                 }
 
-                if(tdata->tune_persistent)
+                if(t->tune_persistent)
                     fprintf(stderr, "device = %s\n", tuner[lp]);
                 break; /* found suitable tuner */
             }
         }
 
         /* all tuners cannot be used */
-        if(tdata->tfd < 0) {
+        if(t->tfd < 0) {
             fprintf(stderr, "Cannot tune to the specified channel\n");
             return 1;
         }
     }
 
-    if(!tdata->tune_persistent) {
+    if(!t->tune_persistent) {
         /* show signal strength */
-        calc_cn(tdata->tfd, tdata->table->type, FALSE);
+        calc_cn(t->tfd, t->table->type, FALSE);
     }
 
     return 0; /* success */
@@ -572,3 +549,81 @@ tune(char *channel, thread_data *tdata, char *device)
     return 0; /* success */
 }
 #endif
+
+
+/* librecpt1 tuner handles */
+recpt1_tuner *
+recpt1_tuner_create(int lnb)
+{
+    recpt1_tuner *t = calloc(1, sizeof(recpt1_tuner));
+
+    if(t) {
+        t->tfd = -1;
+        t->lnb = lnb;
+    }
+    return t;
+}
+
+int
+recpt1_tuner_tune(recpt1_tuner *t, const char *channel, const char *device,
+                  int persistent)
+{
+    t->tune_persistent = persistent;
+    return tune((char *)channel, t, (char *)device) == 0 ? 0 : -1;
+}
+
+void
+recpt1_tuner_cancel(recpt1_tuner *t)
+{
+    t->cancel = TRUE;
+}
+
+int
+recpt1_tuner_fd(const recpt1_tuner *t)
+{
+    return t->tfd;
+}
+
+int
+recpt1_tuner_type(const recpt1_tuner *t)
+{
+    return t->table ? t->table->type : -1;
+}
+
+const char *
+recpt1_tuner_channel(const recpt1_tuner *t)
+{
+    return t->table ? t->table->parm_freq : NULL;
+}
+
+double
+recpt1_tuner_cn(const recpt1_tuner *t)
+{
+    int rc;
+
+    if(t->tfd < 0 || ioctl(t->tfd, GET_SIGNAL_STRENGTH, &rc) < 0)
+        return -1.0;
+    return cnlut_lookup(t->table->type, rc);
+}
+
+int
+recpt1_tuner_close(recpt1_tuner *t)
+{
+    int rv;
+
+    if(!t)
+        return 0;
+    rv = t->table ? close_tuner(t) : 0;
+    if(t->tfd >= 0)
+        close(t->tfd);
+    free(t);
+    return rv ? -1 : 0;
+}
+
+int
+recpt1_channel_valid(const char *channel)
+{
+    bs_channel bs;
+
+    return searchrecoff((char *)channel, &bs) ? 0 : -1;
+}
@@ -2,15 +2,10 @@
 #ifndef _RECPT1_UTIL_H_
 #define _RECPT1_UTIL_H_
 
-#include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,9 +30,17 @@
 #include "recpt1.h"
 #include "mkpath.h"
 #include "tssplitter_lite.h"
-
-/* ipc message size */
-#define MSGSZ     255
+#include "timeshift.h"
+#include "tsindex.h"
+#include "segment.h"
+#include "httpd.h"
+#include "arrival.h"
+#include "pipeout.h"
+#include "shmring.h"
+#include "pidstat.h"
+#include "udpout.h"
+#include "pipestat.h"
+#include "librecpt1.h"
 
 /* used in checksigna.c */
 #define MAX_RETRY (2)
@@ -45,50 +48,83 @@
 /* type definitions */
 typedef int boolean;
 
-typedef struct sock_data {
-    int sfd;    /* socket fd */
-    struct sockaddr_in addr;
-} sock_data;
+/* table entry for BSnn_m channels, which are not in the table */
+typedef struct bs_channel {
+    ISDB_T_FREQ_CONV_TABLE table;
+    char name[20];
+} bs_channel;
 
-typedef struct msgbuf {
-    long    mtype;
-    char    mtext[MSGSZ];
-} message_buf;
+struct recpt1_tuner {
+    int tfd;    /* tuner fd */
+    int lnb;    /* LNB voltage */
+    boolean tune_persistent;
+    volatile boolean cancel;    /* gives up persistent tuning */
+    ISDB_T_FREQ_CONV_TABLE *table;
+    bs_channel bs;
+};
 
-typedef struct thread_data {
-    int tfd;    /* tuner fd */ //xxx variable
+typedef struct recpt1_pipeline {
+    recpt1_tuner *tuner; //invariable, tuned by channel switches
 
     int wfd;    /* output file fd */ //invariable
-    int lnb;    /* LNB voltage */ //invariable
-    int msqid; //invariable
+    boolean use_stdout; //invariable
+    boolean use_splice; /* raw data may bypass userspace */ //invariable
     time_t start_time; //invariable
 
-    int recsec; //xxx variable
+    volatile int recsec; //xxx variable
 
     boolean indefinite; //invaliable
-    boolean tune_persistent; //invaliable
+    volatile boolean f_exit; /* every stage stops */
+    volatile int error; /* errno that ended the recording, 0: none */
 
     QUEUE_T *queue; //invariable
-    ISDB_T_FREQ_CONV_TABLE *table; //invariable
-    sock_data *sock_data; //invariable
-    pthread_t signal_thread; //invariable
+    QUEUE_T *dec_queue; /* decoder output, NULL if decoding inline */ //invariable
+    volatile boolean dec_done; /* decoder thread has flushed */
+    int decode_cpu; /* cpu for decoder thread, -1: any */ //invariable
+    timeshift *tshift; /* time-shift ring output, NULL: off */ //invariable
+    tsindex *tindex; /* seek index of the output file, NULL: off */ //invariable
+    segmenter *segment; /* segmented output, NULL: off */ //invariable
+    httpd *httpd; /* http streaming server, NULL: off */ //invariable
+    arrival *arrival; /* driver arrival timestamps, NULL: off */ //invariable
+    boolean m2ts; /* the stamps go into the output file */ //invariable
+    pipeout *pout; /* vmsplice stdout, NULL: write() */ //invariable
+    shmring *shm; /* shared-memory ring output, NULL: off */ //invariable
+    pidstat *pidstat; /* per-PID analyzer, NULL: off */ //invariable
+    udpout *udp; /* udp/rtp output, NULL: off */ //invariable
     decoder *decoder; //invariable
-    decoder_options *dopt; //invariable
-    splitter *splitter; //invariable
+    decoder_options dopt; //invariable
+    splitter *splitter; /* swapped by the reader on a SID change */
+    pthread_mutex_t sid_lock; /* guards the sid_* fields, sid and spliced */
+    volatile boolean sid_change; /* sid_next waits for the reader */
+    volatile boolean filter_reset; /* a retune cleared the driver filter */
+    splitter *sid_next; /* NULL: whole TS */
+    char *sid; /* current selection, NULL: whole TS */
+    boolean spliced; /* the capture thread splices; SIDs are fixed */
+    recpt1_tune_func http_tune; //invariable
+    void *http_tune_arg; //invariable
+
+    pipestat stat;
+    pthread_mutex_t switch_lock; /* one channel switch at a time */
+    pthread_mutex_t event_lock; /* held while the listener runs */
+    recpt1_event_func event;
+    void *event_arg;
+    boolean started;
+    pthread_t capture_thread;
+    pthread_t decoder_thread;
+    pthread_t reader_thread;
 } thread_data;
 
 extern const char *version;
 extern char *bsdev[];
 extern char *isdb_t_dev[];
 
-extern boolean f_exit;
-
 /* prototypes */
-int tune(char *channel, thread_data *tdata, char *device);
-int close_tuner(thread_data *tdata);
+int tune(char *channel, recpt1_tuner *t, char *device);
+int close_tuner(recpt1_tuner *t);
 void show_channels(void);
-ISDB_T_FREQ_CONV_TABLE *searchrecoff(char *channel);
+ISDB_T_FREQ_CONV_TABLE *searchrecoff(char *channel, bs_channel *bs);
 void calc_cn(int fd, int type, boolean use_bell);
+int show_tune_stat(int fd);
 int parse_time(char *rectimestr, int *recsec);
 void do_bell(int bell);
 
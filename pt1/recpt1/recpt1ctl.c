@@ -1,20 +1,23 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <time.h>
 
 #include <ctype.h>
 #include <getopt.h>
 #include "recpt1core.h"
-
-#define MSGSZ     255
+#include "ctlsock.h"
 
 void
 show_usage(char *cmd)
 {
-    fprintf(stderr, "Usage: \n%s --pid pid [--channel channel] [--extend time_to_extend] [--time recording_time]\n", cmd);
+    fprintf(stderr, "Usage: \n%s {--pid pid | --socket path} [--rec name] [--channel channel] [--extend time_to_extend] [--time recording_time] [--sid SID1,SID2|off] [--stop] [--status] [--stats] [--events] [--ping N]\n", cmd);
     fprintf(stderr, "\n");
 }
 
@@ -23,38 +26,156 @@ show_options(void)
 {
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "--pid:               Process id of recpt1 to control\n");
+    fprintf(stderr, "--socket:            Control socket of recpt1 --ctl or a daemon\n");
+    fprintf(stderr, "--rec:               Recording to control, if the socket has several\n");
     fprintf(stderr, "--channel:           Tune to specified channel\n");
     fprintf(stderr, "--extend:            Extend recording time\n");
     fprintf(stderr, "--time:              Set total recording time\n");
+    fprintf(stderr, "--sid:               Record these SIDs from now on ('off': whole TS)\n");
+    fprintf(stderr, "--stop:              End the recording\n");
+    fprintf(stderr, "--status:            Show channel, SIDs and times as JSON\n");
+    fprintf(stderr, "--stats:             Show pipeline statistics as JSON\n");
+    fprintf(stderr, "--events:            Print events until the recording ends\n");
+    fprintf(stderr, "--ping N:            Measure the round trip of N requests\n");
     fprintf(stderr, "--help:              Show this help\n");
     fprintf(stderr, "--version:           Show version\n");
     fprintf(stderr, "--list:              Show channel list\n");
 }
 
+static int
+ctl_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    size_t len = strlen(path);
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(len == 0 || len >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Invalid control socket: %s\n", path);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, len);
+    if(path[0] == '@')
+        addr.sun_path[0] = '\0';    /* abstract namespace */
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if(connect(fd, (struct sockaddr *)&addr,
+               offsetof(struct sockaddr_un, sun_path) + len) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* one request and its reply; events that come first are printed.
+   0 for "ok", 1 for "err", -1 if the connection failed */
+static int
+request(int fd, const char *rec, const char *verb, const char *arg,
+        boolean quiet)
+{
+    static unsigned int id;
+    char msg[CTL_MSG_MAX + 1];
+    char tag[CTL_ID_MAX + 2];
+    ssize_t n;
+
+    n = snprintf(msg, sizeof(msg), "%u%s%s %s%s%s", ++id, rec ? " @" : "",
+                 rec ? rec : "", verb, arg ? " " : "", arg ? arg : "");
+    if(send(fd, msg, n, MSG_NOSIGNAL) < 0) {
+        perror("send");
+        return -1;
+    }
+    n = snprintf(tag, sizeof(tag), "%u ", id);
+    while(1) {
+        ssize_t rc = recv(fd, msg, sizeof(msg) - 1, 0);
+
+        if(rc <= 0) {
+            fprintf(stderr, "recpt1 closed the control socket\n");
+            return -1;
+        }
+        msg[rc] = '\0';
+        if(strncmp(msg, tag, n)) {
+            printf("%s\n", msg);    /* an event */
+            continue;
+        }
+        if(!strncmp(msg + n, "err ", 4)) {
+            fprintf(stderr, "%s: %s\n", verb, msg + n + 4);
+            return 1;
+        }
+        if(!quiet && msg[n + 2] == ' ')
+            printf("%s\n", msg + n + 3);
+        return 0;
+    }
+}
+
+static double
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int
+ping(int fd, const char *rec, int count)
+{
+    double start, us, total = 0, max = 0;
+    int i;
+
+    for(i = 0; i < count; i++) {
+        start = now_us();
+        if(request(fd, rec, "ping", NULL, TRUE) != 0)
+            return 1;
+        us = now_us() - start;
+        total += us;
+        if(us > max)
+            max = us;
+    }
+    fprintf(stderr, "%d requests: mean %.1f us, max %.1f us\n",
+            count, total / count, max);
+    return 0;
+}
+
 int
 main(int argc, char **argv)
 {
-    int msqid;
-    int msgflg = IPC_CREAT | 0666;
-    key_t key = 0;
-    int channel=0, recsec = 0, extsec=0;
-    message_buf sbuf;
-    size_t buf_length;
+    char path[32];
+    const char *sock = NULL;
+    const char *rec = NULL;
+    const char *channel = NULL, *sid = NULL;
+    int recsec = 0, extsec = 0, pings = 0;
+    boolean stop = FALSE, status = FALSE, stats = FALSE, events = FALSE;
+    int fd, rv = 0;
+    char arg[16];
 
     int result;
     int option_index;
     struct option long_options[] = {
         { "pid",       1, NULL, 'p'},
+        { "socket",    1, NULL, 'S'},
+        { "rec",       1, NULL, 'r'},
         { "channel",   1, NULL, 'c'},
         { "extend",    1, NULL, 'e'},
         { "time",      1, NULL, 't'},
+        { "sid",       1, NULL, 'i'},
+        { "stop",      0, NULL, 'q'},
+        { "status",    0, NULL, 's'},
+        { "stats",     0, NULL, 'a'},
+        { "events",    0, NULL, 'E'},
+        { "ping",      1, NULL, 'P'},
         { "help",      0, NULL, 'h'},
         { "version",   0, NULL, 'v'},
         { "list",      0, NULL, 'l'},
         {0, 0, NULL, 0} /* terminate */
     };
 
-    while((result = getopt_long(argc, argv, "p:c:e:t:hvl",
+    while((result = getopt_long(argc, argv, "p:S:r:c:e:t:i:qsaEP:hvl",
                                 long_options, &option_index)) != -1) {
         switch(result) {
         case 'h':
@@ -76,14 +197,33 @@ main(int argc, char **argv)
             show_channels();
             exit(0);
             break;
+        case 'q':
+            stop = TRUE;
+            break;
+        case 's':
+            status = TRUE;
+            break;
+        case 'a':
+            stats = TRUE;
+            break;
+        case 'E':
+            events = TRUE;
+            break;
         /* following options require argument */
         case 'p':
-            key = (key_t)atoi(optarg);
-            fprintf(stderr, "Pid = %d\n", key);
+            snprintf(path, sizeof(path), "@recpt1.%d", atoi(optarg));
+            sock = path;
+            fprintf(stderr, "Pid = %d\n", atoi(optarg));
+            break;
+        case 'S':
+            sock = optarg;
+            break;
+        case 'r':
+            rec = optarg;
             break;
         case 'c':
-            channel = atoi(optarg);
-            fprintf(stderr, "Channel = %d\n", channel);
+            channel = optarg;
+            fprintf(stderr, "Channel = %s\n", channel);
             break;
         case 'e':
             parse_time(optarg, &extsec);
@@ -93,29 +233,61 @@ main(int argc, char **argv)
             parse_time(optarg, &recsec);
             fprintf(stderr, "Total recording time = %d sec\n", recsec);
             break;
+        case 'i':
+            sid = optarg;
+            break;
+        case 'P':
+            pings = atoi(optarg);
+            break;
         }
     }
 
-    if(!key) {
+    if(!sock) {
         fprintf(stderr, "Arguments are necessary!\n");
         fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
         exit(1);
     }
 
-    if ((msqid = msgget(key, msgflg )) < 0) {
-        perror("msgget");
+    fd = ctl_connect(sock);
+    if(fd < 0)
         exit(1);
-    }
 
-    sbuf.mtype = 1;
-    sprintf(sbuf.mtext, "ch=%d t=%d e=%d", channel, recsec, extsec);
+    /* subscribe first, so the events of the requests below show up */
+    if(events)
+        rv |= request(fd, NULL, "subscribe", NULL, TRUE);
+    if(!rv && channel)
+        rv |= request(fd, rec, "channel", channel, FALSE);
+    if(!rv && sid)
+        rv |= request(fd, rec, "sid", sid, FALSE);
+    if(!rv && extsec) {
+        snprintf(arg, sizeof(arg), "%d", extsec);
+        rv |= request(fd, rec, "extend", arg, FALSE);
+    }
+    if(!rv && recsec) {
+        snprintf(arg, sizeof(arg), "%d", recsec);
+        rv |= request(fd, rec, "time", arg, FALSE);
+    }
+    if(!rv && status)
+        rv |= request(fd, rec, "status", NULL, FALSE);
+    if(!rv && stats)
+        rv |= request(fd, rec, "stats", NULL, FALSE);
+    if(!rv && pings > 0)
+        rv |= ping(fd, rec, pings);
+    if(!rv && stop)
+        rv |= request(fd, rec, "stop", NULL, FALSE);
 
-    buf_length = strlen(sbuf.mtext) + 1 ;
+    /* then follow the recording until recpt1 closes the socket */
+    while(!rv && events) {
+        char msg[CTL_MSG_MAX + 1];
+        ssize_t rc = recv(fd, msg, sizeof(msg) - 1, 0);
 
-    if (msgsnd(msqid, &sbuf, buf_length, IPC_NOWAIT) < 0) {
-        perror("msgsnd");
-        exit(1);
+        if(rc <= 0)
+            break;
+        msg[rc] = '\0';
+        printf("%s\n", msg);
+        fflush(stdout);
     }
 
-    exit(0);
+    close(fd);
+    exit(rv ? 1 : 0);
 }
@@ -0,0 +1,387 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* sync_file_range */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <libgen.h>
+
+#include "segment.h"
+#include "tsindex.h"
+
+#define TS_PACKET_SIZE  188
+#define TS_SYNC         0x47
+#define NS              1000000000ULL
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS + ts.tv_nsec;
+}
+
+/* a pattern is usable if it has exactly one %d conversion */
+static int
+valid_pattern(const char *s)
+{
+    int n = 0;
+
+    for(; *s; s++) {
+        if(*s != '%')
+            continue;
+        if(*++s == '%')
+            continue;
+        while(*s >= '0' && *s <= '9')
+            s++;
+        if(*s != 'd')
+            return 0;
+        n++;
+    }
+    return n == 1;
+}
+
+static char *
+make_pattern(const char *destfile)
+{
+    size_t len = strlen(destfile);
+    char *pattern;
+
+    if(strchr(destfile, '%'))
+        return valid_pattern(destfile) ? strdup(destfile) : NULL;
+
+    pattern = malloc(len + sizeof("-%05d.ts"));
+    if(!pattern)
+        return NULL;
+    strcpy(pattern, destfile);
+    if(len > 3 && !strcmp(pattern + len - 3, ".ts"))
+        pattern[len - 3] = '\0';
+    strcat(pattern, "-%05d.ts");
+    return pattern;
+}
+
+static int
+open_segment(segmenter *seg, int number)
+{
+    char path[1024];
+    int fd;
+
+    snprintf(path, sizeof(path), seg->pattern, number);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0)
+        perror(path);
+    return fd;
+}
+
+static int
+write_all(int fd, const uint8_t *data, size_t len)
+{
+    while(len > 0) {
+        ssize_t wc = write(fd, data, len);
+
+        if(wc < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += wc;
+        len -= wc;
+    }
+    return 0;
+}
+
+/* append the finished segment to the playlist */
+static void
+playlist_add(segmenter *seg, double duration)
+{
+    char path[1024], dir1[1024], dir2[1024];
+    const char *name = path;
+    FILE *fp;
+
+    if(!seg->playlist)
+        return;
+    snprintf(path, sizeof(path), seg->pattern, seg->number);
+    snprintf(dir1, sizeof(dir1), "%s", path);
+    snprintf(dir2, sizeof(dir2), "%s", seg->playlist);
+    /* entries are relative to the playlist when they share a directory */
+    if(!strcmp(dirname(dir1), dirname(dir2))) {
+        name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+    }
+
+    fp = fopen(seg->playlist, "a");
+    if(!fp) {
+        perror(seg->playlist);
+        return;
+    }
+    fprintf(fp, "#EXTINF:%.3f,\n%s\n", duration, name);
+    fclose(fp);
+}
+
+static void
+playlist_start(segmenter *seg)
+{
+    FILE *fp = fopen(seg->playlist, "w");
+
+    if(!fp) {
+        perror(seg->playlist);
+        free(seg->playlist);
+        seg->playlist = NULL;
+        return;
+    }
+    fprintf(fp, "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-MEDIA-SEQUENCE:0\n");
+    if(seg->max_ns)
+        fprintf(fp, "#EXT-X-TARGETDURATION:%llu\n",
+                (unsigned long long)(seg->max_ns / NS +
+                                     (seg->cut_rap ? SEGMENT_RAP_WAIT : 0)));
+    fclose(fp);
+}
+
+static void
+playlist_end(segmenter *seg)
+{
+    FILE *fp;
+
+    if(!seg->playlist)
+        return;
+    fp = fopen(seg->playlist, "a");
+    if(fp) {
+        fprintf(fp, "#EXT-X-ENDLIST\n");
+        fclose(fp);
+    }
+}
+
+segmenter *
+segment_open(const char *destfile, int max_sec, int max_mb, int cut_rap,
+             const char *playlist)
+{
+    segmenter *seg = calloc(1, sizeof(segmenter));
+
+    if(!seg)
+        return NULL;
+    seg->pattern = make_pattern(destfile);
+    if(!seg->pattern) {
+        fprintf(stderr, "Invalid segment name: %s (use one %%d)\n", destfile);
+        free(seg);
+        return NULL;
+    }
+    seg->max_ns = max_sec > 0 ? (uint64_t)max_sec * NS : 0;
+    seg->max_bytes = max_mb > 0 ? (uint64_t)max_mb << 20 : 0;
+    seg->cut_rap = cut_rap;
+
+    seg->fd = open_segment(seg, 0);
+    if(seg->fd < 0)
+        goto fail;
+    seg->next_fd = open_segment(seg, 1);
+    if(seg->next_fd < 0) {
+        close(seg->fd);
+        goto fail;
+    }
+    if(playlist) {
+        seg->playlist = strdup(playlist);
+        if(seg->playlist)
+            playlist_start(seg);
+    }
+    seg->started_ns = now_ns();
+    return seg;
+
+fail:
+    free(seg->pattern);
+    free(seg);
+    return NULL;
+}
+
+/* remember the latest single-packet PAT and PMT sections */
+static void
+cache_psi(segmenter *seg, const uint8_t *p)
+{
+    int pid = ((p[1] & 0x1f) << 8) | p[2];
+    int i, n, len, pos;
+
+    if(!(p[1] & 0x40) || (p[3] & 0x30) != 0x10)
+        return;
+    /* section must end inside this packet */
+    pos = 5 + p[4];
+    if(pos + 3 > TS_PACKET_SIZE)
+        return;
+    len = ((p[pos + 1] & 0x0f) << 8) | p[pos + 2];
+    if(pos + 3 + len > TS_PACKET_SIZE)
+        return;
+
+    if(pid == 0) {
+        if(p[pos] != 0x00)
+            return;
+        memcpy(seg->pat, p, TS_PACKET_SIZE);
+        seg->have_pat = 1;
+        /* program loop, without the CRC; PMTs of listed PIDs stay cached */
+        n = 0;
+        for(i = pos + 8; i + 4 <= pos + 3 + len - 4 && n < SEGMENT_MAX_PMT;
+            i += 4) {
+            int program = (p[i] << 8) | p[i + 1];
+            int pmt = ((p[i + 2] & 0x1f) << 8) | p[i + 3];
+
+            if(program == 0)
+                continue;
+            if(n >= seg->num_pmt || seg->pmt_pid[n] != pmt) {
+                seg->pmt_pid[n] = pmt;
+                seg->have_pmt[n] = 0;
+            }
+            n++;
+        }
+        seg->num_pmt = n;
+        return;
+    }
+    if(p[pos] != 0x02)
+        return;
+    for(i = 0; i < seg->num_pmt; i++) {
+        if(seg->pmt_pid[i] == pid) {
+            memcpy(seg->pmt[i], p, TS_PACKET_SIZE);
+            seg->have_pmt[i] = 1;
+            return;
+        }
+    }
+}
+
+/* open the segment after the current one if rotate() used it up */
+static int
+prepare_next(segmenter *seg)
+{
+    if(seg->next_fd >= 0)
+        return 0;
+    seg->next_fd = open_segment(seg, seg->number + 1);
+    return seg->next_fd < 0 ? -1 : 0;
+}
+
+/* close the current segment and switch to the pre-opened one */
+static int
+rotate(segmenter *seg, uint64_t now)
+{
+    int old = seg->fd;
+    int i;
+
+    if(prepare_next(seg) < 0)
+        return -1;
+    playlist_add(seg, (now - seg->started_ns) / 1e9);
+    seg->fd = seg->next_fd;
+    seg->next_fd = -1;
+    seg->number++;
+    seg->started_ns = now;
+    seg->due_ns = 0;
+    seg->bytes = 0;
+
+    /* start the file with the tables so it decodes on its own */
+    if(seg->have_pat) {
+        if(write_all(seg->fd, seg->pat, TS_PACKET_SIZE) < 0)
+            return -1;
+        seg->bytes += TS_PACKET_SIZE;
+        for(i = 0; i < seg->num_pmt; i++) {
+            if(!seg->have_pmt[i])
+                continue;
+            if(write_all(seg->fd, seg->pmt[i], TS_PACKET_SIZE) < 0)
+                return -1;
+            seg->bytes += TS_PACKET_SIZE;
+        }
+    }
+
+    /* start writeback without waiting for it */
+    sync_file_range(old, 0, 0, SYNC_FILE_RANGE_WRITE);
+    close(old);
+    return 0;
+}
+
+static int
+cut_due(segmenter *seg, uint64_t now, uint64_t bytes)
+{
+    if(seg->max_ns && now - seg->started_ns >= seg->max_ns)
+        return 1;
+    if(seg->max_bytes && bytes >= seg->max_bytes)
+        return 1;
+    return 0;
+}
+
+int
+segment_write(segmenter *seg, const uint8_t *data, size_t len,
+              const rapscan *rs)
+{
+    uint64_t now = now_ns();
+    size_t pos = 0, p;
+    int rotated = 0, rap = 0;
+
+    /* first packet boundary, possibly past this block */
+    p = seg->sync_offset > seg->offset ? seg->sync_offset - seg->offset : 0;
+
+    while(p + TS_PACKET_SIZE <= len) {
+        const uint8_t *pk = data + p;
+
+        if(pk[0] != TS_SYNC) {
+            /* lost alignment: resume at the next confirmed sync byte */
+            ssize_t s = tsindex_find_sync(data, len, p + 1);
+
+            p = s < 0 ? len : (size_t)s;
+            continue;
+        }
+        if(p > pos && cut_due(seg, now, seg->bytes + (p - pos))) {
+            if(!seg->due_ns)
+                seg->due_ns = now;
+            /* RAP offsets are ascending, like p */
+            while(rs && rap < rs->count && rs->rap[rap] < p)
+                rap++;
+            if(!seg->cut_rap || (rs && rap < rs->count && rs->rap[rap] == p) ||
+               now - seg->due_ns >= SEGMENT_RAP_WAIT * NS) {
+                if(write_all(seg->fd, data + pos, p - pos) < 0 ||
+                   rotate(seg, now) < 0)
+                    return -1;
+                pos = p;
+                rotated = 1;
+            }
+        }
+        cache_psi(seg, pk);
+        p += TS_PACKET_SIZE;
+    }
+    /* a packet running into the next block: its end is the next
+       boundary.  without one, the next block resyncs from its start */
+    if(p < len) {
+        ssize_t s = data[p] == TS_SYNC ? (ssize_t)p :
+            tsindex_find_sync(data, len, p);
+
+        seg->sync_offset = s < 0 ? seg->offset + len :
+            tsindex_next_sync(seg->offset, len, s);
+    }
+    else
+        seg->sync_offset = seg->offset + p;
+    seg->offset += len;
+
+    if(write_all(seg->fd, data + pos, len - pos) < 0)
+        return -1;
+    seg->bytes += len - pos;
+    if(rotated)
+        return prepare_next(seg);
+    return 0;
+}
+
+void
+segment_close(segmenter *seg)
+{
+    char path[1024];
+
+    if(!seg)
+        return;
+    playlist_add(seg, (now_ns() - seg->started_ns) / 1e9);
+    playlist_end(seg);
+    close(seg->fd);
+    if(seg->next_fd >= 0) {
+        /* the pre-opened file was never used */
+        close(seg->next_fd);
+        snprintf(path, sizeof(path), seg->pattern, seg->number + 1);
+        unlink(path);
+    }
+    free(seg->pattern);
+    free(seg->playlist);
+    free(seg);
+}
@@ -0,0 +1,56 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _SEGMENT_H_
+#define _SEGMENT_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rapscan.h"
+
+/*
+ * Segmented output: the recording is cut into files of max_sec seconds
+ * and/or max_mb megabytes.  Cuts fall on TS packet boundaries (on a
+ * random access point found by the scanner if cut_rap, waiting at most
+ * SEGMENT_RAP_WAIT seconds for one) and every segment starts with the
+ * last PAT and PMTs seen, so each file plays on its own.
+ *
+ * destfile names the segments: a printf pattern with one %d
+ * ("rec-%05d.ts") is used as is, otherwise "name.ts" becomes
+ * "name-00000.ts", "name-00001.ts", ...  The next file is opened one
+ * segment ahead so a cut is a switch of descriptors.  With a playlist,
+ * an M3U8 entry is appended as each segment is closed.
+ */
+
+#define SEGMENT_RAP_WAIT    3
+#define SEGMENT_MAX_PMT     16
+
+typedef struct segmenter {
+    char *pattern;
+    char *playlist;         /* NULL: none */
+    int fd;                 /* current segment */
+    int next_fd;            /* pre-opened next segment */
+    int number;
+    uint64_t max_ns;        /* 0: no time limit */
+    uint64_t max_bytes;     /* 0: no size limit */
+    int cut_rap;
+    uint64_t started_ns;    /* of the current segment */
+    uint64_t due_ns;        /* when the cut became due, 0: not yet */
+    uint64_t bytes;         /* in the current segment */
+    uint64_t offset;        /* bytes of stream seen */
+    uint64_t sync_offset;   /* next expected packet boundary */
+    /* PSI re-emitted at the start of every segment */
+    uint8_t pat[188];
+    int have_pat;
+    int num_pmt;
+    uint16_t pmt_pid[SEGMENT_MAX_PMT];
+    uint8_t pmt[SEGMENT_MAX_PMT][188];
+    uint8_t have_pmt[SEGMENT_MAX_PMT];
+} segmenter;
+
+segmenter *segment_open(const char *destfile, int max_sec, int max_mb,
+                        int cut_rap, const char *playlist);
+int segment_write(segmenter *seg, const uint8_t *data, size_t len,
+                  const rapscan *rs);
+void segment_close(segmenter *seg);
+
+#endif
@@ -0,0 +1,293 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * shmbench: throughput of the --shm ring with 1 to N reader processes.
+ * A writer publishes numbered TS packets as recpt1 would; every reader
+ * attaches like a real consumer, checks the packet numbers and reports
+ * what it got and what it lost to being lapped.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "shmring.h"
+
+#define TS_PACKET_SIZE  188
+#define BLOCK_PACKETS   87      /* recpt1's MAX_READ_SIZE */
+#define MAX_READER      64
+#define COPY_SIZE       (TS_PACKET_SIZE * 4096)
+
+typedef struct options {
+    int readers;
+    int seconds;
+    int ring_mb;
+    double rate;            /* MB/s, 0: unpaced */
+    int copy;
+} options;
+
+typedef struct result {
+    uint64_t bytes;
+    uint64_t skipped;
+    unsigned long laps;
+    unsigned long errors;   /* misnumbered packets not explained by laps */
+    double seconds;
+} result;
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+packet_no(const uint8_t *p)
+{
+    uint64_t n;
+
+    memcpy(&n, p + 4, sizeof(n));
+    return n;
+}
+
+/* misnumbered packets in data; *next is the number expected */
+static unsigned long
+check(const uint8_t *data, size_t len, uint64_t *next)
+{
+    unsigned long bad = 0;
+    size_t i;
+
+    for(i = 0; i + TS_PACKET_SIZE <= len; i += TS_PACKET_SIZE) {
+        uint64_t n = packet_no(data + i);
+
+        if(data[i] != 0x47 || (*next && n != *next))
+            bad++;
+        *next = n + 1;
+    }
+    return bad;
+}
+
+static void
+reader(const char *name, const options *opt, int ready_fd, int result_fd)
+{
+    shmring *r = shmring_attach(name);
+    result res;
+    uint64_t next = 0;
+    uint8_t *buf = NULL;
+    double start;
+    char c = 0;
+
+    memset(&res, 0, sizeof(res));
+    if(!r)
+        _exit(1);
+    if(opt->copy)
+        buf = malloc(COPY_SIZE);
+    if(write(ready_fd, &c, 1) < 0)
+        _exit(1);
+    start = now_sec();
+
+    while(1) {
+        unsigned long laps = r->laps;
+        unsigned long bad;
+        const uint8_t *p;
+        ssize_t n;
+        size_t len;
+
+        if(opt->copy) {
+            n = shmring_read(r, buf, COPY_SIZE, -1);
+            if(n < 0)
+                break;
+            if(r->laps != laps)
+                next = 0;
+            res.errors += check(buf, n, &next);
+        }
+        else {
+            p = shmring_peek(r, &len, -1);
+            if(!p)
+                break;
+            if(r->laps != laps)
+                next = 0;
+            bad = check(p, len, &next);
+            /* overwritten while we looked: the misnumbering is the lap */
+            if(shmring_release(r, len) < 0) {
+                next = 0;
+                continue;
+            }
+            res.errors += bad;
+            n = len;
+        }
+        res.bytes += n;
+    }
+    res.seconds = now_sec() - start;
+    res.skipped = r->skipped;
+    res.laps = r->laps;
+    if(write(result_fd, &res, sizeof(res)) < 0)
+        _exit(1);
+    shmring_detach(r);
+    _exit(0);
+}
+
+static int
+run(const options *opt, int readers)
+{
+    char name[64];
+    shmring *r;
+    uint8_t block[TS_PACKET_SIZE * BLOCK_PACKETS];
+    int ready[2], results[2];
+    pid_t pid[MAX_READER];
+    result res, total;
+    uint64_t written = 0, packet = 1;
+    double start, elapsed, min_rate = 0, sum_rate = 0, rate;
+    int i, started = 0;
+    char c;
+
+    snprintf(name, sizeof(name), "shmbench.%d", (int)getpid());
+    r = shmring_create(name, (size_t)opt->ring_mb << 20);
+    if(!r)
+        return -1;
+    if(pipe(ready) < 0 || pipe(results) < 0) {
+        perror("pipe");
+        shmring_close(r);
+        return -1;
+    }
+    for(i = 0; i < readers; i++) {
+        pid[i] = fork();
+        if(pid[i] == 0) {
+            close(ready[0]);
+            close(results[0]);
+            reader(name, opt, ready[1], results[1]);
+        }
+        if(pid[i] < 0) {
+            perror("fork");
+            break;
+        }
+        started++;
+    }
+    close(ready[1]);
+    close(results[1]);
+    for(i = 0; i < started; i++) {
+        if(read(ready[0], &c, 1) != 1)
+            break;
+    }
+
+    memset(block, 0xff, sizeof(block));
+    for(i = 0; i < BLOCK_PACKETS; i++) {
+        block[i * TS_PACKET_SIZE] = 0x47;
+        block[i * TS_PACKET_SIZE + 1] = 0x01;
+        block[i * TS_PACKET_SIZE + 3] = 0x10;
+    }
+    start = now_sec();
+    while((elapsed = now_sec() - start) < opt->seconds) {
+        if(opt->rate > 0 && written > opt->rate * 1e6 * elapsed) {
+            usleep(1000);
+            continue;
+        }
+        for(i = 0; i < BLOCK_PACKETS; i++, packet++)
+            memcpy(block + i * TS_PACKET_SIZE + 4, &packet, sizeof(packet));
+        shmring_write(r, block, sizeof(block), NULL);
+        written += sizeof(block);
+    }
+    elapsed = now_sec() - start;
+    shmring_close(r);
+
+    memset(&total, 0, sizeof(total));
+    for(i = 0; i < started; i++) {
+        if(read(results[0], &res, sizeof(res)) != sizeof(res))
+            break;
+        total.bytes += res.bytes;
+        total.skipped += res.skipped;
+        total.laps += res.laps;
+        total.errors += res.errors;
+        /* each reader over its own run time, for avg and min alike */
+        rate = res.seconds > 0 ? res.bytes / res.seconds : 0;
+        sum_rate += rate;
+        if(i == 0 || rate < min_rate)
+            min_rate = rate;
+    }
+    for(i = 0; i < started; i++)
+        waitpid(pid[i], NULL, 0);
+    close(ready[0]);
+    close(results[0]);
+
+    printf("%2d reader%s  write %8.1f MB/s  read avg %8.1f min %8.1f MB/s  "
+           "lost %5.2f%%  laps %lu  errors %lu\n",
+           readers, readers > 1 ? "s" : " ", written / elapsed / 1e6,
+           started ? sum_rate / 1e6 / started : 0.0,
+           min_rate / 1e6,
+           written ? 100.0 * total.skipped / ((double)written * started) : 0.0,
+           total.laps, total.errors);
+    return total.errors ? -1 : 0;
+}
+
+static void
+show_usage(char *cmd)
+{
+    fprintf(stderr, "Usage: \n%s [--readers N] [--seconds N] [--ring MB] [--rate MB/s] [--copy]\n", cmd);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "--readers N:   Run with 1 to N readers (default 8)\n");
+    fprintf(stderr, "--seconds N:   Seconds per run (default 3)\n");
+    fprintf(stderr, "--ring MB:     Ring size (default 16)\n");
+    fprintf(stderr, "--rate MB/s:   Pace the writer, 0 for as fast as possible (default 0)\n");
+    fprintf(stderr, "--copy:        Readers copy out with shmring_read() instead of peeking\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct option long_options[] = {
+        { "readers", 1, NULL, 'n'},
+        { "seconds", 1, NULL, 't'},
+        { "ring",    1, NULL, 'R'},
+        { "rate",    1, NULL, 'r'},
+        { "copy",    0, NULL, 'c'},
+        { "help",    0, NULL, 'h'},
+        {0, 0, NULL, 0} /* terminate */
+    };
+    options opt = { 8, 3, 16, 0, 0 };
+    int result, option_index, n, failed = 0;
+
+    while((result = getopt_long(argc, argv, "n:t:R:r:ch", long_options,
+                                &option_index)) != -1) {
+        switch(result) {
+        case 'n':
+            opt.readers = atoi(optarg);
+            break;
+        case 't':
+            opt.seconds = atoi(optarg);
+            break;
+        case 'R':
+            opt.ring_mb = atoi(optarg);
+            break;
+        case 'r':
+            opt.rate = atof(optarg);
+            break;
+        case 'c':
+            opt.copy = 1;
+            break;
+        case 'h':
+        default:
+            show_usage(argv[0]);
+            return result == 'h' ? 0 : 1;
+        }
+    }
+    if(opt.readers < 1)
+        opt.readers = 1;
+    if(opt.readers > MAX_READER)
+        opt.readers = MAX_READER;
+    if(opt.seconds < 1)
+        opt.seconds = 1;
+
+    for(n = 1; n <= opt.readers; n++) {
+        fflush(stdout);
+        if(run(&opt, n) < 0)
+            failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,99 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * shmcat: copy the shared-memory ring written by recpt1 --shm to
+ * stdout, for consumers that only take a pipe or a file.  Starts at
+ * the latest random access point; exits when recpt1 stops.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "shmring.h"
+
+static void
+show_usage(char *cmd)
+{
+    fprintf(stderr, "Usage: \n%s [--status] name\n", cmd);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "--status:  Show the ring and exit\n");
+    fprintf(stderr, "--help:    Show this help\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct option long_options[] = {
+        { "status", 0, NULL, 's'},
+        { "help",   0, NULL, 'h'},
+        {0, 0, NULL, 0} /* terminate */
+    };
+    int result, option_index;
+    int status = 0;
+    shmring *r;
+    const uint8_t *p;
+    size_t len;
+    ssize_t wc;
+    uint64_t copied = 0;
+    unsigned long laps = 0;
+
+    while((result = getopt_long(argc, argv, "sh", long_options,
+                                &option_index)) != -1) {
+        switch(result) {
+        case 's':
+            status = 1;
+            break;
+        case 'h':
+        default:
+            show_usage(argv[0]);
+            return result == 'h' ? 0 : 1;
+        }
+    }
+    if(argc - optind != 1) {
+        show_usage(argv[0]);
+        return 1;
+    }
+
+    r = shmring_attach(argv[optind]);
+    if(!r)
+        return 1;
+    if(status) {
+        shmring_header *hdr = r->hdr;
+
+        printf("writer pid %u%s\n", hdr->writer_pid,
+               hdr->closed ? " (finished)" : "");
+        printf("ring       %llu bytes\n", (unsigned long long)hdr->ring_size);
+        printf("written    %llu bytes\n", (unsigned long long)hdr->written);
+        printf("last RAP   %llu\n", (unsigned long long)hdr->last_rap);
+        shmring_detach(r);
+        return 0;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    while((p = shmring_peek(r, &len, -1))) {
+        /* straight from the ring; a lap during the write is reported */
+        wc = write(1, p, len);
+        if(wc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno != EPIPE)
+                perror("write");
+            break;
+        }
+        copied += wc;
+        shmring_release(r, wc);
+        if(r->laps != laps) {
+            fprintf(stderr, "shmcat: fell behind, %llu bytes skipped\n",
+                    (unsigned long long)r->skipped);
+            laps = r->laps;
+        }
+    }
+    fprintf(stderr, "shmcat: %llu bytes, %lu laps\n",
+            (unsigned long long)copied, r->laps);
+    shmring_detach(r);
+    return 0;
+}
@@ -0,0 +1,333 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shmring.h"
+
+#define MIN_RING_SIZE       (1024 * 1024)
+#define WAIT_SLICE_MS       1000
+
+static long
+futex(volatile uint32_t *addr, int op, uint32_t val,
+      const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/* shm_open() wants a single leading slash */
+static char *
+object_name(const char *name)
+{
+    char *path = malloc(strlen(name) + 2);
+
+    if(path) {
+        path[0] = '/';
+        strcpy(path + 1, name[0] == '/' ? name + 1 : name);
+    }
+    return path;
+}
+
+/* header page, the ring, then the ring again right behind it */
+static void *
+map_ring(int fd, size_t header_size, size_t ring_size, int prot)
+{
+    size_t total = header_size + 2 * ring_size;
+    uint8_t *base;
+
+    base = mmap(NULL, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED)
+        return NULL;
+    if(mmap(base, header_size + ring_size, prot, MAP_SHARED | MAP_FIXED,
+            fd, 0) == MAP_FAILED ||
+       mmap(base + header_size + ring_size, ring_size, prot,
+            MAP_SHARED | MAP_FIXED, fd, header_size) == MAP_FAILED) {
+        munmap(base, total);
+        return NULL;
+    }
+    return base;
+}
+
+shmring *
+shmring_create(const char *name, size_t ring_size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    shmring *r;
+    shmring_header *hdr;
+    int fd;
+
+    if(ring_size < MIN_RING_SIZE)
+        ring_size = MIN_RING_SIZE;
+    ring_size = (ring_size + page - 1) & ~(page - 1);
+
+    r = calloc(1, sizeof(shmring));
+    if(!r)
+        return NULL;
+    r->name = object_name(name);
+    if(!r->name)
+        goto fail;
+
+    /* a ring left behind by a recpt1 that crashed */
+    shm_unlink(r->name);
+    fd = shm_open(r->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) {
+        perror(r->name);
+        goto fail;
+    }
+    if(ftruncate(fd, page + ring_size) < 0) {
+        perror("ftruncate");
+        close(fd);
+        goto fail_unlink;
+    }
+    hdr = map_ring(fd, page, ring_size, PROT_READ | PROT_WRITE);
+    close(fd);
+    if(!hdr) {
+        perror("mmap");
+        goto fail_unlink;
+    }
+    r->hdr = hdr;
+    r->ring = (uint8_t *)hdr + page;
+    r->map_size = page + 2 * ring_size;
+
+    hdr->version = SHMRING_VERSION;
+    hdr->ring_size = ring_size;
+    hdr->header_size = page;
+    hdr->writer_pid = getpid();
+    __sync_synchronize();
+    hdr->magic = SHMRING_MAGIC;
+    return r;
+
+fail_unlink:
+    shm_unlink(r->name);
+fail:
+    free(r->name);
+    free(r);
+    return NULL;
+}
+
+static void
+publish(shmring_header *hdr)
+{
+    hdr->seq++;
+    futex(&hdr->seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+void
+shmring_write(shmring *r, const uint8_t *data, size_t len, const rapscan *rs)
+{
+    shmring_header *hdr = r->hdr;
+    uint64_t head = hdr->written;
+
+    if(len == 0)
+        return;
+    if(len > hdr->ring_size) {
+        data += len - hdr->ring_size;
+        head += len - hdr->ring_size;
+        len = hdr->ring_size;
+        rs = NULL;
+    }
+
+    hdr->reserved = head + len;
+    __sync_synchronize();
+    memcpy(r->ring + head % hdr->ring_size, data, len);
+    if(rs) {
+        if(rs->count > 0)
+            hdr->last_rap = head + rs->rap[rs->count - 1];
+        hdr->sync = head + (rapscan_sync(rs) - (rs->offset - len));
+    }
+    __sync_synchronize();
+    hdr->written = head + len;
+    publish(hdr);
+}
+
+void
+shmring_close(shmring *r)
+{
+    if(!r)
+        return;
+    /* attached readers drain what is left and see the end */
+    r->hdr->closed = 1;
+    publish(r->hdr);
+    munmap(r->hdr, r->map_size);
+    shm_unlink(r->name);
+    free(r->name);
+    free(r);
+}
+
+/* where a reader joins: the latest RAP, else a packet boundary */
+static uint64_t
+join_offset(shmring_header *hdr)
+{
+    uint64_t written = hdr->written;
+    uint64_t rap = hdr->last_rap;
+    uint64_t sync = hdr->sync;
+
+    if(rap && rap <= written && written - rap < hdr->ring_size / 2)
+        return rap;
+    if(sync && sync <= written && written - sync < hdr->ring_size / 2)
+        return sync;
+    return written;
+}
+
+shmring *
+shmring_attach(const char *name)
+{
+    shmring *r = calloc(1, sizeof(shmring));
+    char *path = object_name(name);
+    shmring_header *hdr;
+    struct stat st;
+    size_t header_size, ring_size;
+    int fd = -1;
+
+    if(!r || !path)
+        goto fail;
+    fd = shm_open(path, O_RDONLY, 0);
+    if(fd < 0) {
+        perror(path);
+        goto fail;
+    }
+    if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(shmring_header))
+        goto bad;
+
+    /* the header first, for the geometry */
+    hdr = mmap(NULL, sizeof(shmring_header), PROT_READ, MAP_SHARED, fd, 0);
+    if(hdr == MAP_FAILED)
+        goto bad;
+    header_size = hdr->header_size;
+    ring_size = hdr->ring_size;
+    if(hdr->magic != SHMRING_MAGIC || hdr->version != SHMRING_VERSION ||
+       header_size != (size_t)sysconf(_SC_PAGESIZE) ||
+       (uint64_t)st.st_size != header_size + ring_size) {
+        munmap(hdr, sizeof(shmring_header));
+        goto bad;
+    }
+    munmap(hdr, sizeof(shmring_header));
+
+    r->hdr = map_ring(fd, header_size, ring_size, PROT_READ);
+    if(!r->hdr) {
+        perror("mmap");
+        goto fail;
+    }
+    close(fd);
+    r->ring = (uint8_t *)r->hdr + header_size;
+    r->map_size = header_size + 2 * ring_size;
+    r->pos = join_offset(r->hdr);
+    free(path);
+    return r;
+
+bad:
+    fprintf(stderr, "%s: not a recpt1 shared-memory ring\n", path);
+fail:
+    if(fd >= 0)
+        close(fd);
+    free(path);
+    free(r);
+    return NULL;
+}
+
+/* the writer overwrote the cursor: skip to where a new reader joins */
+static int
+lapped(shmring *r)
+{
+    shmring_header *hdr = r->hdr;
+    uint64_t reserved = hdr->reserved;
+    uint64_t to;
+
+    if(reserved <= hdr->ring_size || reserved - hdr->ring_size <= r->pos)
+        return 0;
+    to = join_offset(hdr);
+    r->skipped += to - r->pos;
+    r->laps++;
+    r->pos = to;
+    return 1;
+}
+
+const uint8_t *
+shmring_peek(shmring *r, size_t *len, int timeout_ms)
+{
+    shmring_header *hdr = r->hdr;
+    int left = timeout_ms;
+    int waited = 0;
+
+    *len = 0;
+    while(1) {
+        uint32_t seq = hdr->seq;
+        uint64_t written;
+        struct timespec ts;
+        int slice;
+
+        __sync_synchronize();
+        written = hdr->written;
+        lapped(r);
+        if(written > r->pos) {
+            *len = written - r->pos;
+            return r->ring + r->pos % hdr->ring_size;
+        }
+        if(hdr->closed ||
+           (waited && kill(hdr->writer_pid, 0) < 0 && errno == ESRCH)) {
+            errno = EPIPE;
+            return NULL;
+        }
+        if(left == 0) {
+            errno = ETIMEDOUT;
+            return NULL;
+        }
+        /* wake up now and then to notice a writer that died */
+        slice = left < 0 || left > WAIT_SLICE_MS ? WAIT_SLICE_MS : left;
+        if(left > 0)
+            left -= slice;
+        ts.tv_sec = slice / 1000;
+        ts.tv_nsec = (slice % 1000) * 1000000L;
+        /* returns at once if a publish came in since seq was read */
+        futex(&hdr->seq, FUTEX_WAIT, seq, &ts);
+        waited = 1;
+    }
+}
+
+int
+shmring_release(shmring *r, size_t len)
+{
+    __sync_synchronize();
+    if(lapped(r)) {
+        errno = ESTALE;
+        return -1;
+    }
+    r->pos += len;
+    return 0;
+}
+
+ssize_t
+shmring_read(shmring *r, uint8_t *buf, size_t len, int timeout_ms)
+{
+    const uint8_t *p;
+    size_t n;
+
+    do {
+        p = shmring_peek(r, &n, timeout_ms);
+        if(!p)
+            return -1;
+        if(n > len)
+            n = len;
+        memcpy(buf, p, n);
+    } while(shmring_release(r, n) < 0);
+    return n;
+}
+
+void
+shmring_detach(shmring *r)
+{
+    if(!r)
+        return;
+    munmap(r->hdr, r->map_size);
+    free(r);
+}
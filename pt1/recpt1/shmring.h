@@ -0,0 +1,72 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rapscan.h"
+
+/*
+ * Shared-memory ring for local consumers (recpt1 --shm NAME).  recpt1
+ * publishes the stream after b25 and the splitter into the POSIX shared
+ * memory object NAME (/dev/shm/NAME): a header page, then the ring.
+ * The ring is mapped twice back to back, so any range of up to
+ * ring_size bytes is contiguous in memory for the writer and readers.
+ *
+ * Readers map the object read-only and keep their cursor to themselves:
+ * any number of them follow without locks and the writer never waits.
+ * As in the time-shift ring the writer raises `reserved' before
+ * overwriting ring bytes and `written' after; a reader that finds its
+ * cursor behind reserved - ring_size was lapped and is skipped forward
+ * to the latest packet boundary, counting what it lost.  `seq' changes
+ * on every publish and readers sleep on it with a futex.
+ */
+
+#define SHMRING_MAGIC       0x4d485350  /* "PSHM" */
+#define SHMRING_VERSION     1
+
+typedef struct shmring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;
+    uint32_t header_size;   /* a page; the ring starts here */
+    uint32_t writer_pid;
+    volatile uint32_t closed;       /* the writer has finished */
+    volatile uint32_t seq;          /* futex word, bumped per publish */
+    volatile uint64_t reserved;     /* bytes being written up to */
+    volatile uint64_t written;      /* bytes published */
+    volatile uint64_t sync;         /* a recent packet boundary */
+    volatile uint64_t last_rap;     /* offset of the latest RAP */
+} shmring_header;
+
+typedef struct shmring {
+    shmring_header *hdr;
+    uint8_t *ring;          /* ring_size bytes, mapped twice */
+    size_t map_size;
+    char *name;             /* writer: unlinked on close */
+    /* reader state */
+    uint64_t pos;           /* next offset to read */
+    uint64_t skipped;       /* bytes lost to falling behind */
+    unsigned long laps;     /* times skipped forward */
+} shmring;
+
+/* writer (recpt1) */
+shmring *shmring_create(const char *name, size_t ring_size);
+void shmring_write(shmring *r, const uint8_t *data, size_t len,
+                   const rapscan *rs);
+void shmring_close(shmring *r);
+
+/* readers: attach at the latest random access point */
+shmring *shmring_attach(const char *name);
+/* data at the cursor, NULL on timeout (errno ETIMEDOUT) or at the end
+   of the stream (errno EPIPE) */
+const uint8_t *shmring_peek(shmring *r, size_t *len, int timeout_ms);
+/* done with len peeked bytes; -1 (errno ESTALE) if they were
+   overwritten meanwhile, the cursor is then skipped forward */
+int shmring_release(shmring *r, size_t len);
+/* peek + copy + release */
+ssize_t shmring_read(shmring *r, uint8_t *buf, size_t len, int timeout_ms);
+void shmring_detach(shmring *r);
+
+#endif
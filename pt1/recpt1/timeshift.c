@@ -0,0 +1,410 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timeshift.h"
+
+#define TS_PACKET_SIZE      188
+#define MIN_RING_SIZE       (1024 * 1024)
+#define MIN_CAPACITY        4096
+#define MAX_CAPACITY        (1 << 22)
+#define BYTES_PER_ENTRY     (16 * 1024)     /* index sized for >= 16KB/entry */
+#define COPY_SIZE           (1024 * 1024)
+
+static char *
+index_path(const char *path)
+{
+    char *idx = malloc(strlen(path) + sizeof(TIMESHIFT_IDX_EXT));
+
+    if(idx) {
+        strcpy(idx, path);
+        strcat(idx, TIMESHIFT_IDX_EXT);
+    }
+    return idx;
+}
+
+timeshift *
+timeshift_create(const char *path, uint64_t ring_size, int interval_ms)
+{
+    timeshift *ts;
+    timeshift_header *hdr;
+    uint64_t capacity;
+    char *idx;
+    int ifd;
+
+    if(ring_size < MIN_RING_SIZE)
+        ring_size = MIN_RING_SIZE;
+    if(interval_ms <= 0)
+        interval_ms = 500;
+    capacity = ring_size / BYTES_PER_ENTRY;
+    if(capacity < MIN_CAPACITY)
+        capacity = MIN_CAPACITY;
+    if(capacity > MAX_CAPACITY)
+        capacity = MAX_CAPACITY;
+
+    ts = calloc(1, sizeof(timeshift));
+    idx = index_path(path);
+    if(!ts || !idx)
+        goto fail;
+    ts->writable = 1;
+    tsindex_scan_init(&ts->scan, interval_ms);
+    ts->map_size = sizeof(timeshift_header) + capacity * sizeof(tsindex_entry);
+
+    ts->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(ts->fd < 0) {
+        perror(path);
+        goto fail;
+    }
+    if(ftruncate(ts->fd, ring_size) < 0) {
+        perror("ftruncate");
+        goto fail_fd;
+    }
+
+    ifd = open(idx, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(ifd < 0) {
+        perror(idx);
+        goto fail_fd;
+    }
+    if(ftruncate(ifd, ts->map_size) < 0) {
+        perror("ftruncate");
+        close(ifd);
+        goto fail_fd;
+    }
+    hdr = mmap(NULL, ts->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ifd, 0);
+    close(ifd);
+    if(hdr == MAP_FAILED) {
+        perror("mmap");
+        goto fail_fd;
+    }
+
+    hdr->version = TIMESHIFT_VERSION;
+    hdr->ring_size = ring_size;
+    hdr->capacity = capacity;
+    hdr->interval_ms = interval_ms;
+    hdr->start_ns = tsindex_now();
+    hdr->pcr_pid = TSINDEX_NO_PID;
+    __sync_synchronize();
+    hdr->magic = TIMESHIFT_MAGIC;
+    ts->hdr = hdr;
+    free(idx);
+    return ts;
+
+fail_fd:
+    close(ts->fd);
+fail:
+    free(idx);
+    free(ts);
+    return NULL;
+}
+
+static int
+ring_pwrite(timeshift *ts, const uint8_t *data, size_t len, uint64_t offset)
+{
+    uint64_t size = ts->hdr->ring_size;
+
+    while(len > 0) {
+        uint64_t pos = offset % size;
+        size_t n = len < size - pos ? len : size - pos;
+        ssize_t wc = pwrite(ts->fd, data, n, pos);
+
+        if(wc < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += wc;
+        len -= wc;
+        offset += wc;
+    }
+    return 0;
+}
+
+int
+timeshift_write(timeshift *ts, const uint8_t *data, size_t len,
+                const rapscan *rs)
+{
+    timeshift_header *hdr = ts->hdr;
+    uint64_t base = hdr->written;
+    tsindex_entry ent;
+
+    if(len == 0)
+        return 0;
+    if(len > hdr->ring_size) {
+        /* only the tail survives anyway */
+        base += len - hdr->ring_size;
+        data += len - hdr->ring_size;
+        len = hdr->ring_size;
+        rs = NULL;  /* its offsets are for the whole block */
+    }
+
+    hdr->reserved = base + len;
+    __sync_synchronize();
+    if(ring_pwrite(ts, data, len, base) < 0)
+        return -1;
+    __sync_synchronize();
+    hdr->written = base + len;
+
+    if(tsindex_scan_chunk(&ts->scan, base, data, len, rs, &ent)) {
+        hdr->entry[hdr->count % hdr->capacity] = ent;
+        hdr->pcr_pid = ts->scan.pcr_pid;
+        __sync_synchronize();
+        hdr->count++;
+    }
+    return 0;
+}
+
+void
+timeshift_set_pcr_pid(timeshift *ts, int pid)
+{
+    tsindex_scan_pcr_pid(&ts->scan, pid);
+}
+
+void
+timeshift_close(timeshift *ts)
+{
+    if(!ts)
+        return;
+    munmap(ts->hdr, ts->map_size);
+    close(ts->fd);
+    free(ts);
+}
+
+timeshift *
+timeshift_attach(const char *path)
+{
+    timeshift *ts = calloc(1, sizeof(timeshift));
+    char *idx = index_path(path);
+    struct stat st;
+    int ifd, prot = PROT_READ | PROT_WRITE;
+
+    if(!ts || !idx)
+        goto fail;
+    ts->fd = open(path, O_RDONLY);
+    if(ts->fd < 0) {
+        perror(path);
+        goto fail;
+    }
+    /* marks need write access; extraction does not */
+    ifd = open(idx, O_RDWR);
+    if(ifd < 0) {
+        ifd = open(idx, O_RDONLY);
+        prot = PROT_READ;
+    }
+    if(ifd < 0) {
+        perror(idx);
+        goto fail_fd;
+    }
+    if(fstat(ifd, &st) < 0 || st.st_size < (off_t)sizeof(timeshift_header)) {
+        fprintf(stderr, "%s: not a time-shift index\n", idx);
+        close(ifd);
+        goto fail_fd;
+    }
+    ts->map_size = st.st_size;
+    ts->writable = (prot & PROT_WRITE) ? 1 : 0;
+    ts->hdr = mmap(NULL, ts->map_size, prot, MAP_SHARED, ifd, 0);
+    close(ifd);
+    if(ts->hdr == MAP_FAILED) {
+        perror("mmap");
+        goto fail_fd;
+    }
+    if(ts->hdr->magic != TIMESHIFT_MAGIC ||
+       ts->hdr->version != TIMESHIFT_VERSION ||
+       ts->map_size < sizeof(timeshift_header) +
+       ts->hdr->capacity * sizeof(tsindex_entry)) {
+        fprintf(stderr, "%s: not a time-shift index\n", idx);
+        munmap(ts->hdr, ts->map_size);
+        goto fail_fd;
+    }
+    free(idx);
+    return ts;
+
+fail_fd:
+    close(ts->fd);
+fail:
+    free(idx);
+    free(ts);
+    return NULL;
+}
+
+/* oldest entry whose data is still in the ring, count if none */
+static uint64_t
+oldest_entry(timeshift_header *hdr, uint64_t count)
+{
+    uint64_t lo, hi, floor;
+
+    /* entry count - capacity may be rewritten under us: skip it */
+    lo = count > hdr->capacity ? count - hdr->capacity + 1 : 0;
+    hi = count;
+    floor = hdr->reserved > hdr->ring_size ? hdr->reserved - hdr->ring_size : 0;
+    while(lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if(hdr->entry[mid % hdr->capacity].offset < floor)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int
+timeshift_window(timeshift *ts, uint64_t *first_ns, uint64_t *last_ns)
+{
+    timeshift_header *hdr = ts->hdr;
+    uint64_t count = hdr->count;
+    uint64_t lo;
+
+    __sync_synchronize();
+    lo = oldest_entry(hdr, count);
+    if(lo >= count)
+        return -1;
+    *first_ns = hdr->entry[lo % hdr->capacity].wall_ns;
+    *last_ns = hdr->entry[(count - 1) % hdr->capacity].wall_ns;
+    return 0;
+}
+
+/* number of the last entry at or before wall_ns, clamped to the live
+   window; *count is the entry count the search was made against */
+static int
+locate(timeshift_header *hdr, uint64_t wall_ns, uint64_t *n, uint64_t *count)
+{
+    uint64_t lo, hi;
+
+    *count = hdr->count;
+    __sync_synchronize();
+    lo = oldest_entry(hdr, *count);
+    if(lo >= *count)
+        return -1;
+    hi = *count - 1;
+    while(lo < hi) {
+        uint64_t mid = hi - (hi - lo) / 2;
+
+        if(hdr->entry[mid % hdr->capacity].wall_ns <= wall_ns)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    *n = lo;
+    return 0;
+}
+
+/* copy entry n unless its slot has been recycled meanwhile */
+static int
+read_entry(timeshift_header *hdr, uint64_t n, tsindex_entry *ent)
+{
+    *ent = hdr->entry[n % hdr->capacity];
+    __sync_synchronize();
+    return hdr->count - n < hdr->capacity ? 0 : -1;
+}
+
+int
+timeshift_find(timeshift *ts, uint64_t wall_ns, tsindex_entry *ent)
+{
+    uint64_t n, count;
+    int retry;
+
+    for(retry = 0; retry < 4; retry++) {
+        if(locate(ts->hdr, wall_ns, &n, &count) < 0)
+            return -1;
+        if(read_entry(ts->hdr, n, ent) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+int
+timeshift_mark(timeshift *ts, uint64_t wall_ns)
+{
+    uint32_t n;
+
+    if(!ts->writable)
+        return -1;
+    n = __sync_fetch_and_add(&ts->hdr->num_marks, 1);
+    ts->hdr->mark[n % TIMESHIFT_MAX_MARK] = wall_ns;
+    return n;
+}
+
+/* copy [from_ns, to_ns) of the live window to fd, returns bytes copied */
+int64_t
+timeshift_extract(timeshift *ts, uint64_t from_ns, uint64_t to_ns, int fd)
+{
+    timeshift_header *hdr = ts->hdr;
+    tsindex_entry start, end;
+    uint64_t off, stop, n, count;
+    uint8_t *buf;
+    int64_t total = 0;
+
+    errno = ENOENT;
+    if(timeshift_find(ts, from_ns, &start) < 0)
+        return -1;
+    /* stop at the first entry after to_ns */
+    if(locate(hdr, to_ns, &n, &count) < 0)
+        return -1;
+    errno = ESTALE;
+    if(n + 1 < count) {
+        if(read_entry(hdr, n + 1, &end) < 0)
+            return -1;
+        stop = end.offset;
+    }
+    else {
+        /* to_ns is past the last entry: take what has been written,
+           cut at a packet boundary */
+        uint64_t written = hdr->written;
+
+        if(read_entry(hdr, n, &end) < 0)
+            return -1;
+        stop = end.offset +
+            (written - end.offset) / TS_PACKET_SIZE * TS_PACKET_SIZE;
+    }
+    if(stop <= start.offset)
+        return 0;
+
+    buf = malloc(COPY_SIZE);
+    if(!buf)
+        return -1;
+    for(off = start.offset; off < stop; ) {
+        uint64_t pos = off % hdr->ring_size;
+        size_t n = stop - off < COPY_SIZE ? stop - off : COPY_SIZE;
+        ssize_t rc, wc, done;
+
+        if(n > hdr->ring_size - pos)
+            n = hdr->ring_size - pos;
+        rc = pread(ts->fd, buf, n, pos);
+        if(rc <= 0) {
+            if(rc < 0 && errno == EINTR)
+                continue;
+            total = -1;
+            break;
+        }
+        __sync_synchronize();
+        /* the writer caught up with us while we copied */
+        if(hdr->reserved > hdr->ring_size &&
+           hdr->reserved - hdr->ring_size > off) {
+            errno = ESTALE;
+            total = -1;
+            break;
+        }
+        for(done = 0; done < rc; done += wc) {
+            wc = write(fd, buf + done, rc - done);
+            if(wc < 0) {
+                if(errno == EINTR) {
+                    wc = 0;
+                    continue;
+                }
+                free(buf);
+                return -1;
+            }
+        }
+        off += rc;
+        total += rc;
+    }
+    free(buf);
+    return total;
+}
@@ -0,0 +1,72 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _TIMESHIFT_H_
+#define _TIMESHIFT_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tsindex.h"
+
+/*
+ * Time-shift ring: recpt1 keeps the last ring_size bytes of a stream in
+ * a fixed-size file (put it on tmpfs for a memory ring) and maintains a
+ * sidecar index, <ring>.idx, mapping arrival time and PCR to absolute
+ * stream offsets.
+ *
+ * Offsets are counted from the start of the capture; byte X lives at
+ * X % ring_size in the ring and is valid while X >= reserved - ring_size.
+ * The writer raises `reserved' before overwriting ring data and
+ * `written' after, so a reader that copies a range and then re-checks
+ * `reserved' knows whether its copy was overwritten meanwhile.
+ *
+ * Index entry n lives in entry[n % capacity]; `count' is the number of
+ * entries published.  Entries are appended every interval_ms and always
+ * point at a TS sync byte, so extraction is one binary search plus one
+ * copy of the segment.  Clients append marks (wall-clock instants) to
+ * the header to cut segments after the fact.
+ */
+
+#define TIMESHIFT_MAGIC     0x48535450  /* "PTSH" */
+#define TIMESHIFT_VERSION   1
+#define TIMESHIFT_MAX_MARK  64
+#define TIMESHIFT_IDX_EXT   ".idx"
+
+typedef struct timeshift_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;
+    uint32_t capacity;      /* index entries */
+    uint32_t interval_ms;
+    uint64_t start_ns;      /* capture start */
+    volatile uint64_t reserved;     /* bytes being written up to */
+    volatile uint64_t written;      /* bytes in the ring up to */
+    volatile uint64_t count;        /* index entries published */
+    volatile uint32_t num_marks;
+    uint32_t pcr_pid;       /* PID the PCRs are taken from, 0x1fff: none */
+    uint64_t mark[TIMESHIFT_MAX_MARK];
+    tsindex_entry entry[];  /* offsets are absolute */
+} timeshift_header;
+
+typedef struct timeshift {
+    int fd;                 /* ring data */
+    int writable;           /* index mapped read-write */
+    timeshift_header *hdr;
+    size_t map_size;
+    tsindex_scan scan;      /* writer state */
+} timeshift;
+
+/* writer (recpt1) */
+timeshift *timeshift_create(const char *path, uint64_t ring_size, int interval_ms);
+int timeshift_write(timeshift *ts, const uint8_t *data, size_t len,
+                    const rapscan *rs);
+void timeshift_set_pcr_pid(timeshift *ts, int pid);
+void timeshift_close(timeshift *ts);
+
+/* readers */
+timeshift *timeshift_attach(const char *path);
+int timeshift_window(timeshift *ts, uint64_t *first_ns, uint64_t *last_ns);
+int timeshift_find(timeshift *ts, uint64_t wall_ns, tsindex_entry *ent);
+int timeshift_mark(timeshift *ts, uint64_t wall_ns);
+int64_t timeshift_extract(timeshift *ts, uint64_t from_ns, uint64_t to_ns, int fd);
+
+#endif
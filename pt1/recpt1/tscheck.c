@@ -0,0 +1,66 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * tscheck: check that recordings are made of whole TS packets, each
+ * starting with the sync byte.  With --m2ts the units are 192 bytes,
+ * a 4 byte arrival stamp and a packet.
+ *
+ *   make switchtest   --timestamp m2ts across a cross-band switch
+ *   make tshifttest   a segment extracted from a wrapped time-shift ring
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arrival.h"
+
+#define TS_PACKET_SIZE  188
+
+static int
+check(const char *path, int m2ts)
+{
+    uint8_t unit[ARRIVAL_UNIT];
+    size_t size = m2ts ? ARRIVAL_UNIT : TS_PACKET_SIZE;
+    size_t sync = m2ts ? ARRIVAL_STAMP_SIZE : 0;
+    unsigned long long units = 0, bad = 0, first_bad = 0;
+    size_t n;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if(!fp) {
+        perror(path);
+        return 1;
+    }
+    while((n = fread(unit, 1, size, fp)) == size) {
+        if(unit[sync] != 0x47 && !bad++)
+            first_bad = units * size;
+        units++;
+    }
+    fclose(fp);
+
+    printf("%s: %llu units, %llu without sync", path, units, bad);
+    if(bad)
+        printf(" (first at offset %llu)", first_bad);
+    if(n)
+        printf(", %zu trailing bytes", n);
+    printf("\n");
+    return !units || bad || n;
+}
+
+int
+main(int argc, char **argv)
+{
+    int i = 1, m2ts = 0, errors = 0;
+
+    if(argc > 1 && !strcmp(argv[1], "--m2ts")) {
+        m2ts = 1;
+        i++;
+    }
+    if(i == argc) {
+        fprintf(stderr, "Usage: %s [--m2ts] file...\n", argv[0]);
+        return 1;
+    }
+    for(; i < argc; i++)
+        errors += check(argv[i], m2ts);
+    printf("%s\n", errors ? "FAIL" : "ok");
+    return errors ? 1 : 0;
+}
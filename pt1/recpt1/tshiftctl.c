@@ -0,0 +1,229 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * tshiftctl: inspect, mark and cut the time-shift ring written by
+ * recpt1 --timeshift.  Works while recording is in progress.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "timeshift.h"
+
+#define NS 1000000000ULL
+
+static void
+format_time(uint64_t ns, char *buf, size_t len)
+{
+    time_t t = ns / NS;
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    snprintf(buf, len, "%04d-%02d-%02d %02d:%02d:%02d.%03d",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(ns % NS / 1000000));
+}
+
+/*
+ * time specs:
+ *   now       current time
+ *   -N        N seconds ago
+ *   mN        mark number N
+ *   @N        unix time N
+ *   HH:MM[:SS] today (yesterday if that is in the future)
+ */
+static int
+parse_when(timeshift *ts, const char *spec, uint64_t *ns)
+{
+    uint64_t now = tsindex_now();
+    int h, m, s = 0;
+
+    if(!strcmp(spec, "now")) {
+        *ns = now;
+        return 0;
+    }
+    if(spec[0] == '-') {
+        *ns = now - (uint64_t)(atof(spec + 1) * NS);
+        return 0;
+    }
+    if(spec[0] == 'm') {
+        uint32_t n = atoi(spec + 1);
+
+        if(n >= ts->hdr->num_marks || ts->hdr->num_marks - n > TIMESHIFT_MAX_MARK ||
+           !ts->hdr->mark[n % TIMESHIFT_MAX_MARK])
+            return -1;
+        *ns = ts->hdr->mark[n % TIMESHIFT_MAX_MARK];
+        return 0;
+    }
+    if(spec[0] == '@') {
+        *ns = (uint64_t)(atof(spec + 1) * NS);
+        return 0;
+    }
+    if(sscanf(spec, "%d:%d:%d", &h, &m, &s) >= 2) {
+        time_t t = now / NS;
+        struct tm tm;
+
+        localtime_r(&t, &tm);
+        tm.tm_hour = h;
+        tm.tm_min = m;
+        tm.tm_sec = s;
+        t = mktime(&tm);
+        if((uint64_t)t * NS > now)
+            t -= 24 * 60 * 60;
+        *ns = (uint64_t)t * NS;
+        return 0;
+    }
+    return -1;
+}
+
+static void
+show_info(const char *path, timeshift *ts)
+{
+    timeshift_header *hdr = ts->hdr;
+    uint64_t first, last, written = hdr->written;
+    char buf[64];
+    uint32_t i, n = hdr->num_marks;
+
+    printf("ring:      %s (%llu MB)\n", path,
+           (unsigned long long)(hdr->ring_size >> 20));
+    format_time(hdr->start_ns, buf, sizeof(buf));
+    printf("started:   %s\n", buf);
+    printf("written:   %llu bytes, %llu index entries every %ums\n",
+           (unsigned long long)written, (unsigned long long)hdr->count,
+           hdr->interval_ms);
+    if(hdr->pcr_pid != 0x1fff)
+        printf("pcr pid:   0x%04x\n", hdr->pcr_pid);
+    if(timeshift_window(ts, &first, &last) == 0) {
+        format_time(first, buf, sizeof(buf));
+        printf("window:    %s", buf);
+        format_time(last, buf, sizeof(buf));
+        printf(" - %s (%.1fs)\n", buf, (last - first) / 1e9);
+    }
+    for(i = n > TIMESHIFT_MAX_MARK ? n - TIMESHIFT_MAX_MARK : 0; i < n; i++) {
+        uint64_t mark = hdr->mark[i % TIMESHIFT_MAX_MARK];
+
+        if(!mark)
+            continue;
+        format_time(mark, buf, sizeof(buf));
+        printf("mark m%u:   %s\n", i, buf);
+    }
+}
+
+static void
+show_usage(char *cmd)
+{
+    fprintf(stderr, "Usage: \n%s [--info] ring\n", cmd);
+    fprintf(stderr, "%s --mark[=when] ring\n", cmd);
+    fprintf(stderr, "%s --from when [--to when] ring destfile\n", cmd);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "--info:              Show the live window and marks\n");
+    fprintf(stderr, "--mark[=when]:       Record a mark (default now)\n");
+    fprintf(stderr, "--from when:         Start of the segment to extract\n");
+    fprintf(stderr, "--to when:           End of the segment (default now)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "when: now, -SEC (seconds ago), mN (mark N), @UNIXTIME, HH:MM[:SS]\n");
+    fprintf(stderr, "if destfile is '-', stdout is used for output.\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct option long_options[] = {
+        { "info",  0, NULL, 'i'},
+        { "mark",  2, NULL, 'm'},
+        { "from",  1, NULL, 'f'},
+        { "to",    1, NULL, 't'},
+        { "help",  0, NULL, 'h'},
+        {0, 0, NULL, 0} /* terminate */
+    };
+    int result, option_index;
+    int do_mark = 0;
+    const char *mark_at = "now", *from = NULL, *to = "now";
+    timeshift *ts;
+    uint64_t from_ns, to_ns;
+    int64_t copied;
+    int fd, ret = 0;
+
+    while((result = getopt_long(argc, argv, "im::f:t:h",
+                                long_options, &option_index)) != -1) {
+        switch(result) {
+        case 'i':
+            break;
+        case 'm':
+            do_mark = 1;
+            if(optarg)
+                mark_at = optarg;
+            break;
+        case 'f':
+            from = optarg;
+            break;
+        case 't':
+            to = optarg;
+            break;
+        default:
+            show_usage(argv[0]);
+            return result == 'h' ? 0 : 1;
+        }
+    }
+    if(argc - optind < (from ? 2 : 1)) {
+        show_usage(argv[0]);
+        return 1;
+    }
+
+    ts = timeshift_attach(argv[optind]);
+    if(!ts)
+        return 1;
+
+    if(do_mark) {
+        uint64_t ns;
+        int n;
+
+        if(parse_when(ts, mark_at, &ns) < 0) {
+            fprintf(stderr, "Invalid time: %s\n", mark_at);
+            ret = 1;
+        }
+        else if((n = timeshift_mark(ts, ns)) < 0) {
+            fprintf(stderr, "Cannot write marks to the index\n");
+            ret = 1;
+        }
+        else
+            printf("m%d\n", n);
+    }
+    else if(from) {
+        if(parse_when(ts, from, &from_ns) < 0 || parse_when(ts, to, &to_ns) < 0) {
+            fprintf(stderr, "Invalid time: %s - %s\n", from, to);
+            timeshift_close(ts);
+            return 1;
+        }
+        if(!strcmp(argv[optind + 1], "-"))
+            fd = 1;
+        else
+            fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(fd < 0) {
+            perror(argv[optind + 1]);
+            timeshift_close(ts);
+            return 1;
+        }
+        copied = timeshift_extract(ts, from_ns, to_ns, fd);
+        if(copied < 0) {
+            fprintf(stderr, "Extraction failed: %s\n",
+                    errno == ESTALE ? "segment was overwritten while copying"
+                    : strerror(errno));
+            ret = 1;
+        }
+        else
+            fprintf(stderr, "Extracted %lld bytes\n", (long long)copied);
+        if(fd != 1)
+            close(fd);
+    }
+    else
+        show_info(argv[optind], ts);
+
+    timeshift_close(ts);
+    return ret;
+}
@@ -0,0 +1,308 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tsindex.h"
+
+#define TS_PACKET_SIZE  188
+#define TS_SYNC         0x47
+
+uint64_t
+tsindex_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+tsindex_scan_init(tsindex_scan *sc, int interval_ms)
+{
+    memset(sc, 0, sizeof(tsindex_scan));
+    sc->interval_ms = interval_ms > 0 ? interval_ms : 500;
+    sc->pcr_pid = TSINDEX_NO_PID;
+}
+
+/* the PMT knows better than a guess from the stream */
+void
+tsindex_scan_pcr_pid(tsindex_scan *sc, int pid)
+{
+    if(pid < 0 || pid >= TSINDEX_NO_PID)
+        return;
+    sc->pcr_pid = pid;
+    sc->pcr_from_pmt = 1;
+}
+
+/* PCR of the packet if it carries one on the PCR PID */
+static uint64_t
+packet_pcr(tsindex_scan *sc, const uint8_t *p)
+{
+    int pid = ((p[1] & 0x1f) << 8) | p[2];
+    uint64_t base;
+
+    /* adaptation field with PCR_flag */
+    if(!(p[3] & 0x20) || p[4] < 7 || !(p[5] & 0x10))
+        return TSINDEX_NO_PCR;
+    if(sc->pcr_pid == TSINDEX_NO_PID)
+        sc->pcr_pid = pid;
+    else if(sc->pcr_pid != pid)
+        return TSINDEX_NO_PCR;
+
+    base = ((uint64_t)p[6] << 25) | (p[7] << 17) | (p[8] << 9) |
+        (p[9] << 1) | (p[10] >> 7);
+    return base * 300 + (((p[10] & 0x01) << 8) | p[11]);
+}
+
+/* lost alignment: the first sync byte at or after from that another
+   one a packet later confirms, or that is too near the end to tell.
+   -1 if none */
+ssize_t
+tsindex_find_sync(const uint8_t *data, size_t len, size_t from)
+{
+    size_t p;
+
+    for(p = from; p < len; p++) {
+        if(data[p] != TS_SYNC)
+            continue;
+        if(p + TS_PACKET_SIZE >= len || data[p + TS_PACKET_SIZE] == TS_SYNC)
+            return p;
+    }
+    return -1;
+}
+
+/* the first packet boundary at or past the end of len bytes at offset,
+   whose packet at sync is aligned: past a packet that runs into the
+   next block, not at its start */
+uint64_t
+tsindex_next_sync(uint64_t offset, size_t len, size_t sync)
+{
+    return offset + sync +
+        (len - sync + TS_PACKET_SIZE - 1) / TS_PACKET_SIZE * TS_PACKET_SIZE;
+}
+
+/* offset in data of the first packet boundary, -1 if none */
+static ssize_t
+find_sync(tsindex_scan *sc, uint64_t base, const uint8_t *data, size_t len)
+{
+    /* the whole block is inside one packet: a 0x47 in it is payload */
+    if(sc->sync_offset >= base + len)
+        return -1;
+    if(sc->sync_offset >= base && data[sc->sync_offset - base] == TS_SYNC)
+        return sc->sync_offset - base;
+    return tsindex_find_sync(data, len, 0);
+}
+
+/*
+ * Track packet alignment over a block written at offset base and fill
+ * ent when an index entry is due.  rs, if not NULL, is the RAP scan of
+ * the same block.  Returns 1 if ent was filled.
+ */
+int
+tsindex_scan_chunk(tsindex_scan *sc, uint64_t base, const uint8_t *data,
+                   size_t len, const rapscan *rs, tsindex_entry *ent)
+{
+    ssize_t sync;
+    uint64_t now;
+    size_t p;
+
+    if(len == 0)
+        return 0;
+    sync = find_sync(sc, base, data, len);
+    if(sync < 0)
+        return 0;
+    sc->sync_offset = tsindex_next_sync(base, len, sync);
+
+    now = tsindex_now();
+    if(now < sc->next_ns)
+        return 0;
+    if(rs && rs->count > 0)
+        sync = rs->rap[0];
+    else if(rs && rs->total > 0 &&
+            now < sc->next_ns + TSINDEX_RAP_WAIT_MS * 1000000ULL)
+        return 0;   /* a key frame is due soon */
+    sc->next_ns = now + sc->interval_ms * 1000000ULL;
+
+    ent->wall_ns = now;
+    ent->offset = base + sync;
+    ent->pcr = TSINDEX_NO_PCR;
+    for(p = sync; p + TS_PACKET_SIZE <= len; p += TS_PACKET_SIZE) {
+        ent->pcr = packet_pcr(sc, data + p);
+        if(ent->pcr != TSINDEX_NO_PCR)
+            break;
+    }
+    return 1;
+}
+
+tsindex *
+tsindex_create(const char *path, int interval_ms)
+{
+    tsindex *ix = calloc(1, sizeof(tsindex));
+    tsindex_header hdr;
+
+    if(!ix)
+        return NULL;
+    tsindex_scan_init(&ix->scan, interval_ms);
+
+    ix->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(ix->fd < 0) {
+        perror(path);
+        free(ix);
+        return NULL;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TSINDEX_MAGIC;
+    hdr.version = TSINDEX_VERSION;
+    hdr.entry_size = sizeof(tsindex_entry);
+    hdr.interval_ms = ix->scan.interval_ms;
+    hdr.start_ns = tsindex_now();
+    hdr.pcr_pid = TSINDEX_NO_PID;
+    if(write(ix->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        perror(path);
+        close(ix->fd);
+        free(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+static void
+update_pcr_pid(tsindex *ix)
+{
+    uint32_t pid = ix->scan.pcr_pid;
+
+    if(pwrite(ix->fd, &pid, sizeof(pid), offsetof(tsindex_header, pcr_pid)) < 0)
+        perror("tsindex");
+}
+
+int
+tsindex_add(tsindex *ix, const uint8_t *data, size_t len, const rapscan *rs)
+{
+    tsindex_entry ent;
+    int guessed = ix->scan.pcr_pid == TSINDEX_NO_PID;
+
+    if(tsindex_scan_chunk(&ix->scan, ix->offset, data, len, rs, &ent)) {
+        /* one entry is appended whole; readers ignore a partial tail */
+        if(write(ix->fd, &ent, sizeof(ent)) != sizeof(ent))
+            return -1;
+        if(guessed && ix->scan.pcr_pid != TSINDEX_NO_PID)
+            update_pcr_pid(ix);
+    }
+    ix->offset += len;
+    return 0;
+}
+
+void
+tsindex_set_pcr_pid(tsindex *ix, int pid)
+{
+    if(ix->scan.pcr_from_pmt && ix->scan.pcr_pid == pid)
+        return;
+    tsindex_scan_pcr_pid(&ix->scan, pid);
+    update_pcr_pid(ix);
+}
+
+void
+tsindex_close(tsindex *ix)
+{
+    if(!ix)
+        return;
+    close(ix->fd);
+    free(ix);
+}
+
+const tsindex_entry *
+tsindex_map(const char *path, size_t *count, const tsindex_header **hdr,
+            size_t *map_size)
+{
+    struct stat st;
+    const tsindex_header *h;
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(tsindex_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(h == MAP_FAILED)
+        return NULL;
+    if(h->magic != TSINDEX_MAGIC || h->version != TSINDEX_VERSION ||
+       h->entry_size != sizeof(tsindex_entry)) {
+        munmap((void *)h, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    *hdr = h;
+    *map_size = st.st_size;
+    *count = (st.st_size - sizeof(tsindex_header)) / sizeof(tsindex_entry);
+    return (const tsindex_entry *)(h + 1);
+}
+
+/* last entry at or before wall_ns, 0 if wall_ns is earlier than all */
+ssize_t
+tsindex_find_time(const tsindex_entry *ent, size_t count, uint64_t wall_ns)
+{
+    size_t lo = 0, hi;
+
+    if(count == 0)
+        return -1;
+    hi = count - 1;
+    while(lo < hi) {
+        size_t mid = hi - (hi - lo) / 2;
+
+        if(ent[mid].wall_ns <= wall_ns)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* PCR relative to the first one, so one wrap of the 33 bit clock
+   (26.5 hours) keeps the order */
+static uint64_t
+pcr_since(uint64_t pcr, uint64_t pcr0)
+{
+    return (pcr + TSINDEX_PCR_WRAP - pcr0) % TSINDEX_PCR_WRAP;
+}
+
+/* last entry whose PCR is at or before pcr, -1 if the index has none */
+ssize_t
+tsindex_find_pcr(const tsindex_entry *ent, size_t count, uint64_t pcr)
+{
+    size_t first, lo, hi, p;
+    uint64_t pcr0, target;
+
+    for(first = 0; first < count && ent[first].pcr == TSINDEX_NO_PCR; first++)
+        ;
+    if(first >= count)
+        return -1;
+    pcr0 = ent[first].pcr;
+    target = pcr_since(pcr, pcr0);
+
+    lo = first;
+    hi = count - 1;
+    while(lo < hi) {
+        size_t mid = hi - (hi - lo) / 2;
+
+        /* entries without a PCR take the next PCR in the block */
+        for(p = mid; p <= hi && ent[p].pcr == TSINDEX_NO_PCR; p++)
+            ;
+        if(p <= hi && pcr_since(ent[p].pcr, pcr0) <= target)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
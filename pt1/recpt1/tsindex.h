@@ -0,0 +1,85 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _TSINDEX_H_
+#define _TSINDEX_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rapscan.h"
+
+/*
+ * Seek index for recordings: entries map arrival time and PCR to the
+ * byte offset of a TS packet.  recpt1 --index writes <destfile>.tsidx
+ * as a 32 byte header followed by fixed-size entries, appended as the
+ * recording grows, so readers can mmap the file at any time and
+ * binary-search it.  The time-shift ring uses the same entries.
+ *
+ * The PCR is taken from the PCR_PID of the PMT when the splitter is
+ * active, otherwise from the first PID seen carrying a PCR.  Given a
+ * RAP scan of the block, entries are placed on random access points,
+ * waiting up to TSINDEX_RAP_WAIT_MS past the interval for one once the
+ * stream has shown any.
+ */
+
+#define TSINDEX_MAGIC       0x58495450  /* "PTIX" */
+#define TSINDEX_VERSION     1
+#define TSINDEX_EXT         ".tsidx"
+#define TSINDEX_NO_PCR      UINT64_MAX
+#define TSINDEX_NO_PID      0x1fff
+#define TSINDEX_PCR_WRAP    ((1ULL << 33) * 300)
+#define TSINDEX_RAP_WAIT_MS 2000
+
+typedef struct tsindex_entry {
+    uint64_t wall_ns;       /* CLOCK_REALTIME at arrival */
+    uint64_t offset;        /* offset of a sync byte */
+    uint64_t pcr;           /* first PCR at or after offset, 27MHz */
+} tsindex_entry;
+
+typedef struct tsindex_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t interval_ms;
+    uint64_t start_ns;
+    uint32_t pcr_pid;       /* updated when the PMT is known */
+    uint32_t reserved;
+} tsindex_header;
+
+/* packet alignment and sampling state shared by the index writers */
+typedef struct tsindex_scan {
+    uint64_t sync_offset;   /* next expected packet boundary */
+    uint64_t next_ns;
+    uint32_t interval_ms;
+    int pcr_pid;
+    int pcr_from_pmt;
+} tsindex_scan;
+
+typedef struct tsindex {
+    int fd;
+    uint64_t offset;        /* bytes recorded so far */
+    tsindex_scan scan;
+} tsindex;
+
+uint64_t tsindex_now(void);
+/* packet alignment over blocks, for every writer that tracks it */
+ssize_t tsindex_find_sync(const uint8_t *data, size_t len, size_t from);
+uint64_t tsindex_next_sync(uint64_t offset, size_t len, size_t sync);
+void tsindex_scan_init(tsindex_scan *sc, int interval_ms);
+void tsindex_scan_pcr_pid(tsindex_scan *sc, int pid);
+int tsindex_scan_chunk(tsindex_scan *sc, uint64_t base, const uint8_t *data,
+                       size_t len, const rapscan *rs, tsindex_entry *ent);
+
+/* writer: call tsindex_add with every block written to the recording */
+tsindex *tsindex_create(const char *path, int interval_ms);
+int tsindex_add(tsindex *ix, const uint8_t *data, size_t len,
+                const rapscan *rs);
+void tsindex_set_pcr_pid(tsindex *ix, int pid);
+void tsindex_close(tsindex *ix);
+
+/* readers: map the index and look an entry up */
+const tsindex_entry *tsindex_map(const char *path, size_t *count,
+                                 const tsindex_header **hdr, size_t *map_size);
+ssize_t tsindex_find_time(const tsindex_entry *ent, size_t count, uint64_t wall_ns);
+ssize_t tsindex_find_pcr(const tsindex_entry *ent, size_t count, uint64_t pcr);
+
+#endif
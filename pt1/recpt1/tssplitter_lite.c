@@ -147,18 +147,27 @@ splitter* split_startup(
 	}
 	memset(sp->pids, 0, sizeof(sp->pids));
 	memset(sp->pmt_pids, 0, sizeof(sp->pmt_pids));
+	memset(sp->stream_type, 0, sizeof(sp->stream_type));
 
 	sp->sid_list	= NULL;
 	sp->pat			= NULL;
-	sp->sid_list	= AnalyzeSid(sid);
+	/* AnalyzeSidはsidを書き換えて指すので、呼び出し元の文字列は使わない */
+	sp->sid_buf		= strdup(sid);
+	if ( sp->sid_buf != NULL )
+	{
+		sp->sid_list	= AnalyzeSid(sp->sid_buf);
+	}
 	if ( sp->sid_list == NULL )
 	{
+		free(sp->sid_buf);
 		free(sp);
 		return NULL;
 	}
 	sp->pat_count	= 0xFF;
 	sp->pmt_retain = -1;
 	sp->pmt_counter = 0;
+	sp->pcr_pid = MAX_PID - 1;
+	sp->pid_gen = 0;
 
 	memset(sp->section_remain, 0U, sizeof(sp->section_remain));
 	memset(sp->packet_seq, 0U, sizeof(sp->packet_seq));
@@ -197,6 +206,7 @@ void split_shutdown(splitter* sp)
 			free(sp->sid_list);
 			sp->sid_list = NULL;
 		}
+		free(sp->sid_buf);
 		free(sp);
 		sp = NULL;
 	}
@@ -254,6 +264,7 @@ static int ReadTs(splitter *sp, ARIB_STD_B25_BUFFER *sbuf)
 		/* pmt_counter と pmt_retain が一致する場合に条件は満たされる */
 		if(sp->pmt_counter == sp->pmt_retain) {
 			result = TSS_SUCCESS;
+			sp->pid_gen++;
 			break;
 		}
 		else {
@@ -291,6 +302,7 @@ static int RescanPID(splitter *splitter, unsigned char *buf)
 			    splitter->pids[i] -= 1;
 		    }
 		}
+		splitter->pid_gen++;
 		fprintf(stderr, "Rescan PID End\n");
 	}
 
@@ -712,6 +724,9 @@ static int AnalyzePmt(splitter *sp, unsigned char *buf, unsigned char mark)
 		// PCR
 		pcr = GetPid(&buf[payload_offset + 8]);
 		sp->pids[pcr] = mark;
+		if (sp->pcr_pid == MAX_PID - 1) {
+			sp->pcr_pid = pcr;
+		}
 
 		// ECM
 		N = ((buf[payload_offset + 10] & 0x0F) << 8) + buf[payload_offset + 11] + payload_offset + 12;	// ES情報開始点
@@ -754,6 +769,7 @@ static int AnalyzePmt(splitter *sp, unsigned char *buf, unsigned char mark)
 			epid = GetPid(&buf[N + 1]);
 
 			sp->pids[epid] = mark;
+			sp->stream_type[epid] = buf[N];
 		}
 		N += 4 + (((buf[N + 3]) & 0x0F) << 8) + buf[N + 4] + 1;
 		retry_count++;
@@ -51,6 +51,7 @@ typedef struct splitter {
 	unsigned char	pmt_pids[MAX_PID];
 	unsigned char*	pat;
 	char**			sid_list;
+	char*			sid_buf;		// sid_listが指すsidの複製
 	unsigned char	pat_count;
 	int pmt_retain;
 	int pmt_counter;
@@ -59,6 +60,9 @@ typedef struct splitter {
 	int num_pmts;
 	uint16_t section_remain[MAX_PID];	// セクション残りバイト数
 	uint8_t packet_seq[MAX_PID];	// 巡回カウンタ
+	int pcr_pid;					// 最初に解析したPMTのPCR_PID(未取得は0x1FFF)
+	unsigned char	stream_type[MAX_PID];	// PMTのストリーム種別(未取得は0)
+	int pid_gen;					// pids[]が確定するたびに増える(ドライバのPIDフィルタ更新用)
 } splitter;
 
 typedef struct _splitbuf_t
@@ -0,0 +1,161 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * tunestress: four threads open, tune, read, retune and close one tuner
+ * each, over and over, as several recorders starting and stopping on
+ * one card would.  Every ioctl and read must succeed; the exit status
+ * is 1 otherwise.
+ *
+ * make stress runs it against the pt1emu emulator, which checks the
+ * ioctl sequence only: the emulator has none of the driver's locks, so
+ * the i2c_lock, tuner_lock and open/close split is not tested there.
+ * On a real card the four tuners share one I2C bus and those locks do
+ * run against each other, but only failures are reported, not stalls.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "pt1_ioctl.h"
+
+#define NUM_LOOP    4
+#define READ_BUF    (188 * 87)
+
+typedef struct loop {
+    const char *device;
+    FREQUENCY freq[2];          /* tuned alternately */
+    pthread_t thread;
+    unsigned long cycles;
+    unsigned long errors;
+} loop;
+
+/* the first ISDB-S and ISDB-T pairs of card 0, as in pt1_dev.h:
+   BS 101/103 and UHF 27/28 */
+static loop loops[NUM_LOOP] = {
+    { "/dev/pt1video0", { { 7, 0 }, { 1, 1 } } },
+    { "/dev/pt1video1", { { 1, 1 }, { 7, 0 } } },
+    { "/dev/pt1video2", { { 77, 0 }, { 78, 0 } } },
+    { "/dev/pt1video3", { { 78, 0 }, { 77, 0 } } },
+};
+
+static volatile int stop;
+static int reads = 4;
+
+static int
+fail(loop *l, const char *what)
+{
+    fprintf(stderr, "%s: %s: %s\n", l->device, what, strerror(errno));
+    l->errors++;
+    return -1;
+}
+
+/* one open to close cycle */
+static int
+cycle(loop *l, char *buf)
+{
+    int fd, signal, i, rv = 0;
+
+    fd = open(l->device, O_RDONLY);
+    if(fd < 0)
+        return fail(l, "open");
+    if(ioctl(fd, SET_CHANNEL, &l->freq[l->cycles & 1]) < 0)
+        rv = fail(l, "SET_CHANNEL");
+    else if(ioctl(fd, START_REC, 0) < 0)
+        rv = fail(l, "START_REC");
+    for(i = 0; !rv && i < reads; i++) {
+        if(read(fd, buf, READ_BUF) <= 0)
+            rv = fail(l, "read");
+        /* the /proc monitor polls this while recording */
+        else if(ioctl(fd, GET_SIGNAL_STRENGTH, &signal) < 0)
+            rv = fail(l, "GET_SIGNAL_STRENGTH");
+    }
+    if(!rv && ioctl(fd, SWITCH_CHANNEL, &l->freq[!(l->cycles & 1)]) < 0)
+        rv = fail(l, "SWITCH_CHANNEL");
+    if(!rv && read(fd, buf, READ_BUF) <= 0)
+        rv = fail(l, "read after switch");
+    if(!rv && ioctl(fd, STOP_REC, 0) < 0)
+        rv = fail(l, "STOP_REC");
+    if(close(fd) < 0)
+        rv = fail(l, "close");
+    return rv;
+}
+
+static void *
+loop_func(void *p)
+{
+    loop *l = p;
+    char *buf = malloc(READ_BUF);
+
+    if(!buf) {
+        l->errors++;
+        return NULL;
+    }
+    while(!stop) {
+        cycle(l, buf);
+        l->cycles++;
+    }
+    free(buf);
+    return NULL;
+}
+
+static void
+show_usage(const char *cmd)
+{
+    fprintf(stderr, "Usage: %s [--seconds N] [--reads N]\n", cmd);
+    fprintf(stderr, "  --seconds N  run the four loops this long (default 10)\n");
+    fprintf(stderr, "  --reads N    reads per tune before the switch (default 4)\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int seconds = 10;
+    unsigned long errors = 0;
+    int i, c;
+    struct option long_options[] = {
+        { "seconds", 1, NULL, 's' },
+        { "reads",   1, NULL, 'r' },
+        { "help",    0, NULL, 'h' },
+        { 0, 0, NULL, 0 }
+    };
+
+    while((c = getopt_long(argc, argv, "s:r:h", long_options, NULL)) != -1) {
+        switch(c) {
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 'r':
+            reads = atoi(optarg);
+            break;
+        default:
+            show_usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    for(i = 0; i < NUM_LOOP; i++) {
+        if(pthread_create(&loops[i].thread, NULL, loop_func, &loops[i])) {
+            fprintf(stderr, "Cannot start loop %d\n", i);
+            stop = 1;
+            return 1;
+        }
+    }
+    sleep(seconds);
+    stop = 1;
+
+    for(i = 0; i < NUM_LOOP; i++) {
+        pthread_join(loops[i].thread, NULL);
+        printf("%s: %lu cycles, %lu errors\n",
+               loops[i].device, loops[i].cycles, loops[i].errors);
+        errors += loops[i].errors;
+        if(!loops[i].cycles)
+            errors++;
+    }
+    printf("%s\n", errors ? "FAIL" : "ok");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,652 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+#ifdef SO_TXTIME
+#include <linux/net_tstamp.h>
+#endif
+
+#include "udpout.h"
+
+#define TS_PACKET_SIZE  188
+#define STAMP_SIZE      4
+#define M2TS_UNIT       (STAMP_SIZE + TS_PACKET_SIZE)
+#define STAMP_PERIOD    (1ULL << 30)                /* arrival stamps */
+#define PCR_PERIOD      ((1ULL << 33) * 300)
+#define PCR_WAIT_NS     500000000ULL    /* then pace by write times */
+#define MARK_SPACING    (4 * UDPOUT_PAYLOAD)       /* arrival marks */
+#define MAX_STEP        UDPOUT_CLOCK    /* larger clock steps are jumps */
+#define LATE_NS         1000000
+#define DEFAULT_TPB     6.75            /* 27MHz ticks per byte at 32Mbit/s */
+
+#define MARK(u, i)      (&(u)->mark[(i) % UDPOUT_MARKS])
+
+static void *sender_thread(void *arg);
+
+static uint64_t
+now_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+udpout_options_init(udpout_options *opt)
+{
+    memset(opt, 0, sizeof(udpout_options));
+    opt->pace = 1;
+    opt->delay_ms = UDPOUT_DELAY_MS;
+}
+
+/* hop limit and interface for multicast groups, ttl also for unicast.
+   a link-local IPv6 group takes the scope of iface. */
+static int
+set_scope(int fd, const struct addrinfo *ai, const udpout_options *opt,
+          int ifindex)
+{
+    int ttl = opt->ttl;
+
+    if(ai->ai_family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)ai->ai_addr;
+
+        if(!IN_MULTICAST(ntohl(sin->sin_addr.s_addr)))
+            return ttl ? setsockopt(fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) : 0;
+        if(ttl && setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+                             sizeof(ttl)) < 0)
+            return -1;
+        if(ifindex) {
+            struct ip_mreqn mreq;
+
+            memset(&mreq, 0, sizeof(mreq));
+            mreq.imr_ifindex = ifindex;
+            if(setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq,
+                          sizeof(mreq)) < 0)
+                return -1;
+        }
+    }
+    else if(ai->ai_family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ai->ai_addr;
+
+        /* link-local groups are only reachable through the interface */
+        if(ifindex && !sin6->sin6_scope_id &&
+           IN6_IS_ADDR_MC_LINKLOCAL(&sin6->sin6_addr))
+            sin6->sin6_scope_id = ifindex;
+        if(!IN6_IS_ADDR_MULTICAST(&sin6->sin6_addr))
+            return ttl ? setsockopt(fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl,
+                                    sizeof(ttl)) : 0;
+        if(ttl && setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl,
+                             sizeof(ttl)) < 0)
+            return -1;
+        if(ifindex && setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF,
+                                 &ifindex, sizeof(ifindex)) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+open_socket(udpout *u, const char *host, int port)
+{
+    struct addrinfo hints, *res, *ai;
+    char service[16];
+    int ifindex = 0;
+    int rv;
+
+    if(u->opt.iface) {
+        ifindex = if_nametoindex(u->opt.iface);
+        if(!ifindex) {
+            fprintf(stderr, "Unknown interface %s\n", u->opt.iface);
+            return -1;
+        }
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(service, sizeof(service), "%d", port);
+    rv = getaddrinfo(host, service, &hints, &res);
+    if(rv != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(rv));
+        return -1;
+    }
+
+    for(ai = res; ai; ai = ai->ai_next) {
+        u->fd = socket(ai->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if(u->fd < 0)
+            continue;
+        if(set_scope(u->fd, ai, &u->opt, ifindex) == 0 &&
+           connect(u->fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            memcpy(&u->addr, ai->ai_addr, ai->ai_addrlen);
+            u->addrlen = ai->ai_addrlen;
+            break;
+        }
+        close(u->fd);
+        u->fd = -1;
+    }
+    freeaddrinfo(res);
+    if(u->fd < 0) {
+        perror("udp");
+        return -1;
+    }
+    return 0;
+}
+
+/* etf wants CLOCK_TAI; without SO_TXTIME the timer paces alone */
+static void
+set_txtime(udpout *u)
+{
+#ifdef SO_TXTIME
+    struct sock_txtime st;
+
+    memset(&st, 0, sizeof(st));
+    st.clockid = CLOCK_TAI;
+    if(setsockopt(u->fd, SOL_SOCKET, SO_TXTIME, &st, sizeof(st)) == 0) {
+        u->txclock = CLOCK_TAI;
+        return;
+    }
+    perror("SO_TXTIME");
+#endif
+    fprintf(stderr, "UDP: no SO_TXTIME, pacing with a timer\n");
+    u->opt.txtime = 0;
+}
+
+udpout *
+udpout_open(const char *host, int port, const udpout_options *opt)
+{
+    udpout *u = calloc(1, sizeof(udpout));
+    pthread_condattr_t attr;
+
+    if(!u)
+        return NULL;
+    u->fd = u->tfd = -1;
+    u->opt = *opt;
+    if(u->opt.delay_ms <= 0)
+        u->opt.delay_ms = UDPOUT_DELAY_MS;
+    u->ssrc = (uint32_t)(now_ns(CLOCK_REALTIME) ^ ((uint64_t)getpid() << 16));
+    u->pcr_pid = -1;
+    u->tpb = DEFAULT_TPB;
+    u->txclock = CLOCK_MONOTONIC;
+    pthread_mutex_init(&u->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&u->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if(open_socket(u, host, port) < 0)
+        goto fail;
+    if(!u->opt.pace)
+        return u;
+
+    if(u->opt.txtime)
+        set_txtime(u);
+    u->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    u->ring_size = UDPOUT_RING;
+    u->ring = malloc(u->ring_size);
+    if(u->tfd < 0 || !u->ring)
+        goto fail;
+    u->start_ns = now_ns(CLOCK_MONOTONIC);
+    if(pthread_create(&u->thread, NULL, sender_thread, u) != 0)
+        goto fail;
+    u->started = 1;
+    return u;
+
+fail:
+    udpout_close(u);
+    return NULL;
+}
+
+/* one datagram; due_ns is CLOCK_MONOTONIC, 0 to send at once */
+static ssize_t
+send_datagram(udpout *u, const uint8_t *data, size_t len, uint64_t clock,
+              uint64_t due_ns)
+{
+    uint8_t rtp[UDPOUT_RTP_HEADER];
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t rv;
+#ifdef SO_TXTIME
+    char control[CMSG_SPACE(sizeof(uint64_t))];
+#endif
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    if(u->opt.rtp) {
+        uint32_t ts = (uint32_t)(clock / 300);  /* 90kHz */
+
+        rtp[0] = 0x80;
+        rtp[1] = UDPOUT_RTP_MP2T;
+        rtp[2] = u->seq >> 8;
+        rtp[3] = u->seq;
+        rtp[4] = ts >> 24;
+        rtp[5] = ts >> 16;
+        rtp[6] = ts >> 8;
+        rtp[7] = ts;
+        rtp[8] = u->ssrc >> 24;
+        rtp[9] = u->ssrc >> 16;
+        rtp[10] = u->ssrc >> 8;
+        rtp[11] = u->ssrc;
+        u->seq++;
+        iov[msg.msg_iovlen].iov_base = rtp;
+        iov[msg.msg_iovlen++].iov_len = sizeof(rtp);
+    }
+    iov[msg.msg_iovlen].iov_base = (void *)data;
+    iov[msg.msg_iovlen++].iov_len = len;
+
+#ifdef SO_TXTIME
+    if(u->opt.txtime && due_ns) {
+        struct cmsghdr *cm;
+        uint64_t txtime = due_ns + now_ns(u->txclock) - now_ns(CLOCK_MONOTONIC);
+
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_TXTIME;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        memcpy(CMSG_DATA(cm), &txtime, sizeof(txtime));
+    }
+#endif
+
+    rv = sendmsg(u->fd, &msg, 0);
+    if(rv < 0) {
+        u->errors++;
+        return -1;
+    }
+    u->datagrams++;
+    u->bytes += len;
+    return len;
+}
+
+/* unpaced: the block goes out as it comes */
+static int
+send_now(udpout *u, const uint8_t *data, size_t len)
+{
+    uint64_t clock = now_ns(CLOCK_MONOTONIC) * 27 / 1000;
+    size_t off;
+    int rv = 0;
+
+    for(off = 0; off < len; off += UDPOUT_PAYLOAD) {
+        size_t n = len - off < UDPOUT_PAYLOAD ? len - off : UDPOUT_PAYLOAD;
+
+        if(send_datagram(u, data + off, n, clock, 0) < 0 && errno == EPIPE)
+            rv = -1;
+    }
+    return rv;
+}
+
+/* with the lock held */
+static void
+ring_copy(const udpout *u, uint8_t *dst, uint64_t off, size_t len)
+{
+    size_t pos = off % u->ring_size;
+    size_t n = len < u->ring_size - pos ? len : u->ring_size - pos;
+
+    memcpy(dst, u->ring + pos, n);
+    memcpy(dst + n, u->ring, len - n);
+}
+
+/* with the lock held; a sender that fell a ring behind loses the
+   oldest packets */
+static void
+ring_put(udpout *u, const uint8_t *data, size_t len)
+{
+    size_t pos = u->head % u->ring_size;
+    size_t n = len < u->ring_size - pos ? len : u->ring_size - pos;
+
+    if(u->head + len - u->tail > u->ring_size) {
+        uint64_t drop = u->head + len - u->tail - u->ring_size;
+
+        drop += (TS_PACKET_SIZE - drop % TS_PACKET_SIZE) % TS_PACKET_SIZE;
+        u->tail += drop;
+        u->dropped += drop;
+    }
+    memcpy(u->ring + pos, data, n);
+    memcpy(u->ring, data + n, len - n);
+    u->head += len;
+}
+
+/* with the lock held: the clock is raw at ring offset off.  period is
+   where raw wraps, 0 if it does not. */
+static void
+add_mark(udpout *u, uint64_t raw, uint64_t period, uint64_t off)
+{
+    udpout_mark *m;
+
+    if(u->mark_head == 0)
+        u->clock = raw;
+    else {
+        uint64_t delta = period ? (raw + period - u->raw) % period
+                                : raw - u->raw;
+        uint64_t bytes = off - u->clock_offset;
+
+        if(delta > MAX_STEP) {
+            /* a jump: carry on at the rate seen so far */
+            delta = (uint64_t)(bytes * u->tpb);
+            u->resyncs++;
+        }
+        else if(bytes > 0)
+            u->tpb += ((double)delta / bytes - u->tpb) / 8;
+        u->clock += delta;
+    }
+    u->raw = raw;
+    u->clock_offset = off;
+    u->mark_ns = now_ns(CLOCK_MONOTONIC);
+
+    if(u->mark_head - u->mark_tail == UDPOUT_MARKS)
+        u->mark_tail++;
+    m = MARK(u, u->mark_head);
+    m->offset = off;
+    m->clock = u->clock;
+    u->mark_head++;
+}
+
+static uint64_t
+get_pcr(const uint8_t *p)
+{
+    uint64_t base = (uint64_t)p[6] << 25 | p[7] << 17 | p[8] << 9 |
+        p[9] << 1 | p[10] >> 7;
+
+    return base * 300 + ((p[10] & 1) << 8 | p[11]);
+}
+
+/* with the lock held: PCRs of the packets written since the last call */
+static void
+scan_pcr(udpout *u)
+{
+    uint8_t p[12];
+
+    if(u->scan < u->tail)
+        u->scan = u->tail;
+    while(u->scan + TS_PACKET_SIZE <= u->head) {
+        int pid;
+
+        ring_copy(u, p, u->scan, sizeof(p));
+        if(p[0] != 0x47) {
+            u->scan++;
+            continue;
+        }
+        pid = (p[1] & 0x1f) << 8 | p[2];
+        /* adaptation field with PCR_flag */
+        if((p[3] & 0x20) && p[4] >= 7 && (p[5] & 0x10) &&
+           (u->pcr_pid < 0 || pid == u->pcr_pid)) {
+            u->pcr_pid = pid;
+            u->source = UDPOUT_SRC_PCR;
+            add_mark(u, get_pcr(p), PCR_PERIOD, u->scan);
+        }
+        u->scan += TS_PACKET_SIZE;
+    }
+}
+
+void
+udpout_set_pcr_pid(udpout *u, int pid)
+{
+    u->pcr_pid = pid;
+}
+
+/* called from the reader thread only */
+int
+udpout_write(udpout *u, const uint8_t *data, size_t len)
+{
+    uint64_t off;
+
+    if(!u->opt.pace)
+        return send_now(u, data, len);
+    if(len == 0)
+        return 0;
+
+    pthread_mutex_lock(&u->lock);
+    off = u->head;
+    if(off == 0)
+        u->start_ns = now_ns(CLOCK_MONOTONIC);
+    ring_put(u, data, len);
+    if(u->source == UDPOUT_SRC_NONE &&
+       now_ns(CLOCK_MONOTONIC) - u->start_ns > PCR_WAIT_NS) {
+        fprintf(stderr, "UDP: no PCR, pacing by input\n");
+        u->source = UDPOUT_SRC_WRITE;
+        /* spread what waited for a PCR over the time it took to come */
+        add_mark(u, u->start_ns * 27 / 1000, 0, u->tail);
+    }
+    if(u->source == UDPOUT_SRC_WRITE)
+        add_mark(u, now_ns(CLOCK_MONOTONIC) * 27 / 1000, 0, off);
+    else
+        scan_pcr(u);
+    pthread_cond_signal(&u->cond);
+    pthread_mutex_unlock(&u->lock);
+    return 0;
+}
+
+int
+udpout_write_m2ts(udpout *u, const uint8_t *data, size_t len)
+{
+    size_t pos;
+
+    if(!u->opt.pace) {
+        /* the stamps are of no use here */
+        uint8_t *payload = u->packet + UDPOUT_RTP_HEADER;
+        size_t n = 0;
+
+        for(pos = 0; pos + M2TS_UNIT <= len; pos += M2TS_UNIT) {
+            memcpy(payload + n, data + pos + STAMP_SIZE, TS_PACKET_SIZE);
+            n += TS_PACKET_SIZE;
+            if(n == UDPOUT_PAYLOAD || pos + 2 * M2TS_UNIT > len) {
+                if(send_now(u, payload, n) < 0)
+                    return -1;
+                n = 0;
+            }
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&u->lock);
+    u->source = UDPOUT_SRC_ARRIVAL;
+    for(pos = 0; pos + M2TS_UNIT <= len; pos += M2TS_UNIT) {
+        const uint8_t *s = data + pos;
+
+        if(u->mark_head == 0 || u->head - u->clock_offset >= MARK_SPACING)
+            add_mark(u, ((uint32_t)s[0] << 24 | s[1] << 16 | s[2] << 8 | s[3])
+                     & (STAMP_PERIOD - 1), STAMP_PERIOD, u->head);
+        ring_put(u, s + STAMP_SIZE, TS_PACKET_SIZE);
+    }
+    pthread_cond_signal(&u->cond);
+    pthread_mutex_unlock(&u->lock);
+    return 0;
+}
+
+/* with the lock held: the stream clock at ring offset off, between the
+   marks around it or, with extrapolate, at the rate after the last one.
+   0 if there is no mark to go by. */
+static int
+clock_at(udpout *u, uint64_t off, uint64_t *clock, int extrapolate)
+{
+    udpout_mark *a, *b;
+
+    while(u->mark_head - u->mark_tail >= 2 &&
+          MARK(u, u->mark_tail + 1)->offset <= off)
+        u->mark_tail++;
+    if(u->mark_head == u->mark_tail)
+        return 0;
+
+    a = MARK(u, u->mark_tail);
+    if(a->offset >= off) {
+        /* before the first mark */
+        *clock = a->clock;
+        return 1;
+    }
+    if(u->mark_head - u->mark_tail >= 2) {
+        b = MARK(u, u->mark_tail + 1);
+        *clock = a->clock + (b->clock - a->clock) * (off - a->offset) /
+            (b->offset - a->offset);
+        return 1;
+    }
+    if(!extrapolate)
+        return 0;
+    *clock = a->clock + (uint64_t)((off - a->offset) * u->tpb);
+    return 1;
+}
+
+static void
+timed_wait(udpout *u, uint64_t until_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = until_ns / 1000000000ULL;
+    ts.tv_nsec = until_ns % 1000000000ULL;
+    pthread_cond_timedwait(&u->cond, &u->lock, &ts);
+}
+
+static void
+sleep_until(udpout *u, uint64_t ns)
+{
+    struct itimerspec its;
+    uint64_t expired;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ns / 1000000000ULL;
+    its.it_value.tv_nsec = ns % 1000000000ULL;
+    if(timerfd_settime(u->tfd, TFD_TIMER_ABSTIME, &its, NULL) == 0 &&
+       read(u->tfd, &expired, sizeof(expired)) < 0)
+        ;   /* interrupted: send early */
+}
+
+static void *
+sender_thread(void *arg)
+{
+    udpout *u = (udpout *)arg;
+    uint8_t *payload = u->packet + UDPOUT_RTP_HEADER;
+    uint64_t delay_ns = (uint64_t)u->opt.delay_ms * 1000000;
+
+    pthread_mutex_lock(&u->lock);
+    while(1) {
+        uint64_t off = u->tail;
+        uint64_t avail = u->head - off;
+        uint64_t now = now_ns(CLOCK_MONOTONIC);
+        uint64_t clock = 0, due;
+        size_t len;
+        int extrapolate;
+
+        if(avail == 0 && u->stop)
+            break;
+        if(avail < UDPOUT_PAYLOAD && !u->stop) {
+            pthread_cond_wait(&u->cond, &u->lock);
+            continue;
+        }
+        len = avail < UDPOUT_PAYLOAD ? avail : UDPOUT_PAYLOAD;
+
+        /* the next mark is late, or the ring is filling up */
+        extrapolate = u->stop || now >= u->mark_ns + delay_ns ||
+            avail > u->ring_size / 4 * 3;
+        if(!clock_at(u, off, &clock, extrapolate)) {
+            if(!u->stop) {
+                timed_wait(u, (u->mark_head ? u->mark_ns : u->start_ns +
+                               PCR_WAIT_NS) + delay_ns);
+                continue;
+            }
+            due = now;
+        }
+        else {
+            if(!u->anchored) {
+                u->base_clock = clock;
+                u->base_ns = now + delay_ns;
+                u->anchored = 1;
+            }
+            due = u->base_ns + (int64_t)(clock - u->base_clock) * 1000 / 27;
+            /* stalled input or a clock gone astray */
+            if(due + delay_ns < now || due > now + 2 * delay_ns + 1000000000ULL) {
+                u->base_clock = clock;
+                u->base_ns = due = now + delay_ns;
+                u->resyncs++;
+            }
+        }
+        ring_copy(u, payload, off, len);
+        pthread_mutex_unlock(&u->lock);
+
+        if(u->opt.txtime) {
+            if(due > now + UDPOUT_TXTIME_LEAD)
+                sleep_until(u, due - UDPOUT_TXTIME_LEAD);
+        }
+        else if(due > now)
+            sleep_until(u, due);
+        send_datagram(u, payload, len, clock, due);
+        if(!u->opt.txtime) {
+            now = now_ns(CLOCK_MONOTONIC);
+            if(now > due + LATE_NS) {
+                u->late++;
+                if(now - due > u->max_late_ns)
+                    u->max_late_ns = now - due;
+            }
+        }
+
+        pthread_mutex_lock(&u->lock);
+        /* unless the writer dropped it meanwhile */
+        if(u->tail == off)
+            u->tail = off + len;
+    }
+    pthread_mutex_unlock(&u->lock);
+    return NULL;
+}
+
+void
+udpout_report(FILE *fp, const udpout *u)
+{
+    static const char *source[] = {
+        "none", "pcr", "arrival", "input",
+    };
+
+    fprintf(fp, "udp           %llu datagrams, %llu bytes",
+            (unsigned long long)u->datagrams, (unsigned long long)u->bytes);
+    if(u->opt.pace) {
+        fprintf(fp, ", paced by %s", source[u->source]);
+        if(u->source == UDPOUT_SRC_PCR)
+            fprintf(fp, " (pid 0x%04x)", u->pcr_pid);
+        if(u->opt.txtime)
+            fprintf(fp, " with SO_TXTIME");
+        else
+            fprintf(fp, ", %llu late (max %.1f ms)",
+                    (unsigned long long)u->late, u->max_late_ns / 1e6);
+        fprintf(fp, ", %lu resyncs, %llu bytes dropped", u->resyncs,
+                (unsigned long long)u->dropped);
+    }
+    fprintf(fp, ", %llu errors\n", (unsigned long long)u->errors);
+}
+
+void
+udpout_drain(udpout *u)
+{
+    if(!u || !u->started)
+        return;
+    pthread_mutex_lock(&u->lock);
+    u->stop = 1;
+    pthread_cond_signal(&u->cond);
+    pthread_mutex_unlock(&u->lock);
+    pthread_join(u->thread, NULL);
+    u->started = 0;
+}
+
+void
+udpout_close(udpout *u)
+{
+    if(!u)
+        return;
+    udpout_drain(u);
+    if(u->tfd >= 0)
+        close(u->tfd);
+    if(u->fd >= 0)
+        close(u->fd);
+    pthread_cond_destroy(&u->cond);
+    pthread_mutex_destroy(&u->lock);
+    free(u->ring);
+    free(u);
+}
@@ -0,0 +1,130 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+#ifndef _UDPOUT_H_
+#define _UDPOUT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * Paced UDP/RTP output for recpt1 --udp.  The reader thread copies each
+ * block into a ring and notes where the stream clock is known; a sender
+ * thread cuts the ring into datagrams of seven packets and sends each
+ * one when it is due, so the network sees the broadcast rate instead of
+ * a burst of a whole queue buffer every few milliseconds.
+ *
+ * The stream clock comes from the driver's arrival timestamps when
+ * recpt1 takes them (--timestamp), else from the PCRs of the first PID
+ * carrying them.  A datagram is due at the clock interpolated between
+ * the marks before and after it, plus `delay', which also bounds how
+ * long the sender waits for the next mark.  A stream without PCRs is
+ * paced by the time each block reached the writer.  A jump of the clock
+ * (channel switch, PCR discontinuity) continues the timeline at the
+ * rate seen so far.
+ *
+ * With txtime the datagrams are handed to the kernel up to
+ * UDPOUT_TXTIME_LEAD early with SO_TXTIME, for an etf or fq qdisc to
+ * release on time; otherwise the sender sleeps on a timerfd until each
+ * is due.  Multicast destinations (IPv4 or IPv6) take ttl and iface.
+ */
+
+#define UDPOUT_PACKETS      7
+#define UDPOUT_PAYLOAD      (188 * UDPOUT_PACKETS)
+#define UDPOUT_RTP_HEADER   12
+#define UDPOUT_RTP_MP2T     33          /* RFC 3551 payload type */
+#define UDPOUT_RING         (8 << 20)
+#define UDPOUT_MARKS        4096
+#define UDPOUT_DELAY_MS     200
+#define UDPOUT_TXTIME_LEAD  2000000     /* ns */
+#define UDPOUT_CLOCK        27000000
+
+typedef struct udpout_options {
+    int rtp;                /* prefix RTP headers */
+    int ttl;                /* multicast TTL / hop limit, 0: default */
+    const char *iface;      /* multicast interface name, NULL: default */
+    int pace;               /* 0: send each block as it comes */
+    int txtime;             /* SO_TXTIME to an etf/fq qdisc */
+    int delay_ms;           /* 0: UDPOUT_DELAY_MS */
+} udpout_options;
+
+/* a point of the stream with a known clock */
+typedef struct udpout_mark {
+    uint64_t offset;        /* ring byte offset */
+    uint64_t clock;         /* 27MHz, unwrapped */
+} udpout_mark;
+
+typedef struct udpout {
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    udpout_options opt;
+    uint16_t seq;
+    uint32_t ssrc;
+    int tfd;                /* timerfd the sender sleeps on */
+    clockid_t txclock;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int started;
+    int stop;
+
+    /* reader -> sender, under lock */
+    uint8_t *ring;
+    size_t ring_size;
+    uint64_t head;          /* bytes written */
+    uint64_t tail;          /* bytes sent */
+    udpout_mark mark[UDPOUT_MARKS];
+    uint64_t mark_head;
+    uint64_t mark_tail;
+    uint64_t mark_ns;       /* CLOCK_MONOTONIC of the latest mark */
+
+    /* clock source, reader side */
+    int source;             /* UDPOUT_SRC_* */
+    uint64_t scan;          /* next packet boundary to look at */
+    int pcr_pid;            /* -1: the first PID with a PCR */
+    uint64_t raw;           /* last raw clock, for unwrapping */
+    uint64_t clock;         /* last unwrapped clock */
+    uint64_t clock_offset;  /* ring offset of `clock' */
+    double tpb;             /* clock ticks per byte, for jumps */
+    uint64_t start_ns;
+
+    /* sender side */
+    int anchored;
+    uint64_t base_clock;
+    uint64_t base_ns;
+    uint8_t packet[UDPOUT_RTP_HEADER + UDPOUT_PAYLOAD];
+
+    /* counters */
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t late;          /* sent more than 1ms after due */
+    uint64_t max_late_ns;
+    uint64_t dropped;       /* bytes overwritten before sending */
+    uint64_t errors;
+    unsigned long resyncs;
+} udpout;
+
+enum {
+    UDPOUT_SRC_NONE,        /* looking for PCRs */
+    UDPOUT_SRC_PCR,
+    UDPOUT_SRC_ARRIVAL,
+    UDPOUT_SRC_WRITE,       /* no PCRs: block write times */
+};
+
+void udpout_options_init(udpout_options *opt);
+udpout *udpout_open(const char *host, int port, const udpout_options *opt);
+/* reader side: follow the PCR_PID of the PMT */
+void udpout_set_pcr_pid(udpout *u, int pid);
+/* 188 byte packets */
+int udpout_write(udpout *u, const uint8_t *data, size_t len);
+/* 192 byte units with arrival stamps in front, as arrival_m2ts() */
+int udpout_write_m2ts(udpout *u, const uint8_t *data, size_t len);
+void udpout_report(FILE *fp, const udpout *u);
+/* sends what is queued, at its pace, and stops the sender */
+void udpout_drain(udpout *u);
+void udpout_close(udpout *u);
+
+#endif
@@ -0,0 +1,430 @@
+/* -*- tab-width: 4; indent-tabs-mode: nil -*- */
+/*
+ * udprecv: receiver for recpt1 --udp that measures how evenly the
+ * datagrams arrive.  It takes plain TS or RTP, joins a multicast group
+ * if asked, and prints once a second and at the end:
+ *
+ *   gap     time between datagrams (kernel receive stamps): mean,
+ *           standard deviation and maximum, plus a log2 histogram
+ *   jitter  RFC 3550 interarrival jitter against the RTP timestamps
+ *   pcr     spread (max - min) of arrival time minus PCR, the delay
+ *           variation a decoder buffer has to absorb
+ *   lost    RTP sequence numbers skipped, and packets without sync
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <netdb.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "udpout.h"
+
+#define TS_PACKET_SIZE  188
+#define MAX_DATAGRAM    65536
+#define GAP_HIST        16          /* <1us, <2us, ..., >=2^14us */
+
+typedef struct stats {
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t lost;          /* RTP sequence gaps */
+    uint64_t sync_errors;
+    uint64_t gaps;
+    double gap_sum;         /* us */
+    double gap_sq;
+    double gap_max;
+    unsigned long hist[GAP_HIST];
+    double pcr_min;         /* arrival - PCR, us */
+    double pcr_max;
+    uint64_t pcrs;
+} stats;
+
+typedef struct receiver {
+    int fd;
+    int rtp;                /* RTP seen */
+    uint16_t seq;
+    double prev_arrival;    /* us */
+    double prev_transit;
+    double jitter;          /* RFC 3550, us */
+    int pcr_pid;
+    double pcr_base;        /* unwraps the 33 bit base */
+    uint64_t pcr_last;
+    stats total;
+    stats window;
+} receiver;
+
+static double
+now_us(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+reset(stats *st)
+{
+    memset(st, 0, sizeof(stats));
+    st->pcr_min = HUGE_VAL;
+    st->pcr_max = -HUGE_VAL;
+}
+
+static void
+add_gap(stats *st, double gap)
+{
+    int b = 0;
+
+    st->gaps++;
+    st->gap_sum += gap;
+    st->gap_sq += gap * gap;
+    if(gap > st->gap_max)
+        st->gap_max = gap;
+    while(b < GAP_HIST - 1 && gap >= (double)(1 << b))
+        b++;
+    st->hist[b]++;
+}
+
+static void
+add_pcr(stats *st, double offset)
+{
+    st->pcrs++;
+    if(offset < st->pcr_min)
+        st->pcr_min = offset;
+    if(offset > st->pcr_max)
+        st->pcr_max = offset;
+}
+
+/* the first PID with a PCR; arrival - PCR of its packets */
+static void
+scan_ts(receiver *r, const uint8_t *p, size_t len, double arrival)
+{
+    size_t i;
+
+    for(i = 0; i + TS_PACKET_SIZE <= len; i += TS_PACKET_SIZE) {
+        const uint8_t *q = p + i;
+        int pid = (q[1] & 0x1f) << 8 | q[2];
+        uint64_t base, pcr;
+        double offset;
+
+        if(q[0] != 0x47) {
+            r->total.sync_errors++;
+            r->window.sync_errors++;
+            continue;
+        }
+        if(!(q[3] & 0x20) || q[4] < 7 || !(q[5] & 0x10))
+            continue;
+        if(r->pcr_pid < 0)
+            r->pcr_pid = pid;
+        if(pid != r->pcr_pid)
+            continue;
+        base = (uint64_t)q[6] << 25 | q[7] << 17 | q[8] << 9 | q[9] << 1 |
+            q[10] >> 7;
+        pcr = base * 300 + ((q[10] & 1) << 8 | q[11]);
+        if(pcr < r->pcr_last)
+            r->pcr_base += (double)(1ULL << 33) * 300;
+        r->pcr_last = pcr;
+        offset = arrival - (r->pcr_base + pcr) / 27.0;
+        add_pcr(&r->total, offset);
+        add_pcr(&r->window, offset);
+    }
+}
+
+static void
+datagram(receiver *r, const uint8_t *p, size_t len, double arrival)
+{
+    if(len >= UDPOUT_RTP_HEADER && p[0] == 0x80 &&
+       (p[1] & 0x7f) == UDPOUT_RTP_MP2T) {
+        uint16_t seq = p[2] << 8 | p[3];
+        uint32_t ts = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+        double transit = arrival - ts / 0.09;
+
+        if(r->rtp) {
+            uint16_t skipped = seq - r->seq - 1;
+            double d = transit - r->prev_transit;
+
+            if(skipped < 0x8000) {
+                r->total.lost += skipped;
+                r->window.lost += skipped;
+            }
+            /* the timestamp wraps every 13 hours: skip that one */
+            if(fabs(d) < 1e6)
+                r->jitter += (fabs(d) - r->jitter) / 16;
+        }
+        r->rtp = 1;
+        r->seq = seq;
+        r->prev_transit = transit;
+        p += UDPOUT_RTP_HEADER;
+        len -= UDPOUT_RTP_HEADER;
+    }
+
+    if(r->total.datagrams) {
+        add_gap(&r->total, arrival - r->prev_arrival);
+        add_gap(&r->window, arrival - r->prev_arrival);
+    }
+    r->prev_arrival = arrival;
+    r->total.datagrams++;
+    r->total.bytes += len;
+    r->window.datagrams++;
+    r->window.bytes += len;
+    scan_ts(r, p, len, arrival);
+}
+
+static void
+print_stats(const receiver *r, const stats *st, double sec)
+{
+    double mean = st->gaps ? st->gap_sum / st->gaps : 0;
+    double var = st->gaps ? st->gap_sq / st->gaps - mean * mean : 0;
+
+    printf("%8llu dgrams %7.2f Mbit/s  gap %7.1f us sd %7.1f max %8.1f",
+           (unsigned long long)st->datagrams,
+           sec > 0 ? st->bytes * 8 / sec / 1e6 : 0.0, mean,
+           var > 0 ? sqrt(var) : 0.0, st->gap_max);
+    if(r->rtp)
+        printf("  jitter %6.1f us  lost %llu", r->jitter,
+               (unsigned long long)st->lost);
+    if(st->pcrs)
+        printf("  pcr p-p %7.2f ms", (st->pcr_max - st->pcr_min) / 1000);
+    if(st->sync_errors)
+        printf("  sync %llu", (unsigned long long)st->sync_errors);
+    printf("\n");
+}
+
+static void
+print_hist(const stats *st)
+{
+    int b;
+
+    printf("gap histogram:\n");
+    for(b = 0; b < GAP_HIST; b++) {
+        if(!st->hist[b])
+            continue;
+        if(b == 0)
+            printf("  <      1us %10lu\n", st->hist[b]);
+        else if(b == GAP_HIST - 1)
+            printf("  >= %6dus %10lu\n", 1 << (b - 1), st->hist[b]);
+        else
+            printf("  < %7dus %10lu\n", 1 << b, st->hist[b]);
+    }
+}
+
+/* bound to port; with group, joined on iface */
+static int
+open_socket(const char *group, int port, const char *iface)
+{
+    struct addrinfo hints, *ai;
+    char service[16];
+    int ifindex = 0, on = 1, off = 0, fd, rv;
+
+    if(iface && !(ifindex = if_nametoindex(iface))) {
+        fprintf(stderr, "Unknown interface %s\n", iface);
+        return -1;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = group ? AF_UNSPEC : AF_INET6;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    snprintf(service, sizeof(service), "%d", port);
+    rv = getaddrinfo(group, service, &hints, &ai);
+    if(rv != 0) {
+        fprintf(stderr, "%s: %s\n", group ? group : "any", gai_strerror(rv));
+        return -1;
+    }
+
+    fd = socket(ai->ai_family, SOCK_DGRAM, 0);
+    if(fd < 0) {
+        perror("socket");
+        goto fail;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    /* without a group take IPv4 and IPv6 alike */
+    if(ai->ai_family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ai->ai_addr;
+
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        if(ifindex && !sin6->sin6_scope_id &&
+           IN6_IS_ADDR_MC_LINKLOCAL(&sin6->sin6_addr))
+            sin6->sin6_scope_id = ifindex;
+    }
+    if(bind(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+        perror("bind");
+        goto fail;
+    }
+
+    if(group && ai->ai_family == AF_INET) {
+        struct ip_mreqn mreq;
+
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr = ((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+        mreq.imr_ifindex = ifindex;
+        if(IN_MULTICAST(ntohl(mreq.imr_multiaddr.s_addr)) &&
+           setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                      sizeof(mreq)) < 0) {
+            perror("IP_ADD_MEMBERSHIP");
+            goto fail;
+        }
+    }
+    else if(group && ai->ai_family == AF_INET6) {
+        struct ipv6_mreq mreq;
+
+        mreq.ipv6mr_multiaddr = ((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr;
+        mreq.ipv6mr_interface = ifindex;
+        if(IN6_IS_ADDR_MULTICAST(&mreq.ipv6mr_multiaddr) &&
+           setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq,
+                      sizeof(mreq)) < 0) {
+            perror("IPV6_JOIN_GROUP");
+            goto fail;
+        }
+    }
+    freeaddrinfo(ai);
+    return fd;
+
+fail:
+    if(fd >= 0)
+        close(fd);
+    freeaddrinfo(ai);
+    return -1;
+}
+
+/* kernel receive time, or now */
+static double
+arrival_us(struct msghdr *msg)
+{
+    struct cmsghdr *cm;
+
+    for(cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+        if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+        }
+    }
+    return now_us(CLOCK_REALTIME);
+}
+
+static void
+show_usage(char *cmd)
+{
+    fprintf(stderr, "Usage: \n%s [--port N] [--group addr [--iface name]] [--seconds N] [--quiet]\n", cmd);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "--port N:      UDP port (default 1234)\n");
+    fprintf(stderr, "--group addr:  Join IPv4/IPv6 multicast group addr\n");
+    fprintf(stderr, "--iface name:  Interface to join the group on\n");
+    fprintf(stderr, "--seconds N:   Stop after N seconds, 0 for never (default 0)\n");
+    fprintf(stderr, "--quiet:       Only print the summary\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct option long_options[] = {
+        { "port",    1, NULL, 'p'},
+        { "group",   1, NULL, 'g'},
+        { "iface",   1, NULL, 'I'},
+        { "seconds", 1, NULL, 't'},
+        { "quiet",   0, NULL, 'q'},
+        { "help",    0, NULL, 'h'},
+        {0, 0, NULL, 0} /* terminate */
+    };
+    const char *group = NULL, *iface = NULL;
+    int port = 1234, seconds = 0, quiet = 0;
+    int result, option_index;
+    static uint8_t buf[MAX_DATAGRAM];
+    char control[256];
+    double begin = now_us(CLOCK_REALTIME);
+    double start = 0, window_start = 0, last = 0;
+    receiver r;
+
+    while((result = getopt_long(argc, argv, "p:g:I:t:qh", long_options,
+                                &option_index)) != -1) {
+        switch(result) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'g':
+            group = optarg;
+            break;
+        case 'I':
+            iface = optarg;
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'h':
+        default:
+            show_usage(argv[0]);
+            return result == 'h' ? 0 : 1;
+        }
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.pcr_pid = -1;
+    reset(&r.total);
+    reset(&r.window);
+    r.fd = open_socket(group, port, iface);
+    if(r.fd < 0)
+        return 1;
+    if(seconds > 0) {
+        struct timeval tv = { 1, 0 };
+
+        /* come back to check the time while nothing arrives */
+        setsockopt(r.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    while(1) {
+        struct iovec iov = { buf, sizeof(buf) };
+        struct msghdr msg;
+        double arrival;
+        ssize_t len;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        len = recvmsg(r.fd, &msg, 0);
+        if(len < 0 && errno != EAGAIN && errno != EINTR) {
+            perror("recvmsg");
+            break;
+        }
+        arrival = len >= 0 ? arrival_us(&msg) : now_us(CLOCK_REALTIME);
+        if(len >= 0) {
+            if(!start)
+                start = window_start = arrival;
+            datagram(&r, buf, len, arrival - start);
+            last = arrival;
+        }
+        if(start && arrival - window_start >= 1e6) {
+            if(!quiet) {
+                printf("%6.1fs ", (arrival - start) / 1e6);
+                print_stats(&r, &r.window, (arrival - window_start) / 1e6);
+                fflush(stdout);
+            }
+            reset(&r.window);
+            window_start = arrival;
+        }
+        if(seconds > 0 && now_us(CLOCK_REALTIME) - (start ? start : begin) >=
+           seconds * 1e6)
+            break;
+    }
+
+    printf("total   ");
+    print_stats(&r, &r.total, (last - start) / 1e6);
+    print_hist(&r.total);
+    close(r.fd);
+    return 0;
+}